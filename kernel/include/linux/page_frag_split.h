@@ -0,0 +1,81 @@
+/*
+ * page_frag_split - split high-order pages into packet buffers
+ *
+ * Small packet buffers (<= 2KB) are often carved out of an order-0
+ * page each, wasting most of the page, and paying a page allocator
+ * call per packet.  This allocator instead splits an order-3 (32KB)
+ * page into many fragments.
+ *
+ * The page refcount is "biased": when a new page is taken, its
+ * refcount is raised once to a large value, and handing out a
+ * fragment only decrements a local (non-atomic) bias counter.  The
+ * frag owner release it with put_page() (or page_frag_split_free())
+ * as usual.  When the page is exhausted, the remaining bias is
+ * compared against the page refcount; if all fragments are already
+ * returned the page is recycled directly without involving the page
+ * allocator.
+ *
+ * A page_frag_split instance is NOT thread safe.  Like the per NAPI
+ * page_frag_cache, the owner must provide serialization, e.g. by
+ * keeping it per RX-ring or per CPU in softirq context.
+ *
+ * Copyright (C) 2017, Red Hat, Inc., Jesper Dangaard Brouer
+ *  for licensing details see kernel-base/COPYING
+ */
+#ifndef _LINUX_PAGE_FRAG_SPLIT_H
+#define _LINUX_PAGE_FRAG_SPLIT_H
+
+#include <linux/mm.h>
+#include <linux/gfp.h>
+
+#define PAGE_FRAG_SPLIT_ORDER 3
+
+struct page_frag_split {
+	struct page *page;
+	int offset;			/* counts down towards zero */
+	unsigned int pagecnt_bias;	/* refcnt we own, not handed out */
+	bool pfmemalloc;
+
+	/* Setup */
+	unsigned int order;
+	unsigned int size;		/* PAGE_SIZE << order */
+	gfp_t gfp_mask;
+
+	/* Stats */
+	unsigned long pages_alloc;
+	unsigned long pages_recycle;
+};
+
+extern void page_frag_split_init(struct page_frag_split *pfs,
+				 unsigned int order, gfp_t gfp_mask);
+extern void page_frag_split_drain(struct page_frag_split *pfs);
+
+extern void *__page_frag_split_refill(struct page_frag_split *pfs,
+				      unsigned int fragsz);
+extern int page_frag_split_alloc_bulk(struct page_frag_split *pfs,
+				      unsigned int fragsz,
+				      void **frags, int n);
+
+/* Allocate a fragment of fragsz bytes.  The caller is responsible
+ * for alignment of fragsz, e.g. via SKB_DATA_ALIGN().
+ */
+static inline void *page_frag_split_alloc(struct page_frag_split *pfs,
+					  unsigned int fragsz)
+{
+	int offset = pfs->offset - fragsz;
+
+	/* Also catch first use, as init set offset to zero */
+	if (unlikely(offset < 0))
+		return __page_frag_split_refill(pfs, fragsz);
+
+	pfs->offset = offset;
+	pfs->pagecnt_bias--;
+	return page_address(pfs->page) + offset;
+}
+
+static inline void page_frag_split_free(void *addr)
+{
+	put_page(virt_to_head_page(addr));
+}
+
+#endif /* _LINUX_PAGE_FRAG_SPLIT_H */
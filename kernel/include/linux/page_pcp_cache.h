@@ -0,0 +1,176 @@
+/*
+ * page_pcp_cache - per CPU cache for high-order pages
+ *
+ * The page allocator per CPU lists (pcp) only cache order-0 pages.
+ * Order>0 allocations goes directly to the buddy allocator, and take
+ * the zone->lock on every alloc and free.  With many CPUs doing
+ * order-1..3 allocations (e.g. NIC drivers using larger pages for
+ * page fragments) the zone->lock becomes the bottleneck, as can be
+ * seen with mm/bench/page_bench03.
+ *
+ * This prototype places a small per CPU stack of pages, per order,
+ * in-front of alloc_pages().  The stack is refilled and drained
+ * "batch" pages at a time.  The buddy allocator has no bulk API for
+ * order>0 pages, thus refill and drain still take the zone->lock once
+ * per page.  The gain is that these bursts only happen when a stack
+ * runs empty or reaches "high", and the zone->lock is never taken in
+ * the steady-state where pages are recycled on the same CPU.
+ *
+ * Only pages from the local NUMA node are cached, and only when the
+ * caller holds the last reference (refcnt == 1), else the page is
+ * simply handed back to the page allocator.
+ *
+ * Like qmempool, this is optimized for usage from softirq context,
+ * and cannot be used from hardirq context.
+ *
+ * Copyright (C) 2017, Red Hat, Inc., Jesper Dangaard Brouer
+ *  for licensing details see kernel-base/COPYING
+ */
+#ifndef _LINUX_PAGE_PCP_CACHE_H
+#define _LINUX_PAGE_PCP_CACHE_H
+
+#include <linux/mm.h>
+#include <linux/percpu.h>
+#include <linux/hardirq.h>
+#include <linux/topology.h>
+
+#define PAGE_PCP_CACHE_MIN_ORDER 1
+#define PAGE_PCP_CACHE_MAX_ORDER 3
+#define PAGE_PCP_CACHE_NR_ORDERS \
+	(PAGE_PCP_CACHE_MAX_ORDER - PAGE_PCP_CACHE_MIN_ORDER + 1)
+
+/* Max number of pages cached per order per CPU.  Notice memory
+ * held per CPU can be: SIZE * (8K + 16K + 32K) = 3.5MB
+ */
+#define PAGE_PCP_CACHE_SIZE 64
+
+struct page_pcp_cache_stack {
+	unsigned int count;
+	struct page *pages[PAGE_PCP_CACHE_SIZE];
+};
+
+struct page_pcp_cache_percpu {
+	struct page_pcp_cache_stack stack[PAGE_PCP_CACHE_NR_ORDERS];
+};
+
+struct page_pcp_cache {
+	struct page_pcp_cache_percpu __percpu *percpu;
+
+	/* Setup */
+	unsigned int high;  /* drain stack when reaching this count */
+	unsigned int batch; /* pages per bulk refill/drain */
+	gfp_t gfp_mask;
+};
+
+extern struct page_pcp_cache *page_pcp_cache_create(
+	unsigned int high, unsigned int batch, gfp_t gfp_mask);
+extern void page_pcp_cache_destroy(struct page_pcp_cache *pcc);
+
+extern struct page *__page_pcp_cache_refill(struct page_pcp_cache *pcc,
+					    struct page_pcp_cache_stack *s,
+					    unsigned int order);
+extern void __page_pcp_cache_drain(struct page_pcp_cache *pcc,
+				   struct page_pcp_cache_stack *s,
+				   unsigned int order);
+
+/* Same softirq trick as qmempool, see __qmempool_preempt_disable() */
+static inline int __page_pcp_cache_preempt_disable(void)
+{
+	int in_serving_softirq = in_serving_softirq();
+
+	if (!in_serving_softirq)
+		local_bh_disable();
+
+	return in_serving_softirq;
+}
+
+static inline void __page_pcp_cache_preempt_enable(int in_serving_softirq)
+{
+	if (!in_serving_softirq)
+		local_bh_enable();
+}
+
+static inline bool page_pcp_cache_order_ok(unsigned int order)
+{
+	return (order >= PAGE_PCP_CACHE_MIN_ORDER &&
+		order <= PAGE_PCP_CACHE_MAX_ORDER);
+}
+
+static inline struct page_pcp_cache_stack *
+__page_pcp_cache_stack(struct page_pcp_cache *pcc, unsigned int order)
+{
+	struct page_pcp_cache_percpu *cpu = this_cpu_ptr(pcc->percpu);
+
+	return &cpu->stack[order - PAGE_PCP_CACHE_MIN_ORDER];
+}
+
+/* Caller must make sure this is called from a preemptive safe context */
+static inline struct page *main_page_pcp_cache_alloc(
+	struct page_pcp_cache *pcc, unsigned int order)
+{
+	struct page_pcp_cache_stack *s = __page_pcp_cache_stack(pcc, order);
+
+	/* LIFO: the last freed page is the most cache-hot */
+	if (likely(s->count))
+		return s->pages[--s->count];
+
+	/* Stack empty, bulk refill from buddy allocator */
+	return __page_pcp_cache_refill(pcc, s, order);
+}
+
+static inline void main_page_pcp_cache_free(
+	struct page_pcp_cache *pcc, struct page *page, unsigned int order)
+{
+	struct page_pcp_cache_stack *s = __page_pcp_cache_stack(pcc, order);
+
+	if (unlikely(s->count >= pcc->high))
+		__page_pcp_cache_drain(pcc, s, order);
+
+	s->pages[s->count++] = page;
+}
+
+static inline struct page *__page_pcp_cache_alloc(
+	struct page_pcp_cache *pcc, unsigned int order)
+{
+	struct page *page;
+	int state;
+
+	if (unlikely(!page_pcp_cache_order_ok(order)))
+		return alloc_pages(pcc->gfp_mask, order);
+
+	state = __page_pcp_cache_preempt_disable();
+	page  = main_page_pcp_cache_alloc(pcc, order);
+	__page_pcp_cache_preempt_enable(state);
+	return page;
+}
+
+/* Replacement for __free_pages(page, order) */
+static inline void __page_pcp_cache_free(
+	struct page_pcp_cache *pcc, struct page *page, unsigned int order)
+{
+	int state;
+
+	/* Only recycle pages we are the last user of, that belong to
+	 * the local NUMA node, and which were not taken from the
+	 * emergency reserves.
+	 */
+	if (unlikely(!page_pcp_cache_order_ok(order) ||
+		     page_ref_count(page) != 1 ||
+		     page_to_nid(page) != numa_mem_id() ||
+		     page_is_pfmemalloc(page))) {
+		__free_pages(page, order);
+		return;
+	}
+
+	state = __page_pcp_cache_preempt_disable();
+	main_page_pcp_cache_free(pcc, page, order);
+	__page_pcp_cache_preempt_enable(state);
+}
+
+/* API users can choose to use "__" prefixed versions for inlining */
+extern struct page *page_pcp_cache_alloc(struct page_pcp_cache *pcc,
+					 unsigned int order);
+extern void page_pcp_cache_free(struct page_pcp_cache *pcc,
+				struct page *page, unsigned int order);
+
+#endif /* _LINUX_PAGE_PCP_CACHE_H */
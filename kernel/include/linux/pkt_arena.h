@@ -0,0 +1,146 @@
+/*
+ * pkt_arena - arena backed fixed-size packet buffer allocator
+ *
+ * Per packet page or slab allocations spread packet buffers over
+ * many pages, which stress the dTLB when processing capture buffers
+ * at high rates.  This allocator reserves a few large physically
+ * contiguous chunks (2MB, the PMD huge page size) up-front, and
+ * carves them into fixed-size packet slots.  The kernel direct map
+ * cover these chunks with huge-page TLB entries, thus all buffers
+ * live within a small number of TLB entries.
+ *
+ * Slot handout follows the qmempool design: a shared Lock-Free
+ * alf_queue (MPMC) holding all free slots, in-front of which a per
+ * CPU alf_queue (SPSC) cache is bulk refilled/flushed, to amortize
+ * the cmpxchg cost.  Unlike qmempool, there is no fallback
+ * allocator; the arena is fixed-size and alloc return NULL when all
+ * slots are in use.
+ *
+ * The buddy allocator can at most hand out MAX_ORDER-1 pages, thus
+ * 1GB chunks are not supported (that would require hugetlbfs/CMA).
+ *
+ * Like qmempool, this is optimized for usage from softirq context,
+ * and cannot be used from hardirq context.
+ *
+ * Copyright (C) 2017, Red Hat, Inc., Jesper Dangaard Brouer
+ *  for licensing details see kernel-base/COPYING
+ */
+#ifndef _LINUX_PKT_ARENA_H
+#define _LINUX_PKT_ARENA_H
+
+#include <linux/alf_queue.h>
+#include <linux/hardirq.h>
+#include <linux/percpu.h>
+
+#define PKT_ARENA_BULK 16
+/* PMD sized chunks, 2MB on x86_64 */
+#define PKT_ARENA_CHUNK_ORDER (PMD_SHIFT - PAGE_SHIFT)
+#define PKT_ARENA_CHUNK_SIZE  (PAGE_SIZE << PKT_ARENA_CHUNK_ORDER)
+
+struct pkt_arena_percpu {
+	struct alf_queue *localq;
+};
+
+struct pkt_arena {
+	/* All free slots, Multi-Producer-Multi-Consumer queue */
+	struct alf_queue	*sharedq;
+
+	/* Per CPU Single-Producer-Single-Consumer cache queues */
+	struct pkt_arena_percpu __percpu *percpu;
+
+	/* Backing memory */
+	struct page		**chunks;
+	unsigned int		nr_chunks;
+
+	/* Setup */
+	unsigned int slot_size;
+	unsigned int slots_per_chunk;
+	unsigned int nr_slots;
+};
+
+extern struct pkt_arena *pkt_arena_create(unsigned int slot_size,
+					  unsigned int nr_chunks,
+					  unsigned int localq_sz);
+extern void pkt_arena_destroy(struct pkt_arena *arena);
+
+extern void *__pkt_arena_alloc_from_sharedq(struct pkt_arena *arena,
+					    struct alf_queue *localq);
+extern void __pkt_arena_free_to_sharedq(struct pkt_arena *arena,
+					void *slot,
+					struct alf_queue *localq);
+
+/* Same softirq trick as qmempool, see __qmempool_preempt_disable() */
+static inline int __pkt_arena_preempt_disable(void)
+{
+	int in_serving_softirq = in_serving_softirq();
+
+	if (!in_serving_softirq)
+		local_bh_disable();
+
+	return in_serving_softirq;
+}
+
+static inline void __pkt_arena_preempt_enable(int in_serving_softirq)
+{
+	if (!in_serving_softirq)
+		local_bh_enable();
+}
+
+/* Caller must make sure this is called from a preemptive safe context */
+static inline void *main_pkt_arena_alloc(struct pkt_arena *arena)
+{
+	struct pkt_arena_percpu *cpu = this_cpu_ptr(arena->percpu);
+	void *slot;
+
+	if (alf_sc_dequeue(cpu->localq, &slot, 1) == 1)
+		return slot;
+
+	return __pkt_arena_alloc_from_sharedq(arena, cpu->localq);
+}
+
+static inline void main_pkt_arena_free(struct pkt_arena *arena, void *slot)
+{
+	struct pkt_arena_percpu *cpu = this_cpu_ptr(arena->percpu);
+
+	if (alf_sp_enqueue(cpu->localq, &slot, 1) == 1)
+		return;
+
+	__pkt_arena_free_to_sharedq(arena, slot, cpu->localq);
+}
+
+static inline void *__pkt_arena_alloc(struct pkt_arena *arena)
+{
+	void *slot;
+	int state;
+
+	state = __pkt_arena_preempt_disable();
+	slot  = main_pkt_arena_alloc(arena);
+	__pkt_arena_preempt_enable(state);
+	return slot;
+}
+
+static inline void __pkt_arena_free(struct pkt_arena *arena, void *slot)
+{
+	int state;
+
+	state = __pkt_arena_preempt_disable();
+	main_pkt_arena_free(arena, slot);
+	__pkt_arena_preempt_enable(state);
+}
+
+static inline void *__pkt_arena_alloc_softirq(struct pkt_arena *arena)
+{
+	return main_pkt_arena_alloc(arena);
+}
+
+static inline void __pkt_arena_free_softirq(struct pkt_arena *arena,
+					    void *slot)
+{
+	main_pkt_arena_free(arena, slot);
+}
+
+/* API users can choose to use "__" prefixed versions for inlining */
+extern void *pkt_arena_alloc(struct pkt_arena *arena);
+extern void pkt_arena_free(struct pkt_arena *arena, void *slot);
+
+#endif /* _LINUX_PKT_ARENA_H */
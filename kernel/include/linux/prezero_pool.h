@@ -0,0 +1,124 @@
+/*
+ * prezero_pool - pool of pre-zeroed pages
+ *
+ * Allocating pages with __GFP_ZERO pays the page clearing cost inline,
+ * which for a 4K page is a significant part of the per packet budget
+ * (see lib/time_bench_memset.c).  This pool keeps a stock of already
+ * zeroed pages per NUMA node.  The stock is refilled by a low-priority
+ * kthread per node, which clears pages using non-temporal stores, to
+ * avoid polluting the CPU cache with zero'ed cache-lines that the
+ * consumer (likely on another CPU) would need to fetch anyway.
+ *
+ * The stock is stored in an alf_queue, where the node kthread is the
+ * single producer and pool users are the (multiple) consumers.  When
+ * the stock runs empty, the getter falls back to a normal
+ * alloc_page(__GFP_ZERO).
+ *
+ * Copyright (C) 2017, Red Hat, Inc., Jesper Dangaard Brouer
+ *  for licensing details see kernel-base/COPYING
+ */
+#ifndef _LINUX_PREZERO_POOL_H
+#define _LINUX_PREZERO_POOL_H
+
+#include <linux/alf_queue.h>
+#include <linux/hardirq.h>
+#include <linux/mm.h>
+#include <linux/wait.h>
+#include <linux/percpu.h>
+#include <linux/topology.h>
+
+/* Worker zero and enqueue pages in bulk of this size */
+#define PREZERO_POOL_BULK 16
+
+enum prezero_clear_method {
+	PREZERO_CLEAR_PAGE = 0,	/* arch clear_page() */
+	PREZERO_CLEAR_NT,	/* non-temporal stores (x86_64 movnti) */
+};
+
+struct prezero_pool;
+
+struct prezero_pool_node {
+	/* Single-Producer (kthread) Multi-Consumer queue of pages */
+	struct alf_queue	*stock;
+	struct task_struct	*kthread;
+	wait_queue_head_t	wait;
+	struct prezero_pool	*pool;
+	int nid;
+
+	/* Stats, only updated by kthread */
+	unsigned long pages_zeroed;
+	u64 busy_ns;
+};
+
+struct prezero_pool_stats {
+	unsigned long hit;
+	unsigned long miss;
+};
+
+struct prezero_pool {
+	struct prezero_pool_node **node; /* indexed by nid */
+	struct prezero_pool_stats __percpu *stats;
+
+	/* Setup */
+	u32 size;	/* stock per node, power-of-2 */
+	u32 low_wmark;	/* wakeup kthread below this stock level */
+	enum prezero_clear_method clear;
+};
+
+extern struct prezero_pool *prezero_pool_create(
+	u32 size, u32 low_wmark, enum prezero_clear_method clear);
+extern void prezero_pool_destroy(struct prezero_pool *pool);
+
+extern struct page *__prezero_pool_alloc_slow(struct prezero_pool *pool,
+					      gfp_t gfp_mask);
+extern void __prezero_pool_kick(struct prezero_pool_node *pn);
+
+extern int prezero_pool_count(struct prezero_pool *pool, int nid);
+extern void prezero_clear_page_nt(void *page);
+
+/* Same softirq trick as qmempool, see __qmempool_preempt_disable().
+ * A softirq interrupting an alf_queue operation on the same CPU would
+ * spin forever, thus process context disables BH, not only preempt.
+ */
+static inline int __prezero_pool_preempt_disable(void)
+{
+	int in_serving_softirq = in_serving_softirq();
+
+	if (!in_serving_softirq)
+		local_bh_disable();
+
+	return in_serving_softirq;
+}
+
+static inline void __prezero_pool_preempt_enable(int in_serving_softirq)
+{
+	if (!in_serving_softirq)
+		local_bh_enable();
+}
+
+/* Fast-path getter of a zeroed order-0 page.  Can be called from
+ * softirq context.  The gfp_mask is only used for the fallback.
+ */
+static inline struct page *prezero_pool_alloc(struct prezero_pool *pool,
+					      gfp_t gfp_mask)
+{
+	struct prezero_pool_node *pn = pool->node[numa_mem_id()];
+	void *page;
+	int num, state;
+
+	state = __prezero_pool_preempt_disable();
+	num = alf_mc_dequeue(pn->stock, &page, 1);
+	if (likely(num == 1))
+		this_cpu_inc(pool->stats->hit);
+	__prezero_pool_preempt_enable(state);
+
+	if (unlikely(num != 1))
+		return __prezero_pool_alloc_slow(pool, gfp_mask);
+
+	if (unlikely(alf_queue_count(pn->stock) < pool->low_wmark))
+		__prezero_pool_kick(pn);
+
+	return page;
+}
+
+#endif /* _LINUX_PREZERO_POOL_H */
@@ -7,6 +7,17 @@
 #ifndef _LINUX_TIME_BENCH_H
 #define _LINUX_TIME_BENCH_H
 
+#include <linux/version.h>
+
+/* Kernel v5.6 removed struct timespec and getnstimeofday() */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,6,0)
+#define time_bench_timespec	timespec64
+#define time_bench_gettime	ktime_get_real_ts64
+#else
+#define time_bench_timespec	timespec
+#define time_bench_gettime	getnstimeofday
+#endif
+
 /* Main structure used for recording a benchmark run */
 struct time_bench_record
 {
@@ -26,8 +37,8 @@ struct time_bench_record
 	uint64_t invoked_cnt; 	/* Returned actual invocations */
 	uint64_t tsc_start;
 	uint64_t tsc_stop;
-	struct timespec ts_start;
-	struct timespec ts_stop;
+	struct time_bench_timespec ts_start;
+	struct time_bench_timespec ts_stop;
 	/** PMU counters for instruction and cycles
 	 * instructions counter including pipelined instructions */
 	uint64_t pmc_inst_start;
@@ -166,6 +177,20 @@ inline uint64_t rdtsc(void)
 
 bool time_bench_PMU_config(bool enable);
 
+/* Generic perf event counter (e.g. dTLB misses) bound to the current
+ * task, thus it follows the benchmark across CPUs.  Read the counter
+ * before and after the measured code, like the TSC.
+ */
+struct perf_event;
+struct perf_event *time_bench_perf_event_create(uint32_t type,
+						uint64_t config);
+uint64_t time_bench_perf_event_read(struct perf_event *event);
+void time_bench_perf_event_release(struct perf_event *event);
+
+/* Config for PERF_TYPE_HW_CACHE events, see perf_event_open(2) */
+#define TIME_BENCH_HW_CACHE(id, op, result)	\
+	((id) | ((op) << 8) | ((result) << 16))
+
 /* Raw reading via rdpmc() using fixed counters
  *
  * From: https://github.com/andikleen/simple-pmu
@@ -234,7 +259,7 @@ void time_bench_print_stats_cpumask(const char *desc,
 //FIXME: use rec->flags to select measurement, should be MACRO
 static __always_inline void
 time_bench_start(struct time_bench_record *rec) {
-	getnstimeofday(&rec->ts_start);
+	time_bench_gettime(&rec->ts_start);
 	if (rec->flags & TIME_BENCH_PMU) {
 		rec->pmc_inst_start = pmc_inst();
 		rec->pmc_clk_start  = pmc_clk();
@@ -249,7 +274,7 @@ time_bench_stop(struct time_bench_record *rec, uint64_t invoked_cnt) {
 		rec->pmc_inst_stop = pmc_inst();
 		rec->pmc_clk_stop  = pmc_clk();
 	}
-	getnstimeofday(&rec->ts_stop);
+	time_bench_gettime(&rec->ts_stop);
 	rec->invoked_cnt = invoked_cnt;
 }
 
@@ -104,6 +104,49 @@ bool time_bench_PMU_config(bool enable)
 }
 EXPORT_SYMBOL_GPL(time_bench_PMU_config);
 
+struct perf_event *time_bench_perf_event_create(uint32_t type,
+						uint64_t config)
+{
+	struct perf_event_attr attr;
+	struct perf_event *event;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.type           = type;
+	attr.size           = sizeof(attr);
+	attr.config         = config;
+	attr.pinned         = 1;
+	attr.exclude_user   = 1; /* Only kernel events */
+	attr.exclude_kernel = 0;
+
+	/* cpu == -1 and task == current: count current task on any CPU */
+	event = perf_event_create_kernel_counter(&attr, -1, current,
+						 NULL, NULL);
+	if (IS_ERR(event)) {
+		pr_err("%s() failed type:%u config:0x%llx err:%ld\n",
+		       __func__, type, config, PTR_ERR(event));
+		return NULL;
+	}
+	return event;
+}
+EXPORT_SYMBOL_GPL(time_bench_perf_event_create);
+
+uint64_t time_bench_perf_event_read(struct perf_event *event)
+{
+	u64 enabled, running;
+
+	if (!event)
+		return 0;
+	return perf_event_read_value(event, &enabled, &running);
+}
+EXPORT_SYMBOL_GPL(time_bench_perf_event_read);
+
+void time_bench_perf_event_release(struct perf_event *event)
+{
+	if (event)
+		perf_event_release_kernel(event);
+}
+EXPORT_SYMBOL_GPL(time_bench_perf_event_release);
+
 /** Generic functions **
  */
 
@@ -1,17 +1,40 @@
 /*
  * Benchmarking page allocator bulk API
- *  ***NOTICE***: not-upstream experimental patch by Mel Gorman
+ *
+ * Upstream kernel v5.13 added the bulk page allocator (by Mel Gorman):
+ *  alloc_pages_bulk_array() and alloc_pages_bulk_list()
+ *
+ * This benchmark was originally written for Mel's experimental
+ * (non-upstream) list based patch.  It now targets the upstream API,
+ * to evaluate what bulk page refill buys e.g. NIC RX-ring refill.
  */
 #define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
 
 #include <linux/module.h>
+#include <linux/version.h>
 #include <linux/time.h>
 #include <linux/time_bench.h>
 #include <linux/spinlock.h>
+#include <linux/slab.h>
 #include <linux/mm.h>
+#include <linux/gfp.h>
 #include <linux/list.h>
+#include <linux/cpumask.h>
 #include <linux/net.h> /* net_warn_ratelimited */
 
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5,13,0)
+#error "Bulk page allocator API requires kernel v5.13 or newer"
+#endif
+
+/* Kernel v6.14 renamed alloc_pages_bulk_array() to alloc_pages_bulk()
+ * and removed the list variant.
+ */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,14,0)
+#define alloc_pages_bulk_array(gfp, nr, arr) alloc_pages_bulk(gfp, nr, arr)
+#else
+#define HAVE_ALLOC_PAGES_BULK_LIST
+#endif
+
 static int verbose=1;
 
 /* Quick and dirty way to unselect some of the benchmark tests, by
@@ -28,21 +51,25 @@ MODULE_PARM_DESC(run_flags, "Hack way to limit bench to run");
 /* Count the bit number from the enum */
 enum benchmark_bit {
 	bit_run_bench_order0_compare,
-	bit_run_bench_page_bulking,
+	bit_run_bench_page_bulk_array,
+	bit_run_bench_page_bulk_list,
+	bit_run_bench_parallel_cpus,
 };
 #define bit(b)	(1 << (b))
 #define run_or_return(b) do { if (!(run_flags & (bit(b)))) return; } while (0)
 
-
-#define DEFAULT_ORDER 0
-static int page_order = DEFAULT_ORDER;
-module_param(page_order, uint, 0);
-MODULE_PARM_DESC(page_order, "Parameter page order to use in bench");
-
 static uint32_t loops = 1000000;
 module_param(loops, uint, 0);
 MODULE_PARM_DESC(loops, "Iteration loops");
 
+static int parallel_cpus = 2;
+module_param(parallel_cpus, uint, 0);
+MODULE_PARM_DESC(parallel_cpus, "Parameter for number of parallel CPUs");
+
+static int parallel_bulk = 64;
+module_param(parallel_bulk, uint, 0);
+MODULE_PARM_DESC(parallel_bulk, "Bulk size used in parallel CPUs test");
+
 /* Most simple case for comparison */
 static int time_single_page_alloc_put(
 	struct time_bench_record *rec, void *data)
@@ -63,53 +90,141 @@ static int time_single_page_alloc_put(
 	return i;
 }
 
-#define MAX_BULK 32768
+#define MAX_BULK 512
 
-static int time_bulk_page_alloc_free(
-	struct time_bench_record *rec, void *data)
+static bool bulk_setup_ok(struct time_bench_record *rec, size_t bulk)
 {
-	gfp_t gfp = (GFP_ATOMIC | ___GFP_NORETRY);
-	uint64_t loops_cnt = 0;
-	int order=0;
-	int i;
-
-	/* Bulk size setup from "step" */
-	size_t bulk = rec->step;
-
 	if (bulk > MAX_BULK) {
-		pr_warn("%s() bulk(%lu) request too big cap at %d\n",
+		pr_warn("%s() bulk(%lu) request too big max %d\n",
 			__func__, bulk, MAX_BULK);
-		bulk = MAX_BULK;
+		return false;
 	}
 	/* loop count is limited to 32-bit due to div_u64_rem() use */
 	if (((uint64_t)rec->loops * bulk *2) >= ((1ULL<<32)-1)) {
 		pr_err("Loop cnt too big will overflow 32-bit\n");
+		return false;
+	}
+	return true;
+}
+
+/* Comparison: RX-ring refill style loop of single alloc_page() calls,
+ * same access pattern as the bulk tests, but without bulk API.
+ */
+static int time_single_page_alloc_loop(
+	struct time_bench_record *rec, void *data)
+{
+	gfp_t gfp = (GFP_ATOMIC | ___GFP_NORETRY);
+	size_t bulk = rec->step;
+	uint64_t loops_cnt = 0;
+	struct page **pages;
+	int i, j;
+
+	if (!bulk_setup_ok(rec, bulk))
+		return 0;
+	pages = kcalloc(MAX_BULK, sizeof(*pages), GFP_KERNEL);
+	if (!pages)
+		return 0;
+
+	time_bench_start(rec);
+	/** Loop to measure **/
+	for (i = 0; i < rec->loops; i++) {
+		for (j = 0; j < bulk; j++) {
+			pages[j] = alloc_page(gfp);
+			if (unlikely(!pages[j]))
+				break;
+		}
+		barrier();
+		loops_cnt += j;
+		while (j--)
+			put_page(pages[j]);
+	}
+	time_bench_stop(rec, loops_cnt);
+
+	kfree(pages);
+	return loops_cnt;
+}
+
+static int time_bulk_page_alloc_array(
+	struct time_bench_record *rec, void *data)
+{
+	gfp_t gfp = (GFP_ATOMIC | ___GFP_NORETRY);
+	size_t bulk = rec->step;
+	uint64_t loops_cnt = 0;
+	struct page **pages;
+	unsigned long n;
+	int i, j;
+
+	if (!bulk_setup_ok(rec, bulk))
 		return 0;
+	/* The array API only fills NULL entries */
+	pages = kcalloc(MAX_BULK, sizeof(*pages), GFP_KERNEL);
+	if (!pages)
+		return 0;
+
+	time_bench_start(rec);
+	/** Loop to measure **/
+	for (i = 0; i < rec->loops; i++) {
+
+		n = alloc_pages_bulk_array(gfp, bulk, pages);
+
+		if (verbose && (n < bulk))
+			net_warn_ratelimited(
+				"%s(): got less pages: %lu/%lu\n",
+				__func__, n, bulk);
+		barrier();
+		for (j = 0; j < n; j++) {
+			put_page(pages[j]);
+			pages[j] = NULL;
+		}
+
+		/* NOTICE THIS COUNTS (bulk) alloc+free together */
+		loops_cnt += n;
 	}
+	time_bench_stop(rec, loops_cnt);
+
+	kfree(pages);
+	return loops_cnt;
+}
+
+#ifdef HAVE_ALLOC_PAGES_BULK_LIST
+static int time_bulk_page_alloc_list(
+	struct time_bench_record *rec, void *data)
+{
+	gfp_t gfp = (GFP_ATOMIC | ___GFP_NORETRY);
+	size_t bulk = rec->step;
+	uint64_t loops_cnt = 0;
+	int i;
+
+	if (!bulk_setup_ok(rec, bulk))
+		return 0;
 
 	time_bench_start(rec);
 	/** Loop to measure **/
 	for (i = 0; i < rec->loops; i++) {
+		struct page *page, *next;
 		struct list_head list;
 		unsigned long n;
-		INIT_LIST_HEAD(&list);
 
-		n = alloc_pages_bulk(gfp, order, bulk, &list);
+		INIT_LIST_HEAD(&list);
+		n = alloc_pages_bulk_list(gfp, bulk, &list);
 
 		if (verbose && (n < bulk))
 			net_warn_ratelimited(
 				"%s(): got less pages: %lu/%lu\n",
 				__func__, n, bulk);
 		barrier();
-		free_pages_bulk(&list);
+		list_for_each_entry_safe(page, next, &list, lru) {
+			list_del(&page->lru);
+			put_page(page);
+		}
 
 		/* NOTICE THIS COUNTS (bulk) alloc+free together */
-		loops_cnt+= n;
+		loops_cnt += n;
 	}
 	time_bench_stop(rec, loops_cnt);
 	return loops_cnt;
 }
-
+#endif
 
 void noinline run_bench_order0_compare(uint32_t loops)
 {
@@ -121,17 +236,67 @@ void noinline run_bench_order0_compare(uint32_t loops)
 
 void noinline run_bench_page_bulking(uint32_t loops, int bulk)
 {
-	run_or_return(bit_run_bench_page_bulking);
 	/*
 	 * Adjust loops here, according to bulk value, as each test
 	 * should run approx same amount of time.  time_bench_loop()
 	 * will complain if adjusting inside test func.
 	 */
 	loops = loops / bulk;
-	time_bench_loop(loops, bulk, "time_bulk_page_alloc_free",
-			NULL,         time_bulk_page_alloc_free);
+
+	time_bench_loop(loops, bulk, "single_page_alloc_loop",
+			NULL,         time_single_page_alloc_loop);
+
+	if (run_flags & bit(bit_run_bench_page_bulk_array))
+		time_bench_loop(loops, bulk, "bulk_page_alloc_array",
+				NULL,         time_bulk_page_alloc_array);
+#ifdef HAVE_ALLOC_PAGES_BULK_LIST
+	if (run_flags & bit(bit_run_bench_page_bulk_list))
+		time_bench_loop(loops, bulk, "bulk_page_alloc_list",
+				NULL,         time_bulk_page_alloc_list);
+#endif
 }
 
+void noinline run_bench_parallel_cpus(uint32_t loops, int nr_cpus, int bulk)
+{
+	struct time_bench_sync sync;
+	struct time_bench_cpu *cpu_tasks;
+	struct cpumask my_cpumask;
+	int i;
+
+	run_or_return(bit_run_bench_parallel_cpus);
+
+	if (bulk < 1 || bulk > MAX_BULK) {
+		pr_err("parallel_bulk(%d) must be in range 1-%d\n",
+		       bulk, MAX_BULK);
+		return;
+	}
+
+	/* Allocate records for CPUs */
+	cpu_tasks = kzalloc(sizeof(*cpu_tasks) * nr_cpu_ids, GFP_KERNEL);
+	if (!cpu_tasks)
+		return;
+
+	/* Reduce number of CPUs to run on */
+	cpumask_clear(&my_cpumask);
+	for (i = 0; i < nr_cpus ; i++) {
+		cpumask_set_cpu(i, &my_cpumask);
+	}
+	pr_info("Limit to %d parallel CPUs (bulk:%d)\n", nr_cpus, bulk);
+
+	time_bench_run_concurrent(loops / bulk, bulk, NULL,
+				  &my_cpumask, &sync, cpu_tasks,
+				  time_single_page_alloc_loop);
+	time_bench_print_stats_cpumask("parallel_single_page_alloc_loop",
+				       cpu_tasks, &my_cpumask);
+
+	time_bench_run_concurrent(loops / bulk, bulk, NULL,
+				  &my_cpumask, &sync, cpu_tasks,
+				  time_bulk_page_alloc_array);
+	time_bench_print_stats_cpumask("parallel_bulk_page_alloc_array",
+				       cpu_tasks, &my_cpumask);
+
+	kfree(cpu_tasks);
+}
 
 int run_timing_tests(void)
 {
@@ -147,6 +312,9 @@ int run_timing_tests(void)
 	run_bench_page_bulking(loops, 64);
 	run_bench_page_bulking(loops,128);
 	run_bench_page_bulking(loops,256);
+	run_bench_page_bulking(loops,512);
+
+	run_bench_parallel_cpus(loops, parallel_cpus, parallel_bulk);
 	return 0;
 }
 
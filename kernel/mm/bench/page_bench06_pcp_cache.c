@@ -0,0 +1,247 @@
+/*
+ * Benchmarking per CPU high-order page cache (page_pcp_cache)
+ *  - parallel execution scalability, compared against alloc_pages()
+ *
+ */
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/module.h>
+#include <linux/time.h>
+#include <linux/time_bench.h>
+#include <linux/spinlock.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/cpumask.h>
+#include <linux/page_pcp_cache.h>
+
+static int verbose=1;
+
+#define DEFAULT_ORDER 1
+static int page_order = DEFAULT_ORDER;
+module_param(page_order, uint, 0);
+MODULE_PARM_DESC(page_order, "Parameter page order to use in bench");
+
+static uint32_t loops = 100000;
+module_param(loops, uint, 0);
+MODULE_PARM_DESC(loops, "Iteration loops");
+
+/* Zero means sweep up-to all online CPUs */
+static int max_cpus = 0;
+module_param(max_cpus, uint, 0);
+MODULE_PARM_DESC(max_cpus, "Max number of parallel CPUs in sweep");
+
+static int outstanding = 16;
+module_param(outstanding, uint, 0);
+MODULE_PARM_DESC(outstanding, "Pages allocated before freeing them again");
+
+static int cache_high = 64;
+module_param(cache_high, uint, 0);
+MODULE_PARM_DESC(cache_high, "Per CPU cache high mark (drain point)");
+
+static int cache_batch = 16;
+module_param(cache_batch, uint, 0);
+MODULE_PARM_DESC(cache_batch, "Per CPU cache bulk refill/drain size");
+
+/* Quick and dirty way to unselect some of the benchmark tests, by
+ * encoding this in a module parameter flag.  This is useful when
+ * wanting to perf benchmark a specific benchmark test.
+ *
+ * Hint: Bash shells support writing binary number like: $((2#101010))
+ * Use like:
+ *  modprobe page_bench06_pcp_cache page_order=2 run_flags=$((2#10))
+ */
+static unsigned long run_flags = 0xFFFFFFFF;
+module_param(run_flags, ulong, 0);
+MODULE_PARM_DESC(run_flags, "Hack way to limit bench to run");
+/* Count the bit number from the enum */
+enum benchmark_bit {
+	bit_run_bench_uncached,
+	bit_run_bench_cached,
+};
+#define bit(b)	(1 << (b))
+#define run_or_return(b) do { if (!(run_flags & (bit(b)))) return; } while (0)
+
+#define MAX_STORE 128
+
+/* Simulate a NIC RX-ring refill pattern, where "outstanding" pages
+ * are allocated before being freed again (e.g. at TX completion).
+ * The page_pcp_cache is given via "data", when NULL the normal page
+ * allocator is used.
+ */
+static int time_alloc_pages_outstanding(
+	struct time_bench_record *rec, void *data)
+{
+	struct page_pcp_cache *pcc = data;
+	gfp_t gfp_mask = (GFP_ATOMIC | __GFP_COMP | __GFP_NOWARN);
+	struct page *store[MAX_STORE];
+	int order = rec->step;
+	int i = 0, j = 0;
+
+	time_bench_start(rec);
+	/** Loop to measure **/
+	for (i = 0; i < rec->loops; /* inc in loop */) {
+
+		for (j = 0; j < outstanding; j++) {
+			if (pcc)
+				store[j] = page_pcp_cache_alloc(pcc, order);
+			else
+				store[j] = alloc_pages(gfp_mask, order);
+			if (unlikely(store[j] == NULL))
+				goto out;
+		}
+		/* Might overshoot rec->loops */
+		i += j;
+
+		for (j = 0; j < outstanding; j++) {
+			if (pcc)
+				page_pcp_cache_free(pcc, store[j], order);
+			else
+				__free_pages(store[j], order);
+		}
+	}
+	time_bench_stop(rec, i);
+	return i;
+out:
+	pr_err("FAILED alloc order:%d i:%d j:%d\n", order, i, j);
+	while (j--) {
+		if (pcc)
+			page_pcp_cache_free(pcc, store[j], order);
+		else
+			__free_pages(store[j], order);
+	}
+	return 0;
+}
+
+/* Report the per page cost in nanosec averaged over all CPUs, as
+ * this is the number directly comparable across CPU counts.
+ */
+void page_bench_print_ns_cpumask(const char *desc,
+				 struct time_bench_cpu *cpu_tasks,
+				 const struct cpumask *mask)
+{
+	uint64_t average = 0;
+	int order = 0;
+	int cpu;
+	struct sum {
+		uint64_t ns;
+		uint64_t tsc_cycles;
+		int records;
+	} sum = {0};
+
+	for_each_cpu(cpu, mask) {
+		struct time_bench_cpu *c = &cpu_tasks[cpu];
+		struct time_bench_record *rec = &c->rec;
+
+		if (!c->did_bench_run || !time_bench_calc_stats(rec))
+			continue;
+
+		sum.records++;
+		sum.ns += rec->ns_per_call_quotient;
+		sum.tsc_cycles += rec->tsc_cycles;
+		order = rec->step;
+	}
+
+	if (sum.records) /* avoid div-by-zero */
+		average = sum.ns / sum.records;
+
+	pr_info("Sweep:%s CPUs:%d page order:%d(%luB) ave %llu ns per-page"
+		" (%llu cycles) per-%luB %llu ns\n",
+		desc, sum.records, order, PAGE_SIZE << order, average,
+		sum.records ? sum.tsc_cycles / sum.records : 0,
+		PAGE_SIZE, average >> order);
+}
+
+static void bench_cpus(const char *desc, int nr_cpus,
+		       struct page_pcp_cache *pcc)
+{
+	struct time_bench_sync sync;
+	struct time_bench_cpu *cpu_tasks;
+	struct cpumask my_cpumask;
+	int cpu, n = 0;
+
+	/* Records are indexed by CPU id */
+	cpu_tasks = kzalloc(sizeof(*cpu_tasks) * nr_cpu_ids, GFP_KERNEL);
+	if (!cpu_tasks)
+		return;
+
+	cpumask_clear(&my_cpumask);
+	for_each_online_cpu(cpu) {
+		if (n++ >= nr_cpus)
+			break;
+		cpumask_set_cpu(cpu, &my_cpumask);
+	}
+	time_bench_run_concurrent(loops, page_order, pcc,
+				  &my_cpumask, &sync, cpu_tasks,
+				  time_alloc_pages_outstanding);
+	if (verbose >= 2)
+		time_bench_print_stats_cpumask(desc, cpu_tasks, &my_cpumask);
+	page_bench_print_ns_cpumask(desc, cpu_tasks, &my_cpumask);
+	kfree(cpu_tasks);
+}
+
+/* Sweep CPU count: 1, 2, 4, ... and last the max_cpus */
+static void bench_sweep(const char *desc, struct page_pcp_cache *pcc)
+{
+	int max = max_cpus ? min_t(int, max_cpus, num_online_cpus())
+			   : num_online_cpus();
+	int nr;
+
+	for (nr = 1; nr < max; nr <<= 1)
+		bench_cpus(desc, nr, pcc);
+	bench_cpus(desc, max, pcc);
+}
+
+void noinline run_bench_uncached(void)
+{
+	run_or_return(bit_run_bench_uncached);
+	bench_sweep("alloc_pages", NULL);
+}
+
+void noinline run_bench_cached(void)
+{
+	struct page_pcp_cache *pcc;
+
+	run_or_return(bit_run_bench_cached);
+
+	pcc = page_pcp_cache_create(cache_high, cache_batch, GFP_ATOMIC);
+	if (!pcc)
+		return;
+	bench_sweep("page_pcp_cache", pcc);
+	page_pcp_cache_destroy(pcc);
+}
+
+static int __init page_bench06_module_init(void)
+{
+	if (verbose)
+		pr_info("Loaded\n");
+
+	if (outstanding < 1 || outstanding > MAX_STORE) {
+		pr_err("outstanding(%d) must be in range 1-%d\n",
+		       outstanding, MAX_STORE);
+		return -EINVAL;
+	}
+	if (!page_pcp_cache_order_ok(page_order))
+		pr_warn("page_order(%d) not cached, only order %d-%d\n",
+			page_order, PAGE_PCP_CACHE_MIN_ORDER,
+			PAGE_PCP_CACHE_MAX_ORDER);
+
+#ifdef CONFIG_DEBUG_PREEMPT
+	pr_warn("WARN: CONFIG_DEBUG_PREEMPT is enabled: this affect results\n");
+#endif
+	run_bench_uncached();
+	run_bench_cached();
+
+	return 0;
+}
+module_init(page_bench06_module_init);
+
+static void __exit page_bench06_module_exit(void)
+{
+	if (verbose)
+		pr_info("Unloaded\n");
+}
+module_exit(page_bench06_module_exit);
+
+MODULE_DESCRIPTION("Benchmarking per CPU high-order page cache scalability");
+MODULE_AUTHOR("Jesper Dangaard Brouer <netoptimizer@brouer.com>");
+MODULE_LICENSE("GPL");
@@ -0,0 +1,309 @@
+/*
+ * Benchmarking page fragment allocators for small packet buffers
+ *  - per packet order-0 page, compared against
+ *  - page_frag_alloc() and
+ *  - page_frag_split (order-3 page, biased refcnt, bulk handout)
+ *
+ */
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/module.h>
+#include <linux/time.h>
+#include <linux/time_bench.h>
+#include <linux/mm.h>
+#include <linux/mm_types.h>
+#include <linux/gfp.h>
+#include <linux/cache.h>
+#include <linux/page_frag_split.h>
+
+static int verbose=1;
+
+/* Quick and dirty way to unselect some of the benchmark tests, by
+ * encoding this in a module parameter flag.  This is useful when
+ * wanting to perf benchmark a specific benchmark test.
+ *
+ * Hint: Bash shells support writing binary number like: $((2#101010))
+ * Use like:
+ *  modprobe page_bench07_frag loops=$((10**7))  run_flags=$((2#0100))
+ */
+static unsigned long run_flags = 0xFFFFFFFF;
+module_param(run_flags, ulong, 0);
+MODULE_PARM_DESC(run_flags, "Hack way to limit bench to run");
+/* Count the bit number from the enum */
+enum benchmark_bit {
+	bit_run_bench_order0,
+	bit_run_bench_page_frag_alloc,
+	bit_run_bench_frag_split,
+	bit_run_bench_frag_split_bulk,
+};
+#define bit(b)	(1 << (b))
+#define run_or_return(b) do { if (!(run_flags & (bit(b)))) return; } while (0)
+
+static uint32_t loops = 1000000;
+module_param(loops, uint, 0);
+MODULE_PARM_DESC(loops, "Iteration loops");
+
+/* Number of buffers allocated before freeing them again, this is
+ * also the bulk size used for page_frag_split_alloc_bulk().
+ */
+#define MAX_BULK 64
+static int bulk = 32;
+module_param(bulk, uint, 0);
+MODULE_PARM_DESC(bulk, "Outstanding buffers and bulk handout size");
+
+/* Zero means run the default buffer size sweep */
+static int buf_size = 0;
+module_param(buf_size, uint, 0);
+MODULE_PARM_DESC(buf_size, "Only bench this buffer size (bytes)");
+
+/* Baseline: one order-0 page per packet buffer */
+static int time_order0_per_buffer(
+	struct time_bench_record *rec, void *data)
+{
+	gfp_t gfp_mask = (GFP_ATOMIC | __GFP_NOWARN);
+	struct page *store[MAX_BULK];
+	uint64_t loops_cnt = 0;
+	int i, j;
+
+	time_bench_start(rec);
+	/** Loop to measure **/
+	for (i = 0; i < rec->loops; i++) {
+		for (j = 0; j < bulk; j++) {
+			store[j] = alloc_page(gfp_mask);
+			if (unlikely(store[j] == NULL))
+				goto out;
+		}
+		barrier();
+		for (j = 0; j < bulk; j++)
+			put_page(store[j]);
+		loops_cnt += bulk;
+	}
+	time_bench_stop(rec, loops_cnt);
+	return loops_cnt;
+out:
+	while (j--)
+		put_page(store[j]);
+	return 0;
+}
+
+static int time_page_frag_alloc(
+	struct time_bench_record *rec, void *data)
+{
+	struct page_frag_cache nc = { 0 };
+	unsigned int fragsz = rec->step;
+	void *store[MAX_BULK];
+	uint64_t loops_cnt = 0;
+	int i, j;
+
+	time_bench_start(rec);
+	/** Loop to measure **/
+	for (i = 0; i < rec->loops; i++) {
+		for (j = 0; j < bulk; j++) {
+			store[j] = page_frag_alloc(&nc, fragsz, GFP_ATOMIC);
+			if (unlikely(store[j] == NULL))
+				goto out;
+		}
+		barrier();
+		for (j = 0; j < bulk; j++)
+			page_frag_free(store[j]);
+		loops_cnt += bulk;
+	}
+	time_bench_stop(rec, loops_cnt);
+	goto drain;
+out:
+	while (j--)
+		page_frag_free(store[j]);
+	loops_cnt = 0;
+drain:
+	if (nc.va)
+		__page_frag_cache_drain(virt_to_head_page(nc.va),
+					nc.pagecnt_bias);
+	return loops_cnt;
+}
+
+static void print_frag_split_stats(struct page_frag_split *pfs,
+				   const char *func, unsigned int fragsz)
+{
+	if (verbose >= 2)
+		pr_info("%s() fragsz:%u pages alloc:%lu recycle:%lu\n",
+			func, fragsz, pfs->pages_alloc, pfs->pages_recycle);
+}
+
+static int time_frag_split(
+	struct time_bench_record *rec, void *data)
+{
+	struct page_frag_split pfs;
+	unsigned int fragsz = rec->step;
+	void *store[MAX_BULK];
+	uint64_t loops_cnt = 0;
+	int i, j;
+
+	page_frag_split_init(&pfs, PAGE_FRAG_SPLIT_ORDER, GFP_ATOMIC);
+
+	time_bench_start(rec);
+	/** Loop to measure **/
+	for (i = 0; i < rec->loops; i++) {
+		for (j = 0; j < bulk; j++) {
+			store[j] = page_frag_split_alloc(&pfs, fragsz);
+			if (unlikely(store[j] == NULL))
+				goto out;
+		}
+		barrier();
+		for (j = 0; j < bulk; j++)
+			page_frag_split_free(store[j]);
+		loops_cnt += bulk;
+	}
+	time_bench_stop(rec, loops_cnt);
+	goto drain;
+out:
+	while (j--)
+		page_frag_split_free(store[j]);
+	loops_cnt = 0;
+drain:
+	print_frag_split_stats(&pfs, __func__, fragsz);
+	page_frag_split_drain(&pfs);
+	return loops_cnt;
+}
+
+static int time_frag_split_bulk(
+	struct time_bench_record *rec, void *data)
+{
+	struct page_frag_split pfs;
+	unsigned int fragsz = rec->step;
+	void *store[MAX_BULK];
+	uint64_t loops_cnt = 0;
+	int i, j, n = 0;
+
+	page_frag_split_init(&pfs, PAGE_FRAG_SPLIT_ORDER, GFP_ATOMIC);
+
+	time_bench_start(rec);
+	/** Loop to measure **/
+	for (i = 0; i < rec->loops; i++) {
+		n = page_frag_split_alloc_bulk(&pfs, fragsz, store, bulk);
+		if (unlikely(n < bulk))
+			goto out;
+		barrier();
+		for (j = 0; j < n; j++)
+			page_frag_split_free(store[j]);
+		loops_cnt += n;
+	}
+	time_bench_stop(rec, loops_cnt);
+	goto drain;
+out:
+	for (j = 0; j < n; j++)
+		page_frag_split_free(store[j]);
+	loops_cnt = 0;
+drain:
+	print_frag_split_stats(&pfs, __func__, fragsz);
+	page_frag_split_drain(&pfs);
+	return loops_cnt;
+}
+
+/* Memory waste per buffer, when carving fixed size buffers out of a
+ * page of page_sz bytes.  Reported in bytes as "quotient.decimal".
+ */
+static void print_waste(const char *desc, unsigned int page_sz,
+			unsigned int fragsz)
+{
+	unsigned int per_page = page_sz / fragsz;
+	unsigned int waste_total = page_sz - (per_page * fragsz);
+	unsigned int waste_x1000 = (waste_total * 1000) / per_page;
+
+	pr_info("Waste:%s fragsz:%u page:%uB buffers-per-page:%u"
+		" waste per-buffer %u.%03u bytes (%u.%u%%)\n",
+		desc, fragsz, page_sz, per_page,
+		waste_x1000 / 1000, waste_x1000 % 1000,
+		(waste_total * 100) / page_sz,
+		((waste_total * 1000) / page_sz) % 10);
+}
+
+void noinline run_bench_buffer_size(uint32_t loops, unsigned int size)
+{
+	/* Cache-line align buffers, same for all tests */
+	unsigned int fragsz = ALIGN(size, SMP_CACHE_BYTES);
+	uint32_t nr_loops = loops / bulk;
+
+	pr_info("Buffer size:%u (aligned fragsz:%u) bulk:%d\n",
+		size, fragsz, bulk);
+
+	if (run_flags & bit(bit_run_bench_order0)) {
+		time_bench_loop(nr_loops, fragsz, "order0_per_buffer",
+				NULL, time_order0_per_buffer);
+		/* One page per buffer, rest of the page is wasted */
+		if (fragsz <= PAGE_SIZE)
+			pr_info("Waste:order0_per_buffer fragsz:%u page:%luB"
+				" buffers-per-page:1 waste per-buffer %lu"
+				" bytes (%lu%%)\n", fragsz, PAGE_SIZE,
+				PAGE_SIZE - fragsz,
+				((PAGE_SIZE - fragsz) * 100) / PAGE_SIZE);
+	}
+	if (run_flags & bit(bit_run_bench_page_frag_alloc)) {
+		time_bench_loop(nr_loops, fragsz, "page_frag_alloc",
+				NULL, time_page_frag_alloc);
+		print_waste("page_frag_alloc", PAGE_FRAG_CACHE_MAX_SIZE,
+			    fragsz);
+	}
+	if (run_flags & bit(bit_run_bench_frag_split)) {
+		time_bench_loop(nr_loops, fragsz, "page_frag_split",
+				NULL, time_frag_split);
+	}
+	if (run_flags & bit(bit_run_bench_frag_split_bulk)) {
+		time_bench_loop(nr_loops, fragsz, "page_frag_split_bulk",
+				NULL, time_frag_split_bulk);
+	}
+	if (run_flags & (bit(bit_run_bench_frag_split) |
+			 bit(bit_run_bench_frag_split_bulk)))
+		print_waste("page_frag_split",
+			    PAGE_SIZE << PAGE_FRAG_SPLIT_ORDER, fragsz);
+}
+
+int run_timing_tests(void)
+{
+	static const unsigned int sizes[] = {
+		64, 128, 256, 512, 1024, 1500, 2048 };
+	int i;
+
+	if (buf_size) {
+		run_bench_buffer_size(loops, buf_size);
+		return 0;
+	}
+	for (i = 0; i < ARRAY_SIZE(sizes); i++)
+		run_bench_buffer_size(loops, sizes[i]);
+	return 0;
+}
+
+static int __init page_bench07_module_init(void)
+{
+	if (verbose)
+		pr_info("Loaded\n");
+
+	if (bulk < 1 || bulk > MAX_BULK) {
+		pr_err("bulk(%d) must be in range 1-%d\n", bulk, MAX_BULK);
+		return -EINVAL;
+	}
+	if (buf_size > PAGE_SIZE) {
+		pr_err("buf_size(%d) must be <= PAGE_SIZE\n", buf_size);
+		return -EINVAL;
+	}
+
+#ifdef CONFIG_DEBUG_PREEMPT
+	pr_warn("WARN: CONFIG_DEBUG_PREEMPT is enabled: this affect results\n");
+#endif
+	if (run_timing_tests() < 0) {
+		return -ECANCELED;
+	}
+
+	return 0;
+}
+module_init(page_bench07_module_init);
+
+static void __exit page_bench07_module_exit(void)
+{
+	if (verbose)
+		pr_info("Unloaded\n");
+}
+module_exit(page_bench07_module_exit);
+
+MODULE_DESCRIPTION("Benchmarking page fragment allocators");
+MODULE_AUTHOR("Jesper Dangaard Brouer <netoptimizer@brouer.com>");
+MODULE_LICENSE("GPL");
@@ -0,0 +1,253 @@
+/*
+ * Benchmarking pre-zeroed page pool (prezero_pool)
+ *  - inline latency of getting a zeroed page, compared to __GFP_ZERO
+ *  - background worker CPU cost at different consumption rates
+ *
+ */
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/module.h>
+#include <linux/time.h>
+#include <linux/time_bench.h>
+#include <linux/mm.h>
+#include <linux/gfp.h>
+#include <linux/delay.h>
+#include <linux/sched.h>
+#include <linux/timex.h> /* get_cycles */
+#include <linux/math64.h>
+#include <linux/prezero_pool.h>
+
+static int verbose=1;
+
+/* Quick and dirty way to unselect some of the benchmark tests, by
+ * encoding this in a module parameter flag.  This is useful when
+ * wanting to perf benchmark a specific benchmark test.
+ *
+ * Hint: Bash shells support writing binary number like: $((2#101010))
+ * Use like:
+ *  modprobe page_bench08_prezero run_flags=$((2#100)) clear_nt=0
+ */
+static unsigned long run_flags = 0xFFFFFFFF;
+module_param(run_flags, ulong, 0);
+MODULE_PARM_DESC(run_flags, "Hack way to limit bench to run");
+/* Count the bit number from the enum */
+enum benchmark_bit {
+	bit_run_bench_inline_zero,
+	bit_run_bench_prezero_pool,
+	bit_run_bench_consumption_rates,
+};
+#define bit(b)	(1 << (b))
+#define run_or_return(b) do { if (!(run_flags & (bit(b)))) return; } while (0)
+
+static int pool_size = 4096;
+module_param(pool_size, uint, 0);
+MODULE_PARM_DESC(pool_size, "Stock of pre-zeroed pages per node (power-of-2)");
+
+static int clear_nt = 1;
+module_param(clear_nt, uint, 0);
+MODULE_PARM_DESC(clear_nt, "Worker clear method: 1=non-temporal 0=clear_page");
+
+static int rate_period_ms = 200;
+module_param(rate_period_ms, uint, 0);
+MODULE_PARM_DESC(rate_period_ms, "Duration of each consumption rate test");
+
+/* Baseline: page zeroing paid inline */
+static int time_alloc_page_zero(
+	struct time_bench_record *rec, void *data)
+{
+	gfp_t gfp_mask = (GFP_ATOMIC | __GFP_ZERO | __GFP_NOWARN);
+	struct page *page;
+	int i;
+
+	time_bench_start(rec);
+	/** Loop to measure **/
+	for (i = 0; i < rec->loops; i++) {
+		page = alloc_page(gfp_mask);
+		if (unlikely(page == NULL))
+			return 0;
+		put_page(page);
+	}
+	time_bench_stop(rec, i);
+	return i;
+}
+
+/* Consumes loops pages from the stock, which must be pre-filled */
+static int time_prezero_pool_alloc(
+	struct time_bench_record *rec, void *data)
+{
+	struct prezero_pool *pool = data;
+	struct page *page;
+	int i;
+
+	time_bench_start(rec);
+	/** Loop to measure **/
+	for (i = 0; i < rec->loops; i++) {
+		page = prezero_pool_alloc(pool, GFP_ATOMIC);
+		if (unlikely(page == NULL))
+			return 0;
+		put_page(page);
+	}
+	time_bench_stop(rec, i);
+	return i;
+}
+
+static void prezero_pool_stats_sum(struct prezero_pool *pool,
+				   struct prezero_pool_stats *sum,
+				   unsigned long *zeroed, u64 *busy_ns)
+{
+	int cpu, nid;
+
+	memset(sum, 0, sizeof(*sum));
+	for_each_possible_cpu(cpu) {
+		struct prezero_pool_stats *s = per_cpu_ptr(pool->stats, cpu);
+
+		sum->hit  += s->hit;
+		sum->miss += s->miss;
+	}
+	*zeroed = 0;
+	*busy_ns = 0;
+	for_each_node(nid) {
+		if (!pool->node[nid])
+			continue;
+		*zeroed  += READ_ONCE(pool->node[nid]->pages_zeroed);
+		*busy_ns += READ_ONCE(pool->node[nid]->busy_ns);
+	}
+}
+
+/* Wait for background worker to fill up the local node stock */
+static bool wait_stock_full(struct prezero_pool *pool)
+{
+	int nid = numa_mem_id();
+	int tries = 1000;
+
+	while (prezero_pool_count(pool, nid) <
+	       pool_size - PREZERO_POOL_BULK) {
+		if (!tries--) {
+			pr_warn("Stock not filled (%d/%d)\n",
+				prezero_pool_count(pool, nid), pool_size);
+			return false;
+		}
+		msleep(10);
+	}
+	return true;
+}
+
+/* Consume pages at a paced rate (pages/sec) and record the getter
+ * latency and how much CPU time the worker spends zeroing pages.
+ */
+static void bench_consumption_rate(struct prezero_pool *pool,
+				   unsigned long rate)
+{
+	u64 gap_ns = NSEC_PER_SEC / rate;
+	u64 period_ns = (u64)rate_period_ms * NSEC_PER_MSEC;
+	struct prezero_pool_stats s0, s1;
+	unsigned long zeroed0, zeroed1, n = 0;
+	u64 busy0, busy1, busy, permille, now, start, next;
+	cycles_t c, cycles = 0;
+	struct page *page;
+
+	wait_stock_full(pool);
+	prezero_pool_stats_sum(pool, &s0, &zeroed0, &busy0);
+
+	start = next = local_clock();
+	do {
+		c = get_cycles();
+		page = prezero_pool_alloc(pool, GFP_ATOMIC);
+		cycles += get_cycles() - c;
+		if (unlikely(!page))
+			break;
+		put_page(page);
+		n++;
+
+		/* Pacing, busy wait to keep control of the rate */
+		next += gap_ns;
+		while ((now = local_clock()) < next)
+			cpu_relax();
+		if (need_resched())
+			cond_resched();
+	} while (now - start < period_ns);
+
+	prezero_pool_stats_sum(pool, &s1, &zeroed1, &busy1);
+	busy = busy1 - busy0;
+	permille = div64_u64(busy * 1000, now - start);
+
+	pr_info("Rate:%lu pages/sec consumed:%lu ave %llu cycles per-get"
+		" hit:%lu miss:%lu worker zeroed:%lu busy %llu us"
+		" (CPU %llu.%01llu%%)\n",
+		rate, n, n ? (u64)cycles / n : 0,
+		s1.hit - s0.hit, s1.miss - s0.miss, zeroed1 - zeroed0,
+		div_u64(busy, NSEC_PER_USEC), permille / 10, permille % 10);
+}
+
+void noinline run_bench_inline_zero(uint32_t loops)
+{
+	run_or_return(bit_run_bench_inline_zero);
+	time_bench_loop(loops, 0, "alloc_page_GFP_ZERO",
+			NULL, time_alloc_page_zero);
+}
+
+void noinline run_bench_prezero_pool(struct prezero_pool *pool)
+{
+	run_or_return(bit_run_bench_prezero_pool);
+
+	/* Measure only the hit case, stay within a full stock */
+	if (!wait_stock_full(pool))
+		return;
+	time_bench_loop(pool_size - PREZERO_POOL_BULK, 0,
+			"prezero_pool_alloc", pool, time_prezero_pool_alloc);
+}
+
+void noinline run_bench_consumption_rates(struct prezero_pool *pool)
+{
+	static const unsigned long rates[] = {
+		10000, 100000, 250000, 500000, 1000000, 2000000 };
+	int i;
+
+	run_or_return(bit_run_bench_consumption_rates);
+
+	for (i = 0; i < ARRAY_SIZE(rates); i++)
+		bench_consumption_rate(pool, rates[i]);
+}
+
+static int __init page_bench08_module_init(void)
+{
+	struct prezero_pool *pool;
+
+	if (verbose)
+		pr_info("Loaded\n");
+
+	if (pool_size < 2048) {
+		pr_err("pool_size(%d) too small for timing (min 2048)\n",
+		       pool_size);
+		return -EINVAL;
+	}
+
+#ifdef CONFIG_DEBUG_PREEMPT
+	pr_warn("WARN: CONFIG_DEBUG_PREEMPT is enabled: this affect results\n");
+#endif
+	run_bench_inline_zero(100000);
+
+	pool = prezero_pool_create(pool_size, pool_size / 2,
+				   clear_nt ? PREZERO_CLEAR_NT :
+					      PREZERO_CLEAR_PAGE);
+	if (!pool)
+		return -ENOMEM;
+
+	run_bench_prezero_pool(pool);
+	run_bench_consumption_rates(pool);
+
+	prezero_pool_destroy(pool);
+	return 0;
+}
+module_init(page_bench08_module_init);
+
+static void __exit page_bench08_module_exit(void)
+{
+	if (verbose)
+		pr_info("Unloaded\n");
+}
+module_exit(page_bench08_module_exit);
+
+MODULE_DESCRIPTION("Benchmarking pre-zeroed page pool");
+MODULE_AUTHOR("Jesper Dangaard Brouer <netoptimizer@brouer.com>");
+MODULE_LICENSE("GPL");
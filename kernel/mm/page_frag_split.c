@@ -0,0 +1,146 @@
+/*
+ * page_frag_split - split high-order pages into packet buffers
+ *
+ * Copyright (C) 2017, Red Hat, Inc., Jesper Dangaard Brouer
+ *  for licensing details see kernel-base/COPYING
+ */
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/module.h>
+#include <linux/mm.h>
+#include <linux/gfp.h>
+#include <linux/export.h>
+#include <linux/topology.h>
+#include <linux/page_frag_split.h>
+
+void page_frag_split_init(struct page_frag_split *pfs, unsigned int order,
+			  gfp_t gfp_mask)
+{
+	memset(pfs, 0, sizeof(*pfs));
+	pfs->order = order;
+	pfs->size  = PAGE_SIZE << order;
+	pfs->gfp_mask = gfp_mask;
+	if (order)
+		pfs->gfp_mask |= __GFP_COMP;
+}
+EXPORT_SYMBOL(page_frag_split_init);
+
+/* Drop the references (bias) still owned by the allocator.  The page
+ * is freed when the last outstanding fragment is put.
+ */
+static void __page_frag_split_release(struct page_frag_split *pfs)
+{
+	struct page *page = pfs->page;
+
+	page_ref_sub(page, pfs->pagecnt_bias - 1);
+	put_page(page);
+	pfs->page = NULL;
+}
+
+void page_frag_split_drain(struct page_frag_split *pfs)
+{
+	if (pfs->page)
+		__page_frag_split_release(pfs);
+	pfs->offset = 0;
+	pfs->pagecnt_bias = 0;
+}
+EXPORT_SYMBOL(page_frag_split_drain);
+
+/* Get a new page, or recycle the current one if every fragment
+ * handed out from it has already been returned.
+ */
+static bool page_frag_split_new_page(struct page_frag_split *pfs)
+{
+	struct page *page = pfs->page;
+
+	/* Recycle: our bias is the only reference left.  This cannot
+	 * race, as no-one else can get a new reference to the page.
+	 */
+	if (page && page_ref_count(page) == pfs->pagecnt_bias &&
+	    !pfs->pfmemalloc && page_to_nid(page) == numa_mem_id()) {
+		page_ref_add(page, pfs->size + 1 - pfs->pagecnt_bias);
+		pfs->pagecnt_bias = pfs->size + 1;
+		pfs->offset = pfs->size;
+		pfs->pages_recycle++;
+		return true;
+	}
+
+	if (page)
+		__page_frag_split_release(pfs);
+
+	page = alloc_pages(pfs->gfp_mask | __GFP_NOWARN | __GFP_NORETRY,
+			   pfs->order);
+	if (unlikely(!page)) {
+		pfs->offset = 0;
+		pfs->pagecnt_bias = 0;
+		return false;
+	}
+	pfs->pages_alloc++;
+
+	/* Even with one-byte frags, bias can never reach zero */
+	page_ref_add(page, pfs->size);
+	pfs->page = page;
+	pfs->pagecnt_bias = pfs->size + 1;
+	pfs->pfmemalloc = page_is_pfmemalloc(page);
+	pfs->offset = pfs->size;
+	return true;
+}
+
+void *__page_frag_split_refill(struct page_frag_split *pfs,
+			       unsigned int fragsz)
+{
+	if (unlikely(fragsz > pfs->size)) {
+		WARN_ONCE(1, "%s() fragsz(%u) larger than page(%u)\n",
+			  __func__, fragsz, pfs->size);
+		return NULL;
+	}
+	if (!page_frag_split_new_page(pfs))
+		return NULL;
+
+	pfs->offset -= fragsz;
+	pfs->pagecnt_bias--;
+	return page_address(pfs->page) + pfs->offset;
+}
+EXPORT_SYMBOL(__page_frag_split_refill);
+
+/* Bulk handout of n fragments.  The number of fragments left in the
+ * current page is calculated once, which avoid the per fragment
+ * boundary check and bias update.
+ *
+ * Returns number of fragments stored in frags[], which is only less
+ * than n if the page allocator failed.
+ */
+int page_frag_split_alloc_bulk(struct page_frag_split *pfs,
+			       unsigned int fragsz, void **frags, int n)
+{
+	int i = 0;
+
+	if (unlikely(!fragsz || fragsz > pfs->size))
+		return 0;
+
+	while (i < n) {
+		int avail = pfs->offset / fragsz;
+		int cnt = min(avail, n - i);
+		void *va;
+		int j;
+
+		if (!cnt) {
+			if (!page_frag_split_new_page(pfs))
+				break;
+			continue;
+		}
+
+		va = page_address(pfs->page);
+		for (j = 0; j < cnt; j++) {
+			pfs->offset -= fragsz;
+			frags[i++] = va + pfs->offset;
+		}
+		pfs->pagecnt_bias -= cnt;
+	}
+	return i;
+}
+EXPORT_SYMBOL(page_frag_split_alloc_bulk);
+
+MODULE_DESCRIPTION("Split high-order pages into packet buffer fragments");
+MODULE_AUTHOR("Jesper Dangaard Brouer <netoptimizer@brouer.com>");
+MODULE_LICENSE("GPL");
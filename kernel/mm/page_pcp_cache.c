@@ -0,0 +1,161 @@
+/*
+ * page_pcp_cache - per CPU cache for high-order pages
+ *
+ * Copyright (C) 2017, Red Hat, Inc., Jesper Dangaard Brouer
+ *  for licensing details see kernel-base/COPYING
+ */
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/module.h>
+#include <linux/mm.h>
+#include <linux/gfp.h>
+#include <linux/slab.h>
+#include <linux/export.h>
+#include <linux/percpu.h>
+#include <linux/page_pcp_cache.h>
+
+static void page_pcp_cache_free_stack(struct page_pcp_cache_stack *s,
+				      unsigned int order)
+{
+	while (s->count)
+		__free_pages(s->pages[--s->count], order);
+}
+
+void page_pcp_cache_destroy(struct page_pcp_cache *pcc)
+{
+	int cpu, i;
+
+	if (pcc->percpu) {
+		for_each_possible_cpu(cpu) {
+			struct page_pcp_cache_percpu *c =
+				per_cpu_ptr(pcc->percpu, cpu);
+
+			for (i = 0; i < PAGE_PCP_CACHE_NR_ORDERS; i++)
+				page_pcp_cache_free_stack(&c->stack[i],
+					i + PAGE_PCP_CACHE_MIN_ORDER);
+		}
+		free_percpu(pcc->percpu);
+	}
+	kfree(pcc);
+}
+EXPORT_SYMBOL(page_pcp_cache_destroy);
+
+struct page_pcp_cache *
+page_pcp_cache_create(unsigned int high, unsigned int batch, gfp_t gfp_mask)
+{
+	struct page_pcp_cache *pcc;
+
+	/* Validate constraints */
+	if (batch == 0 || batch > high) {
+		pr_err("%s() batch(%u) must be in range 1..high(%u)\n",
+		       __func__, batch, high);
+		return NULL;
+	}
+	if (high > PAGE_PCP_CACHE_SIZE) {
+		pr_err("%s() high(%u) too big, max %d\n",
+		       __func__, high, PAGE_PCP_CACHE_SIZE);
+		return NULL;
+	}
+	/* Refill happens with preemption/BH disabled */
+#ifdef __GFP_WAIT
+	if (gfp_mask & __GFP_WAIT) {
+#else
+	if (gfp_mask & __GFP_DIRECT_RECLAIM) {
+#endif
+		pr_err("%s() gfp_mask cannot allow sleeping\n", __func__);
+		return NULL;
+	}
+
+	pcc = kzalloc(sizeof(*pcc), GFP_KERNEL);
+	if (!pcc)
+		return NULL;
+	pcc->high  = high;
+	pcc->batch = batch;
+	/* Important to set: __GFP_COMP for compound pages */
+	pcc->gfp_mask = gfp_mask | __GFP_COMP;
+
+	pcc->percpu = alloc_percpu(struct page_pcp_cache_percpu);
+	if (pcc->percpu == NULL) {
+		pr_err("%s() failed to alloc percpu\n", __func__);
+		page_pcp_cache_destroy(pcc);
+		return NULL;
+	}
+
+	return pcc;
+}
+EXPORT_SYMBOL(page_pcp_cache_create);
+
+/* Called when the per CPU stack runs empty.  Return one page to the
+ * caller, and refill the stack with (batch - 1) pages.
+ *
+ * There is no bulk API for order>0 pages in the buddy allocator,
+ * thus this still cost a zone->lock per page, but the cost is now
+ * only paid when the stack runs empty, instead of for every alloc.
+ *
+ * Caller must assure this is called in an preemptive safe context.
+ */
+struct page *__page_pcp_cache_refill(struct page_pcp_cache *pcc,
+				     struct page_pcp_cache_stack *s,
+				     unsigned int order)
+{
+	int nid = numa_mem_id();
+	struct page *page;
+	int i;
+
+	page = alloc_pages_node(nid, pcc->gfp_mask, order);
+	if (unlikely(!page))
+		return NULL;
+
+	/* Opportunistic refill, don't warn if memory gets tight */
+	for (i = 1; i < pcc->batch; i++) {
+		struct page *p;
+
+		p = alloc_pages_node(nid, pcc->gfp_mask | __GFP_NOWARN, order);
+		if (unlikely(!p))
+			break;
+		s->pages[s->count++] = p;
+	}
+	return page;
+}
+EXPORT_SYMBOL(__page_pcp_cache_refill);
+
+/* Called when the per CPU stack reached "high" mark.  Return "batch"
+ * pages to the buddy allocator, one __free_pages() (and zone->lock)
+ * per page.  The pages at the bottom of the stack are released, as
+ * they are the most cache-cold.
+ *
+ * Caller must assure this is called in an preemptive safe context.
+ */
+void __page_pcp_cache_drain(struct page_pcp_cache *pcc,
+			    struct page_pcp_cache_stack *s,
+			    unsigned int order)
+{
+	unsigned int n = min(pcc->batch, s->count);
+	unsigned int i;
+
+	for (i = 0; i < n; i++)
+		__free_pages(s->pages[i], order);
+
+	s->count -= n;
+	memmove(&s->pages[0], &s->pages[n], s->count * sizeof(s->pages[0]));
+}
+EXPORT_SYMBOL(__page_pcp_cache_drain);
+
+/* API users can choose to use "__" prefixed versions for inlining */
+struct page *page_pcp_cache_alloc(struct page_pcp_cache *pcc,
+				  unsigned int order)
+{
+	return __page_pcp_cache_alloc(pcc, order);
+}
+EXPORT_SYMBOL(page_pcp_cache_alloc);
+
+void page_pcp_cache_free(struct page_pcp_cache *pcc, struct page *page,
+			 unsigned int order)
+{
+	__page_pcp_cache_free(pcc, page, order);
+}
+EXPORT_SYMBOL(page_pcp_cache_free);
+
+MODULE_DESCRIPTION("Per CPU cache for high-order pages");
+MODULE_AUTHOR("Jesper Dangaard Brouer <netoptimizer@brouer.com>");
+MODULE_LICENSE("GPL");
@@ -0,0 +1,216 @@
+/*
+ * pkt_arena - arena backed fixed-size packet buffer allocator
+ *
+ * Copyright (C) 2017, Red Hat, Inc., Jesper Dangaard Brouer
+ *  for licensing details see kernel-base/COPYING
+ */
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/module.h>
+#include <linux/mm.h>
+#include <linux/gfp.h>
+#include <linux/slab.h>
+#include <linux/export.h>
+#include <linux/percpu.h>
+#include <linux/log2.h>
+#include <linux/cache.h>
+#include <linux/pkt_arena.h>
+
+void pkt_arena_destroy(struct pkt_arena *arena)
+{
+	int i, cpu;
+
+	/* Slots are not individually freed, only queues and chunks */
+	if (arena->percpu) {
+		for_each_possible_cpu(cpu) {
+			struct pkt_arena_percpu *c =
+				per_cpu_ptr(arena->percpu, cpu);
+
+			if (c->localq)
+				alf_queue_free(c->localq);
+		}
+		free_percpu(arena->percpu);
+	}
+	if (arena->sharedq)
+		alf_queue_free(arena->sharedq);
+
+	if (arena->chunks) {
+		for (i = 0; i < arena->nr_chunks; i++) {
+			if (arena->chunks[i])
+				__free_pages(arena->chunks[i],
+					     PKT_ARENA_CHUNK_ORDER);
+		}
+		kfree(arena->chunks);
+	}
+	kfree(arena);
+}
+EXPORT_SYMBOL(pkt_arena_destroy);
+
+/* Carve chunk into slots, and make them available in sharedq */
+static bool pkt_arena_add_chunk(struct pkt_arena *arena, struct page *chunk)
+{
+	void *slots[PKT_ARENA_BULK];
+	void *base = page_address(chunk);
+	int i, n = 0;
+
+	for (i = 0; i < arena->slots_per_chunk; i++) {
+		slots[n++] = base + (i * arena->slot_size);
+		if (n == PKT_ARENA_BULK || i == arena->slots_per_chunk - 1) {
+			/* Not visible yet, but use MP version to be safe */
+			if (alf_mp_enqueue(arena->sharedq, slots, n) != n)
+				return false;
+			n = 0;
+		}
+	}
+	return true;
+}
+
+struct pkt_arena *pkt_arena_create(unsigned int slot_size,
+				   unsigned int nr_chunks,
+				   unsigned int localq_sz)
+{
+	struct pkt_arena *arena;
+	unsigned int sharedq_sz;
+	int i, cpu;
+
+	slot_size = ALIGN(slot_size, SMP_CACHE_BYTES);
+
+	/* Validate constraints, e.g. due to bulking */
+	if (!slot_size || slot_size > PKT_ARENA_CHUNK_SIZE) {
+		pr_err("%s() slot_size(%u) invalid\n", __func__, slot_size);
+		return NULL;
+	}
+	if (localq_sz < PKT_ARENA_BULK || !is_power_of_2(localq_sz)) {
+		pr_err("%s() localq size(%u) must be power-of-2 and >= %d\n",
+		       __func__, localq_sz, PKT_ARENA_BULK);
+		return NULL;
+	}
+	if (!nr_chunks) {
+		pr_err("%s() need at least one chunk\n", __func__);
+		return NULL;
+	}
+
+	arena = kzalloc(sizeof(*arena), GFP_KERNEL);
+	if (!arena)
+		return NULL;
+	arena->slot_size = slot_size;
+	arena->slots_per_chunk = PKT_ARENA_CHUNK_SIZE / slot_size;
+	arena->nr_slots = arena->slots_per_chunk * nr_chunks;
+
+	/* sharedq must be able to hold every slot, thus free to
+	 * sharedq can never fail.  alf_queue is limited to 65536.
+	 */
+	sharedq_sz = roundup_pow_of_two(arena->nr_slots);
+	if (sharedq_sz > 65536) {
+		pr_err("%s() too many slots(%u) max 65536\n",
+		       __func__, arena->nr_slots);
+		goto err;
+	}
+	arena->sharedq = alf_queue_alloc(sharedq_sz, GFP_KERNEL);
+	if (IS_ERR_OR_NULL(arena->sharedq)) {
+		arena->sharedq = NULL;
+		goto err;
+	}
+
+	arena->chunks = kcalloc(nr_chunks, sizeof(*arena->chunks), GFP_KERNEL);
+	if (!arena->chunks)
+		goto err;
+	arena->nr_chunks = nr_chunks;
+
+	for (i = 0; i < nr_chunks; i++) {
+		struct page *chunk;
+
+		chunk = alloc_pages(GFP_KERNEL | __GFP_COMP | __GFP_NOWARN,
+				    PKT_ARENA_CHUNK_ORDER);
+		if (!chunk) {
+			pr_err("%s() failed alloc chunk %d (order:%d)\n",
+			       __func__, i, PKT_ARENA_CHUNK_ORDER);
+			goto err;
+		}
+		arena->chunks[i] = chunk;
+		if (!pkt_arena_add_chunk(arena, chunk))
+			goto err;
+	}
+
+	arena->percpu = alloc_percpu(struct pkt_arena_percpu);
+	if (!arena->percpu)
+		goto err;
+
+	for_each_possible_cpu(cpu) {
+		struct pkt_arena_percpu *c = per_cpu_ptr(arena->percpu, cpu);
+
+		c->localq = alf_queue_alloc(localq_sz, GFP_KERNEL);
+		if (IS_ERR_OR_NULL(c->localq)) {
+			c->localq = NULL;
+			pr_err("%s() failed alloc localq(sz:%u) on cpu:%d\n",
+			       __func__, localq_sz, cpu);
+			goto err;
+		}
+	}
+	return arena;
+err:
+	pkt_arena_destroy(arena);
+	return NULL;
+}
+EXPORT_SYMBOL(pkt_arena_create);
+
+/* This function is called when the localq runs out-of slots.
+ * Thus, localq is refilled (enq) with slots (deq) from sharedq.
+ *
+ * Returns NULL if the arena is exhausted.
+ */
+void *__pkt_arena_alloc_from_sharedq(struct pkt_arena *arena,
+				     struct alf_queue *localq)
+{
+	void *slots[PKT_ARENA_BULK]; /* on stack variable */
+	int num;
+
+	/* Costs atomic "cmpxchg", but amortize cost by bulk dequeue */
+	num = alf_mc_dequeue(arena->sharedq, slots, PKT_ARENA_BULK);
+	if (unlikely(num == 0))
+		return NULL;
+
+	if (num > 1) {
+		/* Refill localq, should be empty, must succeed */
+		if (alf_sp_enqueue(localq, &slots[1], num - 1) == 0)
+			BUG();
+	}
+	return slots[0];
+}
+EXPORT_SYMBOL(__pkt_arena_alloc_from_sharedq);
+
+/* This function is called when the localq is full.  Slots from
+ * localq are returned in bulk to sharedq, which is sized to hold all
+ * slots, thus cannot be full.
+ */
+void __pkt_arena_free_to_sharedq(struct pkt_arena *arena, void *slot,
+				 struct alf_queue *localq)
+{
+	void *slots[PKT_ARENA_BULK]; /* on stack variable */
+	int num_deq;
+
+	slots[0] = slot;
+	num_deq = alf_sc_dequeue(localq, &slots[1], PKT_ARENA_BULK - 1);
+	num_deq++; /* count first 'slot' */
+
+	if (alf_mp_enqueue(arena->sharedq, slots, num_deq) != num_deq)
+		BUG(); /* Indicate double free of slots */
+}
+EXPORT_SYMBOL(__pkt_arena_free_to_sharedq);
+
+/* API users can choose to use "__" prefixed versions for inlining */
+void *pkt_arena_alloc(struct pkt_arena *arena)
+{
+	return __pkt_arena_alloc(arena);
+}
+EXPORT_SYMBOL(pkt_arena_alloc);
+
+void pkt_arena_free(struct pkt_arena *arena, void *slot)
+{
+	__pkt_arena_free(arena, slot);
+}
+EXPORT_SYMBOL(pkt_arena_free);
+
+MODULE_DESCRIPTION("Arena backed fixed-size packet buffer allocator");
+MODULE_AUTHOR("Jesper Dangaard Brouer <netoptimizer@brouer.com>");
+MODULE_LICENSE("GPL");
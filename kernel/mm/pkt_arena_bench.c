@@ -0,0 +1,311 @@
+/*
+ * Benchmarking pkt_arena against qmempool-over-slab and page allocator
+ *  - ns per alloc+free with N outstanding packet buffers
+ *  - dTLB misses per buffer, read via perf event counters
+ *
+ * Each outstanding buffer gets a small write (like a packet header),
+ * which is what touch the TLB.  Increase nr_outstanding to spread
+ * buffers over more pages than the dTLB can cover.
+ */
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/gfp.h>
+#include <linux/perf_event.h>
+#include <linux/math64.h>
+#include <linux/time_bench.h>
+#include <linux/qmempool.h>
+#include <linux/pkt_arena.h>
+
+static int verbose=1;
+
+/* Quick and dirty way to unselect some of the benchmark tests, by
+ * encoding this in a module parameter flag.  This is useful when
+ * wanting to perf benchmark a specific benchmark test.
+ *
+ * Hint: Bash shells support writing binary number like: $((2#101010))
+ * Use like:
+ *  modprobe pkt_arena_bench run_flags=$((2#1000)) nr_outstanding=8192
+ */
+static unsigned long run_flags = 0xFFFFFFFF;
+module_param(run_flags, ulong, 0);
+MODULE_PARM_DESC(run_flags, "Hack way to limit bench to run");
+/* Count the bit number from the enum */
+enum benchmark_bit {
+	bit_run_bench_kmem_cache,
+	bit_run_bench_qmempool,
+	bit_run_bench_alloc_page,
+	bit_run_bench_pkt_arena,
+};
+#define bit(b)	(1 << (b))
+#define run_or_return(b) do { if (!(run_flags & (bit(b)))) return; } while (0)
+
+static int slot_size = 2048;
+module_param(slot_size, uint, 0);
+MODULE_PARM_DESC(slot_size, "Packet buffer size");
+
+static int nr_outstanding = 4096;
+module_param(nr_outstanding, uint, 0);
+MODULE_PARM_DESC(nr_outstanding, "Buffers allocated before freeing them");
+
+static int nr_chunks = 8;
+module_param(nr_chunks, uint, 0);
+MODULE_PARM_DESC(nr_chunks, "Arena 2MB chunks to reserve");
+
+static int loops = 200;
+module_param(loops, uint, 0);
+MODULE_PARM_DESC(loops, "Rounds of alloc+free nr_outstanding buffers");
+
+enum bench_type {
+	KMEM_CACHE = 1,
+	QMEMPOOL,
+	ALLOC_PAGE,
+	PKT_ARENA,
+};
+
+struct bench_ctx {
+	enum bench_type type;
+	struct kmem_cache *slab;
+	struct qmempool *qpool;
+	struct pkt_arena *arena;
+	void **elems;
+
+	/* dTLB counters, zero if PMU not available */
+	struct perf_event *dtlb_load;
+	struct perf_event *dtlb_store;
+	u64 dtlb_misses;
+};
+
+static u64 read_dtlb(struct bench_ctx *ctx)
+{
+	return time_bench_perf_event_read(ctx->dtlb_load) +
+		time_bench_perf_event_read(ctx->dtlb_store);
+}
+
+static __always_inline void *bench_alloc(struct bench_ctx *ctx,
+					 enum bench_type type)
+{
+	struct page *page;
+
+	switch (type) {
+	case KMEM_CACHE:
+		return kmem_cache_alloc(ctx->slab, GFP_ATOMIC);
+	case QMEMPOOL:
+		return __qmempool_alloc(ctx->qpool, GFP_ATOMIC);
+	case ALLOC_PAGE:
+		page = alloc_page(GFP_ATOMIC);
+		return page ? page_address(page) : NULL;
+	case PKT_ARENA:
+		return __pkt_arena_alloc(ctx->arena);
+	}
+	return NULL;
+}
+
+static __always_inline void bench_free(struct bench_ctx *ctx,
+				       enum bench_type type, void *elem)
+{
+	switch (type) {
+	case KMEM_CACHE:
+		kmem_cache_free(ctx->slab, elem);
+		break;
+	case QMEMPOOL:
+		__qmempool_free(ctx->qpool, elem);
+		break;
+	case ALLOC_PAGE:
+		free_page((unsigned long)elem);
+		break;
+	case PKT_ARENA:
+		__pkt_arena_free(ctx->arena, elem);
+		break;
+	}
+}
+
+/* Allocate N buffers, write packet header area, then free N buffers */
+static __always_inline int __time_alloc_pattern(
+	struct time_bench_record *rec, void *data, enum bench_type type)
+{
+	struct bench_ctx *ctx = data;
+	uint64_t loops_cnt = 0;
+	u64 dtlb_start;
+	int i, n, j;
+
+	dtlb_start = read_dtlb(ctx);
+	time_bench_start(rec);
+	/** Loop to measure **/
+	for (i = 0; i < rec->loops; i++) {
+
+		for (n = 0; n < nr_outstanding; n++) {
+			ctx->elems[n] = bench_alloc(ctx, type);
+			if (unlikely(!ctx->elems[n]))
+				goto out;
+			/* Touch the buffer like a packet header */
+			*(u64 *)ctx->elems[n] = n;
+		}
+
+		barrier(); /* compiler barrier */
+
+		for (n = 0; n < nr_outstanding; n++) {
+			bench_free(ctx, type, ctx->elems[n]);
+			loops_cnt++;
+		}
+	}
+	time_bench_stop(rec, loops_cnt);
+	ctx->dtlb_misses = read_dtlb(ctx) - dtlb_start;
+	return loops_cnt;
+out:
+	time_bench_stop(rec, loops_cnt);
+	pr_err("%s() type:%d alloc failed at elem %d\n", __func__, type, n);
+	for (j = 0; j < n; j++)
+		bench_free(ctx, type, ctx->elems[j]);
+	return 0;
+}
+
+static int time_kmem_cache(struct time_bench_record *rec, void *data)
+{
+	return __time_alloc_pattern(rec, data, KMEM_CACHE);
+}
+
+static int time_qmempool(struct time_bench_record *rec, void *data)
+{
+	return __time_alloc_pattern(rec, data, QMEMPOOL);
+}
+
+static int time_alloc_page(struct time_bench_record *rec, void *data)
+{
+	return __time_alloc_pattern(rec, data, ALLOC_PAGE);
+}
+
+static int time_pkt_arena(struct time_bench_record *rec, void *data)
+{
+	return __time_alloc_pattern(rec, data, PKT_ARENA);
+}
+
+static void print_dtlb(struct bench_ctx *ctx, const char *txt)
+{
+	u64 ops = (u64)loops * nr_outstanding;
+	u64 permille;
+
+	if (!ctx->dtlb_load && !ctx->dtlb_store)
+		return;
+	permille = div64_u64(ctx->dtlb_misses * 1000, ops);
+	pr_info("%s: dTLB misses %llu (%llu.%03llu per buffer)\n",
+		txt, ctx->dtlb_misses, permille / 1000, permille % 1000);
+}
+
+static void bench_run(struct bench_ctx *ctx, char *txt,
+		      int (*func)(struct time_bench_record *rec, void *data))
+{
+	ctx->dtlb_misses = 0;
+	time_bench_loop(loops, 0, txt, ctx, func);
+	print_dtlb(ctx, txt);
+}
+
+void noinline run_bench_kmem_cache(struct bench_ctx *ctx)
+{
+	run_or_return(bit_run_bench_kmem_cache);
+
+	ctx->slab = kmem_cache_create("pkt_arena_bench", slot_size, 0,
+				      SLAB_HWCACHE_ALIGN, NULL);
+	if (!ctx->slab)
+		return;
+	bench_run(ctx, "kmem_cache", time_kmem_cache);
+	kmem_cache_destroy(ctx->slab);
+	ctx->slab = NULL;
+}
+
+void noinline run_bench_qmempool(struct bench_ctx *ctx)
+{
+	run_or_return(bit_run_bench_qmempool);
+
+	ctx->slab = kmem_cache_create("pkt_arena_bench_q", slot_size, 0,
+				      SLAB_HWCACHE_ALIGN, NULL);
+	if (!ctx->slab)
+		return;
+	ctx->qpool = qmempool_create(32, 1024, 0, ctx->slab, GFP_ATOMIC);
+	if (ctx->qpool) {
+		bench_run(ctx, "qmempool-over-slab", time_qmempool);
+		qmempool_destroy(ctx->qpool);
+		ctx->qpool = NULL;
+	}
+	kmem_cache_destroy(ctx->slab);
+	ctx->slab = NULL;
+}
+
+void noinline run_bench_alloc_page(struct bench_ctx *ctx)
+{
+	run_or_return(bit_run_bench_alloc_page);
+	bench_run(ctx, "alloc_page", time_alloc_page);
+}
+
+void noinline run_bench_pkt_arena(struct bench_ctx *ctx)
+{
+	run_or_return(bit_run_bench_pkt_arena);
+
+	ctx->arena = pkt_arena_create(slot_size, nr_chunks, 32);
+	if (!ctx->arena)
+		return;
+	if (ctx->arena->nr_slots < nr_outstanding) {
+		pr_err("Arena too small slots:%u < nr_outstanding:%d\n",
+		       ctx->arena->nr_slots, nr_outstanding);
+	} else {
+		bench_run(ctx, "pkt_arena", time_pkt_arena);
+	}
+	pkt_arena_destroy(ctx->arena);
+	ctx->arena = NULL;
+}
+
+static int __init pkt_arena_bench_module_init(void)
+{
+	struct bench_ctx ctx;
+
+	if (verbose)
+		pr_info("Loaded\n");
+
+	if (slot_size > PAGE_SIZE) {
+		pr_err("slot_size(%d) must be <= PAGE_SIZE\n", slot_size);
+		return -EINVAL;
+	}
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.elems = kvmalloc_array(nr_outstanding, sizeof(void *), GFP_KERNEL);
+	if (!ctx.elems)
+		return -ENOMEM;
+
+	/* Missing PMU support (e.g. guests) only disable dTLB stats */
+	ctx.dtlb_load = time_bench_perf_event_create(PERF_TYPE_HW_CACHE,
+		TIME_BENCH_HW_CACHE(PERF_COUNT_HW_CACHE_DTLB,
+				    PERF_COUNT_HW_CACHE_OP_READ,
+				    PERF_COUNT_HW_CACHE_RESULT_MISS));
+	ctx.dtlb_store = time_bench_perf_event_create(PERF_TYPE_HW_CACHE,
+		TIME_BENCH_HW_CACHE(PERF_COUNT_HW_CACHE_DTLB,
+				    PERF_COUNT_HW_CACHE_OP_WRITE,
+				    PERF_COUNT_HW_CACHE_RESULT_MISS));
+	if (!ctx.dtlb_load && !ctx.dtlb_store)
+		pr_warn("No dTLB perf counters, only timing results\n");
+
+#ifdef CONFIG_DEBUG_PREEMPT
+	pr_warn("WARN: CONFIG_DEBUG_PREEMPT is enabled: this affect results\n");
+#endif
+	run_bench_kmem_cache(&ctx);
+	run_bench_qmempool(&ctx);
+	run_bench_alloc_page(&ctx);
+	run_bench_pkt_arena(&ctx);
+
+	time_bench_perf_event_release(ctx.dtlb_load);
+	time_bench_perf_event_release(ctx.dtlb_store);
+	kvfree(ctx.elems);
+	return 0;
+}
+module_init(pkt_arena_bench_module_init);
+
+static void __exit pkt_arena_bench_module_exit(void)
+{
+	if (verbose)
+		pr_info("Unloaded\n");
+}
+module_exit(pkt_arena_bench_module_exit);
+
+MODULE_DESCRIPTION("Benchmarking pkt_arena dTLB behavior");
+MODULE_AUTHOR("Jesper Dangaard Brouer <netoptimizer@brouer.com>");
+MODULE_LICENSE("GPL");
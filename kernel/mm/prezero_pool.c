@@ -0,0 +1,260 @@
+/*
+ * prezero_pool - pool of pre-zeroed pages
+ *
+ * Copyright (C) 2017, Red Hat, Inc., Jesper Dangaard Brouer
+ *  for licensing details see kernel-base/COPYING
+ */
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/module.h>
+#include <linux/mm.h>
+#include <linux/gfp.h>
+#include <linux/slab.h>
+#include <linux/export.h>
+#include <linux/kthread.h>
+#include <linux/sched.h>
+#include <linux/wait.h>
+#include <linux/nodemask.h>
+#include <linux/log2.h>
+#include <linux/prezero_pool.h>
+
+/* Clear page with non-temporal stores, which bypass the CPU cache.
+ * Background zeroing should not evict the cache-lines the rest of
+ * the system is working on.
+ */
+void prezero_clear_page_nt(void *page)
+{
+#ifdef CONFIG_X86_64
+	int i;
+
+	for (i = 0; i < PAGE_SIZE/64; i++) {
+		__asm__ __volatile__(
+		"  movnti %1, (%0)\n"
+		"  movnti %1, 8(%0)\n"
+		"  movnti %1, 16(%0)\n"
+		"  movnti %1, 24(%0)\n"
+		"  movnti %1, 32(%0)\n"
+		"  movnti %1, 40(%0)\n"
+		"  movnti %1, 48(%0)\n"
+		"  movnti %1, 56(%0)\n"
+		: : "r" (page), "r" (0UL) : "memory");
+		page += 64;
+	}
+	/* NT-stores are weakly ordered, SFENCE before page is visible */
+	wmb();
+#else
+	clear_page(page);
+#endif
+}
+EXPORT_SYMBOL(prezero_clear_page_nt);
+
+static void prezero_clear(struct prezero_pool *pool, struct page *page)
+{
+	if (pool->clear == PREZERO_CLEAR_NT)
+		prezero_clear_page_nt(page_address(page));
+	else
+		clear_page(page_address(page));
+}
+
+static bool prezero_need_refill(struct prezero_pool_node *pn)
+{
+	return alf_queue_count(pn->stock) < pn->pool->low_wmark;
+}
+
+/* Refill the stock in bulks of PREZERO_POOL_BULK pages */
+static void prezero_pool_refill(struct prezero_pool_node *pn)
+{
+	struct prezero_pool *pool = pn->pool;
+	void *pages[PREZERO_POOL_BULK];
+	int i, n, num, state;
+	u64 start;
+
+	while (!kthread_should_stop() &&
+	       alf_queue_avail_space(pn->stock) >= PREZERO_POOL_BULK) {
+
+		start = local_clock();
+		for (n = 0; n < PREZERO_POOL_BULK; n++) {
+			struct page *page;
+
+			page = alloc_pages_node(pn->nid, GFP_KERNEL |
+						__GFP_THISNODE | __GFP_NOWARN, 0);
+			if (!page)
+				break;
+			prezero_clear(pool, page);
+			pages[n] = page;
+		}
+		pn->busy_ns += local_clock() - start;
+
+		/* Single producer, thus enqueue cannot fail.  Consumers
+		 * run in softirq, which must not interrupt the enqueue.
+		 */
+		state = __prezero_pool_preempt_disable();
+		num = alf_sp_enqueue(pn->stock, pages, n);
+		__prezero_pool_preempt_enable(state);
+		if (unlikely(num != n)) {
+			for (i = 0; i < n; i++)
+				__free_page(pages[i]);
+			break;
+		}
+		pn->pages_zeroed += n;
+
+		if (n < PREZERO_POOL_BULK) /* Node low on memory */
+			break;
+		cond_resched();
+	}
+}
+
+static int prezero_pool_kthread(void *arg)
+{
+	struct prezero_pool_node *pn = arg;
+
+	/* Lowest priority, zeroing is only done on otherwise idle time */
+	set_user_nice(current, MAX_NICE);
+
+	while (!kthread_should_stop()) {
+		wait_event_interruptible(pn->wait, prezero_need_refill(pn) ||
+					 kthread_should_stop());
+		prezero_pool_refill(pn);
+	}
+	return 0;
+}
+
+void __prezero_pool_kick(struct prezero_pool_node *pn)
+{
+	/* wq_has_sleeper() contains the needed barrier */
+	if (wq_has_sleeper(&pn->wait))
+		wake_up(&pn->wait);
+}
+EXPORT_SYMBOL(__prezero_pool_kick);
+
+/* Stock ran empty, fallback to zeroing inline */
+struct page *__prezero_pool_alloc_slow(struct prezero_pool *pool,
+				       gfp_t gfp_mask)
+{
+	this_cpu_inc(pool->stats->miss);
+	__prezero_pool_kick(pool->node[numa_mem_id()]);
+
+	return alloc_page(gfp_mask | __GFP_ZERO);
+}
+EXPORT_SYMBOL(__prezero_pool_alloc_slow);
+
+int prezero_pool_count(struct prezero_pool *pool, int nid)
+{
+	if (!pool->node[nid])
+		return 0;
+	return alf_queue_count(pool->node[nid]->stock);
+}
+EXPORT_SYMBOL(prezero_pool_count);
+
+static void prezero_pool_node_destroy(struct prezero_pool_node *pn)
+{
+	void *page;
+
+	if (pn->kthread)
+		kthread_stop(pn->kthread);
+
+	if (pn->stock) {
+		/* kthread stopped, safe to consume from any context */
+		while (alf_mc_dequeue(pn->stock, &page, 1) == 1)
+			__free_page(page);
+		alf_queue_free(pn->stock);
+	}
+	kfree(pn);
+}
+
+void prezero_pool_destroy(struct prezero_pool *pool)
+{
+	int nid;
+
+	if (pool->node) {
+		for_each_node(nid) {
+			if (pool->node[nid])
+				prezero_pool_node_destroy(pool->node[nid]);
+		}
+		kfree(pool->node);
+	}
+	free_percpu(pool->stats);
+	kfree(pool);
+}
+EXPORT_SYMBOL(prezero_pool_destroy);
+
+static struct prezero_pool_node *
+prezero_pool_node_create(struct prezero_pool *pool, int nid)
+{
+	struct prezero_pool_node *pn;
+
+	pn = kzalloc_node(sizeof(*pn), GFP_KERNEL, nid);
+	if (!pn)
+		return NULL;
+	pn->pool = pool;
+	pn->nid  = nid;
+	init_waitqueue_head(&pn->wait);
+
+	pn->stock = alf_queue_alloc(pool->size, GFP_KERNEL);
+	if (IS_ERR_OR_NULL(pn->stock)) {
+		pn->stock = NULL;
+		goto err;
+	}
+
+	pn->kthread = kthread_create_on_node(prezero_pool_kthread, pn, nid,
+					     "prezero/%d", nid);
+	if (IS_ERR(pn->kthread)) {
+		pn->kthread = NULL;
+		goto err;
+	}
+	set_cpus_allowed_ptr(pn->kthread, cpumask_of_node(nid));
+	wake_up_process(pn->kthread);
+	return pn;
+err:
+	prezero_pool_node_destroy(pn);
+	return NULL;
+}
+
+struct prezero_pool *prezero_pool_create(u32 size, u32 low_wmark,
+					 enum prezero_clear_method clear)
+{
+	struct prezero_pool *pool;
+	int nid;
+
+	/* Validate constraints, e.g. due to bulking */
+	if (!is_power_of_2(size) || size < (PREZERO_POOL_BULK * 2)) {
+		pr_err("%s() size(%u) must be power-of-2 and >= %d\n",
+		       __func__, size, PREZERO_POOL_BULK * 2);
+		return NULL;
+	}
+	if (!low_wmark || low_wmark > size - PREZERO_POOL_BULK) {
+		pr_err("%s() low_wmark(%u) out of range for size(%u)\n",
+		       __func__, low_wmark, size);
+		return NULL;
+	}
+
+	pool = kzalloc(sizeof(*pool), GFP_KERNEL);
+	if (!pool)
+		return NULL;
+	pool->size = size;
+	pool->low_wmark = low_wmark;
+	pool->clear = clear;
+
+	pool->stats = alloc_percpu(struct prezero_pool_stats);
+	pool->node = kcalloc(nr_node_ids, sizeof(*pool->node), GFP_KERNEL);
+	if (!pool->stats || !pool->node)
+		goto err;
+
+	/* A consumer on a memory-less node gets numa_mem_id() node */
+	for_each_node_state(nid, N_MEMORY) {
+		pool->node[nid] = prezero_pool_node_create(pool, nid);
+		if (!pool->node[nid]) {
+			pr_err("%s() failed to setup node:%d\n", __func__, nid);
+			goto err;
+		}
+	}
+	return pool;
+err:
+	prezero_pool_destroy(pool);
+	return NULL;
+}
+EXPORT_SYMBOL(prezero_pool_create);
+
+MODULE_DESCRIPTION("Pool of pre-zeroed pages with background zeroing");
+MODULE_AUTHOR("Jesper Dangaard Brouer <netoptimizer@brouer.com>");
+MODULE_LICENSE("GPL");
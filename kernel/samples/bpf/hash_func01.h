@@ -4,7 +4,11 @@
  * From: http://www.azillionmonkeys.com/qed/hash.html
  */
 
-#define get16bits(d) (*((const uint16_t *) (d)))
+/* Data is accessed via 16-bit loads, allow aliasing any type, else
+ * userspace compilers may optimize away stores to e.g. a u32 key.
+ */
+typedef uint16_t __attribute__((__may_alias__)) hash_u16_alias_t;
+#define get16bits(d) (*((const hash_u16_alias_t *) (d)))
 
 static __always_inline
 uint32_t SuperFastHash (const char *data, int len, uint32_t initval) {
@@ -18,7 +22,9 @@ uint32_t SuperFastHash (const char *data, int len, uint32_t initval) {
 	len >>= 2;
 
 	/* Main loop */
+#ifdef __clang__ /* also used by userspace, for identical hashing */
 #pragma clang loop unroll(full)
+#endif
 	for (;len > 0; len--) {
 		hash  += get16bits (data);
 		tmp    = (get16bits (data+2) << 11) ^ hash;
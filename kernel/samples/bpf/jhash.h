@@ -0,0 +1,81 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#ifndef _SAMPLES_JHASH_H
+#define _SAMPLES_JHASH_H
+
+/* Copy of jhash2() from include/linux/jhash.h, without the kernel
+ * headers it pulls in, usable from both _kern.c and userspace.
+ *
+ * Bob Jenkins' lookup3.c, May 2006, Public Domain.
+ */
+
+static inline __u32 jhash_rol32(__u32 word, unsigned int shift)
+{
+	return (word << shift) | (word >> ((-shift) & 31));
+}
+
+/* __jhash_mix -- mix 3 32-bit values reversibly. */
+#define __jhash_mix(a, b, c)			\
+{						\
+	a -= c;  a ^= jhash_rol32(c, 4);  c += b;	\
+	b -= a;  b ^= jhash_rol32(a, 6);  a += c;	\
+	c -= b;  c ^= jhash_rol32(b, 8);  b += a;	\
+	a -= c;  a ^= jhash_rol32(c, 16); c += b;	\
+	b -= a;  b ^= jhash_rol32(a, 19); a += c;	\
+	c -= b;  c ^= jhash_rol32(b, 4);  b += a;	\
+}
+
+/* __jhash_final - final mixing of 3 32-bit values (a,b,c) into c */
+#define __jhash_final(a, b, c)			\
+{						\
+	c ^= b; c -= jhash_rol32(b, 14);		\
+	a ^= c; a -= jhash_rol32(c, 11);		\
+	b ^= a; b -= jhash_rol32(a, 25);		\
+	c ^= b; c -= jhash_rol32(b, 16);		\
+	a ^= c; a -= jhash_rol32(c, 4);		\
+	b ^= a; b -= jhash_rol32(a, 14);		\
+	c ^= b; c -= jhash_rol32(b, 24);		\
+}
+
+/* An arbitrary initial parameter */
+#define JHASH_INITVAL		0xdeadbeef
+
+/* jhash2 - hash an array of u32's
+ * @k: the key which must be an array of u32's
+ * @length: the number of u32's in the key
+ * @initval: the previous hash, or an arbitray value
+ *
+ * Returns the hash value of the key.  Use a constant length from BPF,
+ * so the loop gets unrolled.
+ */
+static __always_inline __u32 jhash2(const __u32 *k, __u32 length,
+				    __u32 initval)
+{
+	__u32 a, b, c;
+
+	/* Set up the internal state */
+	a = b = c = JHASH_INITVAL + (length<<2) + initval;
+
+	/* Handle most of the key */
+	while (length > 3) {
+		a += k[0];
+		b += k[1];
+		c += k[2];
+		__jhash_mix(a, b, c);
+		length -= 3;
+		k += 3;
+	}
+
+	/* Handle the last 3 u32's */
+	switch (length) {
+	case 3: c += k[2];	/* fall through */
+	case 2: b += k[1];	/* fall through */
+	case 1: a += k[0];
+		__jhash_final(a, b, c);
+	case 0:	/* Nothing left to add */
+		break;
+	}
+
+	return c;
+}
+
+#endif /* _SAMPLES_JHASH_H */
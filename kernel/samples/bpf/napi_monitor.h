@@ -20,6 +20,24 @@ struct napi_bulk_histogram {
 	struct bulk_event_type type[3];
 };
 
+/* Per NAPI instance (RX queue) histograms in napi_dev_map, keyed by
+ * napi_id and the device name from the tracepoint.  napi_id can be
+ * zero for drivers without busy-poll support, then all queues of that
+ * device share one entry.
+ */
+#define NAPI_DEV_NAME_LEN	16	/* IFNAMSIZ */
+#define NAPI_DEV_MAX		1024
+struct napi_key {
+	char dev_name[NAPI_DEV_NAME_LEN];
+	__u32 napi_id;
+};
+
+/* Only collect NAPI events from one device, when enabled */
+struct napi_filter {
+	char dev_name[NAPI_DEV_NAME_LEN];
+	__u32 enabled;
+};
+
 /* SOFTIRQ tracepoint data structures */
 enum vec_nr_t {
 	SOFTIRQ_HI,
@@ -62,6 +80,28 @@ static inline const char *softirq2str(enum vec_nr_t softirq)
 	return NULL;
 }
 
+/* Latency histograms, log2 buckets in nanosec: slot[n] counts
+ * durations in range [2^n, 2^(n+1)) ns, slot[0] also counts 0 ns.
+ */
+#define LAT_HIST_SLOTS	32	/* Last slot 2^31 ns = 2.1 sec and above */
+struct lat_hist {
+	unsigned long slot[LAT_HIST_SLOTS];
+	unsigned long cnt;
+	unsigned long sum_ns;
+};
+struct latency_data {
+	struct lat_hist napi_poll;	/* Duration of a single NAPI poll */
+	struct lat_hist runtime[SOFTIRQ_MAX];	/* Entry to exit */
+	struct lat_hist raise_delay[SOFTIRQ_MAX]; /* Raise to entry */
+};
+
+/* Per CPU timestamps, only used by _kern side */
+struct softirq_timestamps {
+	__u64 entry[SOFTIRQ_MAX];
+	__u64 raise[SOFTIRQ_MAX];	/* First raise while not pending */
+	__u64 napi_poll_start;		/* NET_RX entry or previous poll */
+};
+
 //#define DEBUG 1
 #ifdef  DEBUG
 /* Only use this for debug output. Notice output from bpf_trace_printk()
@@ -31,6 +31,80 @@ struct bpf_map_def SEC("maps") cnt_map = { /* For debugging */
 	.max_entries = 1,
 };
 
+struct bpf_map_def SEC("maps") latency_map = {
+	.type = BPF_MAP_TYPE_PERCPU_ARRAY,
+	.key_size = sizeof(u32),
+	.value_size = sizeof(struct latency_data),
+	.max_entries = 1,
+};
+
+/* Per CPU scratch state, softirqs don't nest on the same CPU */
+struct bpf_map_def SEC("maps") softirq_ts_map = {
+	.type = BPF_MAP_TYPE_PERCPU_ARRAY,
+	.key_size = sizeof(u32),
+	.value_size = sizeof(struct softirq_timestamps),
+	.max_entries = 1,
+};
+
+struct bpf_map_def SEC("maps") napi_dev_map = {
+	.type = BPF_MAP_TYPE_PERCPU_HASH,
+	.key_size = sizeof(struct napi_key),
+	.value_size = sizeof(struct napi_bulk_histogram),
+	.max_entries = NAPI_DEV_MAX,
+};
+
+struct bpf_map_def SEC("maps") napi_filter_map = {
+	.type = BPF_MAP_TYPE_ARRAY,
+	.key_size = sizeof(u32),
+	.value_size = sizeof(struct napi_filter),
+	.max_entries = 1,
+};
+
+/* Never written, zero value for inserting into napi_dev_map, as
+ * struct napi_bulk_histogram is too large for the BPF stack.
+ */
+struct bpf_map_def SEC("maps") napi_zero_map = {
+	.type = BPF_MAP_TYPE_ARRAY,
+	.key_size = sizeof(u32),
+	.value_size = sizeof(struct napi_bulk_histogram),
+	.max_entries = 1,
+};
+
+/* Loop free log2, as BPF cannot have loops */
+static __always_inline unsigned int log2(unsigned int v)
+{
+	unsigned int r;
+	unsigned int shift;
+
+	r = (v > 0xFFFF) << 4; v >>= r;
+	shift = (v > 0xFF) << 3; v >>= shift; r |= shift;
+	shift = (v > 0xF) << 2; v >>= shift; r |= shift;
+	shift = (v > 0x3) << 1; v >>= shift; r |= shift;
+	r |= (v >> 1);
+	return r;
+}
+
+static __always_inline unsigned int log2l(unsigned long v)
+{
+	unsigned int hi = v >> 32;
+
+	if (hi)
+		return log2(hi) + 32;
+	else
+		return log2(v);
+}
+
+static __always_inline void lat_hist_add(struct lat_hist *h, u64 ns)
+{
+	unsigned int slot = log2l(ns);
+
+	if (slot >= LAT_HIST_SLOTS)
+		slot = LAT_HIST_SLOTS - 1;
+	h->slot[slot]++;
+	h->cnt++;
+	h->sum_ns += ns;
+}
+
 /* Tracepoint format: /sys/kernel/debug/tracing/events/napi/napi_poll/format
  * Code in:                kernel/include/trace/events/napi.h
  */
@@ -57,6 +131,69 @@ do {									\
 		bpf_probe_read((void *)dst, __length, (char *)ctx + __offset); \
 } while (0)
 
+/* Device name is a dynamic array (__string) in the trace record.
+ * Clear bytes after the terminating NUL, as the name is a hash key.
+ */
+static __always_inline
+void napi_dev_name(struct napi_poll_ctx *ctx, char *name)
+{
+	unsigned short offset = ctx->data_loc_dev_name & 0xFFFF;
+	bool end = false;
+	int i;
+
+	bpf_probe_read(name, NAPI_DEV_NAME_LEN, (char *)ctx + offset);
+#pragma clang loop unroll(full)
+	for (i = 0; i < NAPI_DEV_NAME_LEN; i++) {
+		if (end)
+			name[i] = 0;
+		else if (!name[i])
+			end = true;
+	}
+}
+
+static __always_inline
+bool napi_dev_match(struct napi_filter *filter, char *name)
+{
+	int i;
+
+#pragma clang loop unroll(full)
+	for (i = 0; i < NAPI_DEV_NAME_LEN; i++)
+		if (filter->dev_name[i] != name[i])
+			return false;
+	return true;
+}
+
+static __always_inline
+struct napi_bulk_histogram *napi_dev_lookup(struct napi_key *key)
+{
+	struct napi_bulk_histogram *hist, *zero;
+	u32 idx = 0;
+
+	hist = bpf_map_lookup_elem(&napi_dev_map, key);
+	if (hist)
+		return hist;
+
+	zero = bpf_map_lookup_elem(&napi_zero_map, &idx);
+	if (!zero)
+		return NULL;
+	/* BPF_NOEXIST: other CPU might have inserted it */
+	bpf_map_update_elem(&napi_dev_map, key, zero, BPF_NOEXIST);
+	return bpf_map_lookup_elem(&napi_dev_map, key);
+}
+
+static __always_inline
+void napi_hist_record(struct napi_bulk_histogram *h,
+		      unsigned int event_type, unsigned int work)
+{
+	if (event_type != TYPE_VIOLATE && work < 65)
+		h->hist[work]++;
+
+	h->type[event_type].cnt++;
+	h->type[event_type].pkts += work;
+	if (!work)
+		h->type[event_type].cnt_bulk0++;
+}
+
 SEC("tracepoint/napi/napi_poll")
 int napi_poll(struct napi_poll_ctx *ctx)
 {
@@ -65,39 +202,52 @@ int napi_poll(struct napi_poll_ctx *ctx)
 	unsigned int work = ctx->work;
 	struct napi_struct *napi = ctx->napi;
 	u64 pid_tgid = 0;
-	//int ifindex = 0;
 	u32 key = 0;
 	//u64 *cnt;
 
-	//unsigned long	state = 0;
-	unsigned int	napi_id = 0;
-
-	struct napi_bulk_histogram *napi_work;
+	struct napi_bulk_histogram *napi_work, *napi_dev;
+	struct napi_key dev_key = { 0 };
+	struct softirq_timestamps *ts;
+	struct napi_filter *filter;
+	struct latency_data *lat;
+	bool filtered;
+	u64 now;
 
 	napi_work = bpf_map_lookup_elem(&napi_hist_map, &key);
 	if (!napi_work)
 		return 0;
 
-	/* TODO: Want to implement limiting tool to collect from a
-	 * specific interface, but I cannot figure out howto extract
-	 * the ifindex here.
+	/* Deref of the napi pointer (e.g. napi->dev->ifindex) is
+	 * rejected by the verifier, but napi_id can be read via
+	 * bpf_probe_read, and the device name is in the trace record.
 	 */
-	// Cannot deref napi pointer directly :-(
-	//if (ctx->napi->dev)
-	//	ifindex = ctx->napi->dev->ifindex;
-
-	// TODO: look at using bpf_probe_read
-	//  bpf_probe_read(napi,     sizeof(napi),    ctx->napi);
-	//  bpf_probe_read(&ifindex, sizeof(ifindex), dev->ifindex);
-	//  bpf_probe_read(&ifindex, 4, &ctx->napi->dev->ifindex);
-	if (napi) {
-		/* This seems to work: */
-		bpf_probe_read(&napi_id, sizeof(napi_id), &napi->napi_id);
+	if (napi)
+		bpf_probe_read(&dev_key.napi_id, sizeof(dev_key.napi_id),
+			       &napi->napi_id);
+	napi_dev_name(ctx, dev_key.dev_name);
+
+	/* Limit collection to a specific interface */
+	filter = bpf_map_lookup_elem(&napi_filter_map, &key);
+	filtered = filter && filter->enabled &&
+		!napi_dev_match(filter, dev_key.dev_name);
+
+	/* Tracepoint fires after the poll, there is no poll start event.
+	 * Within net_rx_action, a poll starts where the NET_RX softirq
+	 * entered or the previous poll on this CPU ended.  Polls outside
+	 * NET_RX softirq (busy-poll, netpoll, threaded) are not timed.
+	 * Filtered polls still mark where the next poll starts.
+	 */
+	ts  = bpf_map_lookup_elem(&softirq_ts_map, &key);
+	lat = bpf_map_lookup_elem(&latency_map, &key);
+	if (ts && lat && ts->napi_poll_start) {
+		now = bpf_ktime_get_ns();
+		if (!filtered)
+			lat_hist_add(&lat->napi_poll,
+				     now - ts->napi_poll_start);
+		ts->napi_poll_start = now;
 	}
-//	if (napi && napi->dev) {
-//              (NOT WORKING: rejected by verifier)
-//		bpf_probe_read(&ifindex, sizeof(ifindex), &(napi->dev->ifindex));
-//	}
+	if (filtered)
+		return 0;
 
 #ifdef DEBUG
 	/* Counter that keeps state across invocations (for hacks) */
@@ -111,9 +261,7 @@ int napi_poll(struct napi_poll_ctx *ctx)
 		unsigned char c = 0;
 		unsigned int pid = 0; //= ctx->common_pid;
 		u64 z = 0;
-		char devname[IFNAMSIZ] = { 0 };
 
-		unsigned short d_offset = ctx->data_loc_dev_name & 0xFFFF;
 		z = bpf_get_current_pid_tgid();
 		bpf_probe_read(&c, 1, &ctx->common_flags);
 		bpf_probe_read(&t, 2, &ctx->common_type);
@@ -121,25 +269,17 @@ int napi_poll(struct napi_poll_ctx *ctx)
 		bpf_probe_read(&pid, 4, &ctx->common_pid);
 		bpf_debug("TestAAA a:%u c:%u t:%u\n", a, c, t);
 		bpf_debug("TestBBB pid:%u z:%u work:%u\n", pid, z, work);
-
-		//DATA_LOC_READ(ctx, devname, dev_name, IFNAMSIZ);
-		bpf_probe_read(devname, IFNAMSIZ, (char *)ctx + d_offset);
-		bpf_debug("TestCCC data_loc:%u devname:%s\n",
-			  ctx->data_loc_dev_name, devname);
+		bpf_debug("TestCCC napi_id:%u devname:%s\n",
+			  dev_key.napi_id, dev_key.dev_name);
 	}
 #endif
 	/* Detect API violation */
 	if (work > budget) {
-		bpf_debug("API violation ifindex(%d) work(%d)>budget(%d)",
-			  ifindex, work, budget);
+		bpf_debug("API violation napi_id(%u) work(%d)>budget(%d)",
+			  dev_key.napi_id, work, budget);
 		goto record_event_type;
 	}
 
-	/* TODO: Detect */
-
-	if (work < 65)
-		napi_work->hist[work]++;
-
 	/* Detect when this gets invoked from idle task or from ksoftirqd */
 	pid_tgid = bpf_get_current_pid_tgid();
 	if (pid_tgid == 0)
@@ -148,10 +288,11 @@ int napi_poll(struct napi_poll_ctx *ctx)
 		event_type = TYPE_SOFTIRQ;
 
 record_event_type:
-	napi_work->type[event_type].cnt++;
-	napi_work->type[event_type].pkts += work;
-	if (!work)
-		napi_work->type[event_type].cnt_bulk0++;
+	napi_hist_record(napi_work, event_type, work);
+
+	napi_dev = napi_dev_lookup(&dev_key);
+	if (napi_dev)
+		napi_hist_record(napi_dev, event_type, work);
 
 	return 0;
 }
@@ -180,8 +321,11 @@ SEC("tracepoint/irq/softirq_entry")
 int softirq_entry(struct irq_ctx *ctx)
 {
 	struct softirq_data *data = NULL;
+	struct softirq_timestamps *ts;
+	struct latency_data *lat;
 	unsigned int vec_nr = ctx->vec_nr;
 	u32 key = 0;
+	u64 now;
 
 	data = bpf_map_lookup_elem(&softirq_map, &key);
 	if (!data)
@@ -189,6 +333,23 @@ int softirq_entry(struct irq_ctx *ctx)
 
 	if (vec_nr < SOFTIRQ_MAX)
 		data->counters[vec_nr].enter++;
+	else
+		return 0;
+
+	ts  = bpf_map_lookup_elem(&softirq_ts_map, &key);
+	lat = bpf_map_lookup_elem(&latency_map, &key);
+	if (!ts || !lat)
+		return 0;
+
+	now = bpf_ktime_get_ns();
+	ts->entry[vec_nr] = now;
+	if (ts->raise[vec_nr]) {
+		lat_hist_add(&lat->raise_delay[vec_nr],
+			     now - ts->raise[vec_nr]);
+		ts->raise[vec_nr] = 0;
+	}
+	if (vec_nr == SOFTIRQ_NET_RX)
+		ts->napi_poll_start = now;
 
 	return 0;
 }
@@ -197,6 +358,8 @@ SEC("tracepoint/irq/softirq_exit")
 int softirq_exit(struct irq_ctx *ctx)
 {
 	struct softirq_data *data = NULL;
+	struct softirq_timestamps *ts;
+	struct latency_data *lat;
 	unsigned int vec_nr = ctx->vec_nr;
 	u32 key = 0;
 
@@ -206,6 +369,22 @@ int softirq_exit(struct irq_ctx *ctx)
 
 	if (vec_nr < SOFTIRQ_MAX)
 		data->counters[vec_nr].exit++;
+	else
+		return 0;
+
+	ts  = bpf_map_lookup_elem(&softirq_ts_map, &key);
+	lat = bpf_map_lookup_elem(&latency_map, &key);
+	if (!ts || !lat)
+		return 0;
+
+	/* Zero entry means started before we attached */
+	if (ts->entry[vec_nr]) {
+		lat_hist_add(&lat->runtime[vec_nr],
+			     bpf_ktime_get_ns() - ts->entry[vec_nr]);
+		ts->entry[vec_nr] = 0;
+	}
+	if (vec_nr == SOFTIRQ_NET_RX)
+		ts->napi_poll_start = 0;
 
 	return 0;
 }
@@ -214,6 +393,7 @@ SEC("tracepoint/irq/softirq_raise")
 int softirq_raise(struct irq_ctx *ctx)
 {
 	struct softirq_data *data = NULL;
+	struct softirq_timestamps *ts;
 	unsigned int vec_nr = ctx->vec_nr;
 	u32 key = 0;
 
@@ -223,6 +403,16 @@ int softirq_raise(struct irq_ctx *ctx)
 
 	if (vec_nr < SOFTIRQ_MAX)
 		data->counters[vec_nr].raise++;
+	else
+		return 0;
+
+	/* Raising an already pending softirq doesn't move the delay
+	 * start, keep the first raise.  Raise and entry happen on the
+	 * same CPU, as pending softirqs are per CPU.
+	 */
+	ts = bpf_map_lookup_elem(&softirq_ts_map, &key);
+	if (ts && !ts->raise[vec_nr])
+		ts->raise[vec_nr] = bpf_ktime_get_ns();
 
 	return 0;
 }
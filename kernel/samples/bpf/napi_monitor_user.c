@@ -6,6 +6,19 @@ static const char *__doc__=
  "NOTICE: Counter for bulk 64 can be higher than actual processed\n"
  " packets.  Drivers can signal the NAPI API to keep polling via\n"
  " returning the full budget (64)\n"
+ "\n"
+ "Latency is shown as log2 histograms, with percentiles interpolated\n"
+ " within a bucket: NAPI poll duration, softirq runtime (entry to\n"
+ " exit) and softirq raise to entry delay.  Only polls run from the\n"
+ " NET_RX softirq are timed (not busy-poll or threaded NAPI).\n"
+ "\n"
+ "Per RX queue (NAPI instance, by napi_id) and per device breakdown,\n"
+ " top-N queues sorted by packets.  The full% column is polls that\n"
+ " used the whole budget, i.e. the queue had more work waiting.\n"
+ " With --dev only NAPI events of that device are collected.\n"
+ "\n"
+ "--metrics unix:PATH|tcp:PORT|PATH exports counters and latency\n"
+ " histograms in OpenMetrics text format, see xdp_metrics.h\n"
 ;
 
 #include <errno.h>
@@ -27,19 +40,61 @@ static const char *__doc__=
 #include "bpf_load.h"
 #include "bpf_util.h"
 #include "napi_monitor.h" /* Shared structs between _user & _kern */
+#include "xdp_metrics.h"
 
 static int verbose = 1;
+static bool show_hist;
+static bool show_cpu;
+static int top_n = 10;
+static struct metrics *metrics;
 
 static const struct option long_options[] = {
 	{"help",	no_argument,		NULL, 'h' },
 	{"debug",	no_argument,		NULL, 'D' },
 	{"sec", 	required_argument,	NULL, 's' },
+	{"hist",	no_argument,		NULL, 'H' },
+	{"cpu",		no_argument,		NULL, 'c' },
+	{"dev",		required_argument,	NULL, 'd' },
+	{"top",		required_argument,	NULL, 't' },
+	{"metrics",	required_argument,	NULL, 'M' },
 	{0, 0, NULL,  0 }
 };
 
+/* Indexes into map_fd[], follow map order in _kern.c */
+#define MAP_NAPI_HIST	0
+#define MAP_SOFTIRQ	1
+#define MAP_LATENCY	3
+#define MAP_NAPI_DEV	5
+#define MAP_NAPI_FILTER	6
+
 struct stats_record {
 	struct napi_bulk_histogram napi_bulk;
 	struct softirq_data softirq;
+	struct latency_data lat;
+};
+
+/* Per CPU latency, current and previous period, for --cpu */
+static struct latency_data *lat_cpu, *lat_cpu_prev;
+
+/* Per NAPI instance, current and previous period */
+struct napi_dev_entry {
+	struct napi_key key;
+	struct napi_bulk_histogram sum;
+};
+struct napi_dev_record {
+	struct napi_dev_entry e[NAPI_DEV_MAX];
+	int cnt;
+};
+static struct napi_dev_record *napi_dev, *napi_dev_prev;
+
+/* Period deltas of an entry, for sorting and display */
+struct napi_dev_delta {
+	struct napi_key key;
+	unsigned long polls;
+	unsigned long pkts;
+	unsigned long bulk0;
+	unsigned long full;	/* work == budget (64) */
+	unsigned long violate;
 };
 
 static void usage(char *argv[])
@@ -77,34 +132,74 @@ uint64_t gettime(void)
 	return (uint64_t) t.tv_sec * NANOSEC_PER_SEC + t.tv_nsec;
 }
 
+static void napi_hist_sum(struct napi_bulk_histogram *sum,
+			  const struct napi_bulk_histogram *values,
+			  unsigned int nr_cpus)
+{
+	int i, j;
+
+	/* Sum values from each CPU */
+	for (i = 0; i < nr_cpus; i++) {
+		for (j = 0; j < 65; j++) {
+			sum->hist[j] += values[i].hist[j];
+		}
+		for (j = 0; j < 3; j++) {
+			sum->type[j].cnt       += values[i].type[j].cnt;
+			sum->type[j].cnt_bulk0 += values[i].type[j].cnt_bulk0;
+			sum->type[j].pkts      += values[i].type[j].pkts;
+		}
+	}
+}
+
 static bool stats_collect_napi(struct stats_record *record)
 {
 	unsigned int nr_cpus = bpf_num_possible_cpus();
 	struct napi_bulk_histogram values[nr_cpus];
 	struct napi_bulk_histogram sum = { 0 };
 	__u32 key = 0;
-	int i, j;
 
 	/* Notice map is percpu: BPF_MAP_TYPE_PERCPU_ARRAY */
-	if ((bpf_map_lookup_elem(map_fd[0], &key, values)) != 0) {
+	if ((bpf_map_lookup_elem(map_fd[MAP_NAPI_HIST], &key, values)) != 0) {
 		fprintf(stderr, "WARN: bpf_map_lookup_elem failed\n");
 		return false;
 	}
-	/* Sum values from each CPU */
-	for (i = 0; i < nr_cpus; i++) {
-		for (j = 0; j < 65; j++) {
-			sum.hist[j] += values[i].hist[j];
-		}
-		for (j = 0; j < 3; j++) {
-			sum.type[j].cnt       += values[i].type[j].cnt;
-			sum.type[j].cnt_bulk0 += values[i].type[j].cnt_bulk0;
-			sum.type[j].pkts      += values[i].type[j].pkts;
-		}
-	}
+	napi_hist_sum(&sum, values, nr_cpus);
 	memcpy(&record->napi_bulk, &sum, sizeof(sum));
 	return true;
 }
 
+/* Walk napi_dev_map (BPF_MAP_TYPE_PERCPU_HASH), entries are never
+ * deleted, so counters only grow.
+ */
+static bool stats_collect_napi_dev(void)
+{
+	unsigned int nr_cpus = bpf_num_possible_cpus();
+	struct napi_bulk_histogram values[nr_cpus];
+	struct napi_key key, next, *prev_key = NULL;
+	struct napi_dev_record *tmp;
+	struct napi_dev_entry *e;
+
+	tmp = napi_dev_prev;
+	napi_dev_prev = napi_dev;
+	napi_dev = tmp;
+	napi_dev->cnt = 0;
+
+	while (bpf_map_get_next_key(map_fd[MAP_NAPI_DEV], prev_key,
+				    &next) == 0) {
+		key = next;
+		prev_key = &key;
+		if (bpf_map_lookup_elem(map_fd[MAP_NAPI_DEV], &key, values))
+			continue; /* Raced with delete, not expected */
+		if (napi_dev->cnt >= NAPI_DEV_MAX)
+			break;
+		e = &napi_dev->e[napi_dev->cnt++];
+		memset(e, 0, sizeof(*e));
+		e->key = key;
+		napi_hist_sum(&e->sum, values, nr_cpus);
+	}
+	return true;
+}
+
 static bool stats_collect_softirq(struct stats_record *record)
 {
 	unsigned int nr_cpus = bpf_num_possible_cpus();
@@ -114,7 +209,7 @@ static bool stats_collect_softirq(struct stats_record *record)
 	int i, j;
 
 	/* Notice map is percpu: BPF_MAP_TYPE_PERCPU_ARRAY */
-	if ((bpf_map_lookup_elem(map_fd[1], &key, cpu)) != 0) {
+	if ((bpf_map_lookup_elem(map_fd[MAP_SOFTIRQ], &key, cpu)) != 0) {
 		fprintf(stderr, "WARN: bpf_map_lookup_elem failed\n");
 		return false;
 	}
@@ -134,6 +229,289 @@ static bool stats_collect_softirq(struct stats_record *record)
 	return true;
 }
 
+static void lat_hist_sum(struct lat_hist *sum, const struct lat_hist *h)
+{
+	int i;
+
+	for (i = 0; i < LAT_HIST_SLOTS; i++)
+		sum->slot[i] += h->slot[i];
+	sum->cnt    += h->cnt;
+	sum->sum_ns += h->sum_ns;
+}
+
+static void latency_sum(struct latency_data *sum,
+			const struct latency_data *lat)
+{
+	int j;
+
+	lat_hist_sum(&sum->napi_poll, &lat->napi_poll);
+	for (j = 0; j < SOFTIRQ_MAX; j++) {
+		lat_hist_sum(&sum->runtime[j], &lat->runtime[j]);
+		lat_hist_sum(&sum->raise_delay[j], &lat->raise_delay[j]);
+	}
+}
+
+static bool stats_collect_latency(struct stats_record *record)
+{
+	unsigned int nr_cpus = bpf_num_possible_cpus();
+	struct latency_data *tmp;
+	__u32 key = 0;
+	int i;
+
+	/* Keep previous period, for per CPU deltas */
+	tmp = lat_cpu_prev;
+	lat_cpu_prev = lat_cpu;
+	lat_cpu = tmp;
+
+	/* Notice map is percpu: BPF_MAP_TYPE_PERCPU_ARRAY */
+	if ((bpf_map_lookup_elem(map_fd[MAP_LATENCY], &key, lat_cpu)) != 0) {
+		fprintf(stderr, "WARN: bpf_map_lookup_elem failed\n");
+		return false;
+	}
+	memset(&record->lat, 0, sizeof(record->lat));
+	for (i = 0; i < nr_cpus; i++)
+		latency_sum(&record->lat, &lat_cpu[i]);
+	return true;
+}
+
+/* Histogram of the measurement period, counters only grow */
+static void lat_hist_delta(struct lat_hist *d, const struct lat_hist *rec,
+			   const struct lat_hist *prev)
+{
+	int i;
+
+	for (i = 0; i < LAT_HIST_SLOTS; i++)
+		d->slot[i] = rec->slot[i] - prev->slot[i];
+	d->cnt    = rec->cnt - prev->cnt;
+	d->sum_ns = rec->sum_ns - prev->sum_ns;
+}
+
+/* Percentile in nanosec, linear interpolation inside log2 bucket */
+static double lat_hist_percentile(const struct lat_hist *h, double pct)
+{
+	double target = h->cnt * pct / 100.0;
+	double low, high, cum = 0;
+	int i;
+
+	if (!h->cnt)
+		return 0;
+	for (i = 0; i < LAT_HIST_SLOTS; i++) {
+		if (!h->slot[i])
+			continue;
+		if (cum + h->slot[i] >= target) {
+			low  = i ? (double)(1UL << i) : 0;
+			high = (double)(1UL << (i + 1));
+			return low + (high - low) * (target - cum) / h->slot[i];
+		}
+		cum += h->slot[i];
+	}
+	return (double)(1UL << LAT_HIST_SLOTS);
+}
+
+/* Nanosec as usec, as that is the resolution of interest */
+static void lat_hist_print(const char *desc, const struct lat_hist *h,
+			   double period)
+{
+	int i, max = 0;
+
+	if (!h->cnt) {
+		printf(" %-28s %'11.0f/s\n", desc, 0.0);
+		return;
+	}
+	for (i = 0; i < LAT_HIST_SLOTS; i++)
+		if (h->slot[i])
+			max = i;
+	printf(" %-28s %'11.0f/s avg:%8.2f p50:%8.2f p90:%8.2f"
+	       " p99:%8.2f p99.9:%8.2f max<%8.2f usec\n",
+	       desc, h->cnt / period, (double)h->sum_ns / h->cnt / 1000,
+	       lat_hist_percentile(h, 50) / 1000,
+	       lat_hist_percentile(h, 90) / 1000,
+	       lat_hist_percentile(h, 99) / 1000,
+	       lat_hist_percentile(h, 99.9) / 1000,
+	       (double)(1UL << (max + 1)) / 1000);
+
+	if (!show_hist)
+		return;
+	for (i = 0; i < LAT_HIST_SLOTS; i++) {
+		if (!h->slot[i])
+			continue;
+		printf("   %10lu -> %10lu ns : %10lu (%5.2f%%)\n",
+		       i ? 1UL << i : 0, (1UL << (i + 1)) - 1, h->slot[i],
+		       100.0 * h->slot[i] / h->cnt);
+	}
+}
+
+static void stats_latency_type(const char *desc,
+			       const struct lat_hist *rec,
+			       const struct lat_hist *prev, double period)
+{
+	struct lat_hist d;
+
+	lat_hist_delta(&d, rec, prev);
+	lat_hist_print(desc, &d, period);
+}
+
+static void stats_latency_softirq(enum vec_nr_t softirq,
+				  struct stats_record *rec,
+				  struct stats_record *prev, double p)
+{
+	char desc[64];
+
+	snprintf(desc, sizeof(desc), "%s runtime", softirq2str(softirq));
+	stats_latency_type(desc, &rec->lat.runtime[softirq],
+			   &prev->lat.runtime[softirq], p);
+	snprintf(desc, sizeof(desc), "%s raise-delay", softirq2str(softirq));
+	stats_latency_type(desc, &rec->lat.raise_delay[softirq],
+			   &prev->lat.raise_delay[softirq], p);
+}
+
+static void stats_latency(struct stats_record *rec, struct stats_record *prev,
+			  double p)
+{
+	unsigned int nr_cpus = bpf_num_possible_cpus();
+	char desc[64];
+	int i;
+
+	printf("\nSystem global latency:\n");
+	stats_latency_type("NAPI poll duration", &rec->lat.napi_poll,
+			   &prev->lat.napi_poll, p);
+	stats_latency_softirq(SOFTIRQ_NET_RX, rec, prev, p);
+	stats_latency_softirq(SOFTIRQ_NET_TX, rec, prev, p);
+	stats_latency_softirq(SOFTIRQ_TIMER, rec, prev, p);
+
+	if (!show_cpu)
+		return;
+	printf("\nPer CPU latency (only CPUs with NET_RX activity):\n");
+	for (i = 0; i < nr_cpus; i++) {
+		const struct latency_data *c = &lat_cpu[i];
+		const struct latency_data *o = &lat_cpu_prev[i];
+
+		if (c->runtime[SOFTIRQ_NET_RX].cnt ==
+		    o->runtime[SOFTIRQ_NET_RX].cnt)
+			continue;
+		snprintf(desc, sizeof(desc), "cpu:%d NAPI poll duration", i);
+		stats_latency_type(desc, &c->napi_poll, &o->napi_poll, p);
+		snprintf(desc, sizeof(desc), "cpu:%d NET_RX runtime", i);
+		stats_latency_type(desc, &c->runtime[SOFTIRQ_NET_RX],
+				   &o->runtime[SOFTIRQ_NET_RX], p);
+		snprintf(desc, sizeof(desc), "cpu:%d NET_RX raise-delay", i);
+		stats_latency_type(desc, &c->raise_delay[SOFTIRQ_NET_RX],
+				   &o->raise_delay[SOFTIRQ_NET_RX], p);
+	}
+}
+
+static const struct napi_bulk_histogram *
+napi_dev_find(struct napi_dev_record *rec, const struct napi_key *key)
+{
+	int i;
+
+	for (i = 0; i < rec->cnt; i++)
+		if (!memcmp(&rec->e[i].key, key, sizeof(*key)))
+			return &rec->e[i].sum;
+	return NULL;
+}
+
+static void napi_dev_delta(struct napi_dev_delta *d,
+			   const struct napi_dev_entry *e,
+			   const struct napi_bulk_histogram *prev)
+{
+	static const struct napi_bulk_histogram zero;
+	int j;
+
+	if (!prev)
+		prev = &zero;
+	memset(d, 0, sizeof(*d));
+	d->key = e->key;
+	for (j = 0; j < 3; j++) {
+		d->polls += e->sum.type[j].cnt       - prev->type[j].cnt;
+		d->pkts  += e->sum.type[j].pkts      - prev->type[j].pkts;
+		d->bulk0 += e->sum.type[j].cnt_bulk0 - prev->type[j].cnt_bulk0;
+	}
+	d->full    = e->sum.hist[64] - prev->hist[64];
+	d->violate = e->sum.type[TYPE_VIOLATE].cnt - prev->type[TYPE_VIOLATE].cnt;
+}
+
+static int napi_dev_delta_cmp(const void *a, const void *b)
+{
+	const struct napi_dev_delta *x = a, *y = b;
+
+	if (x->pkts != y->pkts)
+		return x->pkts < y->pkts ? 1 : -1;
+	return x->polls < y->polls ? 1 : (x->polls > y->polls ? -1 : 0);
+}
+
+static void napi_dev_delta_print(const char *dev, const char *queue,
+				 const struct napi_dev_delta *d, double p)
+{
+	printf(" %-16s %-8s %'11.0f %'13.0f %8.2f %6.1f%% %6.1f%%",
+	       dev, queue, d->polls / p, d->pkts / p,
+	       d->polls > d->bulk0 ?
+			(double)d->pkts / (d->polls - d->bulk0) : 0.0,
+	       d->polls ? 100.0 * d->bulk0 / d->polls : 0.0,
+	       d->polls ? 100.0 * d->full / d->polls : 0.0);
+	if (d->violate)
+		printf(" violations:%lu", d->violate);
+	printf("\n");
+}
+
+/* Per device totals, then the busiest queues */
+static void stats_napi_dev(double p)
+{
+	struct napi_dev_delta *deltas, devs[NAPI_DEV_MAX];
+	int i, j, nr_devs = 0, n = napi_dev->cnt;
+	char queue[16];
+
+	if (!n)
+		return;
+	deltas = calloc(n, sizeof(*deltas));
+	if (!deltas)
+		return;
+
+	for (i = 0; i < n; i++)
+		napi_dev_delta(&deltas[i], &napi_dev->e[i],
+			       napi_dev_find(napi_dev_prev, &napi_dev->e[i].key));
+
+	for (i = 0; i < n; i++) {
+		for (j = 0; j < nr_devs; j++)
+			if (!strncmp(devs[j].key.dev_name,
+				     deltas[i].key.dev_name,
+				     NAPI_DEV_NAME_LEN))
+				break;
+		if (j == nr_devs) {
+			memset(&devs[j], 0, sizeof(devs[j]));
+			devs[j].key = deltas[i].key;
+			nr_devs++;
+		}
+		devs[j].key.napi_id++; /* Count of queues */
+		devs[j].polls   += deltas[i].polls;
+		devs[j].pkts    += deltas[i].pkts;
+		devs[j].bulk0   += deltas[i].bulk0;
+		devs[j].full    += deltas[i].full;
+		devs[j].violate += deltas[i].violate;
+	}
+	qsort(devs, nr_devs, sizeof(*devs), napi_dev_delta_cmp);
+	qsort(deltas, n, sizeof(*deltas), napi_dev_delta_cmp);
+
+	printf("\nPer device NAPI:\n");
+	printf(" %-16s %-8s %11s %13s %8s %7s %7s\n", "device", "queues",
+	       "polls/s", "pps", "avg-bulk", "bulk0", "full");
+	for (i = 0; i < nr_devs; i++) {
+		snprintf(queue, sizeof(queue), "%u", devs[i].key.napi_id);
+		napi_dev_delta_print(devs[i].key.dev_name, queue, &devs[i], p);
+	}
+
+	printf("\nTop %d RX queues (NAPI instances):\n", top_n);
+	printf(" %-16s %-8s %11s %13s %8s %7s %7s\n", "device", "napi_id",
+	       "polls/s", "pps", "avg-bulk", "bulk0", "full");
+	for (i = 0; i < n && i < top_n; i++) {
+		if (!deltas[i].polls)
+			break;
+		snprintf(queue, sizeof(queue), "%u", deltas[i].key.napi_id);
+		napi_dev_delta_print(deltas[i].key.dev_name, queue,
+				     &deltas[i], p);
+	}
+	free(deltas);
+}
 
 static inline
 void stats_type(
@@ -203,6 +581,110 @@ static void stats_softirq_selective(
 	stats_softirq(SOFTIRQ_TIMER, rec, prev, p);
 }
 
+static const char *napi_type_names[3] = {
+	[TYPE_IDLE_TASK]	= "idle",
+	[TYPE_SOFTIRQ]		= "softirq",
+	[TYPE_VIOLATE]		= "violation",
+};
+
+static void metrics_lat_hist(const char *name, const char *labels,
+			     const struct lat_hist *h)
+{
+	metrics_log2_hist_ns(metrics, name, labels, h->slot, LAT_HIST_SLOTS,
+			     h->cnt, h->sum_ns);
+}
+
+/* Counters since start, rates are left to the scraper */
+static void stats_metrics(struct stats_record *rec)
+{
+	const struct napi_bulk_histogram *h;
+	char labels[64];
+	int i, j;
+
+	metrics_begin(metrics);
+	metrics_family(metrics, "napi_polls", "counter",
+		       "NAPI polls, by context");
+	for (j = 0; j < 3; j++)
+		metrics_u64(metrics, rec->napi_bulk.type[j].cnt,
+			    "napi_polls_total{type=\"%s\"}",
+			    napi_type_names[j]);
+	metrics_family(metrics, "napi_packets", "counter",
+		       "Packets processed by NAPI polls, by context");
+	for (j = 0; j < 3; j++)
+		metrics_u64(metrics, rec->napi_bulk.type[j].pkts,
+			    "napi_packets_total{type=\"%s\"}",
+			    napi_type_names[j]);
+
+	metrics_family(metrics, "napi_queue_polls", "counter",
+		       "NAPI polls per RX queue (napi_id)");
+	for (i = 0; i < napi_dev->cnt; i++) {
+		h = &napi_dev->e[i].sum;
+		metrics_u64(metrics, h->type[0].cnt + h->type[1].cnt +
+			    h->type[2].cnt,
+			    "napi_queue_polls_total{dev=\"%s\",napi_id=\"%u\"}",
+			    napi_dev->e[i].key.dev_name,
+			    napi_dev->e[i].key.napi_id);
+	}
+	metrics_family(metrics, "napi_queue_packets", "counter",
+		       "Packets per RX queue (napi_id)");
+	for (i = 0; i < napi_dev->cnt; i++) {
+		h = &napi_dev->e[i].sum;
+		metrics_u64(metrics, h->type[0].pkts + h->type[1].pkts +
+			    h->type[2].pkts,
+			    "napi_queue_packets_total{dev=\"%s\",napi_id=\"%u\"}",
+			    napi_dev->e[i].key.dev_name,
+			    napi_dev->e[i].key.napi_id);
+	}
+	metrics_family(metrics, "napi_queue_budget_full", "counter",
+		       "NAPI polls that used the full budget, per RX queue");
+	for (i = 0; i < napi_dev->cnt; i++)
+		metrics_u64(metrics, napi_dev->e[i].sum.hist[64],
+			    "napi_queue_budget_full_total{dev=\"%s\","
+			    "napi_id=\"%u\"}",
+			    napi_dev->e[i].key.dev_name,
+			    napi_dev->e[i].key.napi_id);
+
+	metrics_family(metrics, "softirq", "counter",
+		       "Softirq events, by vector and event");
+	for (j = 0; j < SOFTIRQ_MAX; j++) {
+		const struct softirq_cnt *c = &rec->softirq.counters[j];
+
+		metrics_u64(metrics, c->enter,
+			    "softirq_total{vec=\"%s\",event=\"enter\"}",
+			    softirq2str(j));
+		metrics_u64(metrics, c->exit,
+			    "softirq_total{vec=\"%s\",event=\"exit\"}",
+			    softirq2str(j));
+		metrics_u64(metrics, c->raise,
+			    "softirq_total{vec=\"%s\",event=\"raise\"}",
+			    softirq2str(j));
+	}
+
+	metrics_family(metrics, "napi_poll_duration_seconds", "histogram",
+		       "Duration of NAPI polls run from NET_RX softirq");
+	metrics_lat_hist("napi_poll_duration_seconds", "",
+			 &rec->lat.napi_poll);
+	metrics_family(metrics, "softirq_runtime_seconds", "histogram",
+		       "Softirq runtime, entry to exit, by vector");
+	for (j = 0; j < SOFTIRQ_MAX; j++) {
+		if (!rec->lat.runtime[j].cnt)
+			continue;
+		snprintf(labels, sizeof(labels), "vec=\"%s\"", softirq2str(j));
+		metrics_lat_hist("softirq_runtime_seconds", labels,
+				 &rec->lat.runtime[j]);
+	}
+	metrics_family(metrics, "softirq_raise_delay_seconds", "histogram",
+		       "Delay from softirq raise to entry, by vector");
+	for (j = 0; j < SOFTIRQ_MAX; j++) {
+		if (!rec->lat.raise_delay[j].cnt)
+			continue;
+		snprintf(labels, sizeof(labels), "vec=\"%s\"", softirq2str(j));
+		metrics_lat_hist("softirq_raise_delay_seconds", labels,
+				 &rec->lat.raise_delay[j]);
+	}
+	metrics_end(metrics);
+}
+
 static void stats_poll(int interval)
 {
 	struct stats_record rec, prev;
@@ -227,7 +709,7 @@ static void stats_poll(int interval)
 		double pps;
 		int i;
 
-		sleep(interval);
+		metrics_sleep(metrics, interval);
 		prev_timestamp = timestamp;
 		memcpy(&prev, &rec, sizeof(rec));
 		timestamp = gettime();
@@ -236,6 +718,10 @@ static void stats_poll(int interval)
 			exit(EXIT_FAILURE);
 		if (!stats_collect_softirq(&rec))
 			exit(EXIT_FAILURE);
+		if (!stats_collect_latency(&rec))
+			exit(EXIT_FAILURE);
+		if (!stats_collect_napi_dev())
+			exit(EXIT_FAILURE);
 
 		period = timestamp - prev_timestamp;
 		period_ = ((double) period / NANOSEC_PER_SEC);
@@ -254,8 +740,12 @@ static void stats_poll(int interval)
 		stats_type(TYPE_IDLE_TASK, &rec, &prev, period_);
 		stats_type(TYPE_SOFTIRQ,   &rec, &prev, period_);
 		stats_type(TYPE_VIOLATE,   &rec, &prev, period_);
+		stats_napi_dev(period_);
+		if (metrics)
+			stats_metrics(&rec);
 
 		stats_softirq_selective(&rec, &prev, period_);
+		stats_latency(&rec, &prev, period_);
 
 		fflush(stdout);
 	}
@@ -267,14 +757,16 @@ int main(int argc, char **argv)
 	int longindex = 0, opt;
 	int ret = EXIT_SUCCESS;
 	char bpf_obj_file[256];
+	struct napi_filter filter = { 0 };
 	bool debug = false;
 	int interval = 2;
+	__u32 key = 0;
 	// size_t len;
 
 	snprintf(bpf_obj_file, sizeof(bpf_obj_file), "%s_kern.o", argv[0]);
 
 	/* Parse commands line args */
-	while ((opt = getopt_long(argc, argv, "h",
+	while ((opt = getopt_long(argc, argv, "hDs:Hcd:t:M:",
 				  long_options, &longindex)) != -1) {
 		switch (opt) {
 		case 'D':
@@ -287,6 +779,28 @@ int main(int argc, char **argv)
 		case 's':
 			interval = atoi(optarg);
 			break;
+		case 'H':
+			show_hist = true;
+			break;
+		case 'c':
+			show_cpu = true;
+			break;
+		case 'd':
+			if (strlen(optarg) >= NAPI_DEV_NAME_LEN) {
+				fprintf(stderr, "ERR: --dev name too long\n");
+				return EXIT_FAILURE;
+			}
+			strncpy(filter.dev_name, optarg, NAPI_DEV_NAME_LEN);
+			filter.enabled = 1;
+			break;
+		case 't':
+			top_n = atoi(optarg);
+			break;
+		case 'M':
+			metrics = metrics_open(optarg);
+			if (!metrics)
+				return EXIT_FAILURE;
+			break;
 		case 'h':
 		default:
 			usage(argv);
@@ -299,6 +813,15 @@ int main(int argc, char **argv)
 		return 1;
 	}
 
+	lat_cpu       = calloc(bpf_num_possible_cpus(), sizeof(*lat_cpu));
+	lat_cpu_prev  = calloc(bpf_num_possible_cpus(), sizeof(*lat_cpu));
+	napi_dev      = calloc(1, sizeof(*napi_dev));
+	napi_dev_prev = calloc(1, sizeof(*napi_dev));
+	if (!lat_cpu || !lat_cpu_prev || !napi_dev || !napi_dev_prev) {
+		fprintf(stderr, "ERR: cannot allocate per CPU latency\n");
+		return EXIT_FAILURE;
+	}
+
 	if (load_bpf_file(bpf_obj_file)) {
 		printf("%s", bpf_log_buf);
 		return 1;
@@ -308,6 +831,12 @@ int main(int argc, char **argv)
 		return 1;
 	}
 
+	/* Programs are attached on load, events before this are counted */
+	if (bpf_map_update_elem(map_fd[MAP_NAPI_FILTER], &key, &filter, 0)) {
+		fprintf(stderr, "ERR: set napi_filter: %s\n", strerror(errno));
+		return EXIT_FAILURE;
+	}
+
 	if (debug) {
 		if (verbose)
 			printf("Read: /sys/kernel/debug/tracing/trace_pipe\n");
@@ -308,6 +308,28 @@ int bpf_map_get_next_key(int fd, const void *key, void *next_key)
 	return sys_bpf(BPF_MAP_GET_NEXT_KEY, &attr, sizeof(attr));
 }
 
+/* Kernel v5.6+.  On return *count holds the number of elements
+ * processed, also on error.
+ */
+int bpf_map_update_batch(int fd, const void *keys, const void *values,
+			 __u32 *count, __u64 elem_flags, __u64 flags)
+{
+	union bpf_attr attr;
+	int ret;
+
+	bzero(&attr, sizeof(attr));
+	attr.batch.map_fd = fd;
+	attr.batch.keys = ptr_to_u64(keys);
+	attr.batch.values = ptr_to_u64(values);
+	attr.batch.count = *count;
+	attr.batch.elem_flags = elem_flags;
+	attr.batch.flags = flags;
+
+	ret = sys_bpf(BPF_MAP_UPDATE_BATCH, &attr, sizeof(attr));
+	*count = attr.batch.count;
+	return ret;
+}
+
 int bpf_obj_pin(int fd, const char *pathname)
 {
 	union bpf_attr attr;
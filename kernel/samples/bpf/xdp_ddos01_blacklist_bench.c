@@ -0,0 +1,750 @@
+/* Copyright(c) 2017 Jesper Dangaard Brouer, Red Hat, Inc.
+ */
+static const char *__doc__=
+ " XDP ddos01: benchmark blacklist lookup cost via BPF_PROG_TEST_RUN\n"
+ "\n"
+ " Loads xdp_ddos01_blacklist_kern.o with private (non-exported) maps\n"
+ " and measures per packet cost with synthetic traffic, comparing a\n"
+ " /16 range stored as exact-match hash entries against a single\n"
+ " LPM trie prefix, and the per source token-bucket rate limiter\n"
+ " with many tracked sources.  Does not attach to any device.\n"
+ "\n"
+ " Test 'mem' reports kernel memory (memlock) of the exact-match\n"
+ " blacklist, old percpu-counter layout against the compact one.\n"
+ " Test 'port' does the same for the port blacklist, and measures\n"
+ " the port filter pass and drop path.\n"
+ " Test 'bloom' compares pass and drop path with a large blacklist,\n"
+ " with and without the Bloom prefilter.\n"
+ " Test 'hh' measures the heavy-hitter sketch cost per packet, and\n"
+ " replays synthetic attack traffic to measure detection accuracy\n"
+ " and latency in epochs.\n"
+ ;
+
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/resource.h>
+#include <getopt.h>
+#include <arpa/inet.h>
+#include <linux/bpf.h>
+
+#include "bpf_load.h"
+#include "bpf_util.h"
+#include "libbpf.h"
+
+#include "xdp_ddos01_blacklist_common.h"
+#include "xdp_test_run.h"
+
+/* Indexes into map_fd[], follow map order in _kern.c */
+#define MAP_BLACKLIST		0
+#define MAP_PORT_BLACKLIST	2
+#define MAP_PORT_COUNT_UDP	4
+#define MAP_BLACKLIST_LPM4	5
+#define MAP_BLACKLIST_LPM6	6
+#define MAP_BLACKLIST_SET	7
+#define MAP_CONFIG		8
+#define MAP_RATELIMIT_PREFIX	9
+#define MAP_RATELIMIT_BUCKETS	10
+#define MAP_BLACKLIST_COUNTERS	11
+#define MAP_BLACKLIST_BLOOM	12
+#define MAP_HH_SKETCH		13
+#define MAP_HH_CANDIDATES	14
+
+#define NR_PKTS 64 /* Distinct source addresses per test */
+
+static const struct option long_options[] = {
+	{"help",	no_argument,		NULL, 'h' },
+	{"repeat",	required_argument,	NULL, 'r' },
+	{"prefixes",	required_argument,	NULL, 'p' },
+	{"sources",	required_argument,	NULL, 's' },
+	{"test",	required_argument,	NULL, 't' },
+	{0, 0, NULL,  0 }
+};
+
+static const char *xdp_action_names[XDP_TX + 1] = {
+	[XDP_ABORTED]	= "XDP_ABORTED",
+	[XDP_DROP]	= "XDP_DROP",
+	[XDP_PASS]	= "XDP_PASS",
+	[XDP_TX]	= "XDP_TX",
+};
+
+static void usage(char *argv[])
+{
+	int i;
+	printf("\nDOCUMENTATION:\n%s\n", __doc__);
+	printf(" Usage: %s (options-see-below)\n",
+	       argv[0]);
+	printf(" Listing options:\n");
+	for (i = 0; long_options[i].name != 0; i++) {
+		printf(" --%-12s", long_options[i].name);
+		if (long_options[i].flag != NULL)
+			printf(" flag (internal value:%d)",
+			       *long_options[i].flag);
+		else
+			printf(" short-option: -%c",
+			       long_options[i].val);
+		printf("\n");
+	}
+	printf("\n");
+}
+
+static int nr_sources = 1000000;
+
+/* Synthetic packets with source addresses base + i*step */
+static void build_pkts(struct test_pkt *pkts, int nr, int family,
+		       const char *base, __u32 step)
+{
+	struct test_pkt_spec spec;
+	__u32 *last_word;
+	int i;
+
+	memset(&spec, 0, sizeof(spec));
+	spec.proto = IPPROTO_UDP;
+	spec.sport = 4242;
+	spec.dport = 53;
+	if (!test_pkt_spec_addr(&spec, base,
+				family == AF_INET6 ? "2001:db8:ffff::1" :
+						     "198.18.0.1")) {
+		fprintf(stderr, "ERR: bad address %s\n", base);
+		exit(EXIT_FAIL_IP);
+	}
+	last_word = (family == AF_INET6) ? &spec.saddr.v6.s6_addr32[3] :
+					   &spec.saddr.v4.s_addr;
+	for (i = 0; i < nr; i++) {
+		test_pkt_build(&pkts[i], &spec);
+		*last_word = htonl(ntohl(*last_word) + step);
+	}
+}
+
+static void __bench(const char *desc, int family, const char *base,
+		    __u32 step, int nr, __u32 repeat)
+{
+	__u64 verdicts[XDP_TX + 1] = { 0 };
+	struct test_pkt *pkts;
+	double ns;
+	int i;
+
+	pkts = calloc(nr, sizeof(*pkts));
+	if (!pkts)
+		exit(EXIT_FAIL);
+	build_pkts(pkts, nr, family, base, step);
+	ns = xdp_test_run_many(prog_fd[0], pkts, nr, repeat, verdicts);
+	free(pkts);
+	if (ns < 0) {
+		fprintf(stderr, "ERR: BPF_PROG_TEST_RUN failed: %s\n",
+			strerror(-ns));
+		exit(EXIT_FAIL_BPF);
+	}
+	printf(" %-40s %7.2f ns/pkt %9.0f pps", desc, ns,
+	       ns > 0 ? NANOSEC_PER_SEC / ns : 0);
+	for (i = 0; i <= XDP_TX; i++)
+		if (verdicts[i])
+			printf(" %s:%llu", xdp_action_names[i], verdicts[i]);
+	printf("\n");
+}
+
+static void bench(const char *desc, int family, const char *base,
+		  __u32 step, __u32 repeat)
+{
+	__bench(desc, family, base, step, NR_PKTS, repeat);
+}
+
+/* Store 10.0.0.0/16 as 65536 exact entries (or delete them again) */
+static void exact_range16(unsigned int action)
+{
+	__u32 i, key, idx;
+
+	for (i = 0; i < 65536; i++) {
+		key = htonl(0x0A000000 | i);
+		/* As allocated, beyond the counters entries share one */
+		idx = i < BLACKLIST_COUNTER_SHARED ? i :
+						     BLACKLIST_COUNTER_SHARED;
+		if (action == ACTION_ADD)
+			bpf_map_update_elem(map_fd[MAP_BLACKLIST], &key,
+					    &idx, BPF_ANY);
+		else
+			bpf_map_delete_elem(map_fd[MAP_BLACKLIST], &key);
+	}
+}
+
+/* Kernel accounted map memory, via "memlock:" in fdinfo */
+static __u64 map_memlock(int fd)
+{
+	unsigned long long memlock = 0;
+	char path[64], line[128];
+	FILE *f;
+
+	snprintf(path, sizeof(path), "/proc/self/fdinfo/%d", fd);
+	f = fopen(path, "r");
+	if (!f)
+		return 0;
+	while (fgets(line, sizeof(line), f))
+		if (sscanf(line, "memlock: %llu", &memlock) == 1)
+			break;
+	fclose(f);
+	return memlock;
+}
+
+/* Compare the old layout, a percpu hash holding a u64 counter per
+ * CPU, against the hash with a u32 counter index plus the shared
+ * per-CPU counter array.  Both filled with 65536 entries.  Newer
+ * kernels report actual usage, older report the max_entries cost.
+ */
+static void bench_mem(void)
+{
+	unsigned int nr_cpus = bpf_num_possible_cpus();
+	__u64 values[nr_cpus];
+	__u64 old_mem, new_mem, cnt_mem;
+	__u32 i, key;
+	int fd_old;
+
+	fd_old = bpf_create_map(BPF_MAP_TYPE_PERCPU_HASH, sizeof(__u32),
+				sizeof(__u64), 100000, BPF_F_NO_PREALLOC);
+	if (fd_old < 0) {
+		fprintf(stderr, "ERR: create percpu hash: %s\n",
+			strerror(errno));
+		return;
+	}
+	memset(values, 0, sizeof(values));
+	for (i = 0; i < 65536; i++) {
+		key = htonl(0x0A000000 | i);
+		bpf_map_update_elem(fd_old, &key, values, BPF_ANY);
+	}
+	exact_range16(ACTION_ADD);
+
+	old_mem = map_memlock(fd_old);
+	new_mem = map_memlock(map_fd[MAP_BLACKLIST]);
+	cnt_mem = map_memlock(map_fd[MAP_BLACKLIST_COUNTERS]);
+	printf("\nMemory with 65536 exact entries, %u possible CPUs:\n",
+	       nr_cpus);
+	printf(" %-32s %12llu bytes\n", "old: percpu hash u64", old_mem);
+	printf(" %-32s %12llu bytes\n", "new: hash u32 index", new_mem);
+	printf(" %-32s %12llu bytes\n", "new: percpu counters", cnt_mem);
+	if (old_mem)
+		printf(" %-32s %11.1f %%\n", "new/old",
+		       100.0 * (new_mem + cnt_mem) / old_mem);
+
+	exact_range16(ACTION_DEL);
+	close(fd_old);
+}
+
+/* Old port blacklist layout: three percpu arrays, a u32 bitmask and
+ * two u64 drop counters per port.  Arrays are preallocated, thus
+ * memory does not depend on the number of listed ports.
+ */
+static void bench_port(__u32 repeat)
+{
+	unsigned int nr_cpus = bpf_num_possible_cpus();
+	__u64 old_mem = 0, new_mem = 0;
+	int i, fd;
+
+	printf("\nPort blacklist (UDP dport 53):\n");
+	bench("port not listed (pass)", AF_INET, "192.0.2.1", 1, repeat);
+	blacklist_port_modify(map_fd[MAP_PORT_BLACKLIST],
+			      map_fd[MAP_PORT_COUNT_UDP], 53, ACTION_ADD,
+			      IPPROTO_UDP);
+	bench("port listed (drop)", AF_INET, "192.0.2.1", 1, repeat);
+	blacklist_port_modify(map_fd[MAP_PORT_BLACKLIST],
+			      map_fd[MAP_PORT_COUNT_UDP], 53, ACTION_DEL,
+			      IPPROTO_UDP);
+
+	for (i = 0; i < 3; i++) {
+		fd = bpf_create_map(BPF_MAP_TYPE_PERCPU_ARRAY, sizeof(__u32),
+				    i ? sizeof(__u64) : sizeof(__u32),
+				    65536, 0);
+		if (fd < 0) {
+			fprintf(stderr, "ERR: create percpu array: %s\n",
+				strerror(errno));
+			return;
+		}
+		old_mem += map_memlock(fd);
+		close(fd);
+	}
+	for (i = MAP_PORT_BLACKLIST; i <= MAP_PORT_COUNT_UDP; i++)
+		new_mem += map_memlock(map_fd[i]);
+
+	printf("\nPort blacklist memory, %u possible CPUs:\n", nr_cpus);
+	printf(" %-32s %12llu bytes\n", "old: 3 x percpu array", old_mem);
+	printf(" %-32s %12llu bytes\n", "new: bitmap + counter hashes",
+	       new_mem);
+}
+
+/* Fraction of random non-member IPs passing the filter */
+static double bloom_false_positives(int nr)
+{
+	__u64 *bitmap;
+	__u32 word, bit, ip;
+	int i, j, hits = 0;
+
+	bitmap = calloc(BLOOM_WORDS, sizeof(*bitmap));
+	if (!bitmap)
+		return -1;
+	for (word = 0; word < BLOOM_WORDS; word++)
+		bpf_map_lookup_elem(map_fd[MAP_BLACKLIST_BLOOM], &word,
+				    &bitmap[word]);
+	srand(7);
+	for (i = 0; i < nr; i++) {
+		/* 172.16.0.0/12 is never added */
+		ip = htonl(0xAC100000 | ((__u32)rand() & 0xFFFFF));
+		for (j = 0; j < BLOOM_NR_HASH; j++) {
+			bit = bloom_bit(ip, j);
+			if (!(bitmap[bit / 64] & (1ULL << (bit % 64))))
+				break;
+		}
+		if (j == BLOOM_NR_HASH)
+			hits++;
+	}
+	free(bitmap);
+	return (double)hits / nr;
+}
+
+#define BLOOM_BENCH_EXTRA 30000 /* on top of the 65536 in 10.0.0.0/16 */
+
+static void bench_bloom(__u32 repeat)
+{
+	__u32 i, key, idx;
+	long nr;
+
+	exact_range16(ACTION_ADD);
+	srand(42);
+	for (i = 0; i < BLOOM_BENCH_EXTRA; i++) {
+		/* Random in 11.0.0.0/8 - 126.0.0.0/8, avoid test ranges */
+		key = htonl(((11 + rand() % 116) << 24) |
+			    ((__u32)rand() & 0xFFFFFF));
+		idx = BLACKLIST_COUNTER_SHARED;
+		bpf_map_update_elem(map_fd[MAP_BLACKLIST], &key, &idx,
+				    BPF_ANY);
+	}
+	nr = bloom_rebuild(map_fd[MAP_BLACKLIST_BLOOM],
+			   map_fd[MAP_BLACKLIST]);
+	if (nr < 0) {
+		fprintf(stderr, "ERR: bloom rebuild failed\n");
+		exit(EXIT_FAIL_MAP);
+	}
+
+	printf("\nBlacklist with %ld exact entries, Bloom filter off:\n", nr);
+	bench("IPv4 pass (hash miss)", AF_INET, "192.0.2.1", 1, repeat);
+	bench("IPv4 drop (hash hit)", AF_INET, "10.0.1.1", 997, repeat);
+
+	config_modify(map_fd[MAP_CONFIG], DDOS_CFG_BLOOM, 0, false);
+	printf("\nBloom filter on (%d bits, %d hashes):\n",
+	       BLOOM_BITS, BLOOM_NR_HASH);
+	bench("IPv4 pass (bloom miss)", AF_INET, "192.0.2.1", 1, repeat);
+	bench("IPv4 drop (bloom+hash hit)", AF_INET, "10.0.1.1", 997, repeat);
+	printf(" False positive rate (1M random sources): %.3f%%\n",
+	       100.0 * bloom_false_positives(1000000));
+	config_modify(map_fd[MAP_CONFIG], 0, DDOS_CFG_BLOOM, false);
+
+	exact_range16(ACTION_DEL);
+}
+
+/* Replay: legit sources send 1-200 pkts per epoch, attackers (from
+ * epoch HH_ATTACK_START) send HH_ATTACK_PKTS, threshold in between.
+ */
+#define HH_LEGIT	2000
+#define HH_ATTACKERS	10
+#define HH_ATTACK_PKTS	5000
+#define HH_THRESHOLD	1000
+#define HH_EPOCHS	6
+#define HH_ATTACK_START	2
+
+static void hh_replay_run(struct test_pkt *pkts, int nr, __u32 *repeats)
+{
+	__u32 retval;
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		if (xdp_test_run(prog_fd[0], &pkts[i], repeats[i], &retval) < 0) {
+			fprintf(stderr, "ERR: BPF_PROG_TEST_RUN failed: %s\n",
+				strerror(errno));
+			exit(EXIT_FAIL_BPF);
+		}
+	}
+}
+
+static void bench_hh(__u32 repeat)
+{
+	static struct hh_hit hits[HH_MAX_CAND];
+	struct test_pkt *legit, *attack;
+	__u32 legit_rep[HH_LEGIT], attack_rep[HH_ATTACKERS];
+	int detected_at[HH_ATTACKERS];
+	__u64 start, collect_ns = 0;
+	int fd_cfg = map_fd[MAP_CONFIG];
+	int epoch, i, j, nr, tp, fp;
+	__u32 attack_base;
+
+	/* Reset epoch and set candidate threshold */
+	hh_epoch_collect(fd_cfg, map_fd[MAP_HH_SKETCH],
+			 map_fd[MAP_HH_CANDIDATES], HH_THRESHOLD,
+			 hits, HH_MAX_CAND);
+
+	printf("\nHeavy-hitter sketch (%d x %d, per-CPU):\n",
+	       HH_DEPTH, HH_WIDTH);
+	bench("IPv4 pass, sketch off", AF_INET, "192.0.2.1", 1, repeat);
+	config_modify(fd_cfg, DDOS_CFG_HH, 0, false);
+	bench("IPv4 pass, sketch on", AF_INET, "192.0.2.1", 1, repeat);
+	config_modify(fd_cfg, DDOS_CFG_HH_PREFIX24, 0, false);
+	bench("IPv4 pass, sketch on (/24)", AF_INET, "192.0.2.1", 1, repeat);
+	config_modify(fd_cfg, 0, DDOS_CFG_HH_PREFIX24, false);
+
+	legit  = calloc(HH_LEGIT, sizeof(*legit));
+	attack = calloc(HH_ATTACKERS, sizeof(*attack));
+	if (!legit || !attack)
+		exit(EXIT_FAIL);
+	build_pkts(legit, HH_LEGIT, AF_INET, "198.18.0.1", 1);
+	build_pkts(attack, HH_ATTACKERS, AF_INET, "203.0.113.1", 1);
+	inet_pton(AF_INET, "203.0.113.1", &attack_base);
+	srand(42);
+	for (i = 0; i < HH_LEGIT; i++)
+		legit_rep[i] = 1 + rand() % 200;
+	for (i = 0; i < HH_ATTACKERS; i++) {
+		attack_rep[i] = HH_ATTACK_PKTS;
+		detected_at[i] = -1;
+	}
+
+	/* Start replay with a clean epoch */
+	hh_epoch_collect(fd_cfg, map_fd[MAP_HH_SKETCH],
+			 map_fd[MAP_HH_CANDIDATES], HH_THRESHOLD,
+			 hits, HH_MAX_CAND);
+
+	printf("\nReplay %d legit (1-200 pkts) + %d attackers (%d pkts)"
+	       " from epoch %d, threshold %d pkts/epoch:\n",
+	       HH_LEGIT, HH_ATTACKERS, HH_ATTACK_PKTS, HH_ATTACK_START,
+	       HH_THRESHOLD);
+	for (epoch = 0; epoch < HH_EPOCHS; epoch++) {
+		hh_replay_run(legit, HH_LEGIT, legit_rep);
+		if (epoch >= HH_ATTACK_START)
+			hh_replay_run(attack, HH_ATTACKERS, attack_rep);
+
+		start = gettime();
+		nr = hh_epoch_collect(fd_cfg, map_fd[MAP_HH_SKETCH],
+				      map_fd[MAP_HH_CANDIDATES], HH_THRESHOLD,
+				      hits, HH_MAX_CAND);
+		collect_ns += gettime() - start;
+		if (nr < 0)
+			exit(EXIT_FAIL_MAP);
+
+		for (tp = 0, fp = 0, i = 0; i < nr; i++) {
+			j = ntohl(hits[i].key) - ntohl(attack_base);
+			if (j >= 0 && j < HH_ATTACKERS) {
+				tp++;
+				if (detected_at[j] < 0)
+					detected_at[j] = epoch;
+			} else {
+				fp++;
+			}
+		}
+		printf(" epoch %d: detected %d, true-pos %d, false-pos %d,"
+		       " missed %d\n", epoch, nr, tp, fp,
+		       epoch >= HH_ATTACK_START ? HH_ATTACKERS - tp : 0);
+	}
+	for (i = 0, nr = 0; i < HH_ATTACKERS; i++)
+		if (detected_at[i] == HH_ATTACK_START)
+			nr++;
+	printf(" Detected within first attack epoch: %d of %d attackers,"
+	       " collect cost %.2f ms/epoch\n", nr, HH_ATTACKERS,
+	       (double)collect_ns / HH_EPOCHS / 1000000);
+
+	config_modify(fd_cfg, 0, DDOS_CFG_HH, false);
+	free(legit);
+	free(attack);
+}
+
+/* Add random prefixes, outside 10/8 and test ranges, to grow the trie */
+/* Same seed, thus ACTION_DEL removes the prefixes ACTION_ADD inserted */
+static void lpm4_random(int nr, int action)
+{
+	struct lpm_key_ipv4 key;
+	__u64 value = 0;
+	int i;
+
+	srand(42);
+	for (i = 0; i < nr; i++) {
+		key.prefixlen = 16 + rand() % 17;
+		key.addr = htonl((0xC0000000 | ((__u32)rand() & 0x3FFFFFFF)) &
+				 ~((1ULL << (32 - key.prefixlen)) - 1));
+		if (action == ACTION_ADD)
+			bpf_map_update_elem(map_fd[MAP_BLACKLIST_LPM4], &key,
+					    &value, BPF_ANY);
+		else /* Duplicates are already gone, ignore ENOENT */
+			bpf_map_delete_elem(map_fd[MAP_BLACKLIST_LPM4], &key);
+	}
+}
+
+/* Same dispatch as the cmdline --ip option: IPv4 /32 (or no prefix
+ * length) goes into the exact-match hash, everything else into a trie.
+ */
+static void ip_modify(const char *prefix, int action)
+{
+	struct in6_addr addr;
+	__u32 prefixlen;
+	int fam, fd, res;
+
+	if (parse_ip_prefix(prefix, &fam, &addr, &prefixlen))
+		exit(EXIT_FAIL_IP);
+	if (fam == AF_INET && prefixlen == 32) {
+		res = blacklist_key_modify(map_fd[MAP_BLACKLIST],
+					   map_fd[MAP_BLACKLIST_BLOOM],
+					   map_fd[MAP_BLACKLIST_COUNTERS],
+					   addr.s6_addr32[0], action);
+	} else {
+		fd = map_fd[fam == AF_INET6 ? MAP_BLACKLIST_LPM6 :
+					      MAP_BLACKLIST_LPM4];
+		res = blacklist_prefix_modify(fd, fam, &addr, prefixlen,
+					      action);
+	}
+	if (res)
+		exit(EXIT_FAIL_MAP_KEY);
+}
+
+static void check(const char *desc, bool ok)
+{
+	printf(" %-40s %s\n", desc, ok ? "OK" : "FAILED");
+	if (!ok)
+		exit(EXIT_FAIL);
+}
+
+/* Single packet from ip, fail the run on an unexpected verdict */
+static void check_verdict(const char *desc, const char *ip, __u32 expect)
+{
+	struct test_pkt pkt;
+	__u32 retval;
+
+	build_pkts(&pkt, 1, strchr(ip, ':') ? AF_INET6 : AF_INET, ip, 1);
+	if (xdp_test_run(prog_fd[0], &pkt, 1, &retval) < 0) {
+		fprintf(stderr, "ERR: BPF_PROG_TEST_RUN failed: %s\n",
+			strerror(errno));
+		exit(EXIT_FAIL_BPF);
+	}
+	check(desc, retval == expect);
+}
+
+/* Drop count of an exact-match entry, summed over CPUs */
+static __u64 exact_count(const char *ip)
+{
+	unsigned int nr_cpus = bpf_num_possible_cpus();
+	__u64 values[nr_cpus], sum = 0;
+	__u32 key, idx;
+	int i;
+
+	inet_pton(AF_INET, ip, &key);
+	if (bpf_map_lookup_elem(map_fd[MAP_BLACKLIST], &key, &idx) ||
+	    bpf_map_lookup_elem(map_fd[MAP_BLACKLIST_COUNTERS], &idx, values))
+		exit(EXIT_FAIL_MAP_KEY);
+	for (i = 0; i < nr_cpus; i++)
+		sum += values[i];
+	return sum;
+}
+
+/* Size the LRU for the number of tracked sources before map creation */
+static void fixup_map(struct bpf_map_data *map, int idx)
+{
+	if (idx == MAP_RATELIMIT_BUCKETS && nr_sources > 0)
+		map->def.max_entries = nr_sources;
+}
+
+static void ratelimit_set(__u64 rate, __u64 burst)
+{
+	int fd = map_fd[MAP_RATELIMIT_PREFIX];
+
+	if (ratelimit_modify(fd, "0.0.0.0/0", rate, burst, ACTION_ADD) ||
+	    config_modify(map_fd[MAP_CONFIG], DDOS_CFG_RATELIMIT, 0, true))
+		exit(EXIT_FAIL_MAP);
+}
+
+/* Insert buckets for sources 100.64.0.0 + i, like they have been seen
+ * before, using the config currently in ddos_config.
+ */
+static void ratelimit_track_sources(int nr)
+{
+	struct ratelimit_bucket b = {};
+	struct ddos_config cfg;
+	struct lpm_key_ipv4 key4 = { .prefixlen = 0, .addr = 0 };
+	__u32 key = 0, i, ip;
+
+	if (bpf_map_lookup_elem(map_fd[MAP_CONFIG], &key, &cfg) ||
+	    bpf_map_lookup_elem(map_fd[MAP_RATELIMIT_PREFIX], &key4, &b.cfg))
+		exit(EXIT_FAIL_MAP_KEY);
+	b.gen = cfg.ratelimit_gen;
+	b.limited = 1;
+	b.credit_ns = b.cfg.burst_ns;
+
+	for (i = 0; i < nr; i++) {
+		ip = htonl(0x64400000 + i);
+		if (bpf_map_update_elem(map_fd[MAP_RATELIMIT_BUCKETS], &ip,
+					&b, BPF_ANY)) {
+			fprintf(stderr, "ERR: tracking source %u: %s\n",
+				i, strerror(errno));
+			exit(EXIT_FAIL_MAP_KEY);
+		}
+	}
+}
+
+static void bench_ratelimit(__u32 repeat)
+{
+	__u64 start;
+	int spread = nr_sources < 65536 ? nr_sources : 65536;
+	__u32 step = nr_sources / NR_PKTS ? nr_sources / NR_PKTS : 1;
+
+	printf("\nToken bucket rate limit, %d tracked sources:\n",
+	       nr_sources);
+
+	/* Rate so high the limit is never hit */
+	ratelimit_set(NANOSEC_PER_SEC, 0);
+	start = gettime();
+	ratelimit_track_sources(nr_sources);
+	printf(" (tracking %d sources took %.3f sec)\n", nr_sources,
+	       (double)(gettime() - start) / NANOSEC_PER_SEC);
+	bench("under limit (pass)", AF_INET, "100.64.0.0", step, repeat);
+
+	/* One repeat per source, spread over the LRU (cache cold).
+	 * Notice: includes the test_run timer overhead per packet.
+	 */
+	__bench("under limit, spread (pass)", AF_INET, "100.64.0.0",
+		1, spread, 1);
+
+	/* 1 pps with burst 1: nearly all repeats are over the limit */
+	ratelimit_set(1, 1);
+	ratelimit_track_sources(nr_sources);
+	bench("over limit (drop)", AF_INET, "100.64.0.0", step, repeat);
+
+	/* Disabled mode, cost of checking the config flag only */
+	config_modify(map_fd[MAP_CONFIG], 0, DDOS_CFG_RATELIMIT, false);
+	bench("rate limit disabled (pass)", AF_INET, "100.64.0.0", step,
+	      repeat);
+}
+
+static void bench_lpm(__u32 repeat, int nr_prefixes)
+{
+	printf("\nEmpty maps (lookup miss path):\n");
+	bench("IPv4 miss",  AF_INET,  "192.0.2.1", 1, repeat);
+	bench("IPv6 miss",  AF_INET6, "2001:db8::1", 1, repeat);
+
+	printf("\nExact IPv4 given as /32, like --ip 198.18.0.1/32:\n");
+	ip_modify("198.18.0.1/32", ACTION_ADD);
+	check_verdict("IPv4 /32 listed (drop)", "198.18.0.1", XDP_DROP);
+	check_verdict("IPv4 /32 neighbour (pass)", "198.18.0.2", XDP_PASS);
+	ip_modify("198.18.0.2", ACTION_ADD);
+	check("own drop counter per entry",
+	      exact_count("198.18.0.1") == 1 &&
+	      exact_count("198.18.0.2") == 0);
+	ip_modify("198.18.0.2", ACTION_DEL);
+	ip_modify("198.18.0.1", ACTION_DEL);
+	check_verdict("IPv4 /32 deleted w/o prefix (pass)", "198.18.0.1",
+		      XDP_PASS);
+	ip_modify("198.18.0.1", ACTION_ADD);
+	check("re-added entry starts at zero",
+	      exact_count("198.18.0.1") == 0);
+	ip_modify("198.18.0.1", ACTION_DEL);
+
+	printf("\n10.0.0.0/16 as 65536 exact hash entries:\n");
+	exact_range16(ACTION_ADD);
+	bench("IPv4 hash hit (drop)", AF_INET, "10.0.1.1", 997, repeat);
+	bench("IPv4 hash miss (pass)", AF_INET, "192.0.2.1", 1, repeat);
+	exact_range16(ACTION_DEL);
+
+	printf("\n10.0.0.0/16 as a single LPM prefix:\n");
+	ip_modify("10.0.0.0/16", ACTION_ADD);
+	bench("IPv4 LPM hit (drop)", AF_INET, "10.0.1.1", 997, repeat);
+	bench("IPv4 LPM miss (pass)", AF_INET, "192.0.2.1", 1, repeat);
+
+	printf("\nPlus %d random IPv4 prefixes (/16-/32) in trie:\n",
+	       nr_prefixes);
+	lpm4_random(nr_prefixes, ACTION_ADD);
+	bench("IPv4 LPM hit (drop)", AF_INET, "10.0.1.1", 997, repeat);
+	bench("IPv4 LPM miss (pass)", AF_INET, "172.16.0.1", 1, repeat);
+
+	printf("\nIPv6 2001:db8::/32 as LPM prefix:\n");
+	ip_modify("2001:db8::/32", ACTION_ADD);
+	bench("IPv6 LPM hit (drop)", AF_INET6, "2001:db8::1", 997, repeat);
+	bench("IPv6 LPM miss (pass)", AF_INET6, "2001:db9::1", 1, repeat);
+
+	/* Later tests pass 192.0.2.1, it must not hit leftover prefixes */
+	ip_modify("2001:db8::/32", ACTION_DEL);
+	lpm4_random(nr_prefixes, ACTION_DEL);
+	ip_modify("10.0.0.0/16", ACTION_DEL);
+}
+
+int main(int argc, char **argv)
+{
+	struct rlimit r = {RLIM_INFINITY, RLIM_INFINITY};
+	__u32 repeat = 100000;
+	int nr_prefixes = 10000;
+	__u32 set_idx = 0;
+	char *test = NULL;
+	char filename[256];
+	int longindex = 0;
+	int opt;
+
+	while ((opt = getopt_long(argc, argv, "hr:p:s:t:",
+				  long_options, &longindex)) != -1) {
+		switch (opt) {
+		case 'r':
+			repeat = atoi(optarg);
+			break;
+		case 'p':
+			nr_prefixes = atoi(optarg);
+			break;
+		case 's':
+			nr_sources = atoi(optarg);
+			break;
+		case 't': /* lpm, ratelimit, mem, port, bloom or hh */
+			test = optarg;
+			break;
+		case 'h':
+		default:
+			usage(argv);
+			return EXIT_FAIL_OPTION;
+		}
+	}
+	verbose = 0;
+
+	if (setrlimit(RLIMIT_MEMLOCK, &r)) {
+		perror("setrlimit(RLIMIT_MEMLOCK, RLIM_INFINITY)");
+		return EXIT_FAIL;
+	}
+
+	/* Bench binary lives next to the kern object */
+	snprintf(filename, sizeof(filename), "%s", argv[0]);
+	if (strrchr(filename, '_'))
+		*strrchr(filename, '_') = '\0';
+	strncat(filename, "_kern.o", sizeof(filename) - strlen(filename) - 1);
+	if (load_bpf_file_fixup_map(filename, fixup_map)) {
+		fprintf(stderr, "ERR in load_bpf_file(%s): %s\n",
+			filename, bpf_log_buf);
+		return EXIT_FAIL_BPF;
+	}
+	if (!prog_fd[0]) {
+		printf("load_bpf_file: %s\n", strerror(errno));
+		return EXIT_FAIL_BPF;
+	}
+	/* Like the loader, activate blacklist via blacklist_set */
+	if (bpf_map_update_elem(map_fd[MAP_BLACKLIST_SET], &set_idx,
+				&map_fd[MAP_BLACKLIST], BPF_ANY)) {
+		fprintf(stderr, "ERR: cannot init blacklist_set: %s\n",
+			strerror(errno));
+		return EXIT_FAIL_MAP;
+	}
+	printf("Repeat %u times over %d source addresses per test\n",
+	       repeat, NR_PKTS);
+
+	if (!test || !strcmp(test, "lpm"))
+		bench_lpm(repeat, nr_prefixes);
+	if (!test || !strcmp(test, "ratelimit"))
+		bench_ratelimit(repeat);
+	if (!test || !strcmp(test, "mem"))
+		bench_mem();
+	if (!test || !strcmp(test, "port"))
+		bench_port(repeat);
+	if (!test || !strcmp(test, "bloom"))
+		bench_bloom(repeat);
+	if (!test || !strcmp(test, "hh"))
+		bench_hh(repeat);
+
+	return EXIT_OK;
+}
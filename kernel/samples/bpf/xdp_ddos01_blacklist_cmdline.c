@@ -2,7 +2,30 @@
    Copyright(c) 2017 Andy Gospodarek, Broadcom Limited, Inc.
  */
 static const char *__doc__=
- " XDP ddos01: command line tool";
+ " XDP ddos01: command line tool\n"
+ "\n"
+ " The --ip option accept IPv4/IPv6 addresses with an optional\n"
+ " CIDR prefix length, e.g. 198.18.0.0/16 or 2001:db8::/32.\n"
+ " An IPv4 address without prefix is an exact match entry.\n"
+ "\n"
+ " Bulk mode --file reads one IP/prefix per line (\"-\" for stdin,\n"
+ " '#' comments).  With --replace the exact-match set is atomically\n"
+ " swapped with a freshly populated map.\n"
+ "\n"
+ " Rate limit IPv4 sources per prefix with --ip PREFIX --rate PPS\n"
+ " (--burst PKTS) --add, and enable via --ratelimit on.  A token\n"
+ " bucket is kept per source IP.  Remove with --rate 0 --del.\n"
+ "\n"
+ " With --bloom on, a Bloom filter is consulted before the exact-match\n"
+ " hash, which saves the hash lookup for non-blacklisted sources.\n"
+ " Deleted entries leave stale bits, run --bloom on again to rebuild.\n"
+ "\n"
+ " With --auto-blacklist PPS, sources above PPS (per --sec interval)\n"
+ " in the XDP heavy-hitter sketch are added to the blacklist, or\n"
+ " their /24 with --aggregate24.  Use --auto-blacklist 0 to disable.\n"
+ "\n"
+ " --metrics unix:PATH|tcp:PORT|PATH exports verdict counters and rates\n"
+ " in OpenMetrics text format (implies --stats), see xdp_metrics.h";
 
 #include <assert.h>
 #include <errno.h>
@@ -27,6 +50,7 @@ static const char *__doc__=
 #include "bpf_util.h"
 
 #include "xdp_ddos01_blacklist_common.h"
+#include "xdp_metrics.h"
 
 static const struct option long_options[] = {
 	{"help",	no_argument,		NULL, 'h' },
@@ -38,16 +62,26 @@ static const struct option long_options[] = {
 	{"list",	no_argument,		NULL, 'l' },
 	{"udp-dport",	required_argument,	NULL, 'u' },
 	{"tcp-dport",	required_argument,	NULL, 't' },
+	{"file",	required_argument,	NULL, 'f' },
+	{"replace",	no_argument,		NULL, 'R' },
+	{"rate",	required_argument,	NULL, 'r' },
+	{"burst",	required_argument,	NULL, 'b' },
+	{"ratelimit",	required_argument,	NULL, 'L' },
+	{"bloom",	required_argument,	NULL, 'B' },
+	{"auto-blacklist", required_argument,	NULL, 'A' },
+	{"aggregate24",	no_argument,		NULL, 'g' },
+	{"metrics",	required_argument,	NULL, 'M' },
 	{0, 0, NULL,  0 }
 };
 
 #define XDP_ACTION_MAX (XDP_TX + 1)
 #define XDP_ACTION_MAX_STRLEN 11
-static const char *xdp_action_names[XDP_ACTION_MAX] = {
+static const char *xdp_action_names[DDOS_VERDICT_MAX] = {
 	[XDP_ABORTED]	= "XDP_ABORTED",
 	[XDP_DROP]	= "XDP_DROP",
 	[XDP_PASS]	= "XDP_PASS",
 	[XDP_TX]	= "XDP_TX",
+	[DDOS_VERDICT_RATELIMIT] = " ratelimit", /* subset of XDP_DROP */
 };
 
 static const char *xdp_proto_filter_names[DDOS_FILTER_MAX] = {
@@ -57,7 +91,7 @@ static const char *xdp_proto_filter_names[DDOS_FILTER_MAX] = {
 
 static const char *action2str(int action)
 {
-	if (action < XDP_ACTION_MAX)
+	if (action < DDOS_VERDICT_MAX)
 		return xdp_action_names[action];
 	return NULL;
 }
@@ -68,7 +102,18 @@ struct record {
 };
 
 struct stats_record {
-	struct record xdp_action[XDP_ACTION_MAX];
+	struct record xdp_action[DDOS_VERDICT_MAX];
+};
+
+static struct metrics *metrics;
+
+/* Label values, action2str() names are for the table output */
+static const char *verdict_labels[DDOS_VERDICT_MAX] = {
+	[XDP_ABORTED]	= "aborted",
+	[XDP_DROP]	= "drop",
+	[XDP_PASS]	= "pass",
+	[XDP_TX]	= "tx",
+	[DDOS_VERDICT_RATELIMIT] = "ratelimit",
 };
 
 static void usage(char *argv[])
@@ -139,7 +184,7 @@ static void stats_print(struct stats_record *record,
 {
 	int i;
 
-	for (i = 0; i < XDP_ACTION_MAX; i++) {
+	for (i = 0; i < DDOS_VERDICT_MAX; i++) {
 		struct record *r = &record->xdp_action[i];
 		struct record *p = &prev->xdp_action[i];
 		__u64 period  = 0;
@@ -161,11 +206,43 @@ static void stats_print(struct stats_record *record,
 	}
 }
 
+static void stats_metrics(struct stats_record *record,
+			  struct stats_record *prev)
+{
+	struct record *r, *p;
+	double pps;
+	int i;
+
+	metrics_begin(metrics);
+	metrics_family(metrics, "xdp_ddos_verdict", "counter",
+		       "XDP ddos01 blacklist verdicts, ratelimit is a subset"
+		       " of drop");
+	for (i = 0; i < DDOS_VERDICT_MAX; i++)
+		metrics_u64(metrics, record->xdp_action[i].counter,
+			    "xdp_ddos_verdict_total{action=\"%s\"}",
+			    verdict_labels[i]);
+	metrics_family(metrics, "xdp_ddos_verdict_pps", "gauge",
+		       "XDP ddos01 blacklist verdicts per sec");
+	for (i = 0; i < DDOS_VERDICT_MAX; i++) {
+		r = &record->xdp_action[i];
+		p = &prev->xdp_action[i];
+		pps = 0;
+		if (p->timestamp && r->timestamp > p->timestamp)
+			pps = (r->counter - p->counter) /
+				((double)(r->timestamp - p->timestamp) /
+				 NANOSEC_PER_SEC);
+		metrics_double(metrics, pps,
+			       "xdp_ddos_verdict_pps{action=\"%s\"}",
+			       verdict_labels[i]);
+	}
+	metrics_end(metrics);
+}
+
 static void stats_collect(int fd, struct stats_record *rec)
 {
 	int i;
 
-	for (i = 0; i < XDP_ACTION_MAX; i++) {
+	for (i = 0; i < DDOS_VERDICT_MAX; i++) {
 		rec->xdp_action[i].timestamp = gettime();
 		rec->xdp_action[i].counter = get_key32_value64_percpu(fd, i);
 	}
@@ -189,12 +266,70 @@ static void stats_poll(int interval)
 		stats_print_headers();
 		stats_collect(fd, &record);
 		stats_print(&record, &prev);
-		sleep(interval);
+		if (metrics)
+			stats_metrics(&record, &prev);
+		metrics_sleep(metrics, interval);
 	}
 	/* Not reached, but (hint) remember to close fd in other code */
 	close(fd);
 }
 
+/* Companion mode: every interval close the sketch epoch, and
+ * blacklist sources exceeding pps.  Runs until killed.
+ */
+static void auto_blacklist_poll(__u64 pps, int interval, bool prefix24)
+{
+	static struct hh_hit hits[HH_MAX_CAND];
+	char ip_txt[INET_ADDRSTRLEN];
+	__u64 threshold = pps * interval;
+	int fd_config, fd_sketch, fd_cand, fd_bl, fd_bloom, fd_counters;
+	__u32 flags = DDOS_CFG_HH;
+	int i, nr;
+
+	fd_config = open_bpf_map(file_config);
+	fd_sketch = open_bpf_map(file_hh_sketch);
+	fd_cand   = open_bpf_map(file_hh_candidates);
+	fd_bl     = open_bpf_map(prefix24 ? file_blacklist_lpm4 :
+					     file_blacklist);
+	fd_bloom  = open_bpf_map(file_blacklist_bloom);
+	fd_counters = open_bpf_map(file_blacklist_counters);
+
+	/* First collect sets the candidate threshold, and resets */
+	if (config_modify(fd_config, 0,
+			  DDOS_CFG_HH | DDOS_CFG_HH_PREFIX24, false) ||
+	    hh_epoch_collect(fd_config, fd_sketch, fd_cand, threshold,
+			     hits, HH_MAX_CAND) < 0 ||
+	    config_modify(fd_config, flags | (prefix24 ?
+					       DDOS_CFG_HH_PREFIX24 : 0),
+			  0, false))
+		exit(EXIT_FAIL_MAP);
+
+	while (1) {
+		sleep(interval);
+		nr = hh_epoch_collect(fd_config, fd_sketch, fd_cand,
+				      threshold, hits, HH_MAX_CAND);
+		if (nr < 0) {
+			fprintf(stderr, "ERR: heavy-hitter collect failed\n");
+			exit(EXIT_FAIL_MAP);
+		}
+		for (i = 0; i < nr; i++) {
+			inet_ntop(AF_INET, &hits[i].key, ip_txt, sizeof(ip_txt));
+			printf("Heavy hitter %s%s: %llu pkts (%llu pps)\n",
+			       ip_txt, prefix24 ? "/24" : "", hits[i].est,
+			       hits[i].est / interval);
+			if (prefix24)
+				blacklist_prefix_modify(fd_bl, AF_INET,
+							&hits[i].key, 24,
+							ACTION_ADD);
+			else
+				blacklist_key_modify(fd_bl, fd_bloom,
+						     fd_counters, hits[i].key,
+						     ACTION_ADD);
+		}
+		fflush(stdout);
+	}
+}
+
 static void blacklist_print_ipv4(__u32 ip, __u64 count)
 {
 	char ip_txt[INET_ADDRSTRLEN] = {0};
@@ -208,6 +343,43 @@ static void blacklist_print_ipv4(__u32 ip, __u64 count)
 	printf("\n \"%s\" : %llu", ip_txt, count);
 }
 
+/* LPM trie values are shared (not percpu) counters */
+static void blacklist_list_all_lpm(int fd, int family)
+{
+	char ip_txt[INET6_ADDRSTRLEN] = {0};
+	struct lpm_key_ipv6 key6, next6;
+	struct lpm_key_ipv4 key4, next4;
+	void *key = NULL, *next, *addr;
+	__u32 *prefixlen;
+	__u64 value;
+
+	if (family == AF_INET6) {
+		next = &next6;
+		addr = &next6.addr;
+		prefixlen = &next6.prefixlen;
+	} else {
+		next = &next4;
+		addr = &next4.addr;
+		prefixlen = &next4.prefixlen;
+	}
+
+	/* NULL key start iteration from the first element */
+	while (bpf_map_get_next_key(fd, key, next) == 0) {
+		if (bpf_map_lookup_elem(fd, next, &value) != 0)
+			value = 0; /* Deleted while walking */
+		inet_ntop(family, addr, ip_txt, sizeof(ip_txt));
+		printf("\n \"%s/%u\" : %llu,", ip_txt, *prefixlen, value);
+
+		if (family == AF_INET6) {
+			key6 = next6;
+			key = &key6;
+		} else {
+			key4 = next4;
+			key = &key4;
+		}
+	}
+}
+
 static void blacklist_print_proto(int key, __u64 count)
 {
 	printf("\n\t\"%s\" : %llu", xdp_proto_filter_names[key], count);
@@ -232,63 +404,391 @@ static void blacklist_print_port(int key, __u32 val, int countfds[])
 		printf("\n }");
 }
 
-static void blacklist_list_all_ipv4(int fd)
+/* Drop counts live in blacklist_counters, indexed by the value */
+static void blacklist_list_all_ipv4(int fd, int countfd)
 {
-	__u32 key = 0, next_key;
+	__u32 key = 0, next_key, idx;
 	__u64 value;
+	__u64 shared = 0;
 
 	while (bpf_map_get_next_key(fd, &key, &next_key) == 0) {
 		printf("%s", key ? "," : "" );
 		key = next_key;
-		value = get_key32_value64_percpu(fd, key);
+		value = 0;
+		if (bpf_map_lookup_elem(fd, &key, &idx) == 0) {
+			value = get_key32_value64_percpu(countfd, idx);
+			if (idx == BLACKLIST_COUNTER_SHARED)
+				shared++;
+		}
 		blacklist_print_ipv4(key, value);
 	}
 	printf("%s", key ? "," : "");
+
+	if (shared)
+		fprintf(stderr, "NOTICE: %llu exact-match entries (beyond %d)"
+			" share one drop counter, their count is the sum\n",
+			shared, BLACKLIST_COUNTER_SHARED);
 }
 
+/* Walk the port bitmap, a word covers 64/DDOS_FILTER_MAX ports */
 static void blacklist_list_all_ports(int portfd, int countfds[])
 {
-	__u32 key = 0, next_key;
-	__u64 value;
+	const int ports_per_word = 64 / DDOS_FILTER_MAX;
+	const __u32 mask = (1 << DDOS_FILTER_MAX) - 1;
 	bool started = false;
+	__u32 word, val;
+	__u64 value;
+	int i, port;
 
-	/* printf("{\n"); */
-	while (bpf_map_get_next_key(portfd, &key, &next_key) == 0) {
-		if ((bpf_map_lookup_elem(portfd, &key, &value)) != 0) {
+	for (word = 0; word < PORT_BITMAP_WORDS; word++) {
+		if ((bpf_map_lookup_elem(portfd, &word, &value)) != 0) {
 			fprintf(stderr,
-				"ERR: bpf_map_lookup_elem(%d) failed key:0x%X\n", portfd, key);
+				"ERR: bpf_map_lookup_elem(%d) failed key:0x%X\n", portfd, word);
+			continue;
 		}
+		if (!value)
+			continue;
 
-		if (value) {
+		for (i = 0; i < ports_per_word; i++) {
+			val = (value >> (i * DDOS_FILTER_MAX)) & mask;
+			if (!val)
+				continue;
+			port = word * ports_per_word + i;
 			printf("%s", started ? "," : "");
 			started = true;
-			blacklist_print_port(key, value, countfds);
+			blacklist_print_port(port, val, countfds);
 		}
-		key = next_key;
 	}
 }
 
+/*** Bulk loading ***/
+
+#ifndef ENOTSUPP
+#define ENOTSUPP 524 /* Kernel internal errno, can leak to userspace */
+#endif
+
+#define BULK_BATCH 4096
+
+struct bulk_ctx {
+	int fd_exact;
+	int fd_lpm[2]; /* AF_INET and AF_INET6 */
+	unsigned int action;
+	bool use_batch;
+	bool replace;
+
+	/* Local copy of Bloom filter bits, written before the entries */
+	int fd_bloom;
+	__u64 bloom[BLOOM_WORDS];
+	__u8 bloom_dirty[BLOOM_WORDS];
+
+	/* Counter indexes in use, by the live or the replacement set */
+	int fd_counters;
+	__u64 idx_used[BLACKLIST_IDX_WORDS];
+
+	/* Pending exact-match keys, and their counter index values */
+	__u32 keys[BULK_BATCH];
+	__u32 values[BULK_BATCH];
+	__u32 cnt;
+
+	/* Stats */
+	__u64 lines, exact, prefixes, invalid, failed;
+	__u64 update_ns;
+};
+
+/* Flush pending exact-match keys.  Uses BPF_MAP_UPDATE_BATCH (kernel
+ * v5.6+) which needs a single syscall per BULK_BATCH entries, and
+ * falls back to a syscall per entry on older kernels.
+ */
+static void bulk_flush_exact(struct bulk_ctx *ctx)
+{
+	__u32 count = ctx->cnt, i;
+	__u64 start = gettime();
+
+	if (!ctx->cnt)
+		return;
+
+	if (ctx->action == ACTION_DEL) {
+		for (i = 0; i < ctx->cnt; i++)
+			if (bpf_map_delete_elem(ctx->fd_exact, &ctx->keys[i]))
+				ctx->failed++;
+		goto out;
+	}
+
+	/* Also on replace, as the new set must pass the live filter
+	 * when swapped in.  Stale bits are removed after the swap.
+	 */
+	for (i = 0; i < ctx->cnt; i++)
+		bloom_set_bits(ctx->bloom, ctx->bloom_dirty, ctx->keys[i]);
+	if (bloom_write(ctx->fd_bloom, ctx->bloom, ctx->bloom_dirty, false))
+		ctx->failed++;
+
+	if (ctx->use_batch) {
+		if (!bpf_map_update_batch(ctx->fd_exact, ctx->keys,
+					  ctx->values, &count, BPF_ANY, 0))
+			goto out;
+
+		if (count == 0 && (errno == EINVAL || errno == ENOTSUPP)) {
+			if (verbose)
+				fprintf(stderr, "WARN: no batch map update "
+					"support, fallback to single updates\n");
+			ctx->use_batch = false;
+		} else {
+			fprintf(stderr, "ERR: batch update stopped after %u"
+				" of %u entries errno(%d/%s)\n",
+				count, ctx->cnt, errno, strerror(errno));
+			ctx->failed += ctx->cnt - count;
+			goto out;
+		}
+	}
+
+	for (i = 0; i < ctx->cnt; i++)
+		if (bpf_map_update_elem(ctx->fd_exact, &ctx->keys[i],
+					&ctx->values[i], BPF_ANY))
+			ctx->failed++;
+out:
+	ctx->update_ns += gettime() - start;
+	ctx->cnt = 0;
+}
+
+/* Re-adding a listed key also gets a new counter, as the batch update
+ * overwrites the value.  The old index is free again on the next scan.
+ * The replacement set shares indexes with the live set until swapped
+ * in, thus its counters are only reset after the swap.
+ */
+static __u32 bulk_counter_alloc(struct bulk_ctx *ctx)
+{
+	__u32 idx = blacklist_idx_alloc(ctx->idx_used);
+
+	if (!ctx->replace && blacklist_counter_reset(ctx->fd_counters, idx))
+		ctx->failed++;
+	return idx;
+}
+
+/* Reset counters of all indexes used by the (swapped in) new set */
+static void bulk_counters_reset(struct bulk_ctx *ctx)
+{
+	__u32 idx;
+
+	for (idx = 0; idx < BLACKLIST_COUNTER_SHARED; idx++)
+		if (ctx->idx_used[idx / 64] & (1ULL << (idx % 64)) &&
+		    blacklist_counter_reset(ctx->fd_counters, idx))
+			ctx->failed++;
+}
+
+static void bulk_add_line(struct bulk_ctx *ctx, char *line)
+{
+	struct in6_addr addr;
+	__u32 prefixlen;
+	char *tok;
+	int family, res;
+	__u64 start;
+
+	ctx->lines++;
+	tok = strtok(line, " \t\r\n");
+	if (!tok || tok[0] == '#')
+		return;
+
+	if (parse_ip_prefix(tok, &family, &addr, &prefixlen)) {
+		ctx->invalid++;
+		return;
+	}
+
+	if (family == AF_INET && prefixlen == 32) {
+		memcpy(&ctx->keys[ctx->cnt], &addr, sizeof(__u32));
+		if (ctx->action == ACTION_ADD)
+			ctx->values[ctx->cnt] = bulk_counter_alloc(ctx);
+		ctx->cnt++;
+		ctx->exact++;
+		if (ctx->cnt == BULK_BATCH)
+			bulk_flush_exact(ctx);
+		return;
+	}
+
+	/* LPM trie have no batch support, update one by one */
+	start = gettime();
+	res = blacklist_prefix_modify(
+		ctx->fd_lpm[family == AF_INET6], family, &addr, prefixlen,
+		ctx->action);
+	ctx->update_ns += gettime() - start;
+	if (res)
+		ctx->failed++;
+	else
+		ctx->prefixes++;
+}
+
+static int bulk_load(struct bulk_ctx *ctx, const char *file)
+{
+	FILE *fp = stdin;
+	char *line = NULL;
+	size_t len = 0;
+	int save_verbose = verbose;
+
+	if (strcmp(file, "-") != 0) {
+		fp = fopen(file, "r");
+		if (!fp) {
+			fprintf(stderr, "ERR: cannot open %s err(%d):%s\n",
+				file, errno, strerror(errno));
+			return EXIT_FAIL;
+		}
+	}
+
+	verbose = 0; /* Avoid per entry output */
+	while (getline(&line, &len, fp) != -1)
+		bulk_add_line(ctx, line);
+	bulk_flush_exact(ctx);
+	verbose = save_verbose;
+
+	free(line);
+	if (fp != stdin)
+		fclose(fp);
+	return EXIT_OK;
+}
+
+/* Create an empty map with same properties as the existing fd */
+static int create_map_like(int fd)
+{
+	struct bpf_map_info info = {};
+	__u32 info_len = sizeof(info);
+	int new_fd;
+
+	if (bpf_obj_get_info_by_fd(fd, &info, &info_len)) {
+		fprintf(stderr, "ERR: cannot get map info err(%d):%s\n",
+			errno, strerror(errno));
+		return -1;
+	}
+	new_fd = bpf_create_map_name(info.type, info.name, info.key_size,
+				     info.value_size, info.max_entries,
+				     info.map_flags);
+	if (new_fd < 0)
+		fprintf(stderr, "ERR: cannot create map err(%d):%s\n",
+			errno, strerror(errno));
+	return new_fd;
+}
+
+/* Atomically make fd_new the active exact-match set via the
+ * blacklist_set map-in-map, and re-pin it as file_blacklist.
+ */
+static int bulk_swap_in(int fd_new)
+{
+	__u32 key = 0;
+	int fd_set;
+
+	fd_set = open_bpf_map(file_blacklist_set);
+	if (bpf_map_update_elem(fd_set, &key, &fd_new, BPF_ANY)) {
+		fprintf(stderr, "ERR: swap of blacklist set failed err(%d):%s\n",
+			errno, strerror(errno));
+		close(fd_set);
+		return EXIT_FAIL_MAP;
+	}
+	close(fd_set);
+
+	/* XDP now use the new set, make the pinned file follow */
+	if (unlink(file_blacklist) < 0 || bpf_obj_pin(fd_new, file_blacklist)) {
+		fprintf(stderr, "ERR: cannot re-pin %s err(%d):%s\n",
+			file_blacklist, errno, strerror(errno));
+		return EXIT_FAIL_MAP_FILE;
+	}
+	return EXIT_OK;
+}
+
+static int blacklist_bulk(const char *file, unsigned int action,
+			  bool replace)
+{
+	struct bulk_ctx *ctx;
+	__u64 start, total;
+	double sec;
+	int fd_old, res;
+
+	ctx = calloc(1, sizeof(*ctx));
+	if (!ctx)
+		return EXIT_FAIL;
+	ctx->action    = action;
+	ctx->use_batch = true;
+	ctx->replace   = replace;
+	ctx->fd_bloom  = open_bpf_map(file_blacklist_bloom);
+	ctx->fd_counters = open_bpf_map(file_blacklist_counters);
+	ctx->fd_lpm[0] = open_bpf_map(file_blacklist_lpm4);
+	ctx->fd_lpm[1] = open_bpf_map(file_blacklist_lpm6);
+	fd_old = open_bpf_map(file_blacklist);
+
+	start = gettime();
+	if (replace) {
+		ctx->fd_exact = create_map_like(fd_old);
+		if (ctx->fd_exact < 0) {
+			res = EXIT_FAIL_MAP;
+			goto out;
+		}
+		res = bulk_load(ctx, file);
+		if (res == EXIT_OK)
+			res = bulk_swap_in(ctx->fd_exact);
+		if (res == EXIT_OK)
+			bulk_counters_reset(ctx);
+		if (res == EXIT_OK && bloom_rebuild(ctx->fd_bloom,
+						    ctx->fd_exact) < 0)
+			res = EXIT_FAIL_MAP;
+		close(ctx->fd_exact);
+	} else {
+		ctx->fd_exact = fd_old;
+		if (action == ACTION_ADD)
+			blacklist_idx_scan(fd_old, ctx->idx_used);
+		res = bulk_load(ctx, file);
+	}
+	total = gettime() - start;
+
+	sec = (double)total / NANOSEC_PER_SEC;
+	printf("Bulk %s%s: %llu lines, %llu exact, %llu prefixes,"
+	       " %llu invalid, %llu failed\n",
+	       action == ACTION_DEL ? "delete" : "add",
+	       replace ? " (replace)" : "",
+	       ctx->lines, ctx->exact, ctx->prefixes,
+	       ctx->invalid, ctx->failed);
+	printf(" Time %.3f sec (map updates %.3f sec, method:%s):"
+	       " %.0f entries/sec\n",
+	       sec, (double)ctx->update_ns / NANOSEC_PER_SEC,
+	       ctx->use_batch ? "batch" : "single",
+	       sec > 0 ? (ctx->exact + ctx->prefixes) / sec : 0);
+	if (replace && ctx->prefixes)
+		printf(" NOTICE: prefix entries are added to the live LPM"
+		       " maps, only the exact-match set is replaced\n");
+out:
+	close(fd_old);
+	close(ctx->fd_lpm[0]);
+	close(ctx->fd_lpm[1]);
+	close(ctx->fd_bloom);
+	close(ctx->fd_counters);
+	free(ctx);
+	return res;
+}
+
 int main(int argc, char **argv)
 {
-#	define STR_MAX 42 /* For trivial input validation */
+#	define STR_MAX 64 /* For trivial input validation */
 	char _ip_string_buf[STR_MAX] = {};
 	char *ip_string = NULL;
 
 	unsigned int action = 0;
 	bool stats = false;
 	int interval = 1;
-	int fd_blacklist;
+	int fd_blacklist, fd_counters;
 	int fd_verdict;
 	int fd_port_blacklist;
 	int fd_port_blacklist_count;
 	int longindex = 0;
 	bool do_list = false;
+	bool replace = false;
+	char *bulk_file = NULL;
+	char *ratelimit = NULL;
+	char *bloom = NULL;
+	char *auto_pps = NULL;
+	bool aggregate24 = false;
+	__u64 rate = 0, burst = 0;
+	bool rate_opt = false;
 	int opt;
 	int dport = 0;
 	int proto = IPPROTO_TCP;
 	int filter = DDOS_FILTER_TCP;
 
-	while ((opt = getopt_long(argc, argv, "adshi:t:u:",
+	while ((opt = getopt_long(argc, argv, "adshi:t:u:f:Rr:b:L:B:A:gM:",
 				  long_options, &longindex)) != -1) {
 		switch (opt) {
 		case 'a':
@@ -320,6 +820,37 @@ int main(int argc, char **argv)
 		case 'l':
 			do_list = true;
 			break;
+		case 'f':
+			bulk_file = optarg;
+			break;
+		case 'R':
+			replace = true;
+			break;
+		case 'r':
+			rate = strtoull(optarg, NULL, 10);
+			rate_opt = true;
+			break;
+		case 'b':
+			burst = strtoull(optarg, NULL, 10);
+			break;
+		case 'L':
+			ratelimit = optarg;
+			break;
+		case 'B':
+			bloom = optarg;
+			break;
+		case 'A':
+			auto_pps = optarg;
+			break;
+		case 'M':
+			metrics = metrics_open(optarg);
+			if (!metrics)
+				return EXIT_FAIL_OPTION;
+			stats = true;
+			break;
+		case 'g':
+			aggregate24 = true;
+			break;
 		case 'h':
 		fail_opt:
 		default:
@@ -329,6 +860,116 @@ int main(int argc, char **argv)
 	}
 	fd_verdict = open_bpf_map(file_verdict);
 
+	/* Rate limit mode on/off */
+	if (ratelimit) {
+		int fd_config = open_bpf_map(file_config);
+		int res;
+
+		if (!strcmp(ratelimit, "on"))
+			res = config_modify(fd_config, DDOS_CFG_RATELIMIT, 0,
+					    false);
+		else if (!strcmp(ratelimit, "off"))
+			res = config_modify(fd_config, 0, DDOS_CFG_RATELIMIT,
+					    false);
+		else {
+			fprintf(stderr, "ERR: --ratelimit on|off\n");
+			goto fail_opt;
+		}
+		close(fd_config);
+		if (res)
+			return res;
+	}
+
+	/* Bloom prefilter on/off, "on" also rebuilds the filter */
+	if (bloom) {
+		int fd_config = open_bpf_map(file_config);
+		int res;
+
+		if (!strcmp(bloom, "on")) {
+			int fd_bloom = open_bpf_map(file_blacklist_bloom);
+			long nr;
+
+			fd_blacklist = open_bpf_map(file_blacklist);
+			nr = bloom_rebuild(fd_bloom, fd_blacklist);
+			close(fd_blacklist);
+			close(fd_bloom);
+			if (nr < 0) {
+				close(fd_config);
+				return EXIT_FAIL_MAP;
+			}
+			if (verbose)
+				fprintf(stderr, "Bloom filter rebuilt from"
+					" %ld entries\n", nr);
+			res = config_modify(fd_config, DDOS_CFG_BLOOM, 0,
+					    false);
+		} else if (!strcmp(bloom, "off")) {
+			res = config_modify(fd_config, 0, DDOS_CFG_BLOOM,
+					    false);
+		} else {
+			fprintf(stderr, "ERR: --bloom on|off\n");
+			goto fail_opt;
+		}
+		close(fd_config);
+		if (res)
+			return res;
+	}
+
+	/* Heavy-hitter companion mode, does not return unless disabling */
+	if (auto_pps) {
+		__u64 pps = strtoull(auto_pps, NULL, 10);
+
+		if (!pps) {
+			int fd_config = open_bpf_map(file_config);
+			int res;
+
+			res = config_modify(fd_config, 0, DDOS_CFG_HH |
+					    DDOS_CFG_HH_PREFIX24, false);
+			close(fd_config);
+			return res;
+		}
+		if (interval < 1)
+			interval = 1;
+		auto_blacklist_poll(pps, interval, aggregate24);
+	}
+
+	/* Per prefix rate config, buckets pickup change via gen.
+	 * Delete via: --ip PREFIX --rate 0 --del
+	 */
+	if (rate_opt) {
+		int fd_prefix, fd_config, res;
+
+		if (!ip_string || !action) {
+			fprintf(stderr,
+				"ERR: --rate require --ip PREFIX and --add/--del\n");
+			goto fail_opt;
+		}
+		fd_prefix = open_bpf_map(file_ratelimit_prefix);
+		res = ratelimit_modify(fd_prefix, ip_string, rate, burst,
+				       action);
+		close(fd_prefix);
+		if (res == EXIT_OK) {
+			fd_config = open_bpf_map(file_config);
+			res = config_modify(fd_config, 0, 0, true);
+			close(fd_config);
+		}
+		return res;
+	}
+
+	/* Bulk update blacklist, default action is add */
+	if (bulk_file) {
+		if (action == (ACTION_ADD | ACTION_DEL) ||
+		    (replace && action == ACTION_DEL)) {
+			fprintf(stderr, "ERR: invalid action for --file\n");
+			goto fail_opt;
+		}
+		return blacklist_bulk(bulk_file, action ? action : ACTION_ADD,
+				      replace);
+	}
+	if (replace) {
+		fprintf(stderr, "ERR: --replace require --file\n");
+		goto fail_opt;
+	}
+
 	/* Update blacklist */
 	if (action) {
 		int res = 0;
@@ -340,8 +981,38 @@ int main(int argc, char **argv)
 		}
 
 		if (ip_string) {
-			fd_blacklist = open_bpf_map(file_blacklist);
-			res = blacklist_modify(fd_blacklist, ip_string, action);
+			struct in6_addr addr; /* also big enough for IPv4 */
+			__u32 prefixlen;
+			int family;
+
+			res = parse_ip_prefix(ip_string, &family, &addr,
+					      &prefixlen);
+			if (res)
+				return res;
+
+			if (family == AF_INET && prefixlen == 32) {
+				/* Exact match uses the hash, also for "/32" */
+				int fd_bloom = open_bpf_map(file_blacklist_bloom);
+
+				fd_blacklist = open_bpf_map(file_blacklist);
+				fd_counters  = open_bpf_map(file_blacklist_counters);
+				res = blacklist_key_modify(fd_blacklist,
+							   fd_bloom,
+							   fd_counters,
+							   addr.s6_addr32[0],
+							   action);
+				close(fd_counters);
+				close(fd_bloom);
+			} else {
+				fd_blacklist = open_bpf_map(
+					family == AF_INET6 ?
+					file_blacklist_lpm6 :
+					file_blacklist_lpm4);
+				res = blacklist_prefix_modify(fd_blacklist,
+							      family, &addr,
+							      prefixlen,
+							      action);
+			}
 			close(fd_blacklist);
 		}
 
@@ -368,7 +1039,17 @@ int main(int argc, char **argv)
 		int i;
 
 		fd_blacklist = open_bpf_map(file_blacklist);
-		blacklist_list_all_ipv4(fd_blacklist);
+		fd_counters  = open_bpf_map(file_blacklist_counters);
+		blacklist_list_all_ipv4(fd_blacklist, fd_counters);
+		close(fd_blacklist);
+		close(fd_counters);
+
+		fd_blacklist = open_bpf_map(file_blacklist_lpm4);
+		blacklist_list_all_lpm(fd_blacklist, AF_INET);
+		close(fd_blacklist);
+
+		fd_blacklist = open_bpf_map(file_blacklist_lpm6);
+		blacklist_list_all_lpm(fd_blacklist, AF_INET6);
 		close(fd_blacklist);
 
 		fd_port_blacklist = open_bpf_map(file_port_blacklist);
@@ -2,6 +2,8 @@
 #define __XDP_DDOS01_BLACKLIST_COMMON_H
 
 #include <time.h>
+#include <stdint.h>
+#include "hash_func01.h"
 
 /* Exit return codes */
 #define	EXIT_OK			0
@@ -24,11 +26,23 @@ static int verbose = 1;
  * Gotcha need to mount:
  *   mount -t bpf bpf /sys/fs/bpf/
  */
-static const char *file_blacklist = "/sys/fs/bpf/ddos_blacklist";
-static const char *file_verdict   = "/sys/fs/bpf/ddos_blacklist_stat_verdict";
-
-static const char *file_port_blacklist = "/sys/fs/bpf/ddos_port_blacklist";
-static const char *file_port_blacklist_count[] = {
+static const char *const file_blacklist = "/sys/fs/bpf/ddos_blacklist";
+static const char *const file_verdict   = "/sys/fs/bpf/ddos_blacklist_stat_verdict";
+
+static const char *const file_blacklist_counters = "/sys/fs/bpf/ddos_blacklist_counters";
+static const char *const file_blacklist_bloom = "/sys/fs/bpf/ddos_blacklist_bloom";
+static const char *const file_hh_sketch     = "/sys/fs/bpf/ddos_hh_sketch";
+static const char *const file_hh_candidates = "/sys/fs/bpf/ddos_hh_candidates";
+static const char *const file_blacklist_set  = "/sys/fs/bpf/ddos_blacklist_set";
+static const char *const file_blacklist_lpm4 = "/sys/fs/bpf/ddos_blacklist_lpm4";
+static const char *const file_blacklist_lpm6 = "/sys/fs/bpf/ddos_blacklist_lpm6";
+
+static const char *const file_config = "/sys/fs/bpf/ddos_config";
+static const char *const file_ratelimit_prefix  = "/sys/fs/bpf/ddos_ratelimit_prefix";
+static const char *const file_ratelimit_buckets = "/sys/fs/bpf/ddos_ratelimit_buckets";
+
+static const char *const file_port_blacklist = "/sys/fs/bpf/ddos_port_blacklist";
+static const char *const file_port_blacklist_count[] = {
 	"/sys/fs/bpf/ddos_port_blacklist_count_tcp",
 	"/sys/fs/bpf/ddos_port_blacklist_count_udp"
 };
@@ -64,14 +78,269 @@ enum {
 	DDOS_FILTER_MAX
 };
 
-static int blacklist_modify(int fd, char *ip_string, unsigned int action)
+/* The exact-match blacklist value is an index into the per-CPU
+ * blacklist_counters array (size must match _kern.c).  Each entry
+ * gets its own counter, allocated on add.  The in-use indexes are
+ * derived from the blacklist values, thus deleting an entry frees its
+ * counter, and no allocator state is kept in userspace.  When all
+ * counters are in use, further entries share the last (overflow)
+ * counter, BLACKLIST_COUNTER_SHARED.
+ */
+#define BLACKLIST_COUNTERS		8192
+#define BLACKLIST_COUNTER_SHARED	(BLACKLIST_COUNTERS - 1)
+#define BLACKLIST_IDX_WORDS		(BLACKLIST_COUNTERS / 64)
+
+/* Mark counter indexes used by the entries of the blacklist fd */
+static inline int blacklist_idx_scan(int fd, __u64 *used)
+{
+	__u32 key, next_key, idx, *prev = NULL;
+	int nr = 0;
+
+	memset(used, 0, BLACKLIST_IDX_WORDS * sizeof(*used));
+	while (bpf_map_get_next_key(fd, prev, &next_key) == 0) {
+		key = next_key;
+		prev = &key;
+		if (bpf_map_lookup_elem(fd, &key, &idx) ||
+		    idx >= BLACKLIST_COUNTER_SHARED)
+			continue;
+		used[idx / 64] |= 1ULL << (idx % 64);
+		nr++;
+	}
+	return nr;
+}
+
+/* Lowest free index, or the overflow counter when all are in use */
+static inline __u32 blacklist_idx_alloc(__u64 *used)
+{
+	__u32 word, idx;
+
+	for (word = 0; word < BLACKLIST_IDX_WORDS; word++) {
+		if (used[word] == ~0ULL)
+			continue;
+		idx = word * 64 + __builtin_ctzll(~used[word]);
+		if (idx >= BLACKLIST_COUNTER_SHARED)
+			break;
+		used[word] |= 1ULL << (idx % 64);
+		return idx;
+	}
+	return BLACKLIST_COUNTER_SHARED;
+}
+
+/* Zero a counter before handing it to a new entry */
+static inline int blacklist_counter_reset(int fd_counters, __u32 idx)
 {
 	unsigned int nr_cpus = bpf_num_possible_cpus();
-	__u64 values[nr_cpus];
-	__u32 key;
+	__u64 zero[nr_cpus];
+
+	if (idx == BLACKLIST_COUNTER_SHARED)
+		return EXIT_OK;
+	memset(zero, 0, sizeof(zero));
+	if (bpf_map_update_elem(fd_counters, &idx, zero, BPF_EXIST)) {
+		fprintf(stderr, "ERR: %s() idx:%u errno(%d/%s)\n",
+			__func__, idx, errno, strerror(errno));
+		return EXIT_FAIL_MAP_KEY;
+	}
+	return EXIT_OK;
+}
+
+/* Bloom filter over exact-match keys, must match _kern.c */
+#define BLOOM_BITS_SHIFT	21
+#define BLOOM_BITS		(1U << BLOOM_BITS_SHIFT)
+#define BLOOM_WORDS		(BLOOM_BITS / 64)
+#define BLOOM_NR_HASH		3
+#define BLOOM_SEED		0x9E3779B9U
+
+static inline __u32 bloom_bit(__u32 key, int i)
+{
+	return SuperFastHash((const char *)&key, sizeof(key),
+			     BLOOM_SEED * (i + 1)) & (BLOOM_BITS - 1);
+}
+
+/* Set key bits in a local bitmap copy, marking touched words dirty */
+static inline void bloom_set_bits(__u64 *bitmap, __u8 *dirty, __u32 key)
+{
+	__u32 bit;
+	int i;
+
+	for (i = 0; i < BLOOM_NR_HASH; i++) {
+		bit = bloom_bit(key, i);
+		bitmap[bit / 64] |= 1ULL << (bit % 64);
+		if (dirty)
+			dirty[bit / 64] = 1;
+	}
+}
+
+/* Write words (all if dirty is NULL), OR'ed with the live value
+ * unless replacing.  OR'ing avoids clearing bits of entries added
+ * concurrently, replace is used for rebuilding the filter.
+ */
+static inline int bloom_write(int fd, const __u64 *bitmap, __u8 *dirty,
+			      bool replace)
+{
+	__u64 value;
+	__u32 word;
+
+	for (word = 0; word < BLOOM_WORDS; word++) {
+		if (dirty && !dirty[word])
+			continue;
+		value = bitmap[word];
+		if (!replace) {
+			__u64 live = 0;
+
+			bpf_map_lookup_elem(fd, &word, &live);
+			if ((live | value) == live)
+				goto next;
+			value |= live;
+		}
+		if (bpf_map_update_elem(fd, &word, &value, BPF_ANY)) {
+			fprintf(stderr, "ERR: %s() word:%u errno(%d/%s)\n",
+				__func__, word, errno, strerror(errno));
+			return EXIT_FAIL_MAP_KEY;
+		}
+next:
+		if (dirty)
+			dirty[word] = 0;
+	}
+	return EXIT_OK;
+}
+
+/* Single key, read-modify-write of the live words */
+static inline int bloom_add(int fd, __u32 key)
+{
+	__u32 bit, word;
+	__u64 value;
+	int i;
+
+	for (i = 0; i < BLOOM_NR_HASH; i++) {
+		bit  = bloom_bit(key, i);
+		word = bit / 64;
+		value = 0;
+		bpf_map_lookup_elem(fd, &word, &value);
+		value |= 1ULL << (bit % 64);
+		if (bpf_map_update_elem(fd, &word, &value, BPF_ANY)) {
+			fprintf(stderr, "ERR: %s() word:%u errno(%d/%s)\n",
+				__func__, word, errno, strerror(errno));
+			return EXIT_FAIL_MAP_KEY;
+		}
+	}
+	return EXIT_OK;
+}
+
+/* Recalculate the filter from the blacklist keys, dropping stale
+ * bits of deleted entries.  Each new word is a superset of the bits
+ * needed by the keys walked, but a key added concurrently (after the
+ * walk) can have its bits overwritten.  Thus walk again after the
+ * write, and OR the bits of all keys back into the live words.  Adders
+ * set bits both before and after inserting their key, see
+ * blacklist_key_modify(), which closes the race except for the short
+ * time between write and re-walk.  Returns number of keys, or
+ * negative on error.
+ */
+static inline long bloom_rebuild(int fd_bloom, int fd_blacklist)
+{
+	__u32 key, next_key, *prev = NULL;
+	__u64 *bitmap;
+	__u8 *dirty;
+	long nr = 0;
+
+	bitmap = calloc(BLOOM_WORDS, sizeof(*bitmap));
+	dirty  = calloc(BLOOM_WORDS, sizeof(*dirty));
+	if (!bitmap || !dirty) {
+		nr = -ENOMEM;
+		goto out;
+	}
+
+	while (bpf_map_get_next_key(fd_blacklist, prev, &next_key) == 0) {
+		key = next_key;
+		prev = &key;
+		bloom_set_bits(bitmap, NULL, key);
+		nr++;
+	}
+	if (bloom_write(fd_bloom, bitmap, NULL, true)) {
+		nr = -EIO;
+		goto out;
+	}
+
+	/* Re-set bits of keys added while rebuilding */
+	memset(bitmap, 0, BLOOM_WORDS * sizeof(*bitmap));
+	prev = NULL;
+	while (bpf_map_get_next_key(fd_blacklist, prev, &next_key) == 0) {
+		key = next_key;
+		prev = &key;
+		bloom_set_bits(bitmap, dirty, key);
+	}
+	if (bloom_write(fd_bloom, bitmap, dirty, false))
+		nr = -EIO;
+out:
+	free(dirty);
+	free(bitmap);
+	return nr;
+}
+
+/* Key is the IPv4 address in network byte-order.  fd_bloom is
+ * optional (negative to skip), fd_bloom and fd_counters are only
+ * needed on add.  Adding walks the blacklist to find a free counter,
+ * thus concurrent adders can pick the same index, and share it.
+ */
+static inline int blacklist_key_modify(int fd, int fd_bloom, int fd_counters,
+				       __u32 key, unsigned int action)
+{
+	__u64 used[BLACKLIST_IDX_WORDS];
+	char ip_txt[INET_ADDRSTRLEN] = {0};
+	__u32 idx = 0;
 	int res;
 
-	memset(values, 0, sizeof(__u64) * nr_cpus);
+	if (action == ACTION_ADD) {
+		/* Bits before entry, entry must not be filtered out */
+		if (fd_bloom >= 0 && bloom_add(fd_bloom, key))
+			return EXIT_FAIL_MAP_KEY;
+		/* Already listed keeps its counter, and count */
+		if (bpf_map_lookup_elem(fd, &key, &idx) == 0) {
+			errno = EEXIST;
+			res = -1;
+		} else {
+			blacklist_idx_scan(fd, used);
+			idx = blacklist_idx_alloc(used);
+			if (blacklist_counter_reset(fd_counters, idx))
+				return EXIT_FAIL_MAP_KEY;
+			res = bpf_map_update_elem(fd, &key, &idx, BPF_NOEXIST);
+		}
+	} else if (action == ACTION_DEL) {
+		res = bpf_map_delete_elem(fd, &key);
+	} else {
+		fprintf(stderr, "ERR: %s() invalid action 0x%x\n",
+			__func__, action);
+		return EXIT_FAIL_OPTION;
+	}
+
+	inet_ntop(AF_INET, &key, ip_txt, sizeof(ip_txt));
+	if (res != 0) { /* 0 == success */
+		fprintf(stderr,
+			"%s() IP:%s key:0x%X errno(%d/%s)",
+			__func__, ip_txt, key, errno, strerror(errno));
+
+		if (errno == 17) {
+			fprintf(stderr, ": Already in blacklist\n");
+			return EXIT_OK;
+		}
+		fprintf(stderr, "\n");
+		return EXIT_FAIL_MAP_KEY;
+	}
+	/* And after, a concurrent bloom_rebuild() may have missed it */
+	if (action == ACTION_ADD && fd_bloom >= 0 && bloom_add(fd_bloom, key))
+		return EXIT_FAIL_MAP_KEY;
+	if (verbose)
+		fprintf(stderr, "%s() IP:%s key:0x%X idx:%u%s\n", __func__,
+			ip_txt, key, idx,
+			idx == BLACKLIST_COUNTER_SHARED ? " (shared)" : "");
+	return EXIT_OK;
+}
+
+static inline int blacklist_modify(int fd, int fd_bloom, int fd_counters,
+				   char *ip_string, unsigned int action)
+{
+	__u32 key;
+	int res;
 
 	/* Convert IP-string into 32-bit network byte-order value */
 	res = inet_pton(AF_INET, ip_string, &key);
@@ -84,11 +353,96 @@ static int blacklist_modify(int fd, char *ip_string, unsigned int action)
 			perror("inet_pton");
 		return EXIT_FAIL_IP;
 	}
+	return blacklist_key_modify(fd, fd_bloom, fd_counters, key, action);
+}
+
+/* Key layout of LPM trie maps, must match _kern.c */
+struct lpm_key_ipv4 {
+	__u32 prefixlen;
+	__u32 addr;
+};
+
+struct lpm_key_ipv6 {
+	__u32 prefixlen;
+	struct in6_addr addr;
+};
+
+/* Parse "IP" or "IP/prefixlen" for both IPv4 and IPv6.  Address bits
+ * beyond the prefix are cleared, to store a canonical key.
+ */
+static inline int parse_ip_prefix(const char *str, int *family,
+				  void *addr, __u32 *prefixlen)
+{
+	char buf[INET6_ADDRSTRLEN + 5];
+	unsigned int maxlen, len, i;
+	__u8 *a = addr;
+	char *slash, *end;
+
+	if (strlen(str) >= sizeof(buf)) {
+		fprintf(stderr, "ERR: IP prefix \"%s\" too long\n", str);
+		return EXIT_FAIL_IP;
+	}
+	strcpy(buf, str);
+
+	*family = strchr(buf, ':') ? AF_INET6 : AF_INET;
+	maxlen  = (*family == AF_INET6) ? 128 : 32;
+	len     = maxlen;
+
+	slash = strchr(buf, '/');
+	if (slash) {
+		*slash = '\0';
+		errno = 0;
+		len = strtoul(slash + 1, &end, 10);
+		if (errno || *end != '\0' || end == slash + 1 || len > maxlen) {
+			fprintf(stderr, "ERR: invalid prefix length in \"%s\"\n",
+				str);
+			return EXIT_FAIL_IP;
+		}
+	}
+
+	if (inet_pton(*family, buf, addr) <= 0) {
+		fprintf(stderr, "ERR: IP \"%s\" not in presentation format\n",
+			str);
+		return EXIT_FAIL_IP;
+	}
+
+	for (i = 0; i < maxlen / 8; i++) {
+		if (i * 8 >= len)
+			a[i] = 0;
+		else if (i * 8 + 8 > len)
+			a[i] &= 0xff << (8 - (len - i * 8));
+	}
+	*prefixlen = len;
+	return EXIT_OK;
+}
+
+/* Add/del CIDR prefix in LPM trie map fd, family selects key layout */
+static inline int blacklist_prefix_modify(int fd, int family,
+					  const void *addr, __u32 prefixlen,
+					  unsigned int action)
+{
+	char ip_txt[INET6_ADDRSTRLEN] = {0};
+	struct lpm_key_ipv4 key4;
+	struct lpm_key_ipv6 key6;
+	__u64 value = 0;
+	void *key;
+	int res;
+
+	if (family == AF_INET6) {
+		key6.prefixlen = prefixlen;
+		memcpy(&key6.addr, addr, sizeof(key6.addr));
+		key = &key6;
+	} else {
+		key4.prefixlen = prefixlen;
+		memcpy(&key4.addr, addr, sizeof(key4.addr));
+		key = &key4;
+	}
+	inet_ntop(family, addr, ip_txt, sizeof(ip_txt));
 
 	if (action == ACTION_ADD) {
-		res = bpf_map_update_elem(fd, &key, values, BPF_NOEXIST);
+		res = bpf_map_update_elem(fd, key, &value, BPF_NOEXIST);
 	} else if (action == ACTION_DEL) {
-		res = bpf_map_delete_elem(fd, &key);
+		res = bpf_map_delete_elem(fd, key);
 	} else {
 		fprintf(stderr, "ERR: %s() invalid action 0x%x\n",
 			__func__, action);
@@ -96,11 +450,10 @@ static int blacklist_modify(int fd, char *ip_string, unsigned int action)
 	}
 
 	if (res != 0) { /* 0 == success */
-		fprintf(stderr,
-			"%s() IP:%s key:0x%X errno(%d/%s)",
-			__func__, ip_string, key, errno, strerror(errno));
+		fprintf(stderr, "%s() prefix:%s/%u errno(%d/%s)",
+			__func__, ip_txt, prefixlen, errno, strerror(errno));
 
-		if (errno == 17) {
+		if (errno == EEXIST) {
 			fprintf(stderr, ": Already in blacklist\n");
 			return EXIT_OK;
 		}
@@ -108,20 +461,263 @@ static int blacklist_modify(int fd, char *ip_string, unsigned int action)
 		return EXIT_FAIL_MAP_KEY;
 	}
 	if (verbose)
-		fprintf(stderr,
-			"%s() IP:%s key:0x%X\n", __func__, ip_string, key);
+		fprintf(stderr, "%s() prefix:%s/%u\n",
+			__func__, ip_txt, prefixlen);
+	return EXIT_OK;
+}
+
+/* Layout of ddos_config and rate limit maps, must match _kern.c */
+#define DDOS_CFG_RATELIMIT	(1U << 0)
+#define DDOS_CFG_BLOOM		(1U << 1)
+#define DDOS_CFG_HH		(1U << 2)
+#define DDOS_CFG_HH_PREFIX24	(1U << 3)
+
+struct ddos_config {
+	__u32 flags;
+	__u32 ratelimit_gen;
+	__u32 hh_epoch;
+	__u32 hh_cand_thresh;
+};
+
+struct ratelimit_cfg {
+	__u64 ns_per_pkt;
+	__u64 burst_ns;
+};
+
+struct ratelimit_bucket {
+	__u64 credit_ns;
+	__u64 last_ns;
+	struct ratelimit_cfg cfg;
+	__u32 gen;
+	__u32 limited;
+};
+
+/* Extra verdict_cnt slot, see _kern.c */
+#define DDOS_VERDICT_RATELIMIT	(XDP_TX + 1)
+#define DDOS_VERDICT_MAX	(DDOS_VERDICT_RATELIMIT + 1)
+
+/* Set or clear flags, and bump ratelimit_gen to make buckets reload
+ * their rate config.
+ */
+static inline int config_modify(int fd, __u32 set, __u32 clear,
+				bool bump_gen)
+{
+	struct ddos_config cfg;
+	__u32 key = 0;
+
+	if (bpf_map_lookup_elem(fd, &key, &cfg)) {
+		fprintf(stderr, "ERR: %s() lookup failed errno(%d/%s)\n",
+			__func__, errno, strerror(errno));
+		return EXIT_FAIL_MAP_KEY;
+	}
+	cfg.flags |= set;
+	cfg.flags &= ~clear;
+	if (bump_gen)
+		cfg.ratelimit_gen++;
+
+	if (bpf_map_update_elem(fd, &key, &cfg, BPF_ANY)) {
+		fprintf(stderr, "ERR: %s() update failed errno(%d/%s)\n",
+			__func__, errno, strerror(errno));
+		return EXIT_FAIL_MAP_KEY;
+	}
+	if (verbose)
+		fprintf(stderr, "%s() flags:0x%x gen:%u\n",
+			__func__, cfg.flags, cfg.ratelimit_gen);
 	return EXIT_OK;
 }
 
+/* Add/del rate limit for an IPv4 prefix.  Burst is in packets, and
+ * zero burst means one second worth of packets.
+ */
+static inline int ratelimit_modify(int fd, const char *prefix, __u64 rate,
+				   __u64 burst, unsigned int action)
+{
+	struct ratelimit_cfg cfg = {};
+	struct lpm_key_ipv4 key;
+	struct in6_addr addr;
+	__u32 prefixlen;
+	int family, res;
+
+	/* Parse into room for IPv6, the key only has room for IPv4 */
+	res = parse_ip_prefix(prefix, &family, &addr, &prefixlen);
+	if (res)
+		return res;
+	if (family != AF_INET) {
+		fprintf(stderr, "ERR: rate limit only support IPv4\n");
+		return EXIT_FAIL_IP;
+	}
+	memcpy(&key.addr, &addr, sizeof(key.addr));
+	key.prefixlen = prefixlen;
+
+	if (action == ACTION_DEL) {
+		res = bpf_map_delete_elem(fd, &key);
+	} else if (action == ACTION_ADD) {
+		if (rate == 0 || rate > NANOSEC_PER_SEC) {
+			fprintf(stderr, "ERR: rate %llu pps out of range\n",
+				rate);
+			return EXIT_FAIL_OPTION;
+		}
+		if (!burst)
+			burst = rate;
+		cfg.ns_per_pkt = NANOSEC_PER_SEC / rate;
+		cfg.burst_ns   = burst * cfg.ns_per_pkt;
+		res = bpf_map_update_elem(fd, &key, &cfg, BPF_ANY);
+	} else {
+		fprintf(stderr, "ERR: %s() invalid action 0x%x\n",
+			__func__, action);
+		return EXIT_FAIL_OPTION;
+	}
+
+	if (res != 0) {
+		fprintf(stderr, "%s() prefix:%s errno(%d/%s)\n",
+			__func__, prefix, errno, strerror(errno));
+		return EXIT_FAIL_MAP_KEY;
+	}
+	if (verbose)
+		fprintf(stderr, "%s() prefix:%s rate:%llu burst:%llu\n",
+			__func__, prefix, rate, burst);
+	return EXIT_OK;
+}
+
+/* Heavy-hitter count-min sketch, must match _kern.c */
+#define HH_DEPTH	4
+#define HH_WIDTH_SHIFT	11
+#define HH_WIDTH	(1U << HH_WIDTH_SHIFT)
+#define HH_SEED1	0x85EBCA6BU
+#define HH_SEED2	0xC2B2AE35U
+#define HH_MAX_CAND	4096
+
+/* Kernel records candidates at a fraction of the threshold, as the
+ * per-CPU sketches each only see part of a source's traffic.
+ */
+#define HH_CAND_DIV	8
+
+struct hh_hit {
+	__u32 key; /* IP or /24 network, network byte-order */
+	__u64 est;
+};
+
+/* Count-min estimate from a sketch half, already summed over CPUs */
+static inline __u64 hh_estimate(const __u64 *half, __u32 key)
+{
+	__u32 h1, h2, i;
+	__u64 cnt, est = ~0ULL;
+
+	h1 = SuperFastHash((const char *)&key, sizeof(key), HH_SEED1);
+	h2 = SuperFastHash((const char *)&key, sizeof(key), HH_SEED2);
+	for (i = 0; i < HH_DEPTH; i++) {
+		cnt = half[i * HH_WIDTH + ((h1 + i * h2) & (HH_WIDTH - 1))];
+		if (cnt < est)
+			est = cnt;
+	}
+	return est;
+}
+
+/* Read (summed over CPUs) and zero a sketch half */
+static inline int hh_read_clear_half(int fd, __u32 half, __u64 *sum)
+{
+	unsigned int nr_cpus = bpf_num_possible_cpus();
+	__u64 values[nr_cpus], zero[nr_cpus];
+	__u32 i, key;
+	int cpu;
+
+	memset(zero, 0, sizeof(zero));
+	for (i = 0; i < HH_DEPTH * HH_WIDTH; i++) {
+		key = half * HH_DEPTH * HH_WIDTH + i;
+		sum[i] = 0;
+		if (bpf_map_lookup_elem(fd, &key, values))
+			return EXIT_FAIL_MAP_KEY;
+		for (cpu = 0; cpu < nr_cpus; cpu++)
+			sum[i] += values[cpu];
+		if (bpf_map_update_elem(fd, &key, zero, BPF_EXIST))
+			return EXIT_FAIL_MAP_KEY;
+	}
+	return EXIT_OK;
+}
+
+/* Close the current epoch, and return heavy hitters with an estimate
+ * of at least threshold packets.  Also (re)sets the kernel candidate
+ * threshold.  Returns number of hits, or
+ * negative on error.
+ */
+static inline int hh_epoch_collect(int fd_config, int fd_sketch, int fd_cand,
+				   __u64 threshold, struct hh_hit *hits,
+				   int max)
+{
+	static __u32 keys[HH_MAX_CAND];
+	struct ddos_config cfg;
+	__u32 key = 0, next_key, *prev = NULL;
+	__u32 old_epoch, seen;
+	__u64 *half, est;
+	int i, nr = 0, nr_hits = 0;
+
+	if (bpf_map_lookup_elem(fd_config, &key, &cfg))
+		return -EXIT_FAIL_MAP_KEY;
+	old_epoch = cfg.hh_epoch;
+	cfg.hh_epoch++;
+	cfg.hh_cand_thresh = threshold / HH_CAND_DIV ? : 1;
+	if (bpf_map_update_elem(fd_config, &key, &cfg, BPF_ANY))
+		return -EXIT_FAIL_MAP_KEY;
+	/* Let packets in-flight, which read the old epoch, finish */
+	usleep(1000);
+
+	half = calloc(HH_DEPTH * HH_WIDTH, sizeof(*half));
+	if (!half)
+		return -EXIT_FAIL;
+	if (hh_read_clear_half(fd_sketch, old_epoch & 1, half)) {
+		free(half);
+		return -EXIT_FAIL_MAP_KEY;
+	}
+
+	/* Collect keys first, as deleting while iterating restarts */
+	while (nr < HH_MAX_CAND &&
+	       bpf_map_get_next_key(fd_cand, prev, &next_key) == 0) {
+		keys[nr++] = next_key;
+		key = next_key;
+		prev = &key;
+	}
+	for (i = 0; i < nr; i++) {
+		/* XDP already moved the busiest keys to the new epoch
+		 * during this readout, these are still candidates.
+		 */
+		if (bpf_map_lookup_elem(fd_cand, &keys[i], &seen) ||
+		    (seen != old_epoch && seen != old_epoch + 1)) {
+			/* Stale, not seen in the closed epoch */
+			bpf_map_delete_elem(fd_cand, &keys[i]);
+			continue;
+		}
+		est = hh_estimate(half, keys[i]);
+		if (est >= threshold && nr_hits < max) {
+			hits[nr_hits].key = keys[i];
+			hits[nr_hits].est = est;
+			nr_hits++;
+		}
+	}
+	free(half);
+	return nr_hits;
+}
+
+/* Port blacklist bitmap layout, must match _kern.c */
+#define PORT_BITMAP_WORDS	(65536 * DDOS_FILTER_MAX / 64)
+
+static inline __u32 port_bitmap_bit(int dport, int fproto)
+{
+	return (dport * DDOS_FILTER_MAX) + fproto;
+}
+
+/* Set or clear the port bit, and create or remove its drop counter.
+ * The bitmap word is read-modify-write, thus concurrent cmdline
+ * invocations updating ports in the same word can race.
+ */
 static int blacklist_port_modify(int fd, int countfd, int dport, unsigned int action, int proto)
 {
 	unsigned int nr_cpus = bpf_num_possible_cpus();
-	__u64 curr_values[nr_cpus];
 	__u64 stat_values[nr_cpus];
-	__u64 value;
 	__u32 key = dport;
+	__u32 bit, word;
+	__u64 value;
+	int fproto;
 	int res;
-	int i;
 
 	if (action != ACTION_ADD && action != ACTION_DEL)
 	{
@@ -131,68 +727,60 @@ static int blacklist_port_modify(int fd, int countfd, int dport, unsigned int ac
 	}
 
 	if (proto == IPPROTO_TCP)
-		value = 1 << DDOS_FILTER_TCP;
+		fproto = DDOS_FILTER_TCP;
 	else if (proto == IPPROTO_UDP)
-		value = 1 << DDOS_FILTER_UDP;
+		fproto = DDOS_FILTER_UDP;
 	else {
-		fprintf(stderr, "ERR: %s() invalid action 0x%x\n",
-			__func__, action);
+		fprintf(stderr, "ERR: %s() invalid proto %d\n",
+			__func__, proto);
 		return EXIT_FAIL_OPTION;
 	}
 
-	memset(curr_values, 0, sizeof(__u64) * nr_cpus);
-
-	if (dport > 65535) {
+	if (dport < 0 || dport > 65535) {
 		fprintf(stderr,
 			"ERR: destination port \"%d\" invalid\n",
 			dport);
 		return EXIT_FAIL_PORT;
 	}
 
-	if (bpf_map_lookup_elem(fd, &key, curr_values)) {
+	bit  = port_bitmap_bit(dport, fproto);
+	word = bit / 64;
+	if (bpf_map_lookup_elem(fd, &word, &value)) {
 		fprintf(stderr,
-			"%s() 1 bpf_map_lookup_elem(key:0x%X) failed errno(%d/%s)",
-			__func__, key, errno, strerror(errno));
-	}
-
-	if (action == ACTION_ADD) {
-		/* add action set bit */
-		for (i=0; i<nr_cpus; i++)
-			curr_values[i] |= value;
-	} else if (action == ACTION_DEL) {
-		/* delete action clears bit */
-		for (i=0; i<nr_cpus; i++)
-			curr_values[i] &= ~(value);
+			"%s() bpf_map_lookup_elem(word:%u) failed errno(%d/%s)\n",
+			__func__, word, errno, strerror(errno));
+		return EXIT_FAIL_MAP_KEY;
 	}
 
-	res = bpf_map_update_elem(fd, &key, &curr_values, BPF_EXIST);
+	if (action == ACTION_ADD)
+		value |= 1ULL << (bit % 64);
+	else
+		value &= ~(1ULL << (bit % 64));
 
+	res = bpf_map_update_elem(fd, &word, &value, BPF_EXIST);
 	if (res != 0) { /* 0 == success */
 		fprintf(stderr,
-			"%s() dport:%d key:0x%X value errno(%d/%s)",
-			__func__, dport, key, errno, strerror(errno));
-
-		if (errno == 17) {
-			fprintf(stderr, ": Port already in blacklist\n");
-			return EXIT_OK;
-		}
-		fprintf(stderr, "\n");
+			"%s() dport:%d word:%u errno(%d/%s)\n",
+			__func__, dport, word, errno, strerror(errno));
 		return EXIT_FAIL_MAP_KEY;
 	}
 
-	if (action == ACTION_DEL) {
-		/* clear stats on delete */
+	if (action == ACTION_ADD) {
+		/* Start counting from zero, keep counter if already listed */
 		memset(stat_values, 0, sizeof(__u64) * nr_cpus);
-		res = bpf_map_update_elem(countfd, &key, &stat_values, BPF_EXIST);
-
-		if (res != 0) { /* 0 == success */
-			fprintf(stderr,
-				"%s() dport:%d key:0x%X value errno(%d/%s)",
-				__func__, dport, key, errno, strerror(errno));
-
-			fprintf(stderr, "\n");
-			return EXIT_FAIL_MAP_KEY;
-		}
+		res = bpf_map_update_elem(countfd, &key, &stat_values,
+					  BPF_NOEXIST);
+		if (res != 0 && errno != EEXIST)
+			fprintf(stderr, "WARN: %s() dport:%d no drop counter"
+				" errno(%d/%s)\n",
+				__func__, dport, errno, strerror(errno));
+	} else {
+		/* Remove stats on delete */
+		res = bpf_map_delete_elem(countfd, &key);
+		if (res != 0 && errno != ENOENT)
+			fprintf(stderr, "WARN: %s() dport:%d delete counter"
+				" errno(%d/%s)\n",
+				__func__, dport, errno, strerror(errno));
 	}
 
 	if (verbose)
@@ -1,4 +1,4 @@
-/*  XDP example: DDoS protection via IPv4 blacklist
+/*  XDP example: DDoS protection via IPv4/IPv6 blacklist
  *
  *  Copyright(c) 2017 Jesper Dangaard Brouer, Red Hat, Inc.
  *  Copyright(c) 2017 Andy Gospodarek, Broadcom Limited, Inc.
@@ -9,10 +9,12 @@
 #include <uapi/linux/if_packet.h>
 #include <uapi/linux/if_vlan.h>
 #include <uapi/linux/ip.h>
+#include <uapi/linux/ipv6.h>
 #include <uapi/linux/in.h>
 #include <uapi/linux/tcp.h>
 #include <uapi/linux/udp.h>
 #include "bpf_helpers.h"
+#include "hash_func01.h"
 
 enum {
 	DDOS_FILTER_TCP = 0,
@@ -25,49 +27,296 @@ struct vlan_hdr {
 	__be16 h_vlan_encapsulated_proto;
 };
 
+/* Exact-match IPv4 blacklist.  The value is an index into the
+ * blacklist_counters array, assigned by userspace.  Moving the drop
+ * counter out of the (per-CPU) hash value avoids paying
+ * 8 bytes x nr_cpus per entry.
+ */
 struct bpf_map_def SEC("maps") blacklist = {
-	.type        = BPF_MAP_TYPE_PERCPU_HASH,
+	.type        = BPF_MAP_TYPE_HASH,
 	.key_size    = sizeof(u32),
-	.value_size  = sizeof(u64), /* Drop counter */
+	.value_size  = sizeof(u32), /* Counter index */
 	.max_entries = 100000,
 	.map_flags   = BPF_F_NO_PREALLOC,
 };
 
 #define XDP_ACTION_MAX (XDP_TX + 1)
+/* Extra verdict_cnt slot counting the subset of XDP_DROP caused by
+ * rate limiting.  Must match cmdline tool.
+ */
+#define DDOS_VERDICT_RATELIMIT	XDP_ACTION_MAX
+#define DDOS_VERDICT_MAX	(DDOS_VERDICT_RATELIMIT + 1)
 
 /* Counter per XDP "action" verdict */
 struct bpf_map_def SEC("maps") verdict_cnt = {
 	.type = BPF_MAP_TYPE_PERCPU_ARRAY,
 	.key_size = sizeof(u32),
 	.value_size = sizeof(long),
-	.max_entries = XDP_ACTION_MAX,
+	.max_entries = DDOS_VERDICT_MAX,
 };
 
+/* Port blacklist as a shared bitmap, with DDOS_FILTER_MAX (2) bits
+ * per port: bit (port * 2 + fproto).  That is 16KB in total, instead
+ * of a percpu array with a u32 per port per CPU.  Must match common.h.
+ */
+#define PORT_BITMAP_WORDS	(65536 * DDOS_FILTER_MAX / 64)
+
 struct bpf_map_def SEC("maps") port_blacklist = {
-	.type        = BPF_MAP_TYPE_PERCPU_ARRAY,
+	.type        = BPF_MAP_TYPE_ARRAY,
 	.key_size    = sizeof(u32),
-	.value_size  = sizeof(u32),
-	.max_entries = 65536,
+	.value_size  = sizeof(u64),
+	.max_entries = PORT_BITMAP_WORDS,
 };
 
-/* Counter per XDP "action" verdict */
+/* Drop counters only exist for blacklisted ports (keyed by port),
+ * created and deleted by userspace together with the port bit.
+ */
+#define PORT_DROP_COUNT_MAX	1024
 
 /* TCP Drop counter */
 struct bpf_map_def SEC("maps") port_blacklist_drop_count_tcp = {
-	.type        = BPF_MAP_TYPE_PERCPU_ARRAY,
+	.type        = BPF_MAP_TYPE_PERCPU_HASH,
 	.key_size    = sizeof(u32),
 	.value_size  = sizeof(u64),
-	.max_entries = 65536,
+	.max_entries = PORT_DROP_COUNT_MAX,
 };
 
 /* UDP Drop counter */
 struct bpf_map_def SEC("maps") port_blacklist_drop_count_udp = {
+	.type        = BPF_MAP_TYPE_PERCPU_HASH,
+	.key_size    = sizeof(u32),
+	.value_size  = sizeof(u64),
+	.max_entries = PORT_DROP_COUNT_MAX,
+};
+
+/* CIDR prefix blacklists.  The key layout must follow struct
+ * bpf_lpm_trie_key, and match the cmdline tool (common.h).  The
+ * exact-match blacklist above is still consulted first, as a hash
+ * lookup is cheaper than a trie walk.
+ *
+ * LPM trie values cannot be per-CPU, thus counters are atomic.
+ */
+struct lpm_key_ipv4 {
+	u32 prefixlen;
+	u32 addr;
+};
+
+struct lpm_key_ipv6 {
+	u32 prefixlen;
+	struct in6_addr addr;
+};
+
+struct bpf_map_def SEC("maps") blacklist_lpm4 = {
+	.type        = BPF_MAP_TYPE_LPM_TRIE,
+	.key_size    = sizeof(struct lpm_key_ipv4),
+	.value_size  = sizeof(u64), /* Drop counter */
+	.max_entries = 100000,
+	.map_flags   = BPF_F_NO_PREALLOC,
+};
+
+struct bpf_map_def SEC("maps") blacklist_lpm6 = {
+	.type        = BPF_MAP_TYPE_LPM_TRIE,
+	.key_size    = sizeof(struct lpm_key_ipv6),
+	.value_size  = sizeof(u64), /* Drop counter */
+	.max_entries = 100000,
+	.map_flags   = BPF_F_NO_PREALLOC,
+};
+
+/* Indirection allowing the cmdline tool to atomically replace the
+ * whole exact-match blacklist with a freshly populated map.  Slot 0
+ * holds the active set, "blacklist" is the inner map template and
+ * the initial set.
+ */
+struct bpf_map_def SEC("maps") blacklist_set = {
+	.type          = BPF_MAP_TYPE_ARRAY_OF_MAPS,
+	.key_size      = sizeof(u32),
+	.value_size    = sizeof(u32), /* map fd from userspace */
+	.max_entries   = 1,
+	.inner_map_idx = 0, /* blacklist */
+};
+
+/* Behavior controlled by the cmdline tool.  Layout must match
+ * struct ddos_config in common.h.
+ */
+#define DDOS_CFG_RATELIMIT	(1U << 0)
+#define DDOS_CFG_BLOOM		(1U << 1)
+#define DDOS_CFG_HH		(1U << 2) /* heavy-hitter sketch */
+#define DDOS_CFG_HH_PREFIX24	(1U << 3) /* sketch /24 instead of IP */
+
+struct ddos_config {
+	u32 flags;
+	u32 ratelimit_gen; /* bumped on rate config changes */
+	u32 hh_epoch;      /* bumped by userspace, selects sketch half */
+	u32 hh_cand_thresh; /* per CPU count making a key a candidate */
+};
+
+struct bpf_map_def SEC("maps") ddos_config = {
+	.type        = BPF_MAP_TYPE_ARRAY,
+	.key_size    = sizeof(u32),
+	.value_size  = sizeof(struct ddos_config),
+	.max_entries = 1,
+};
+
+/* Per prefix rate limit, the userspace tool converts rate (pps) and
+ * burst into nanosec, to avoid divisions here.  Use 0.0.0.0/0 for a
+ * default rate; sources without a matching prefix are not limited.
+ */
+struct ratelimit_cfg {
+	u64 ns_per_pkt;	/* 10^9 / rate */
+	u64 burst_ns;	/* burst * ns_per_pkt */
+};
+
+struct bpf_map_def SEC("maps") ratelimit_prefix = {
+	.type        = BPF_MAP_TYPE_LPM_TRIE,
+	.key_size    = sizeof(struct lpm_key_ipv4),
+	.value_size  = sizeof(struct ratelimit_cfg),
+	.max_entries = 10000,
+	.map_flags   = BPF_F_NO_PREALLOC,
+};
+
+/* Token bucket per source IPv4, where tokens are nanosec of credit.
+ * The rate config is cached in the bucket, to avoid a trie lookup
+ * per packet, and refreshed when ratelimit_gen changes.
+ *
+ * Buckets are shared between CPUs and updated without locking, thus
+ * concurrent packets from one source on several CPUs can be
+ * slightly over-admitted.  That is acceptable for DDoS mitigation.
+ */
+struct ratelimit_bucket {
+	u64 credit_ns;
+	u64 last_ns;
+	struct ratelimit_cfg cfg;
+	u32 gen;
+	u32 limited; /* 0 if no prefix matched */
+};
+
+struct bpf_map_def SEC("maps") ratelimit_buckets = {
+	.type        = BPF_MAP_TYPE_LRU_HASH,
+	.key_size    = sizeof(u32),
+	.value_size  = sizeof(struct ratelimit_bucket),
+	.max_entries = 100000,
+};
+
+/* Compact drop counters for exact-match blacklist entries, allocated
+ * per entry by userspace.  The last slot is shared by entries added
+ * when all others are in use.  Must match BLACKLIST_COUNTERS in
+ * common.h.
+ */
+#define BLACKLIST_COUNTERS 8192
+
+struct bpf_map_def SEC("maps") blacklist_counters = {
+	.type        = BPF_MAP_TYPE_PERCPU_ARRAY,
+	.key_size    = sizeof(u32),
+	.value_size  = sizeof(u64),
+	.max_entries = BLACKLIST_COUNTERS,
+};
+
+/* Bloom filter over the exact-match blacklist keys, maintained by
+ * userspace when adding entries.  When enabled (DDOS_CFG_BLOOM), the
+ * hash is only consulted on a Bloom hit, which saves the hash lookup
+ * for legitimate traffic.  Deleted entries leave stale bits, which
+ * only cause false positives, until userspace rebuilds the filter.
+ *
+ * 2^21 bits (256KB) and 3 hash functions gives ~0.25% false
+ * positives with 100000 entries.  Must match common.h.
+ */
+#define BLOOM_BITS_SHIFT	21
+#define BLOOM_BITS		(1U << BLOOM_BITS_SHIFT)
+#define BLOOM_WORDS		(BLOOM_BITS / 64)
+#define BLOOM_NR_HASH		3
+#define BLOOM_SEED		0x9E3779B9U
+
+struct bpf_map_def SEC("maps") blacklist_bloom = {
+	.type        = BPF_MAP_TYPE_ARRAY,
+	.key_size    = sizeof(u32),
+	.value_size  = sizeof(u64),
+	.max_entries = BLOOM_WORDS,
+};
+
+static __always_inline
+bool bloom_maybe_member(u32 ip)
+{
+	u32 bit, word, i;
+	u64 *bits;
+
+#pragma clang loop unroll(full)
+	for (i = 0; i < BLOOM_NR_HASH; i++) {
+		bit  = SuperFastHash((const char *)&ip, sizeof(ip),
+				     BLOOM_SEED * (i + 1));
+		bit &= BLOOM_BITS - 1;
+		word = bit / 64;
+		bits = bpf_map_lookup_elem(&blacklist_bloom, &word);
+		if (!bits || !(*bits & (1ULL << (bit % 64))))
+			return false;
+	}
+	return true;
+}
+
+/* Heavy-hitter detection via a per-CPU count-min sketch of source
+ * IPs (or /24 prefixes) that pass the blacklists.  The sketch has
+ * two halves, XDP counts into half (hh_epoch & 1), while userspace
+ * reads and clears the other half after bumping the epoch.
+ *
+ * A sketch cannot enumerate its keys, thus keys whose (per-CPU)
+ * estimate reach hh_cand_thresh are recorded in hh_candidates, and
+ * userspace does the final estimate summed over all CPUs.
+ *
+ * Row indexes are derived from two hashes (h1 + row * h2), which
+ * keeps the per packet cost at two hash calculations.  Must match
+ * common.h.
+ */
+#define HH_DEPTH	4
+#define HH_WIDTH_SHIFT	11
+#define HH_WIDTH	(1U << HH_WIDTH_SHIFT)
+#define HH_SEED1	0x85EBCA6BU
+#define HH_SEED2	0xC2B2AE35U
+
+struct bpf_map_def SEC("maps") hh_sketch = {
 	.type        = BPF_MAP_TYPE_PERCPU_ARRAY,
 	.key_size    = sizeof(u32),
 	.value_size  = sizeof(u64),
-	.max_entries = 65536,
+	.max_entries = 2 * HH_DEPTH * HH_WIDTH,
+};
+
+struct bpf_map_def SEC("maps") hh_candidates = {
+	.type        = BPF_MAP_TYPE_LRU_HASH,
+	.key_size    = sizeof(u32),
+	.value_size  = sizeof(u32), /* hh_epoch last seen */
+	.max_entries = 4096,
 };
 
+static __always_inline
+void hh_sketch_update(u32 ip_src, struct ddos_config *cfg)
+{
+	u32 key = ip_src, epoch = cfg->hh_epoch;
+	u32 h1, h2, idx, i, *seen;
+	u64 *cnt, est = ~0ULL;
+
+	if (cfg->flags & DDOS_CFG_HH_PREFIX24)
+		key &= __constant_htonl(0xFFFFFF00);
+
+	h1 = SuperFastHash((const char *)&key, sizeof(key), HH_SEED1);
+	h2 = SuperFastHash((const char *)&key, sizeof(key), HH_SEED2);
+
+#pragma clang loop unroll(full)
+	for (i = 0; i < HH_DEPTH; i++) {
+		idx  = ((epoch & 1) * HH_DEPTH + i) * HH_WIDTH;
+		idx += (h1 + i * h2) & (HH_WIDTH - 1);
+		cnt = bpf_map_lookup_elem(&hh_sketch, &idx);
+		if (!cnt)
+			return;
+		*cnt += 1; /* percpu, no atomic needed */
+		if (*cnt < est)
+			est = *cnt;
+	}
+
+	if (est < cfg->hh_cand_thresh)
+		return;
+	seen = bpf_map_lookup_elem(&hh_candidates, &key);
+	if (!seen || *seen != epoch)
+		bpf_map_update_elem(&hh_candidates, &key, &epoch, BPF_ANY);
+}
+
 static inline struct bpf_map_def *drop_count_by_fproto(int fproto) {
 
 	switch (fproto) {
@@ -81,8 +330,6 @@ static inline struct bpf_map_def *drop_count_by_fproto(int fproto) {
 	return NULL;
 }
 
-// TODO: Add map for controlling behavior
-
 //#define DEBUG 1
 #ifdef  DEBUG
 /* Only use this for debug output. Notice output from bpf_trace_printk()
@@ -104,7 +351,7 @@ void stats_action_verdict(u32 action)
 {
 	u64 *value;
 
-	if (action >= XDP_ACTION_MAX)
+	if (action >= DDOS_VERDICT_MAX)
 		return;
 
 	value = bpf_map_lookup_elem(&verdict_cnt, &action);
@@ -112,6 +359,53 @@ void stats_action_verdict(u32 action)
 		*value += 1;
 }
 
+/* Token bucket check, returns true if packet is over the limit */
+static __always_inline
+bool ratelimit_ipv4(u32 ip_src, u32 gen)
+{
+	struct ratelimit_bucket *b, new_b = {};
+	struct ratelimit_cfg *cfg;
+	struct lpm_key_ipv4 key4;
+	u64 now = bpf_ktime_get_ns();
+	u64 credit;
+
+	b = bpf_map_lookup_elem(&ratelimit_buckets, &ip_src);
+	if (b && b->gen == gen) {
+		if (!b->limited)
+			return false;
+		/* Another CPU can have stored a later last_ns */
+		credit = b->credit_ns;
+		if (now > b->last_ns) {
+			credit += now - b->last_ns;
+			b->last_ns = now;
+		}
+		if (credit > b->cfg.burst_ns)
+			credit = b->cfg.burst_ns;
+		if (credit < b->cfg.ns_per_pkt) {
+			b->credit_ns = credit;
+			return true;
+		}
+		b->credit_ns = credit - b->cfg.ns_per_pkt;
+		return false;
+	}
+
+	/* New source or config changed, start with full burst */
+	key4.prefixlen = 32;
+	key4.addr = ip_src;
+	cfg = bpf_map_lookup_elem(&ratelimit_prefix, &key4);
+	new_b.gen = gen;
+	new_b.last_ns = now;
+	if (cfg) {
+		new_b.limited = 1;
+		new_b.cfg = *cfg;
+		new_b.credit_ns = cfg->burst_ns;
+		if (new_b.credit_ns >= cfg->ns_per_pkt)
+			new_b.credit_ns -= cfg->ns_per_pkt;
+	}
+	bpf_map_update_elem(&ratelimit_buckets, &ip_src, &new_b, BPF_ANY);
+	return false;
+}
+
 /* Parse Ethernet layer 2, extract network layer 3 offset and protocol
  *
  * Returns false on error and non-supported ether-type
@@ -165,10 +459,10 @@ u32 parse_port(struct xdp_md *ctx, u8 proto, void *hdr)
 	void *data_end = (void *)(long)ctx->data_end;
 	struct udphdr *udph;
 	struct tcphdr *tcph;
-	u32 *value;
-	u32 *drops;
+	u64 *value;
+	u64 *drops;
 	u32 dport;
-	u32 dport_idx;
+	u32 word, bit;
 	u32 fproto;
 
 	switch (proto) {
@@ -196,14 +490,15 @@ u32 parse_port(struct xdp_md *ctx, u8 proto, void *hdr)
 		return XDP_PASS;
 	}
 
-	dport_idx = dport;
-	value = bpf_map_lookup_elem(&port_blacklist, &dport_idx);
+	bit  = (dport * DDOS_FILTER_MAX) + fproto;
+	word = bit / 64;
+	value = bpf_map_lookup_elem(&port_blacklist, &word);
 
 	if (value) {
-		if (*value & (1 << fproto)) {
+		if (*value & (1ULL << (bit % 64))) {
 			struct bpf_map_def *drop_counter = drop_count_by_fproto(fproto);
 			if (drop_counter) {
-				drops = bpf_map_lookup_elem(drop_counter , &dport_idx);
+				drops = bpf_map_lookup_elem(drop_counter, &dport);
 				if (drops)
 					*drops += 1; /* Keep a counter for drop matches */
 			}
@@ -219,6 +514,11 @@ u32 parse_ipv4(struct xdp_md *ctx, u64 l3_offset)
 	void *data_end = (void *)(long)ctx->data_end;
 	void *data     = (void *)(long)ctx->data;
 	struct iphdr *iph = data + l3_offset;
+	struct lpm_key_ipv4 key4;
+	struct ddos_config *cfg;
+	u32 set_idx = 0;
+	u32 *cnt_idx;
+	void *active;
 	u64 *value;
 	u32 ip_src; /* type need to match map */
 
@@ -233,16 +533,71 @@ u32 parse_ipv4(struct xdp_md *ctx, u64 l3_offset)
 
 	bpf_debug("Valid IPv4 packet: raw saddr:0x%x\n", ip_src);
 
-	value = bpf_map_lookup_elem(&blacklist, &ip_src);
+	cfg = bpf_map_lookup_elem(&ddos_config, &set_idx);
+
+	if (cfg && (cfg->flags & DDOS_CFG_BLOOM) && !bloom_maybe_member(ip_src))
+		goto not_exact;
+
+	active = bpf_map_lookup_elem(&blacklist_set, &set_idx);
+	if (active)
+		cnt_idx = bpf_map_lookup_elem(active, &ip_src);
+	else
+		cnt_idx = bpf_map_lookup_elem(&blacklist, &ip_src);
+	if (cnt_idx) {
+		value = bpf_map_lookup_elem(&blacklist_counters, cnt_idx);
+		if (value)
+			/* Don't need __sync_fetch_and_add(); as percpu map */
+			*value += 1; /* Keep a counter for drop matches */
+		return XDP_DROP;
+	}
+
+not_exact:
+	key4.prefixlen = 32;
+	key4.addr = ip_src;
+	value = bpf_map_lookup_elem(&blacklist_lpm4, &key4);
 	if (value) {
-		/* Don't need __sync_fetch_and_add(); as percpu map */
-		*value += 1; /* Keep a counter for drop matches */
+		__sync_fetch_and_add(value, 1);
+		return XDP_DROP;
+	}
+
+	if (cfg && (cfg->flags & DDOS_CFG_HH))
+		hh_sketch_update(ip_src, cfg);
+
+	if (cfg && (cfg->flags & DDOS_CFG_RATELIMIT) &&
+	    ratelimit_ipv4(ip_src, cfg->ratelimit_gen)) {
+		stats_action_verdict(DDOS_VERDICT_RATELIMIT);
 		return XDP_DROP;
 	}
 
 	return parse_port(ctx, iph->protocol, iph + 1);
 }
 
+static __always_inline
+u32 parse_ipv6(struct xdp_md *ctx, u64 l3_offset)
+{
+	void *data_end = (void *)(long)ctx->data_end;
+	void *data     = (void *)(long)ctx->data;
+	struct ipv6hdr *ip6h = data + l3_offset;
+	struct lpm_key_ipv6 key6;
+	u64 *value;
+
+	if (ip6h + 1 > data_end) {
+		bpf_debug("Invalid IPv6 packet: L3off:%llu\n", l3_offset);
+		return XDP_ABORTED;
+	}
+
+	key6.prefixlen = 128;
+	key6.addr = ip6h->saddr;
+	value = bpf_map_lookup_elem(&blacklist_lpm6, &key6);
+	if (value) {
+		__sync_fetch_and_add(value, 1);
+		return XDP_DROP;
+	}
+
+	/* IPv6 extension headers are not skipped, only direct L4 */
+	return parse_port(ctx, ip6h->nexthdr, ip6h + 1);
+}
+
 static __always_inline
 u32 handle_eth_protocol(struct xdp_md *ctx, u16 eth_proto, u64 l3_offset)
 {
@@ -250,7 +605,9 @@ u32 handle_eth_protocol(struct xdp_md *ctx, u16 eth_proto, u64 l3_offset)
 	case ETH_P_IP:
 		return parse_ipv4(ctx, l3_offset);
 		break;
-	case ETH_P_IPV6: /* Not handler for IPv6 yet*/
+	case ETH_P_IPV6:
+		return parse_ipv6(ctx, l3_offset);
+		break;
 	case ETH_P_ARP:  /* Let OS handle ARP */
 		/* Fall-through */
 	default:
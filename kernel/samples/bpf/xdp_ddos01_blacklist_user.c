@@ -2,7 +2,7 @@
  *  Copyright(c) 2017 Andy Gospodarek, Broadcom Limited, Inc.
  */
 static const char *__doc__=
- " XDP: DDoS protection via IPv4 blacklist\n"
+ " XDP: DDoS protection via IPv4/IPv6 blacklist\n"
  "\n"
  "This program loads the XDP eBPF program into the kernel.\n"
  "Use the cmdline tool for add/removing source IPs to the blacklist\n"
@@ -45,7 +45,7 @@ static char ifname_buf[IF_NAMESIZE];
 static char *ifname = NULL;
 static int ifindex = -1;
 
-#define NR_MAPS 5
+#define NR_MAPS 15
 int maps_marked_for_export[MAX_MAPS] = { 0 };
 
 static const char* map_idx_to_export_filename(int idx)
@@ -69,6 +69,36 @@ static const char* map_idx_to_export_filename(int idx)
 	case 4: /* map_fd[4]: port_blacklist_drop_count_udp */
 		file =   file_port_blacklist_count[DDOS_FILTER_UDP];
 		break;
+	case 5: /* map_fd[5]: blacklist_lpm4 */
+		file =   file_blacklist_lpm4;
+		break;
+	case 6: /* map_fd[6]: blacklist_lpm6 */
+		file =   file_blacklist_lpm6;
+		break;
+	case 7: /* map_fd[7]: blacklist_set */
+		file =   file_blacklist_set;
+		break;
+	case 8: /* map_fd[8]: ddos_config */
+		file =   file_config;
+		break;
+	case 9: /* map_fd[9]: ratelimit_prefix */
+		file =   file_ratelimit_prefix;
+		break;
+	case 10: /* map_fd[10]: ratelimit_buckets */
+		file =   file_ratelimit_buckets;
+		break;
+	case 11: /* map_fd[11]: blacklist_counters */
+		file =   file_blacklist_counters;
+		break;
+	case 12: /* map_fd[12]: blacklist_bloom */
+		file =   file_blacklist_bloom;
+		break;
+	case 13: /* map_fd[13]: hh_sketch */
+		file =   file_hh_sketch;
+		break;
+	case 14: /* map_fd[14]: hh_candidates */
+		file =   file_hh_candidates;
+		break;
 	default:
 		break;
 	}
@@ -355,6 +385,17 @@ int main(int argc, char **argv)
 		return 1;
 	}
 
+	/* A new blacklist_set starts out with the blacklist map as the
+	 * active set.  If loaded from filesystem, keep the active set.
+	 */
+	if (maps_marked_for_export[7]) {
+		__u32 key = 0;
+
+		if (bpf_map_update_elem(map_fd[7], &key, &map_fd[0], BPF_ANY))
+			fprintf(stderr, "ERR: cannot init blacklist_set (%d):%s\n",
+				errno, strerror(errno));
+	}
+
 	/* Export maps that were not loaded from filesystem */
 	export_maps();
 
@@ -367,7 +408,8 @@ int main(int argc, char **argv)
 	}
 
 	/* Add something to the map as a test */
-	blacklist_modify(map_fd[0], "198.18.50.3", ACTION_ADD);
+	blacklist_modify(map_fd[0], map_fd[12], map_fd[11], "198.18.50.3",
+			 ACTION_ADD);
 	blacklist_port_modify(map_fd[2], map_fd[4], 80, ACTION_ADD, IPPROTO_UDP);
 
 	return EXIT_OK;
@@ -0,0 +1,330 @@
+/* OpenMetrics text exporter, shared by the sample stats tools
+ *
+ * Tools render their stats once per --sec interval, from the per-CPU
+ * map values they already collect and sum, into a text snapshot.  A
+ * scrape is served from that snapshot, so scrape cost doesn't depend on
+ * the number of CPUs and never touches the BPF maps.
+ *
+ * The --metrics SPEC option selects where the snapshot goes:
+ *  unix:PATH  HTTP on a unix socket (curl --unix-socket PATH)
+ *  tcp:PORT   HTTP on 127.0.0.1:PORT (Prometheus scrape target)
+ *  PATH       File, atomically replaced (node_exporter textfile dir)
+ *
+ * Connections are served from metrics_sleep(), which replaces the
+ * sleep(interval) of the stats loop, thus no threads are needed.
+ *
+ *  Copyright(c) 2017 Jesper Dangaard Brouer, Red Hat, Inc.
+ */
+#ifndef __XDP_METRICS_H
+#define __XDP_METRICS_H
+
+#include <errno.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <linux/types.h>
+
+#define METRICS_CONTENT_TYPE \
+	"application/openmetrics-text; version=1.0.0; charset=utf-8"
+
+struct metrics {
+	char *buf;		/* Snapshot being rendered */
+	size_t len;
+	size_t size;
+	char *snap;		/* Last complete snapshot, served */
+	size_t snap_len;
+	char *path;		/* File output */
+	int listen_fd;		/* Socket output, -1 when unused */
+};
+
+static inline void metrics_vprintf(struct metrics *m, const char *fmt,
+				   va_list ap)
+{
+	va_list ap2;
+	size_t size;
+	char *tmp;
+	int n;
+
+	va_copy(ap2, ap);
+	n = vsnprintf(m->buf + m->len, m->size - m->len, fmt, ap2);
+	va_end(ap2);
+	if (n < 0)
+		return;
+	if (m->len + n >= m->size) {
+		/* Grows to the size of a full snapshot, then stays */
+		size = (m->len + n + 1) * 2;
+		tmp = realloc(m->buf, size);
+		if (!tmp)
+			return;
+		m->buf = tmp;
+		m->size = size;
+		vsnprintf(m->buf + m->len, m->size - m->len, fmt, ap);
+	}
+	m->len += n;
+}
+
+static inline void metrics_printf(struct metrics *m, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	metrics_vprintf(m, fmt, ap);
+	va_end(ap);
+}
+
+/* Metric family header, type is "counter", "gauge" or "histogram".
+ * Counter samples must be named family_total.
+ */
+static inline void metrics_family(struct metrics *m, const char *family,
+				  const char *type, const char *help)
+{
+	if (!m)
+		return;
+	metrics_printf(m, "# TYPE %s %s\n# HELP %s %s\n",
+		       family, type, family, help);
+}
+
+/* Sample with name and labels given as format, e.g.
+ *  metrics_u64(m, cnt, "xdp_redirect_total{result=\"%s\"}", str);
+ */
+static inline void metrics_u64(struct metrics *m, __u64 value,
+			       const char *fmt, ...)
+{
+	va_list ap;
+
+	if (!m)
+		return;
+	va_start(ap, fmt);
+	metrics_vprintf(m, fmt, ap);
+	va_end(ap);
+	metrics_printf(m, " %llu\n", value);
+}
+
+static inline void metrics_double(struct metrics *m, double value,
+				  const char *fmt, ...)
+{
+	va_list ap;
+
+	if (!m)
+		return;
+	va_start(ap, fmt);
+	metrics_vprintf(m, fmt, ap);
+	va_end(ap);
+	metrics_printf(m, " %.3f\n", value);
+}
+
+/* Histogram from log2 buckets in nanosec, bucket n is [2^n, 2^(n+1)),
+ * except the last, which counts everything at or above 2^(nr-1) and only
+ * goes into +Inf.  Emitted in seconds with cumulative le buckets, as
+ * OpenMetrics wants.  Labels (without braces) may be empty.
+ */
+static inline void metrics_log2_hist_ns(struct metrics *m, const char *name,
+					const char *labels,
+					const unsigned long *slot, int nr,
+					unsigned long cnt, unsigned long sum_ns)
+{
+	const char *sep = labels[0] ? "," : "";
+	unsigned long cum = 0;
+	int i;
+
+	if (!m)
+		return;
+	for (i = 0; i < nr - 1; i++) {
+		cum += slot[i];
+		/* Skip empty leading buckets, keep the series short */
+		if (!cum && i < nr - 2)
+			continue;
+		metrics_printf(m, "%s_bucket{%s%sle=\"%.9g\"} %lu\n", name,
+			       labels, sep, (double)(1UL << (i + 1)) / 1e9,
+			       cum);
+	}
+	metrics_printf(m, "%s_bucket{%s%sle=\"+Inf\"} %lu\n", name, labels,
+		       sep, cnt);
+	metrics_printf(m, "%s_count{%s} %lu\n", name, labels, cnt);
+	metrics_printf(m, "%s_sum{%s} %.9f\n", name, labels, sum_ns / 1e9);
+}
+
+static inline void metrics_begin(struct metrics *m)
+{
+	if (m)
+		m->len = 0;
+}
+
+static inline bool metrics_write_file(struct metrics *m)
+{
+	char tmp[4096];
+	FILE *f;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", m->path);
+	f = fopen(tmp, "w");
+	if (!f)
+		return false;
+	if (fwrite(m->snap, 1, m->snap_len, f) != m->snap_len) {
+		fclose(f);
+		unlink(tmp);
+		return false;
+	}
+	fclose(f);
+	/* Readers never see a partial file */
+	return rename(tmp, m->path) == 0;
+}
+
+/* Completes the snapshot, that is served until the next one */
+static inline void metrics_end(struct metrics *m)
+{
+	char *tmp;
+
+	if (!m)
+		return;
+	metrics_printf(m, "# EOF\n");
+	tmp = m->snap;
+	m->snap = m->buf;
+	m->snap_len = m->len;
+	m->buf = tmp;
+	m->size = m->size > m->snap_len ? m->size : m->snap_len + 1;
+	/* Swapped buffers must both be big enough for next render */
+	tmp = realloc(m->buf, m->size);
+	if (tmp)
+		m->buf = tmp;
+	else
+		m->size = 0;
+	m->len = 0;
+
+	if (m->path && !metrics_write_file(m))
+		fprintf(stderr, "WARN: metrics write %s: %s\n", m->path,
+			strerror(errno));
+}
+
+static inline void metrics_serve_one(struct metrics *m)
+{
+	struct timeval tv = { .tv_sec = 0, .tv_usec = 100000 };
+	char req[1024], hdr[256];
+	int fd, n;
+
+	fd = accept(m->listen_fd, NULL, NULL);
+	if (fd < 0)
+		return;
+	/* A slow client must not stall the stats loop */
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+	/* Any request gets the snapshot, the path is not checked */
+	if (recv(fd, req, sizeof(req), 0) > 0) {
+		n = snprintf(hdr, sizeof(hdr),
+			     "HTTP/1.0 200 OK\r\n"
+			     "Content-Type: " METRICS_CONTENT_TYPE "\r\n"
+			     "Content-Length: %zu\r\n"
+			     "Connection: close\r\n\r\n", m->snap_len);
+		if (send(fd, hdr, n, MSG_NOSIGNAL) == n && m->snap_len)
+			send(fd, m->snap, m->snap_len, MSG_NOSIGNAL);
+	}
+	close(fd);
+}
+
+/* Replaces sleep(sec) in the stats loop, serving scrapes meanwhile */
+static inline void metrics_sleep(struct metrics *m, int sec)
+{
+	struct timespec now, end;
+	struct pollfd pfd;
+	long ms;
+
+	if (!m || m->listen_fd < 0) {
+		sleep(sec);
+		return;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	end.tv_sec += sec;
+	pfd.fd = m->listen_fd;
+	pfd.events = POLLIN;
+	while (1) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		ms = (end.tv_sec - now.tv_sec) * 1000 +
+			(end.tv_nsec - now.tv_nsec) / 1000000;
+		if (ms <= 0)
+			return;
+		if (poll(&pfd, 1, ms) > 0)
+			metrics_serve_one(m);
+	}
+}
+
+static inline int metrics_listen_unix(const char *path)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	int fd;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		return -1;
+	unlink(path); /* Stale socket from previous run */
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+	    listen(fd, 16)) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/* Loopback only, exporting is a local affair */
+static inline int metrics_listen_tcp(int port)
+{
+	struct sockaddr_in addr = {
+		.sin_family = AF_INET,
+		.sin_port = htons(port),
+		.sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+	};
+	int fd, one = 1;
+
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0)
+		return -1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+	    listen(fd, 16)) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/* Returns NULL on error, with message printed */
+static inline struct metrics *metrics_open(const char *spec)
+{
+	struct metrics *m;
+
+	m = calloc(1, sizeof(*m));
+	if (!m)
+		return NULL;
+	m->listen_fd = -1;
+
+	if (!strncmp(spec, "unix:", 5))
+		m->listen_fd = metrics_listen_unix(spec + 5);
+	else if (!strncmp(spec, "tcp:", 4))
+		m->listen_fd = metrics_listen_tcp(atoi(spec + 4));
+	else
+		m->path = strdup(spec);
+
+	if (m->listen_fd < 0 && !m->path) {
+		fprintf(stderr, "ERR: --metrics %s: %s\n", spec,
+			strerror(errno));
+		free(m);
+		return NULL;
+	}
+	return m;
+}
+
+#endif /* __XDP_METRICS_H */
@@ -0,0 +1,26 @@
+#ifndef __XDP_MONITOR_H__
+#define __XDP_MONITOR_H__
+
+/* Shared struct between _user & _kern */
+
+/* Key of redirect_tuple_cnt (BPF_MAP_TYPE_PERCPU_HASH), value is a u64
+ * event count.  err is the negative errno from the tracepoint, zero for
+ * success.  map_id is zero for plain bpf_redirect (non-map variant).
+ */
+struct redirect_key {
+	__s32 from_ifindex;
+	__s32 to_ifindex;
+	__s32 err;
+	__u32 map_id;
+};
+
+/* When full, new tuples are only counted in redirect_err_cnt */
+#define REDIRECT_TUPLE_MAX	1024
+
+/* Exception counts per XDP action, index exception_cnt.  Last slot
+ * counts action codes unknown at compile time.
+ */
+#define XDP_UNKNOWN		(XDP_REDIRECT + 1)
+#define XDP_ACTION_MAX		(XDP_UNKNOWN + 1)
+
+#endif /* __XDP_MONITOR_H__ */
@@ -4,13 +4,32 @@
  */
 #include <uapi/linux/bpf.h>
 #include "bpf_helpers.h"
+#include "xdp_monitor.h"
 
 struct bpf_map_def SEC("maps") redirect_err_cnt = {
 	.type = BPF_MAP_TYPE_PERCPU_ARRAY,
 	.key_size = sizeof(u32),
 	.value_size = sizeof(u64),
 	.max_entries = 2,
-	/* TODO: have entries for all possible errno's */
+	/* Breakdown per errno in redirect_tuple_cnt */
+};
+
+/* Per (from_ifindex, to_ifindex, err, map_id) breakdown.  Known tuples
+ * cost a hash lookup and a per-CPU increment, no atomics, cheap enough
+ * to leave attached.  Entries are never deleted, counters only grow.
+ */
+struct bpf_map_def SEC("maps") redirect_tuple_cnt = {
+	.type = BPF_MAP_TYPE_PERCPU_HASH,
+	.key_size = sizeof(struct redirect_key),
+	.value_size = sizeof(u64),
+	.max_entries = REDIRECT_TUPLE_MAX,
+};
+
+struct bpf_map_def SEC("maps") exception_cnt = {
+	.type = BPF_MAP_TYPE_PERCPU_ARRAY,
+	.key_size = sizeof(u32),
+	.value_size = sizeof(u64),
+	.max_entries = XDP_ACTION_MAX,
 };
 
 /* Tracepoint format: /sys/kernel/debug/tracing/events/xdp/xdp_redirect/format
@@ -36,6 +55,33 @@ enum {
 	XDP_REDIRECT_ERROR = 1
 };
 
+static __always_inline
+void xdp_redirect_collect_tuple(struct xdp_redirect_ctx *ctx)
+{
+	struct redirect_key key;
+	u64 *cnt, one = 1;
+
+	/* map_id is zero in the non-map tracepoints */
+	key.from_ifindex = ctx->ifindex;
+	key.to_ifindex   = ctx->to_ifindex;
+	key.err          = ctx->err;
+	key.map_id       = ctx->map_id;
+
+	cnt = bpf_map_lookup_elem(&redirect_tuple_cnt, &key);
+	if (cnt) {
+		*cnt += 1;
+		return;
+	}
+	/* First event of tuple.  Insert sets only this CPU's value.  On
+	 * failure another CPU raced us (retry lookup) or map is full.
+	 */
+	if (!bpf_map_update_elem(&redirect_tuple_cnt, &key, &one, BPF_NOEXIST))
+		return;
+	cnt = bpf_map_lookup_elem(&redirect_tuple_cnt, &key);
+	if (cnt)
+		*cnt += 1;
+}
+
 static __always_inline
 int xdp_redirect_collect_stat(struct xdp_redirect_ctx *ctx)
 {
@@ -51,6 +97,8 @@ int xdp_redirect_collect_stat(struct xdp_redirect_ctx *ctx)
 		return 0;
 	*cnt += 1;
 
+	xdp_redirect_collect_tuple(ctx);
+
 	return 0; /* Indicate event was filtered (no further processing)*/
 	/*
 	 * Returning 1 here would allow e.g. a perf-record tracepoint
@@ -87,3 +135,34 @@ int trace_xdp_redirect_map(struct xdp_redirect_ctx *ctx)
 	return xdp_redirect_collect_stat(ctx);
 }
 
+/* Tracepoint format: /sys/kernel/debug/tracing/events/xdp/xdp_exception/format
+ * Code in:                kernel/include/trace/events/xdp.h
+ */
+struct xdp_exception_ctx {
+	unsigned short common_type;	//	offset:0;  size:2; signed:0;
+	unsigned char common_flags;	//	offset:2;  size:1; signed:0;
+	unsigned char common_preempt_count;//	offset:3;  size:1; signed:0;
+	int common_pid;			//	offset:4;  size:4; signed:1;
+
+	int prog_id;			//	offset:8;  size:4; signed:1;
+	u32 act;			//	offset:12; size:4; signed:0;
+	int ifindex;			//	offset:16; size:4; signed:1;
+};
+
+/* Keep last: user side close()'s prog_fd[2] and [3] by index */
+SEC("tracepoint/xdp/xdp_exception")
+int trace_xdp_exception(struct xdp_exception_ctx *ctx)
+{
+	u32 key = ctx->act;
+	u64 *cnt;
+
+	if (key >= XDP_UNKNOWN)
+		key = XDP_UNKNOWN;
+
+	cnt = bpf_map_lookup_elem(&exception_cnt, &key);
+	if (!cnt)
+		return 0;
+	*cnt += 1;
+
+	return 0;
+}
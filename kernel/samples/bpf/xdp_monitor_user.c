@@ -2,6 +2,16 @@
  */
 static const char *__doc__=
  "XDP monitor tool, based on tracepoints\n"
+ "\n"
+ " Redirect events are also broken down per (from-dev, to-dev, errno,\n"
+ " map_id) tuple, showing the --top N tuples by rate, and XDP\n"
+ " exceptions (e.g. XDP_ABORTED) are counted per action.\n"
+;
+
+static const char *__doc_metrics__=
+ " --metrics SPEC exports counters and rates in OpenMetrics text format\n"
+ "  unix:PATH (HTTP on unix socket), tcp:PORT (HTTP on 127.0.0.1)\n"
+ "  or a file PATH, updated every --sec interval\n"
 ;
 
 static const char *__doc_err_only__=
@@ -24,26 +34,38 @@ static const char *__doc_err_only__=
 #include <net/if.h>
 #include <time.h>
 
+#include <linux/bpf.h>
+
 #include "libbpf.h"
 #include "bpf_load.h"
 #include "bpf_util.h"
+#include "xdp_monitor.h"
+#include "xdp_metrics.h"
 
 static int verbose = 1;
 static bool debug = false;
+static int top_n = 10;
+static struct metrics *metrics;
+
+/* Indexes into map_fd[], follow map order in _kern.c */
+#define MAP_REDIRECT_ERR	0
+#define MAP_REDIRECT_TUPLE	1
+#define MAP_EXCEPTION		2
 
 static const struct option long_options[] = {
 	{"help",	no_argument,		NULL, 'h' },
 	{"debug",	no_argument,		NULL, 'D' },
 	{"stats",	no_argument,		NULL, 'S' },
 	{"sec", 	required_argument,	NULL, 's' },
+	{"top",		required_argument,	NULL, 't' },
+	{"metrics",	required_argument,	NULL, 'M' },
 	{0, 0, NULL,  0 }
 };
 
 static void usage(char *argv[])
 {
 	int i;
-	printf("\nDOCUMENTATION:\n%s\n", __doc__);
-	printf("\n");
+	printf("\nDOCUMENTATION:\n%s\n%s\n", __doc__, __doc_metrics__);
 	printf(" Usage: %s (options-see-below)\n",
 	       argv[0]);
 	printf(" Listing options:\n");
@@ -95,8 +117,37 @@ struct record {
 	__u64 timestamp;
 };
 
+static const char *xdp_action_names[XDP_ACTION_MAX] = {
+	[XDP_ABORTED]	= "XDP_ABORTED",
+	[XDP_DROP]	= "XDP_DROP",
+	[XDP_PASS]	= "XDP_PASS",
+	[XDP_TX]	= "XDP_TX",
+	[XDP_REDIRECT]	= "XDP_REDIRECT",
+	[XDP_UNKNOWN]	= "XDP_UNKNOWN",
+};
+
 struct stats_record {
 	struct record xdp_redir[REDIR_RES_MAX];
+	struct record xdp_exception[XDP_ACTION_MAX];
+};
+
+/* Per redirect tuple, current and previous period */
+struct tuple_entry {
+	struct redirect_key key;
+	__u64 counter;
+};
+struct tuple_record {
+	struct tuple_entry e[REDIRECT_TUPLE_MAX];
+	int cnt;
+	__u64 timestamp;
+};
+static struct tuple_record *tuples, *tuples_prev;
+
+/* Period delta of an entry, for sorting and display */
+struct tuple_delta {
+	struct redirect_key key;
+	__u64 packets;
+	__u64 counter;
 };
 
 static void stats_print_headers(bool err_only)
@@ -139,6 +190,165 @@ static void stats_print(struct stats_record *rec,
 	}
 }
 
+static double calc_pps(struct record *r, struct record *p)
+{
+	__u64 period = r->timestamp - p->timestamp;
+
+	if (!p->timestamp || !period)
+		return 0;
+	return (r->counter - p->counter) / ((double) period / NANOSEC_PER_SEC);
+}
+
+static void stats_print_exceptions(struct stats_record *rec,
+				   struct stats_record *prev)
+{
+	int i;
+
+	for (i = 0; i < XDP_ACTION_MAX; i++) {
+		struct record *r = &rec->xdp_exception[i];
+		struct record *p = &prev->xdp_exception[i];
+		double pps = calc_pps(r, p);
+
+		if (!r->counter)
+			continue;
+		printf("%-14s %-10.0f %'-18.0f %s (total:%llu)\n",
+		       "XDP_EXCEPTION", pps, pps, xdp_action_names[i],
+		       r->counter);
+	}
+}
+
+/* Device name, or ifindex if unknown (e.g. device since removed) */
+static const char *ifindex2str(int ifindex, char *buf)
+{
+	if (!ifindex)
+		return "-";
+	if (ifindex > 0 && if_indextoname(ifindex, buf))
+		return buf;
+	snprintf(buf, IF_NAMESIZE, "%d", ifindex);
+	return buf;
+}
+
+static const char *tuple_err2str(int err)
+{
+	if (!err)
+		return "Success";
+	return strerror(-err);
+}
+
+static struct tuple_entry *tuple_find(struct tuple_record *rec,
+				      const struct redirect_key *key)
+{
+	int i;
+
+	for (i = 0; i < rec->cnt; i++)
+		if (!memcmp(&rec->e[i].key, key, sizeof(*key)))
+			return &rec->e[i];
+	return NULL;
+}
+
+static int tuple_delta_cmp(const void *a, const void *b)
+{
+	const struct tuple_delta *x = a, *y = b;
+
+	if (x->packets != y->packets)
+		return x->packets < y->packets ? 1 : -1;
+	return x->counter < y->counter ? 1 : (x->counter > y->counter ? -1 : 0);
+}
+
+/* Top tuples by rate this period.  Events not found in any tuple were
+ * dropped from the breakdown, because redirect_tuple_cnt was full.
+ */
+static void stats_print_tuples(struct stats_record *rec,
+			       struct stats_record *prev)
+{
+	char from[IF_NAMESIZE], to[IF_NAMESIZE], map_id[16];
+	__u64 total = 0, tracked = 0;
+	struct tuple_delta *deltas;
+	struct tuple_entry *p;
+	double period;
+	int i, n = tuples->cnt;
+
+	if (!tuples_prev->timestamp || !n)
+		return;
+	period = (double)(tuples->timestamp - tuples_prev->timestamp) /
+		NANOSEC_PER_SEC;
+	if (period <= 0)
+		return;
+	deltas = calloc(n, sizeof(*deltas));
+	if (!deltas)
+		return;
+
+	for (i = 0; i < n; i++) {
+		p = tuple_find(tuples_prev, &tuples->e[i].key);
+		deltas[i].key = tuples->e[i].key;
+		deltas[i].counter = tuples->e[i].counter;
+		deltas[i].packets = tuples->e[i].counter - (p ? p->counter : 0);
+		tracked += deltas[i].packets;
+	}
+	qsort(deltas, n, sizeof(*deltas), tuple_delta_cmp);
+
+	printf(" %-16s %-16s %-8s %-14s %s\n", "from", "to", "map_id", "pps",
+	       "result");
+	for (i = 0; i < n && i < top_n; i++) {
+		if (!deltas[i].packets)
+			break;
+		if (deltas[i].key.map_id)
+			snprintf(map_id, sizeof(map_id), "%u",
+				 deltas[i].key.map_id);
+		else
+			snprintf(map_id, sizeof(map_id), "-");
+		printf(" %-16s %-16s %-8s %'-14.0f %s\n",
+		       ifindex2str(deltas[i].key.from_ifindex, from),
+		       ifindex2str(deltas[i].key.to_ifindex, to), map_id,
+		       deltas[i].packets / period,
+		       tuple_err2str(deltas[i].key.err));
+	}
+
+	for (i = 0; i < REDIR_RES_MAX; i++)
+		total += rec->xdp_redir[i].counter - prev->xdp_redir[i].counter;
+	if (prev->xdp_redir[0].timestamp && total > tracked)
+		printf(" WARN: %llu events not in breakdown (max %d tuples)\n",
+		       total - tracked, REDIRECT_TUPLE_MAX);
+	free(deltas);
+}
+
+static void stats_metrics(struct stats_record *rec, struct stats_record *prev)
+{
+	char from[IF_NAMESIZE], to[IF_NAMESIZE];
+	int i;
+
+	metrics_begin(metrics);
+	metrics_family(metrics, "xdp_redirect", "counter",
+		       "XDP_REDIRECT events by result");
+	for (i = 0; i < REDIR_RES_MAX; i++)
+		metrics_u64(metrics, rec->xdp_redir[i].counter,
+			    "xdp_redirect_total{result=\"%s\"}", err2str(i));
+	metrics_family(metrics, "xdp_redirect_pps", "gauge",
+		       "XDP_REDIRECT events per sec over last interval");
+	for (i = 0; i < REDIR_RES_MAX; i++)
+		metrics_double(metrics, calc_pps(&rec->xdp_redir[i],
+						 &prev->xdp_redir[i]),
+			       "xdp_redirect_pps{result=\"%s\"}", err2str(i));
+	metrics_family(metrics, "xdp_redirect_tuple", "counter",
+		       "XDP_REDIRECT events per device pair, errno and map");
+	for (i = 0; i < tuples->cnt; i++) {
+		struct redirect_key *k = &tuples->e[i].key;
+
+		metrics_u64(metrics, tuples->e[i].counter,
+			    "xdp_redirect_tuple_total{from=\"%s\",to=\"%s\","
+			    "err=\"%d\",map_id=\"%u\"}",
+			    ifindex2str(k->from_ifindex, from),
+			    ifindex2str(k->to_ifindex, to), k->err, k->map_id);
+	}
+	metrics_family(metrics, "xdp_exception", "counter",
+		       "XDP exceptions (tracepoint xdp_exception) by action");
+	for (i = 0; i < XDP_ACTION_MAX; i++)
+		metrics_u64(metrics, rec->xdp_exception[i].counter,
+			    "xdp_exception_total{action=\"%s\"}",
+			    xdp_action_names[i]);
+	metrics_end(metrics);
+}
+
 static __u64 get_key32_value64_percpu(int fd, __u32 key)
 {
 	/* For percpu maps, userspace gets a value per possible CPU */
@@ -160,7 +370,41 @@ static __u64 get_key32_value64_percpu(int fd, __u32 key)
 	return sum;
 }
 
-static bool stats_collect(int fd, struct stats_record *rec)
+/* Walk redirect_tuple_cnt (BPF_MAP_TYPE_PERCPU_HASH), entries are
+ * never deleted, so counters only grow.
+ */
+static void stats_collect_tuples(void)
+{
+	unsigned int nr_cpus = bpf_num_possible_cpus();
+	struct redirect_key key, next, *prev_key = NULL;
+	int fd = map_fd[MAP_REDIRECT_TUPLE];
+	struct tuple_record *tmp;
+	struct tuple_entry *e;
+	__u64 values[nr_cpus];
+	int i;
+
+	tmp = tuples_prev;
+	tuples_prev = tuples;
+	tuples = tmp;
+	tuples->cnt = 0;
+	tuples->timestamp = gettime();
+
+	while (bpf_map_get_next_key(fd, prev_key, &next) == 0) {
+		key = next;
+		prev_key = &key;
+		if (bpf_map_lookup_elem(fd, &key, values))
+			continue;
+		if (tuples->cnt >= REDIRECT_TUPLE_MAX)
+			break;
+		e = &tuples->e[tuples->cnt++];
+		e->key = key;
+		e->counter = 0;
+		for (i = 0; i < nr_cpus; i++)
+			e->counter += values[i];
+	}
+}
+
+static bool stats_collect(struct stats_record *rec)
 {
 	int i;
 
@@ -170,15 +414,21 @@ static bool stats_collect(int fd, struct stats_record *rec)
 
 	for (i = 0; i < REDIR_RES_MAX; i++) {
 		rec->xdp_redir[i].timestamp = gettime();
-		rec->xdp_redir[i].counter = get_key32_value64_percpu(fd, i);
+		rec->xdp_redir[i].counter =
+			get_key32_value64_percpu(map_fd[MAP_REDIRECT_ERR], i);
+	}
+	for (i = 0; i < XDP_ACTION_MAX; i++) {
+		rec->xdp_exception[i].timestamp = gettime();
+		rec->xdp_exception[i].counter =
+			get_key32_value64_percpu(map_fd[MAP_EXCEPTION], i);
 	}
+	stats_collect_tuples();
 	return true;
 }
 
 static void stats_poll(int interval, bool err_only)
 {
 	struct stats_record rec, prev;
-	int map_fd;
 
 	memset(&rec, 0, sizeof(rec));
 
@@ -189,20 +439,25 @@ static void stats_poll(int interval, bool err_only)
 	if (verbose)
 		printf("\n%s", __doc__);
 
-	/* TODO Need more advanced stats on error types */
 	if (verbose)
-		printf(" - Stats map: %s\n", map_data[0].name);
-	map_fd = map_data[0].fd;
+		printf(" - Stats map: %s, %s and %s\n",
+		       map_data[MAP_REDIRECT_ERR].name,
+		       map_data[MAP_REDIRECT_TUPLE].name,
+		       map_data[MAP_EXCEPTION].name);
 
 	stats_print_headers(err_only);
 	fflush(stdout);
 
 	while (1) {
 		memcpy(&prev, &rec, sizeof(rec));
-		stats_collect(map_fd, &rec);
+		stats_collect(&rec);
 		stats_print(&rec, &prev, err_only);
+		stats_print_exceptions(&rec, &prev);
+		stats_print_tuples(&rec, &prev);
+		if (metrics)
+			stats_metrics(&rec, &prev);
 		fflush(stdout);
-		sleep(interval);
+		metrics_sleep(metrics, interval);
 	}
 }
 
@@ -246,7 +501,7 @@ int main(int argc, char **argv)
 	snprintf(bpf_obj_file, sizeof(bpf_obj_file), "%s_kern.o", argv[0]);
 
 	/* Parse commands line args */
-	while ((opt = getopt_long(argc, argv, "h",
+	while ((opt = getopt_long(argc, argv, "hDSs:t:M:",
 				  long_options, &longindex)) != -1) {
 		switch (opt) {
 		case 'D':
@@ -258,6 +513,14 @@ int main(int argc, char **argv)
 		case 's':
 			interval = atoi(optarg);
 			break;
+		case 't':
+			top_n = atoi(optarg);
+			break;
+		case 'M':
+			metrics = metrics_open(optarg);
+			if (!metrics)
+				return EXIT_FAILURE;
+			break;
 		case 'h':
 		default:
 			usage(argv);
@@ -265,6 +528,13 @@ int main(int argc, char **argv)
 		}
 	}
 
+	tuples = calloc(1, sizeof(*tuples));
+	tuples_prev = calloc(1, sizeof(*tuples_prev));
+	if (!tuples || !tuples_prev) {
+		fprintf(stderr, "ERR: cannot allocate stats records\n");
+		return EXIT_FAILURE;
+	}
+
 	if (load_bpf_file(bpf_obj_file)) {
 		printf("ERROR - bpf_log_buf: %s", bpf_log_buf);
 		return 1;
@@ -0,0 +1,265 @@
+#!/bin/bash
+
+TESTNAME=xdp_redirect_cpu_adaptive
+
+usage() {
+  echo "Evaluate adaptive CPU steering with skewed traffic: $TESTNAME"
+  echo ""
+  echo "Usage: $0 [-vfh] [--duration SEC] [--tolerance PCT]"
+  echo "  -v | --verbose : Verbose"
+  echo "  --flush        : Flush before starting (e.g. after --interactive)"
+  echo "  --interactive  : Keep netns setup running after test-run"
+  echo "  --duration SEC : Seconds of traffic per run (default 20)"
+  echo "  --tolerance PCT: Allowed adaptive drop increase (default 20%)"
+  echo ""
+  echo "Replays skewed synthetic UDP traffic via pktgen over a veth pair:"
+  echo "one elephant flow at full speed plus many rate limited mice flows."
+  echo "Runs xdp_redirect_cpu --prognum 6 without and with --adaptive,"
+  echo "and compares cpumap enqueue drops in the last half of each run."
+  echo "Adaptive must rebalance: move buckets, and lower the share of"
+  echo "offered load (enqueued plus dropped) on the CPU it moved buckets"
+  echo "away from first, comparing until that move with the last half."
+  echo "Single pktgen runs are noisy, thus adaptive only fails when it"
+  echo "drops more than static plus the tolerance (and a 1000 pps floor)."
+  echo ""
+}
+
+cleanup()
+{
+	local status=$?
+
+	if [ "$status" = "0" ]; then
+		echo "selftests: $TESTNAME [PASS]";
+	else
+		echo "selftests: $TESTNAME [FAILED]";
+	fi
+
+	if [ -n "$INTERACTIVE" ]; then
+		echo "Namespace setup still active explore with:"
+		echo " ip netns exec ns1 bash"
+		echo " ip netns exec ns2 bash"
+		exit $status
+	fi
+
+	set +e
+	[ -n "$XDP_PID" ] && kill $XDP_PID 2> /dev/null
+	ip netns exec ns2 sh -c "echo stop > /proc/net/pktgen/pgctrl" 2> /dev/null
+	ip link del veth1 2> /dev/null
+	ip netns del ns1 2> /dev/null
+	ip netns del ns2 2> /dev/null
+	rm -f $LOG
+}
+
+# Using external program "getopt" to get --long-options
+OPTIONS=$(getopt -o hvfi: \
+    --long verbose,flush,help,interactive,debug,duration:,tolerance: -- "$@")
+if (( $? != 0 )); then
+    usage
+    echo "selftests: $TESTNAME [FAILED] Error calling getopt, unknown option?"
+    exit 2
+fi
+eval set -- "$OPTIONS"
+
+DURATION=20
+TOLERANCE=20
+
+##  --- Parse command line arguments / parameters ---
+while true; do
+	case "$1" in
+	    -v | --verbose)
+		export VERBOSE=yes
+		shift
+		;;
+	    -i | --interactive | --debug )
+		INTERACTIVE=yes
+		shift
+		;;
+	    -f | --flush )
+		cleanup
+		shift
+		;;
+	    --tolerance )
+		TOLERANCE=$2
+		shift 2
+		;;
+	    --duration )
+		DURATION=$2
+		shift 2
+		;;
+	    -- )
+		shift
+		break
+		;;
+	    -h | --help )
+		usage;
+		echo "selftests: $TESTNAME [SKIP] usage help info requested"
+		exit 0
+		;;
+	    * )
+		shift
+		break
+		;;
+	esac
+done
+
+if [ "$EUID" -ne 0 ]; then
+	echo "selftests: $TESTNAME [FAILED] need root privileges"
+	exit 1
+fi
+
+if [ ! -x ./xdp_redirect_cpu ]; then
+	echo "selftests: $TESTNAME [SKIP] build ./xdp_redirect_cpu first"
+	exit 0
+fi
+
+if [ $(nproc) -lt 4 ]; then
+	echo "selftests: $TESTNAME [SKIP] need at least 4 CPUs"
+	exit 0
+fi
+
+modprobe pktgen 2> /dev/null
+if [ ! -d /proc/net/pktgen ]; then
+	echo "selftests: $TESTNAME [SKIP] need pktgen module"
+	exit 0
+fi
+
+# Interactive mode likely require us to cleanup netns
+if [ -n "$INTERACTIVE" ]; then
+	ip link del veth1 2> /dev/null
+	ip netns del ns1 2> /dev/null
+	ip netns del ns2 2> /dev/null
+fi
+
+# Exit on failure
+set -e
+
+# Make rest of shell verbose, showing comments as doc/info
+if [ -n "$VERBOSE" ]; then
+    set -v
+fi
+
+LOG=$(mktemp /tmp/${TESTNAME}.XXXXXX)
+
+# Create two namespaces
+ip netns add ns1
+ip netns add ns2
+
+# Run cleanup if failing or on kill
+trap cleanup 0 2 3 6 9
+
+# ns1 runs XDP cpumap steering (veth native XDP), ns2 runs pktgen
+ip link add veth1 type veth peer name veth2
+ip link set veth1 netns ns1
+ip link set veth2 netns ns2
+
+export IPADDR1=100.64.43.1
+export IPADDR2=100.64.43.2
+
+ip netns exec ns1 ip addr add ${IPADDR1}/24 dev veth1
+ip netns exec ns2 ip addr add ${IPADDR2}/24 dev veth2
+ip netns exec ns1 ip link set veth1 up
+ip netns exec ns2 ip link set veth2 up
+MAC1=$(ip netns exec ns1 cat /sys/class/net/veth1/address)
+
+# pktgen config, per network namespace
+pgset() {
+	local file=$1 cmd=$2
+
+	ip netns exec ns2 sh -c "echo \"$cmd\" > /proc/net/pktgen/$file"
+}
+
+pgdev() {
+	local thread=$1 dev=veth2@$1
+
+	pgset kpktgend_$thread "rem_device_all"
+	pgset kpktgend_$thread "add_device $dev"
+	pgset $dev "count 0"
+	pgset $dev "clone_skb 0"
+	pgset $dev "pkt_size 60"
+	pgset $dev "delay 0"
+	pgset $dev "dst $IPADDR1"
+	pgset $dev "dst_mac $MAC1"
+	pgset $dev "udp_dst_min 9"
+	pgset $dev "udp_dst_max 9"
+}
+
+# Elephant: single flow, full speed
+pgdev 0
+pgset veth2@0 "udp_src_min 4242"
+pgset veth2@0 "udp_src_max 4242"
+
+# Mice: many random flows, rate limited
+pgdev 1
+pgset veth2@1 "flag UDPSRC_RND"
+pgset veth2@1 "udp_src_min 1024"
+pgset veth2@1 "udp_src_max 65000"
+pgset veth2@1 "ratep 200000"
+
+# Sum cpumap enqueue drops over the last half of the intervals
+late_drops() {
+	awk '/^Running XDP/ { n++ }
+	     $1 == "cpumap-enqueue" && $2 ~ /^sum:/ { d[n] += $4 }
+	     END { if (!n) { print 0; exit }
+		   for (i = int(n / 2) + 1; i <= n; i++) s += d[i];
+		   printf "%.0f\n", s / (n - int(n / 2)) }' $1
+}
+
+# Share (per mille) of offered enqueue load (pps + drops) on the CPU
+# adaptive first moved buckets away from, up to that move and over the
+# last half of the intervals.  Prints "early late".
+hot_share() {
+	awk '/^Running XDP/ { n++ }
+	     $1 == "cpumap-enqueue" && $2 ~ /^sum:/ {
+		split($2, c, ":"); load[n, c[2]] += $3 + $4; tot[n] += $3 + $4 }
+	     /^Adaptive: CPU:.* moved/ && !first {
+		split($2, c, ":"); hot = c[2]; first = n }
+	     END { if (!first) { print "0 0"; exit }
+		   for (i = 1; i <= first; i++) {
+			e += load[i, hot]; et += tot[i] }
+		   for (i = int(n / 2) + 1; i <= n; i++) {
+			l += load[i, hot]; lt += tot[i] }
+		   printf "%d %d\n", et ? 1000 * e / et : 0,
+				     lt ? 1000 * l / lt : 0 }' $1
+}
+
+run() {
+	local mode="$1"
+
+	ip netns exec ns1 ./xdp_redirect_cpu --dev veth1 --prognum 6 \
+		--cpu 1 --cpu 2 --cpu 3 --sec 1 --no-separators $mode \
+		> $LOG &
+	XDP_PID=$!
+	sleep 1
+
+	ip netns exec ns2 sh -c "echo start > /proc/net/pktgen/pgctrl" &
+	sleep $DURATION
+	ip netns exec ns2 sh -c "echo stop > /proc/net/pktgen/pgctrl"
+	wait $! 2> /dev/null || true
+
+	kill -INT $XDP_PID
+	wait $XDP_PID 2> /dev/null || true
+	XDP_PID=
+}
+
+run ""
+DROPS_STATIC=$(late_drops $LOG)
+run "--adaptive"
+DROPS_ADAPTIVE=$(late_drops $LOG)
+MOVES=$(grep -c "^Adaptive: CPU:.* moved" $LOG || true)
+read SHARE_EARLY SHARE_LATE < <(hot_share $LOG)
+
+echo " - static Maglev steering : $DROPS_STATIC avg drop pps (last half)"
+echo " - adaptive steering      : $DROPS_ADAPTIVE avg drop pps (last half),"\
+     "$MOVES rebalance steps"
+echo " - hot CPU load share     : ${SHARE_EARLY} -> ${SHARE_LATE} per mille"\
+     "(until first move -> last half)"
+if [ -n "$VERBOSE" ]; then grep "^Adaptive:" $LOG || true; fi
+
+# Adaptive mode must rebalance, moving load off the hot CPU
+[ "$MOVES" -gt 0 ]
+[ "$SHARE_LATE" -lt "$SHARE_EARLY" ]
+
+# Adaptive mode must not make things worse, beyond run to run noise
+LIMIT=$(( DROPS_STATIC * (100 + TOLERANCE) / 100 + 1000 ))
+echo " - limit (static +${TOLERANCE}% +1000): $LIMIT avg drop pps"
+[ "$DROPS_ADAPTIVE" -le "$LIMIT" ]
@@ -98,6 +98,28 @@ struct bpf_map_def SEC("maps") exception_cnt = {
 	.max_entries	= 1,
 };
 
+/* Consistent hashing (Maglev) lookup table, mapping a flow hash
+ * bucket to a CPU.  Populated by userspace, such that adding or
+ * removing a CPU only moves approx 1/N of the buckets.
+ */
+#define CPU_LUT_SIZE 4099 /* Prime, WARNING - sync with _user.c */
+struct bpf_map_def SEC("maps") cpus_lut = {
+	.type		= BPF_MAP_TYPE_ARRAY,
+	.key_size	= sizeof(u32),
+	.value_size	= sizeof(u32),
+	.max_entries	= CPU_LUT_SIZE,
+};
+
+/* Packets per cpus_lut bucket, allow userspace to move hot buckets
+ * away from overloaded CPUs (adaptive mode).
+ */
+struct bpf_map_def SEC("maps") cpus_lut_cnt = {
+	.type		= BPF_MAP_TYPE_PERCPU_ARRAY,
+	.key_size	= sizeof(u32),
+	.value_size	= sizeof(u64),
+	.max_entries	= CPU_LUT_SIZE,
+};
+
 /* Helper parse functions */
 
 /* Parse Ethernet layer 2, extract network layer 3 offset and protocol
@@ -136,7 +158,16 @@ bool parse_eth(struct ethhdr *eth, void *data_end,
 			return false;
 		eth_type = vlan_hdr->h_vlan_encapsulated_proto;
 	}
-	/* TODO: Handle double VLAN tagged packet */
+	/* Handle double VLAN tagged packet (QinQ) */
+	if (eth_type == htons(ETH_P_8021Q) || eth_type == htons(ETH_P_8021AD)) {
+		struct vlan_hdr *vlan_hdr;
+
+		vlan_hdr = (void *)eth + offset;
+		offset += sizeof(*vlan_hdr);
+		if ((void *)eth + offset > data_end)
+			return false;
+		eth_type = vlan_hdr->h_vlan_encapsulated_proto;
+	}
 
 	*eth_proto = ntohs(eth_type);
 	*l3_offset = offset;
@@ -565,6 +596,110 @@ int  xdp_prognum5_ip_l3_flow_hash(struct xdp_md *ctx)
 	return bpf_redirect_map(&cpu_map, cpu_dest, 0);
 }
 
+struct L4_flow_keys {
+	/* Symmetric: src XOR dst, for both addresses and ports */
+	u32 addr[4];
+	u32 ports;
+	u32 proto;
+};
+
+/* Extract L4 ports for TCP and UDP.  Fragments are hashed without
+ * ports, to keep all fragments of a packet on the same CPU.
+ */
+static __always_inline
+u32 get_l4_ports(void *l4, void *data_end, u8 l4_proto)
+{
+	struct udphdr *udph = l4; /* ports at same offset in tcphdr */
+
+	if (l4_proto != IPPROTO_TCP && l4_proto != IPPROTO_UDP)
+		return 0;
+	if (udph + 1 > data_end)
+		return 0;
+	return udph->source ^ udph->dest;
+}
+
+/* Steer on full 5-tuple hash via a Maglev lookup table.  Unlike
+ * prognum5 (L3 hash and modulo nr CPUs), many flows between a few
+ * hosts are spread, and changing the CPU set only moves ~1/N flows.
+ */
+SEC("xdp_cpu_map6_l4_maglev")
+int  xdp_prognum6_l4_maglev(struct xdp_md *ctx)
+{
+	void *data_end = (void *)(long)ctx->data_end;
+	void *data     = (void *)(long)ctx->data;
+	struct ethhdr *eth = data;
+	struct datarec *rec;
+	u16 eth_proto = 0;
+	u64 l3_offset = 0;
+	u32 cpu_dest = 0;
+	u32 *cpu_lookup;
+	u64 *bucket_cnt;
+	u32 bucket;
+	u32 key0 = 0;
+
+	/* For flow hashing */
+	struct L4_flow_keys f = { 0 };
+	struct iphdr   *ip4h;
+	struct ipv6hdr *ip6h;
+	u32 hash;
+
+	/* Count RX packet in map */
+	rec = bpf_map_lookup_elem(&rx_cnt, &key0);
+	if (!rec)
+		return XDP_ABORTED;
+	rec->processed++;
+
+	if (!(parse_eth(eth, data_end, &eth_proto, &l3_offset)))
+		return XDP_PASS; /* Just skip */
+
+	switch (eth_proto) {
+	case ETH_P_IP:
+		ip4h = data + l3_offset;
+		if (ip4h + 1 > data_end)
+			return XDP_ABORTED;
+		f.addr[0] = ip4h->saddr ^ ip4h->daddr;
+		f.proto   = ip4h->protocol;
+		/* Any fragment (MF bit or offset), no ports */
+		if (!(ip4h->frag_off & htons(0x3FFF)))
+			f.ports = get_l4_ports((void *)ip4h + ip4h->ihl * 4,
+					       data_end, f.proto);
+		break;
+	case ETH_P_IPV6:
+		ip6h = data + l3_offset;
+		if (ip6h + 1 > data_end)
+			return XDP_ABORTED;
+		f.addr[0] = ip6h->saddr.s6_addr32[0] ^ ip6h->daddr.s6_addr32[0];
+		f.addr[1] = ip6h->saddr.s6_addr32[1] ^ ip6h->daddr.s6_addr32[1];
+		f.addr[2] = ip6h->saddr.s6_addr32[2] ^ ip6h->daddr.s6_addr32[2];
+		f.addr[3] = ip6h->saddr.s6_addr32[3] ^ ip6h->daddr.s6_addr32[3];
+		f.proto   = ip6h->nexthdr;
+		/* Extension headers are not walked, hashed as L3 only */
+		f.ports = get_l4_ports(ip6h + 1, data_end, f.proto);
+		break;
+	case ETH_P_ARP:
+		return XDP_PASS; /* ARP packet handled on incoming CPU */
+	default:
+		break; /* Hash of zero keys, all hit same bucket */
+	}
+	hash = SuperFastHash((char *)&f, sizeof(f), INIT_SEED + eth_proto);
+
+	bucket = hash % CPU_LUT_SIZE;
+	cpu_lookup = bpf_map_lookup_elem(&cpus_lut, &bucket);
+	if (!cpu_lookup)
+		return XDP_ABORTED;
+	cpu_dest = *cpu_lookup;
+
+	bucket_cnt = bpf_map_lookup_elem(&cpus_lut_cnt, &bucket);
+	if (bucket_cnt)
+		*bucket_cnt += 1;
+
+	if (cpu_dest >= MAX_CPUS) {
+		rec->issue++;
+		return XDP_ABORTED;
+	}
+
+	return bpf_redirect_map(&cpu_map, cpu_dest, 0);
+}
 
 char _license[] SEC("license") = "GPL";
 
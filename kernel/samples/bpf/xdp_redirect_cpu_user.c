@@ -1,7 +1,10 @@
 /* GPLv2 Copyright(c) 2017 Jesper Dangaard Brouer, Red Hat, Inc.
  */
 static const char *__doc__ =
-	" XDP redirect with a CPU-map type \"BPF_MAP_TYPE_CPUMAP\"";
+	" XDP redirect with a CPU-map type \"BPF_MAP_TYPE_CPUMAP\"\n"
+	"\n"
+	" --metrics unix:PATH|tcp:PORT|PATH exports the stats in\n"
+	" OpenMetrics text format, see xdp_metrics.h";
 
 #include <errno.h>
 #include <signal.h>
@@ -20,9 +23,10 @@ static const char *__doc__ =
 #include <linux/if_link.h>
 
 #define MAX_CPUS 12 /* WARNING - sync with _kern.c */
+#define CPU_LUT_SIZE 4099 /* WARNING - sync with _kern.c */
 
 /* How many xdp_progs are defined in _kern.c */
-#define MAX_PROG 6
+#define MAX_PROG 7
 
 /* Wanted to get rid of bpf_load.h and fake-"libbpf.h" (and instead
  * use bpf/libbpf.h), but cannot as (currently) needed for XDP
@@ -32,6 +36,9 @@ static const char *__doc__ =
 #include "bpf_load.h"
 
 #include "bpf_util.h"
+#include <stdint.h>
+#include "hash_func01.h"
+#include "xdp_metrics.h"
 
 static int ifindex = -1;
 static char ifname_buf[IF_NAMESIZE];
@@ -58,6 +65,10 @@ static const struct option long_options[] = {
 	{"cpu",		required_argument,	NULL, 'c' },
 	{"stress-mode", no_argument,		NULL, 'x' },
 	{"no-separators", no_argument,		NULL, 'z' },
+	{"lut-report",	no_argument,		NULL, 'L' },
+	{"adaptive",	no_argument,		NULL, 'a' },
+	{"qsize-auto",	no_argument,		NULL, 'A' },
+	{"metrics",	required_argument,	NULL, 'M' },
 	{0, 0, NULL,  0 }
 };
 
@@ -121,14 +132,23 @@ struct record {
 	struct datarec total;
 	struct datarec *cpu;
 };
+struct cpu_time {
+	__u64 busy;	/* Jiffies not idle or iowait, from /proc/stat */
+	__u64 total;
+};
 struct stats_record {
 	struct record rx_cnt;
 	struct record redir_err;
 	struct record kthread;
 	struct record exception;
 	struct record enq[MAX_CPUS];
+	struct cpu_time cpu_time[MAX_CPUS];
+	__u64 *bucket;	/* Packets per cpus_lut bucket, adaptive mode */
 };
 
+static bool adaptive;
+static struct metrics *metrics; /* --metrics, see xdp_metrics.h */
+
 static bool map_collect_percpu(int fd, __u32 key, struct record *rec)
 {
 	/* For percpu maps, userspace gets a value per possible CPU */
@@ -195,6 +215,11 @@ static struct stats_record *alloc_stats_record(void)
 	rec->exception.cpu = alloc_record_per_cpu();
 	for (i = 0; i < MAX_CPUS; i++)
 		rec->enq[i].cpu = alloc_record_per_cpu();
+	rec->bucket = calloc(CPU_LUT_SIZE, sizeof(*rec->bucket));
+	if (!rec->bucket) {
+		fprintf(stderr, "Mem alloc error\n");
+		exit(EXIT_FAIL_MEM);
+	}
 
 	return rec;
 }
@@ -205,6 +230,7 @@ static void free_stats_record(struct stats_record *r)
 
 	for (i = 0; i < MAX_CPUS; i++)
 		free(r->enq[i].cpu);
+	free(r->bucket);
 	free(r->exception.cpu);
 	free(r->kthread.cpu);
 	free(r->redir_err.cpu);
@@ -261,6 +287,26 @@ static __u64 calc_errs_pps(struct datarec *r,
 	return pps;
 }
 
+/* Maglev consistent hashing (Eisenbud et al. NSDI 2016) of flow hash
+ * buckets to CPUs.  Each CPU has its own permutation of the buckets,
+ * and CPUs take turns claiming their next preferred free bucket.  This
+ * gives near perfect balance, and when a CPU is added or removed,
+ * mostly only the buckets of that CPU move.
+ */
+static __u32 cpus_lut[CPU_LUT_SIZE];	/* Copy of map cpus_lut */
+static __u32 lut_cpus[MAX_CPUS];	/* CPUs in table */
+static int   lut_cpus_cnt;
+
+static bool cpu_in_lut(__u32 cpu)
+{
+	int i;
+
+	for (i = 0; i < lut_cpus_cnt; i++)
+		if (lut_cpus[i] == cpu)
+			return true;
+	return false;
+}
+
 static void stats_print(struct stats_record *stats_rec,
 			struct stats_record *stats_prev,
 			int prog_num)
@@ -342,6 +388,29 @@ static void stats_print(struct stats_record *stats_rec,
 		}
 	}
 
+	/* Balance of enqueue load across the destination CPUs */
+	{
+		double sum = 0, max = 0, avg;
+		int n = 0;
+
+		for (to_cpu = 0; to_cpu < MAX_CPUS; to_cpu++) {
+			rec  =  &stats_rec->enq[to_cpu];
+			prev = &stats_prev->enq[to_cpu];
+			if (!cpu_in_lut(to_cpu))
+				continue;
+			t = calc_period(rec, prev);
+			pps = calc_pps(&rec->total, &prev->total, t);
+			sum += pps;
+			if (pps > max)
+				max = pps;
+			n++;
+		}
+		avg = n ? sum / n : 0;
+		if (avg > 0)
+			printf("%-15s %-7s max/avg:%.2f (1.00 is perfect)\n",
+			       "cpumap-balance", "", max / avg);
+	}
+
 	/* cpumap kthread stats */
 	{
 		char *fmt_k = "%-15s %-7d %'-14.0f %'-11.0f %'-10.0f %s\n";
@@ -420,6 +489,137 @@ static void stats_print(struct stats_record *stats_rec,
 	fflush(stdout);
 }
 
+/* OpenMetrics export of the same records stats_print() shows.  Only
+ * totals and per destination CPU, per-CPU series would grow with the
+ * number of CPUs.
+ */
+static void stats_metrics(struct stats_record *stats_rec,
+			  struct stats_record *stats_prev)
+{
+	struct record *rec, *prev;
+	int to_cpu;
+	double t;
+
+	metrics_begin(metrics);
+
+	rec  = &stats_rec->rx_cnt;
+	prev = &stats_prev->rx_cnt;
+	t = calc_period(rec, prev);
+	metrics_family(metrics, "xdp_cpumap_rx", "counter",
+		       "Packets seen by XDP prog, by result");
+	metrics_u64(metrics, rec->total.processed,
+		    "xdp_cpumap_rx_total{result=\"processed\"}");
+	metrics_u64(metrics, rec->total.dropped,
+		    "xdp_cpumap_rx_total{result=\"dropped\"}");
+	metrics_u64(metrics, rec->total.issue,
+		    "xdp_cpumap_rx_total{result=\"cpu_dest_error\"}");
+	metrics_family(metrics, "xdp_cpumap_rx_pps", "gauge",
+		       "Packets per sec seen by XDP prog");
+	metrics_double(metrics, calc_pps(&rec->total, &prev->total, t),
+		       "xdp_cpumap_rx_pps{result=\"processed\"}");
+	metrics_double(metrics, calc_drop_pps(&rec->total, &prev->total, t),
+		       "xdp_cpumap_rx_pps{result=\"dropped\"}");
+
+	metrics_family(metrics, "xdp_cpumap_enqueue", "counter",
+		       "Packets enqueued to cpumap, by destination CPU");
+	for (to_cpu = 0; to_cpu < MAX_CPUS; to_cpu++) {
+		rec = &stats_rec->enq[to_cpu];
+		if (!rec->total.processed && !rec->total.dropped)
+			continue;
+		metrics_u64(metrics, rec->total.processed,
+			    "xdp_cpumap_enqueue_total{to_cpu=\"%d\","
+			    "result=\"processed\"}", to_cpu);
+		metrics_u64(metrics, rec->total.dropped,
+			    "xdp_cpumap_enqueue_total{to_cpu=\"%d\","
+			    "result=\"dropped\"}", to_cpu);
+	}
+	metrics_family(metrics, "xdp_cpumap_enqueue_bulks", "counter",
+		       "Bulk enqueue events to cpumap, by destination CPU");
+	for (to_cpu = 0; to_cpu < MAX_CPUS; to_cpu++) {
+		rec = &stats_rec->enq[to_cpu];
+		if (rec->total.issue)
+			metrics_u64(metrics, rec->total.issue,
+				    "xdp_cpumap_enqueue_bulks_total"
+				    "{to_cpu=\"%d\"}", to_cpu);
+	}
+	metrics_family(metrics, "xdp_cpumap_enqueue_pps", "gauge",
+		       "Packets per sec enqueued, by destination CPU");
+	for (to_cpu = 0; to_cpu < MAX_CPUS; to_cpu++) {
+		rec  = &stats_rec->enq[to_cpu];
+		prev = &stats_prev->enq[to_cpu];
+		if (!rec->total.processed)
+			continue;
+		t = calc_period(rec, prev);
+		metrics_double(metrics, calc_pps(&rec->total, &prev->total, t),
+			       "xdp_cpumap_enqueue_pps{to_cpu=\"%d\"}",
+			       to_cpu);
+	}
+
+	rec = &stats_rec->kthread;
+	metrics_family(metrics, "xdp_cpumap_kthread", "counter",
+		       "Packets processed by cpumap kthreads, by result");
+	metrics_u64(metrics, rec->total.processed,
+		    "xdp_cpumap_kthread_total{result=\"processed\"}");
+	metrics_u64(metrics, rec->total.dropped,
+		    "xdp_cpumap_kthread_total{result=\"dropped\"}");
+	metrics_family(metrics, "xdp_cpumap_kthread_sched", "counter",
+		       "Times cpumap kthreads called schedule");
+	metrics_u64(metrics, rec->total.issue,
+		    "xdp_cpumap_kthread_sched_total");
+
+	metrics_family(metrics, "xdp_redirect_error", "counter",
+		       "XDP_REDIRECT errors (tracepoint xdp_redirect_err)");
+	metrics_u64(metrics, stats_rec->redir_err.total.processed,
+		    "xdp_redirect_error_total");
+	metrics_family(metrics, "xdp_exception", "counter",
+		       "XDP exceptions (tracepoint xdp_exception)");
+	metrics_u64(metrics, stats_rec->exception.total.processed,
+		    "xdp_exception_total");
+
+	metrics_end(metrics);
+}
+
+static void cpu_time_collect(struct cpu_time *ct)
+{
+	unsigned long long v[8];
+	char line[256];
+	unsigned int cpu;
+	FILE *f;
+	int i;
+
+	f = fopen("/proc/stat", "r");
+	if (!f)
+		return;
+	while (fgets(line, sizeof(line), f)) {
+		/* cpuN user nice system idle iowait irq softirq steal */
+		if (sscanf(line, "cpu%u %llu %llu %llu %llu %llu %llu %llu %llu",
+			   &cpu, &v[0], &v[1], &v[2], &v[3], &v[4], &v[5],
+			   &v[6], &v[7]) != 9 || cpu >= MAX_CPUS)
+			continue;
+		ct[cpu].total = 0;
+		for (i = 0; i < 8; i++)
+			ct[cpu].total += v[i];
+		ct[cpu].busy = ct[cpu].total - v[3] - v[4];
+	}
+	fclose(f);
+}
+
+static void bucket_collect(int fd, __u64 *bucket)
+{
+	unsigned int nr_cpus = bpf_num_possible_cpus();
+	__u64 values[nr_cpus];
+	__u32 key;
+	int i;
+
+	for (key = 0; key < CPU_LUT_SIZE; key++) {
+		if (bpf_map_lookup_elem(fd, &key, values))
+			continue;
+		bucket[key] = 0;
+		for (i = 0; i < nr_cpus; i++)
+			bucket[key] += values[i];
+	}
+}
+
 static void stats_collect(struct stats_record *rec)
 {
 	int fd, i;
@@ -439,6 +639,11 @@ static void stats_collect(struct stats_record *rec)
 
 	fd = map_fd[8]; /* map: exception_cnt */
 	map_collect_percpu(fd, 0, &rec->exception);
+
+	if (adaptive) {
+		cpu_time_collect(rec->cpu_time);
+		bucket_collect(map_fd[10], rec->bucket); /* cpus_lut_cnt */
+	}
 }
 
 
@@ -452,6 +657,17 @@ static inline void swap(struct stats_record **a, struct stats_record **b)
 	*b = tmp;
 }
 
+/* Per CPU state for automatic queue size tuning (--qsize-auto) */
+struct qsize_tune {
+	bool   active;
+	__u32  qsize;
+	__u32  avail_idx;
+	int    clean;		/* Intervals in a row without drops */
+	__u32  fail_qsize;	/* Largest qsize seen dropping ... */
+	double fail_pps;	/* ... at this enqueue rate */
+};
+static struct qsize_tune qtune[MAX_CPUS];
+
 static int create_cpu_entry(__u32 cpu, __u32 queue_size,
 			    __u32 avail_idx, bool new)
 {
@@ -493,6 +709,10 @@ static int create_cpu_entry(__u32 cpu, __u32 queue_size,
 			exit(EXIT_FAIL_BPF);
 		}
 	}
+	qtune[cpu].active    = true;
+	qtune[cpu].qsize     = queue_size;
+	qtune[cpu].avail_idx = avail_idx;
+
 	/* map_fd[7] = cpus_iterator */
 	printf("%s CPU:%u as idx:%u queue_size:%d (total cpus_count:%u)\n",
 	       new ? "Add-new":"Replace", cpu, avail_idx,
@@ -501,6 +721,350 @@ static int create_cpu_entry(__u32 cpu, __u32 queue_size,
 	return 0;
 }
 
+static void maglev_populate(__u32 *lut, const __u32 *cpus, int n)
+{
+	__u32 offset[MAX_CPUS], skip[MAX_CPUS], next[MAX_CPUS];
+	__u32 filled = 0, c, bucket;
+	int i;
+
+	for (i = 0; i < CPU_LUT_SIZE; i++)
+		lut[i] = MAX_CPUS; /* Invalid CPU, as mark_cpus_unavailable */
+	if (n == 0)
+		return;
+
+	/* Permutation only depends on the CPU id, not the set of CPUs */
+	for (i = 0; i < n; i++) {
+		c = cpus[i];
+		offset[i] = SuperFastHash((char *)&c, sizeof(c), 0xCAFE) %
+			CPU_LUT_SIZE;
+		skip[i]   = SuperFastHash((char *)&c, sizeof(c), 0xF00D) %
+			(CPU_LUT_SIZE - 1) + 1;
+		next[i]   = 0;
+	}
+
+	while (1) {
+		for (i = 0; i < n; i++) {
+			do {
+				bucket = (offset[i] + (__u64)next[i] * skip[i])
+					% CPU_LUT_SIZE;
+				next[i]++;
+			} while (lut[bucket] != MAX_CPUS);
+			lut[bucket] = cpus[i];
+			if (++filled == CPU_LUT_SIZE)
+				return;
+		}
+	}
+}
+
+static int lut_diff(const __u32 *a, const __u32 *b)
+{
+	int i, moved = 0;
+
+	for (i = 0; i < CPU_LUT_SIZE; i++)
+		if (a[i] != b[i])
+			moved++;
+	return moved;
+}
+
+static void lut_balance(const __u32 *lut, int *min, int *max)
+{
+	int cnt[MAX_CPUS + 1] = { 0 };
+	int i;
+
+	for (i = 0; i < CPU_LUT_SIZE; i++)
+		cnt[lut[i]]++;
+	*min = CPU_LUT_SIZE;
+	*max = 0;
+	for (i = 0; i < MAX_CPUS; i++) {
+		if (!cpu_in_lut(i))
+			continue;
+		if (cnt[i] < *min)
+			*min = cnt[i];
+		if (cnt[i] > *max)
+			*max = cnt[i];
+	}
+}
+
+/* Rebuild table for the given CPU set, and update only the changed
+ * buckets in map cpus_lut (map_fd[9]).
+ */
+static void lut_update(const __u32 *cpus, int n)
+{
+	__u32 lut[CPU_LUT_SIZE];
+	int min, max, moved;
+	__u32 i;
+
+	maglev_populate(lut, cpus, n);
+	moved = lut_diff(cpus_lut, lut);
+	for (i = 0; i < CPU_LUT_SIZE; i++) {
+		if (lut[i] == cpus_lut[i])
+			continue;
+		if (bpf_map_update_elem(map_fd[9], &i, &lut[i], 0)) {
+			fprintf(stderr, "Failed updating cpus_lut\n");
+			exit(EXIT_FAIL_BPF);
+		}
+	}
+	memcpy(cpus_lut, lut, sizeof(lut));
+	memcpy(lut_cpus, cpus, n * sizeof(*cpus));
+	lut_cpus_cnt = n;
+	if (n == 0)
+		return;
+
+	lut_balance(lut, &min, &max);
+	printf("Maglev LUT: %d CPUs, buckets per CPU min:%d max:%d,"
+	       " moved %d/%d buckets (%.1f%%)\n", n, min, max,
+	       moved, CPU_LUT_SIZE, 100.0 * moved / CPU_LUT_SIZE);
+}
+
+/* Report how many flow buckets move when removing each CPU, or when
+ * adding the next CPU, compared to the ideal 1/N (and to modulo).
+ */
+static void lut_report(void)
+{
+	__u32 lut[CPU_LUT_SIZE], cpus[MAX_CPUS];
+	int n = lut_cpus_cnt, i, j, k, moved, mod_moved;
+	__u32 extra;
+
+	printf("Maglev reshuffle report (%d buckets):\n", CPU_LUT_SIZE);
+	for (i = 0; i < n && n > 1; i++) {
+		for (j = 0, k = 0; j < n; j++)
+			if (j != i)
+				cpus[k++] = lut_cpus[j];
+		maglev_populate(lut, cpus, k);
+		moved = lut_diff(cpus_lut, lut);
+		/* Modulo steering: bucket b goes to CPU at idx b % n */
+		for (j = 0, mod_moved = 0; j < CPU_LUT_SIZE; j++)
+			if (lut_cpus[j % n] != cpus[j % k])
+				mod_moved++;
+		printf(" remove CPU:%-2u moved %5.1f%% (ideal %5.1f%%,"
+		       " modulo %5.1f%%)\n", lut_cpus[i],
+		       100.0 * moved / CPU_LUT_SIZE, 100.0 / n,
+		       100.0 * mod_moved / CPU_LUT_SIZE);
+	}
+	for (extra = 0; extra < MAX_CPUS && cpu_in_lut(extra); extra++)
+		;
+	if (extra < MAX_CPUS && n < MAX_CPUS) {
+		memcpy(cpus, lut_cpus, n * sizeof(*cpus));
+		cpus[n] = extra;
+		maglev_populate(lut, cpus, n + 1);
+		moved = lut_diff(cpus_lut, lut);
+		for (j = 0, mod_moved = 0; j < CPU_LUT_SIZE; j++)
+			if (lut_cpus[j % n] != cpus[j % (n + 1)])
+				mod_moved++;
+		printf(" add CPU:%-5u moved %5.1f%% (ideal %5.1f%%,"
+		       " modulo %5.1f%%)\n", extra,
+		       100.0 * moved / CPU_LUT_SIZE, 100.0 / (n + 1),
+		       100.0 * mod_moved / CPU_LUT_SIZE);
+	}
+}
+
+/* Adaptive mode: closed loop moving hot buckets of the steering table
+ * away from overloaded CPUs.  A CPU is overloaded when it has enqueue
+ * drops, or is busy above ADAPT_BUSY_HIGH (softirq from the RX CPU, and
+ * the cpumap kthread), for ADAPT_HOLD intervals in a row.  Buckets are
+ * only moved to the least busy CPU, when below ADAPT_BUSY_LOW.  The
+ * gap between the two, the hold time, a cooldown after each move, and
+ * pinning moved buckets, avoids buckets bouncing between CPUs.
+ */
+#define ADAPT_BUSY_HIGH	0.90
+#define ADAPT_BUSY_LOW	0.60
+#define ADAPT_HOLD	2	/* Intervals overloaded before acting */
+#define ADAPT_COOLDOWN	3	/* Intervals without moves after a move */
+#define ADAPT_PIN	10	/* Intervals before a moved bucket can move */
+#define ADAPT_MOVE_FRAC	0.25	/* Max share of CPU load moved per step */
+
+static int adapt_streak[MAX_CPUS];
+static int adapt_cooldown;
+static unsigned int adapt_interval;
+static unsigned int bucket_pinned[CPU_LUT_SIZE]; /* Until interval */
+
+static void lut_write_bucket(__u32 bucket, __u32 cpu)
+{
+	if (bpf_map_update_elem(map_fd[9], &bucket, &cpu, 0)) {
+		fprintf(stderr, "Failed updating cpus_lut\n");
+		exit(EXIT_FAIL_BPF);
+	}
+	cpus_lut[bucket] = cpu;
+}
+
+static double cpu_busy(struct stats_record *rec, struct stats_record *prev,
+		       __u32 cpu)
+{
+	__u64 total = rec->cpu_time[cpu].total - prev->cpu_time[cpu].total;
+	__u64 busy  = rec->cpu_time[cpu].busy  - prev->cpu_time[cpu].busy;
+
+	return total ? (double)busy / total : 0;
+}
+
+static void adaptive_rebalance(struct stats_record *rec,
+			       struct stats_record *prev)
+{
+	double busy[MAX_CPUS], load[MAX_CPUS] = { 0 }, drops[MAX_CPUS];
+	double t, moved, budget, headroom, capacity, pps;
+	__u32 cpu, src = MAX_CPUS, dst = MAX_CPUS, b, hot;
+	int i, cnt;
+
+	adapt_interval++;
+	t = calc_period(&rec->rx_cnt, &prev->rx_cnt);
+	if (t <= 0)
+		return;
+
+	for (b = 0; b < CPU_LUT_SIZE; b++)
+		if (cpus_lut[b] < MAX_CPUS)
+			load[cpus_lut[b]] += (rec->bucket[b] - prev->bucket[b]) / t;
+
+	for (i = 0; i < lut_cpus_cnt; i++) {
+		cpu = lut_cpus[i];
+		busy[cpu]  = cpu_busy(rec, prev, cpu);
+		drops[cpu] = calc_drop_pps(&rec->enq[cpu].total,
+					   &prev->enq[cpu].total, t);
+		if (drops[cpu] > 0 || busy[cpu] > ADAPT_BUSY_HIGH)
+			adapt_streak[cpu]++;
+		else
+			adapt_streak[cpu] = 0;
+
+		/* Most overloaded: highest drops, then highest busy */
+		if (adapt_streak[cpu] >= ADAPT_HOLD &&
+		    (src == MAX_CPUS || drops[cpu] > drops[src] ||
+		     (drops[cpu] == drops[src] && busy[cpu] > busy[src])))
+			src = cpu;
+		if (drops[cpu] == 0 && busy[cpu] < ADAPT_BUSY_LOW &&
+		    (dst == MAX_CPUS || busy[cpu] < busy[dst]))
+			dst = cpu;
+	}
+	if (adapt_cooldown > 0) {
+		adapt_cooldown--;
+		return;
+	}
+	if (src == MAX_CPUS || dst == MAX_CPUS || load[src] <= 0)
+		return;
+
+	/* Estimate pps a CPU handles when fully busy, from the
+	 * overloaded CPU, as the idle dst CPU says little.
+	 */
+	capacity = busy[src] > 0 ? (load[src] - drops[src]) / busy[src] : 0;
+	headroom = capacity * ADAPT_BUSY_LOW - load[dst];
+	budget   = load[src] * ADAPT_MOVE_FRAC;
+	if (headroom < budget)
+		budget = headroom;
+
+	/* Greedy: move hottest unpinned buckets that fit in budget */
+	moved = 0;
+	cnt = 0;
+	while (moved < budget) {
+		hot = CPU_LUT_SIZE;
+		for (b = 0; b < CPU_LUT_SIZE; b++) {
+			if (cpus_lut[b] != src || bucket_pinned[b] > adapt_interval)
+				continue;
+			pps = (rec->bucket[b] - prev->bucket[b]) / t;
+			if (pps <= 0 || moved + pps > budget)
+				continue;
+			if (hot == CPU_LUT_SIZE ||
+			    pps > (rec->bucket[hot] - prev->bucket[hot]) / t)
+				hot = b;
+		}
+		if (hot == CPU_LUT_SIZE)
+			break;
+		moved += (rec->bucket[hot] - prev->bucket[hot]) / t;
+		lut_write_bucket(hot, dst);
+		bucket_pinned[hot] = adapt_interval + ADAPT_PIN;
+		cnt++;
+	}
+
+	if (cnt) {
+		printf("Adaptive: CPU:%u (busy %.0f%% drops %.0f pps) moved %d"
+		       " buckets %.0f pps to CPU:%u (busy %.0f%%)\n",
+		       src, busy[src] * 100, drops[src], cnt, moved, dst,
+		       busy[dst] * 100);
+		adapt_cooldown = ADAPT_COOLDOWN;
+		adapt_streak[src] = 0;
+	} else {
+		/* E.g. single elephant flow larger than dst headroom */
+		printf("Adaptive: CPU:%u overloaded (busy %.0f%% drops %.0f"
+		       " pps), no bucket fits CPU:%u headroom %.0f pps\n",
+		       src, busy[src] * 100, drops[src], dst, headroom);
+		adapt_cooldown = ADAPT_COOLDOWN;
+	}
+}
+
+/* Automatic cpumap queue size tuning: find the smallest queue that
+ * does not drop at the observed enqueue rate, as a smaller queue
+ * saves memory and keeps packets cache hot.  Changing qsize tears
+ * down and re-creates the kernel cpu entry, thus decisions are slow:
+ * grow (x2) on drops, shrink (x3/4) only after TUNE_SHRINK_HOLD clean
+ * intervals, and never back to a size known to drop, unless the rate
+ * has since halved.  Drops while the cpumap kthread never schedules
+ * means the CPU is saturated, which a bigger queue cannot fix.
+ */
+#define TUNE_QSIZE_MIN		32
+#define TUNE_QSIZE_MAX		16384
+#define TUNE_SHRINK_HOLD	10
+
+static void qsize_tune(struct stats_record *rec, struct stats_record *prev)
+{
+	double t, pps, drops, bulk, bulks, kpps, sched;
+	struct qsize_tune *q;
+	__u32 cpu, qsize;
+	char reason[64];
+
+	for (cpu = 0; cpu < MAX_CPUS; cpu++) {
+		q = &qtune[cpu];
+		if (!q->active)
+			continue;
+		t = calc_period(&rec->enq[cpu], &prev->enq[cpu]);
+		pps   = calc_pps(&rec->enq[cpu].total, &prev->enq[cpu].total, t);
+		drops = calc_drop_pps(&rec->enq[cpu].total,
+				      &prev->enq[cpu].total, t);
+		bulks = calc_errs_pps(&rec->enq[cpu].total,
+				      &prev->enq[cpu].total, t);
+		bulk  = bulks > 0 ? pps / bulks : 0;
+		qsize = q->qsize;
+
+		/* Kthread stats are per CPU, the kthread runs on its CPU */
+		t = calc_period(&rec->kthread, &prev->kthread);
+		kpps  = calc_pps(&rec->kthread.cpu[cpu],
+				 &prev->kthread.cpu[cpu], t);
+		sched = calc_errs_pps(&rec->kthread.cpu[cpu],
+				      &prev->kthread.cpu[cpu], t);
+
+		if (drops > 0 && kpps > 0 && sched == 0) {
+			q->clean = 0;
+			printf("qsize-tune: CPU:%u drops %.0f pps, kthread"
+			       " saturated, keep qsize %u\n", cpu, drops,
+			       q->qsize);
+			continue;
+		} else if (drops > 0) {
+			if (q->qsize > q->fail_qsize || pps > q->fail_pps) {
+				q->fail_qsize = q->qsize;
+				q->fail_pps   = pps;
+			}
+			q->clean = 0;
+			qsize = q->qsize * 2;
+			if (qsize > TUNE_QSIZE_MAX)
+				qsize = TUNE_QSIZE_MAX;
+			snprintf(reason, sizeof(reason), "drops %.0f pps", drops);
+		} else if (++q->clean >= TUNE_SHRINK_HOLD) {
+			q->clean = 0;
+			if (pps < q->fail_pps / 2)
+				q->fail_qsize = 0; /* Rate dropped, forget */
+			qsize = q->qsize * 3 / 4;
+			if (qsize < TUNE_QSIZE_MIN)
+				qsize = TUNE_QSIZE_MIN;
+			if (qsize <= q->fail_qsize)
+				qsize = q->qsize; /* Smallest known good */
+			snprintf(reason, sizeof(reason), "no drops for %d intervals",
+				 TUNE_SHRINK_HOLD);
+		}
+		if (qsize == q->qsize)
+			continue;
+
+		printf("qsize-tune: CPU:%u qsize %u -> %u, %s at %.0f pps"
+		       " (bulk-average %.2f)\n", cpu, q->qsize, qsize,
+		       reason, pps, bulk);
+		create_cpu_entry(cpu, qsize, q->avail_idx, false);
+	}
+}
+
 /* CPUs are zero-indexed. Thus, add a special sentinel default value
  * in map cpus_available to mark CPU index'es not configured
  */
@@ -509,6 +1073,10 @@ static void mark_cpus_unavailable(void)
 	__u32 invalid_cpu = MAX_CPUS;
 	int ret, i;
 
+	for (i = 0; i < CPU_LUT_SIZE; i++)
+		cpus_lut[i] = 0; /* Map is zero initialized */
+	lut_update(NULL, 0);
+
 	for (i = 0; i < MAX_CPUS; i++) {
 		/* map_fd[5] = cpus_available */
 		ret = bpf_map_update_elem(map_fd[5], &i, &invalid_cpu, 0);
@@ -532,7 +1100,7 @@ static void stress_cpumap(void)
 }
 
 static void stats_poll(int interval, bool use_separators, int prog_num,
-		       bool stress_mode)
+		       bool stress_mode, bool qsize_auto)
 {
 	struct stats_record *record, *prev;
 
@@ -548,7 +1116,13 @@ static void stats_poll(int interval, bool use_separators, int prog_num,
 		swap(&prev, &record);
 		stats_collect(record);
 		stats_print(record, prev, prog_num);
-		sleep(interval);
+		if (metrics)
+			stats_metrics(record, prev);
+		if (adaptive)
+			adaptive_rebalance(record, prev);
+		if (qsize_auto)
+			qsize_tune(record, prev);
+		metrics_sleep(metrics, interval);
 		if (stress_mode)
 			stress_cpumap();
 	}
@@ -562,6 +1136,8 @@ int main(int argc, char **argv)
 	struct rlimit r = {10 * 1024 * 1024, RLIM_INFINITY};
 	bool use_separators = true;
 	bool stress_mode = false;
+	bool lut_rep = false;
+	bool qsize_auto = false;
 	char filename[256];
 	bool debug = false;
 	int added_cpus = 0;
@@ -569,6 +1145,7 @@ int main(int argc, char **argv)
 	int interval = 2;
 	int prog_num = 0;
 	int add_cpu = -1;
+	__u32 cpus_added[MAX_CPUS];
 	__u32 qsize;
 	int opt;
 
@@ -633,6 +1210,20 @@ int main(int argc, char **argv)
 		case 'z':
 			use_separators = false;
 			break;
+		case 'L':
+			lut_rep = true;
+			break;
+		case 'a':
+			adaptive = true;
+			break;
+		case 'A':
+			qsize_auto = true;
+			break;
+		case 'M':
+			metrics = metrics_open(optarg);
+			if (!metrics)
+				return EXIT_FAIL_OPTION;
+			break;
 		case 'p':
 			/* Selecting eBPF prog to load */
 			prog_num = atoi(optarg);
@@ -653,6 +1244,7 @@ int main(int argc, char **argv)
 				goto error;
 			}
 			create_cpu_entry(add_cpu, qsize, added_cpus, true);
+			cpus_added[added_cpus] = add_cpu;
 			added_cpus++;
 			break;
 		case 'q':
@@ -679,6 +1271,20 @@ int main(int argc, char **argv)
 		return EXIT_FAIL_OPTION;
 	}
 
+	if (adaptive && prog_num != 6) {
+		fprintf(stderr, "ERR: --adaptive requires --prognum 6\n");
+		return EXIT_FAIL_OPTION;
+	}
+	if (qsize_auto && stress_mode) {
+		fprintf(stderr, "ERR: --qsize-auto and --stress-mode conflict\n");
+		return EXIT_FAIL_OPTION;
+	}
+
+	/* Steering table for prognum 6, kept updated for all progs */
+	lut_update(cpus_added, added_cpus);
+	if (lut_rep)
+		lut_report();
+
 	/* Remove XDP program when program is interrupted */
 	signal(SIGINT, int_exit);
 
@@ -692,6 +1298,7 @@ int main(int argc, char **argv)
 		read_trace_pipe();
 	}
 
-	stats_poll(interval, use_separators, prog_num, stress_mode);
+	stats_poll(interval, use_separators, prog_num, stress_mode,
+		   qsize_auto);
 	return EXIT_OK;
 }
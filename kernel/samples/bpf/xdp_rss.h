@@ -0,0 +1,197 @@
+#ifndef __XDP_RSS_H__
+#define __XDP_RSS_H__
+
+/* Shared structs between _user & _kern (and _bench)
+ *
+ * Software Toeplitz hash, as specified for RSS (Receive Side Scaling)
+ * by Microsoft and implemented by most NICs.  Input is source address,
+ * destination address, and for the 4-tuple source and destination port,
+ * all in network byte-order.
+ *
+ * The BPF side avoids the bit-serial algorithm via per-byte lookup
+ * tables: for input byte position i and byte value v, tbl[i][v] is the
+ * XOR of the 32-bit key windows selected by the bits set in v.  Hash is
+ * then the XOR of one table entry per input byte.
+ */
+
+#define RSS_KEY_MAX		52	/* Largest NIC key seen (ice) */
+#define RSS_TUPLE_MAX		36	/* IPv6 4-tuple: 16+16+2+2 */
+#define RSS_INDIR_MAX		512
+
+/* Value of the single entry rss_table map */
+struct rss_table {
+	__u32 tbl[RSS_TUPLE_MAX][256];
+};
+
+enum rss_hash_func {
+	RSS_HASH_TOEPLITZ = 0,
+	RSS_HASH_SUPERFAST,	/* hash_func01.h, for cost comparison */
+	RSS_HASH_JHASH,		/* linux/jhash.h, for cost comparison */
+	RSS_HASH_NONE,		/* Parse only, baseline */
+	RSS_HASH_MAX
+};
+
+#define RSS_FLAG_UDP_4TUPLE	(1U << 0) /* Most NICs default to 2-tuple */
+#define RSS_FLAG_SAVE_LAST	(1U << 1) /* Store hash in rss_last, test */
+
+struct rss_config {
+	__u32 hash_func;	/* enum rss_hash_func */
+	__u32 flags;
+	__u32 indir_size;	/* Zero: no queue prediction */
+	__u32 indir[RSS_INDIR_MAX];
+};
+
+/* Hash type of the last packet, with RSS_FLAG_SAVE_LAST */
+enum rss_type {
+	RSS_TYPE_NONE = 0,
+	RSS_TYPE_IPV4,
+	RSS_TYPE_IPV4_L4,
+	RSS_TYPE_IPV6,
+	RSS_TYPE_IPV6_L4,
+	RSS_TYPE_MAX
+};
+
+struct rss_last {
+	__u32 hash;
+	__u32 type;
+};
+
+/* Per CPU counters in map rss_stats, per predicted queue and below */
+enum rss_stat {
+	RSS_STAT_MATCH = 0,	/* Predicted queue == rx_queue_index */
+	RSS_STAT_MISMATCH,
+	RSS_STAT_NOT_IP,
+	RSS_STAT_MAX
+};
+
+/* Microsoft default key, also the default of many NIC drivers */
+#define RSS_KEY_DEFAULT {						\
+	0x6d, 0x5a, 0x56, 0xda, 0x25, 0x5b, 0x0e, 0xc2,			\
+	0x41, 0x67, 0x25, 0x3d, 0x43, 0xa3, 0x8f, 0xb0,			\
+	0xd0, 0xca, 0x2b, 0xcb, 0xae, 0x7b, 0x30, 0xb4,			\
+	0x77, 0xcb, 0x2d, 0xa3, 0x80, 0x30, 0xf2, 0x0c,			\
+	0x6a, 0x42, 0xb7, 0x3b, 0xbe, 0xac, 0x01, 0xfa }
+
+#ifndef __KERNEL__ /* Not for _kern.c, built with -D__KERNEL__ */
+#include <string.h>
+#include <arpa/inet.h>
+
+/* Userspace reference, bit-serial as in the RSS spec.  Bits past the
+ * key length are zero.
+ */
+static inline __u32 rss_key_bit(const __u8 *key, int key_len, int bit)
+{
+	if (bit / 8 >= key_len)
+		return 0;
+	return (key[bit / 8] >> (7 - bit % 8)) & 1;
+}
+
+static inline __u32 toeplitz_hash_ref(const __u8 *key, int key_len,
+				      const __u8 *in, int len)
+{
+	__u32 hash = 0, window = 0;
+	int i, b;
+
+	for (i = 0; i < 32; i++)
+		window = (window << 1) | rss_key_bit(key, key_len, i);
+
+	for (i = 0; i < len; i++) {
+		for (b = 7; b >= 0; b--) {
+			if (in[i] & (1 << b))
+				hash ^= window;
+			window = (window << 1) |
+				rss_key_bit(key, key_len, 32 + i * 8 + 7 - b);
+		}
+	}
+	return hash;
+}
+
+/* Lookup tables for the BPF side, from the same key */
+static inline void toeplitz_table_build(struct rss_table *t,
+					const __u8 *key, int key_len)
+{
+	__u32 window[8];
+	int i, b, v, bit;
+
+	for (i = 0; i < RSS_TUPLE_MAX; i++) {
+		/* 32-bit key window for each bit of input byte i */
+		for (b = 0; b < 8; b++) {
+			window[b] = 0;
+			for (bit = 0; bit < 32; bit++)
+				window[b] = (window[b] << 1) |
+					rss_key_bit(key, key_len,
+						    i * 8 + b + bit);
+		}
+		for (v = 0; v < 256; v++) {
+			t->tbl[i][v] = 0;
+			for (b = 0; b < 8; b++)
+				if (v & (0x80 >> b))
+					t->tbl[i][v] ^= window[b];
+		}
+	}
+}
+
+/* Same table lookup as the BPF side does */
+static inline __u32 toeplitz_hash_tbl(const struct rss_table *t,
+				      const __u8 *in, int len)
+{
+	__u32 hash = 0;
+	int i;
+
+	for (i = 0; i < len && i < RSS_TUPLE_MAX; i++)
+		hash ^= t->tbl[i][in[i]];
+	return hash;
+}
+
+/* Verification suite from the Microsoft RSS spec, with RSS_KEY_DEFAULT */
+struct rss_test_vector {
+	int family;
+	const char *src;
+	const char *dst;
+	__u16 sport;
+	__u16 dport;
+	__u32 hash_2tuple;
+	__u32 hash_4tuple;
+};
+
+static const struct rss_test_vector rss_test_vectors[] = {
+	{ AF_INET, "66.9.149.187", "161.142.100.80", 2794, 1766,
+	  0x323e8fc2, 0x51ccc178 },
+	{ AF_INET, "199.92.111.2", "65.69.140.83", 14230, 4739,
+	  0xd718262a, 0xc626b0ea },
+	{ AF_INET, "24.19.198.95", "12.22.207.184", 12898, 38024,
+	  0xd2d0a5de, 0x5c2b394a },
+	{ AF_INET, "38.27.205.30", "209.142.163.6", 48228, 2217,
+	  0x82989176, 0xafc7327f },
+	{ AF_INET, "153.39.163.191", "202.188.127.2", 44251, 1303,
+	  0x5d1809c5, 0x10e828a2 },
+	{ AF_INET6, "3ffe:2501:200:1fff::7", "3ffe:2501:200:3::1",
+	  2794, 1766, 0x2cc18cd5, 0x40207d3d },
+	{ AF_INET6, "3ffe:501:8::260:97ff:fe40:efab", "ff02::1",
+	  14230, 4739, 0x0f0c461c, 0xdde51bbf },
+	{ AF_INET6, "3ffe:1900:4545:3:200:f8ff:fe21:67cf",
+	  "fe80::200:f8ff:fe21:67cf", 44251, 38024, 0x4b61e985, 0x02d1feef },
+};
+
+#define RSS_NR_TEST_VECTORS \
+	(sizeof(rss_test_vectors) / sizeof(rss_test_vectors[0]))
+
+/* Hash input of a test vector, returns address part length or -1 */
+static inline int rss_test_vector_input(const struct rss_test_vector *v,
+					__u8 in[RSS_TUPLE_MAX])
+{
+	int alen = v->family == AF_INET6 ? 16 : 4;
+	__u16 port;
+
+	if (inet_pton(v->family, v->src, in) != 1 ||
+	    inet_pton(v->family, v->dst, in + alen) != 1)
+		return -1;
+	port = htons(v->sport);
+	memcpy(in + 2 * alen, &port, 2);
+	port = htons(v->dport);
+	memcpy(in + 2 * alen + 2, &port, 2);
+	return 2 * alen;
+}
+#endif /* __KERNEL__ */
+
+#endif /* __XDP_RSS_H__ */
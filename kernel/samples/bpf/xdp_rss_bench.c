@@ -0,0 +1,335 @@
+/* Copyright(c) 2017 Jesper Dangaard Brouer, Red Hat, Inc.
+ */
+static const char *__doc__=
+ " XDP software RSS: bit-exactness test and benchmark via\n"
+ " BPF_PROG_TEST_RUN\n"
+ "\n"
+ " Loads xdp_rss_kern.o (not attached to any device), checks that the\n"
+ " BPF Toeplitz hash matches the Microsoft RSS verification suite, and\n"
+ " measures the per packet cost of Toeplitz against SuperFastHash\n"
+ " (hash_func01.h), jhash and parsing only, for IPv4/IPv6 2/4-tuple.\n"
+ ;
+
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/resource.h>
+#include <getopt.h>
+#include <arpa/inet.h>
+#include <linux/bpf.h>
+
+#include "bpf_load.h"
+#include "bpf_util.h"
+#include "libbpf.h"
+
+#include "xdp_rss.h"
+#include "xdp_test_run.h"
+
+/* Exit return codes */
+#define	EXIT_OK			0
+#define EXIT_FAIL		1
+#define EXIT_FAIL_OPTION	2
+#define EXIT_FAIL_BPF		40
+#define EXIT_FAIL_TEST		50
+
+/* Indexes into map_fd[], follow map order in _kern.c */
+#define MAP_TABLE	0
+#define MAP_CONFIG	1
+#define MAP_STATS	2
+#define MAP_QUEUE_CNT	3
+#define MAP_LAST	4
+
+#define NR_PKTS 256 /* Distinct flows per benchmark */
+
+static const struct option long_options[] = {
+	{"help",	no_argument,		NULL, 'h' },
+	{"repeat",	required_argument,	NULL, 'r' },
+	{0, 0, NULL,  0 }
+};
+
+static const char *rss_hash_names[RSS_HASH_MAX] = {
+	[RSS_HASH_TOEPLITZ]	= "toeplitz",
+	[RSS_HASH_SUPERFAST]	= "superfast",
+	[RSS_HASH_JHASH]	= "jhash",
+	[RSS_HASH_NONE]		= "none (parse only)",
+};
+
+static void usage(char *argv[])
+{
+	int i;
+	printf("\nDOCUMENTATION:\n%s\n", __doc__);
+	printf(" Usage: %s (options-see-below)\n",
+	       argv[0]);
+	printf(" Listing options:\n");
+	for (i = 0; long_options[i].name != 0; i++) {
+		printf(" --%-12s", long_options[i].name);
+		if (long_options[i].flag != NULL)
+			printf(" flag (internal value:%d)",
+			       *long_options[i].flag);
+		else
+			printf(" short-option: -%c",
+			       long_options[i].val);
+		printf("\n");
+	}
+	printf("\n");
+}
+
+static int failures;
+
+#define CHECK(cond, fmt, ...)						\
+	do {								\
+		if (!(cond)) {						\
+			failures++;					\
+			printf(" FAIL: " fmt "\n", ##__VA_ARGS__);	\
+		} else {						\
+			printf(" ok:   " fmt "\n", ##__VA_ARGS__);	\
+		}							\
+	} while (0)
+
+static void set_config(__u32 hash_func, __u32 flags, __u32 indir_size)
+{
+	struct rss_config cfg;
+	__u32 key = 0, i;
+
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.hash_func = hash_func;
+	cfg.flags = flags;
+	cfg.indir_size = indir_size;
+	for (i = 0; i < indir_size; i++)
+		cfg.indir[i] = i % 16; /* Like ethtool default, 16 queues */
+
+	if (bpf_map_update_elem(map_fd[MAP_CONFIG], &key, &cfg, BPF_ANY)) {
+		fprintf(stderr, "ERR: set rss_config: %s\n", strerror(errno));
+		exit(EXIT_FAIL_BPF);
+	}
+}
+
+static void set_table(void)
+{
+	static const __u8 rss_key[] = RSS_KEY_DEFAULT;
+	static struct rss_table table;
+	__u32 key = 0;
+
+	toeplitz_table_build(&table, rss_key, sizeof(rss_key));
+	if (bpf_map_update_elem(map_fd[MAP_TABLE], &key, &table, BPF_ANY)) {
+		fprintf(stderr, "ERR: set rss_table: %s\n", strerror(errno));
+		exit(EXIT_FAIL_BPF);
+	}
+}
+
+static void run_once(struct test_pkt *pkt)
+{
+	struct test_pkt out;
+	__u32 size_out = sizeof(out.data);
+	__u32 retval = 0, duration;
+
+	if (bpf_prog_test_run(prog_fd[0], 1, pkt->data, pkt->len,
+			      out.data, &size_out, &retval, &duration)) {
+		fprintf(stderr, "ERR: BPF_PROG_TEST_RUN failed: %s\n",
+			strerror(errno));
+		exit(EXIT_FAIL_BPF);
+	}
+}
+
+static struct rss_last last_hash(void)
+{
+	struct rss_last last = { 0 };
+	__u32 key = 0;
+
+	bpf_map_lookup_elem(map_fd[MAP_LAST], &key, &last);
+	return last;
+}
+
+static void vector_pkt(struct test_pkt *pkt, const struct rss_test_vector *v,
+		       __u8 proto, int nr_vlans)
+{
+	struct test_pkt_spec spec;
+
+	memset(&spec, 0, sizeof(spec));
+	spec.proto = proto;
+	spec.sport = v->sport;
+	spec.dport = v->dport;
+	spec.tcp_flags = TEST_TCP_ACK;
+	spec.nr_vlans = nr_vlans;
+	if (!test_pkt_spec_addr(&spec, v->src, v->dst)) {
+		fprintf(stderr, "ERR: bad address %s\n", v->src);
+		exit(EXIT_FAIL);
+	}
+	test_pkt_build(pkt, &spec);
+}
+
+/* BPF Toeplitz must be bit-exact with the spec, as NIC RSS is */
+static void test_vectors(void)
+{
+	const struct rss_test_vector *v;
+	struct test_pkt pkt;
+	struct rss_last last;
+	int i;
+
+	printf("\nFunctional: Toeplitz test vectors\n");
+	set_config(RSS_HASH_TOEPLITZ, RSS_FLAG_SAVE_LAST, 0);
+
+	for (i = 0; i < RSS_NR_TEST_VECTORS; i++) {
+		v = &rss_test_vectors[i];
+
+		vector_pkt(&pkt, v, IPPROTO_TCP, 0);
+		run_once(&pkt);
+		last = last_hash();
+		CHECK(last.hash == v->hash_4tuple,
+		      "%-36s TCP 4-tuple 0x%08x (0x%08x)", v->src,
+		      v->hash_4tuple, last.hash);
+
+		/* UDP is 2-tuple unless RSS_FLAG_UDP_4TUPLE */
+		vector_pkt(&pkt, v, IPPROTO_UDP, 1);
+		run_once(&pkt);
+		last = last_hash();
+		CHECK(last.hash == v->hash_2tuple,
+		      "%-36s UDP 2-tuple 0x%08x (0x%08x) VLAN", v->src,
+		      v->hash_2tuple, last.hash);
+	}
+
+	v = &rss_test_vectors[0];
+	set_config(RSS_HASH_TOEPLITZ, RSS_FLAG_SAVE_LAST |
+		   RSS_FLAG_UDP_4TUPLE, 0);
+	vector_pkt(&pkt, v, IPPROTO_UDP, 0);
+	run_once(&pkt);
+	last = last_hash();
+	CHECK(last.hash == v->hash_4tuple && last.type == RSS_TYPE_IPV4_L4,
+	      "UDP 4-tuple with --udp4 0x%08x (0x%08x)", v->hash_4tuple,
+	      last.hash);
+}
+
+static void bench(const char *desc, struct test_pkt *pkts, int nr,
+		  __u32 repeat)
+{
+	double ns;
+
+	ns = xdp_test_run_many(prog_fd[0], pkts, nr, repeat, NULL);
+	if (ns < 0) {
+		fprintf(stderr, "ERR: BPF_PROG_TEST_RUN failed: %s\n",
+			strerror(-ns));
+		exit(EXIT_FAIL_BPF);
+	}
+	printf(" %-40s %7.2f ns/pkt %9.0f pps\n", desc, ns,
+	       ns > 0 ? 1000000000 / ns : 0);
+}
+
+/* Flows differ in source address and port */
+static void build_pkts(struct test_pkt *pkts, int nr, int family,
+		       __u8 proto)
+{
+	char src[INET6_ADDRSTRLEN];
+	struct test_pkt_spec spec;
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		memset(&spec, 0, sizeof(spec));
+		if (family == AF_INET6)
+			snprintf(src, sizeof(src), "2001:db8::%x:%x",
+				 i / 256, i % 256 + 1);
+		else
+			snprintf(src, sizeof(src), "10.%d.%d.1",
+				 i / 256, i % 256);
+		spec.proto = proto;
+		spec.sport = 1024 + i;
+		spec.dport = 80;
+		spec.tcp_flags = TEST_TCP_ACK;
+		if (!test_pkt_spec_addr(&spec, src, family == AF_INET6 ?
+					"2001:db8:1::1" : "198.18.0.1")) {
+			fprintf(stderr, "ERR: bad address %s\n", src);
+			exit(EXIT_FAIL);
+		}
+		test_pkt_build(&pkts[i], &spec);
+	}
+}
+
+static void run_bench(__u32 repeat)
+{
+	static const struct {
+		const char *desc;
+		int family;
+		__u8 proto;
+	} inputs[] = {
+		{ "IPv4 2-tuple", AF_INET,  IPPROTO_UDP },
+		{ "IPv4 4-tuple", AF_INET,  IPPROTO_TCP },
+		{ "IPv6 2-tuple", AF_INET6, IPPROTO_UDP },
+		{ "IPv6 4-tuple", AF_INET6, IPPROTO_TCP },
+	};
+	struct test_pkt *pkts;
+	char desc[64];
+	int i, h;
+
+	pkts = calloc(NR_PKTS, sizeof(*pkts));
+	if (!pkts)
+		exit(EXIT_FAIL);
+
+	printf("\nBenchmark, repeat %u over %d flows, with queue"
+	       " prediction:\n", repeat, NR_PKTS);
+	for (i = 0; i < sizeof(inputs) / sizeof(inputs[0]); i++) {
+		build_pkts(pkts, NR_PKTS, inputs[i].family, inputs[i].proto);
+		for (h = 0; h < RSS_HASH_MAX; h++) {
+			set_config(h, 0, 128);
+			snprintf(desc, sizeof(desc), "%s %s", inputs[i].desc,
+				 rss_hash_names[h]);
+			bench(desc, pkts, NR_PKTS, repeat);
+		}
+	}
+	free(pkts);
+}
+
+int main(int argc, char **argv)
+{
+	struct rlimit r = {RLIM_INFINITY, RLIM_INFINITY};
+	__u32 repeat = 100000;
+	char filename[256];
+	int longindex = 0;
+	int opt;
+
+	while ((opt = getopt_long(argc, argv, "hr:",
+				  long_options, &longindex)) != -1) {
+		switch (opt) {
+		case 'r':
+			repeat = atoi(optarg);
+			break;
+		case 'h':
+		default:
+			usage(argv);
+			return EXIT_FAIL_OPTION;
+		}
+	}
+
+	if (setrlimit(RLIMIT_MEMLOCK, &r)) {
+		perror("setrlimit(RLIMIT_MEMLOCK, RLIM_INFINITY)");
+		return EXIT_FAIL;
+	}
+
+	/* Bench binary lives next to the kern object */
+	snprintf(filename, sizeof(filename), "%s", argv[0]);
+	if (strrchr(filename, '_'))
+		*strrchr(filename, '_') = '\0';
+	strncat(filename, "_kern.o", sizeof(filename) - strlen(filename) - 1);
+	if (load_bpf_file(filename)) {
+		fprintf(stderr, "ERR in load_bpf_file(%s): %s\n",
+			filename, bpf_log_buf);
+		return EXIT_FAIL_BPF;
+	}
+	if (!prog_fd[0]) {
+		printf("load_bpf_file: %s\n", strerror(errno));
+		return EXIT_FAIL_BPF;
+	}
+
+	set_table();
+	test_vectors();
+	run_bench(repeat);
+
+	if (failures) {
+		printf("\n%d functional checks FAILED\n", failures);
+		return EXIT_FAIL_TEST;
+	}
+	return EXIT_OK;
+}
@@ -0,0 +1,275 @@
+/*  XDP software RSS: Toeplitz hash, bit-exact with NIC RSS
+ *
+ *  Computes the RSS Toeplitz hash of IPv4/IPv6 2-tuple and 4-tuple via
+ *  per-byte lookup tables (built by userspace from the RSS key), and
+ *  predicts the RX queue via the indirection table.  Replaces the
+ *  xdp_rxhash sample, that depended on a rejected xdp_md extension.
+ *
+ *  Copyright(c) 2017 Jesper Dangaard Brouer, Red Hat, Inc.
+ */
+#define KBUILD_MODNAME "foo"
+#include <uapi/linux/bpf.h>
+#include <uapi/linux/if_ether.h>
+#include <uapi/linux/if_packet.h>
+#include <uapi/linux/if_vlan.h>
+#include <uapi/linux/ip.h>
+#include <uapi/linux/ipv6.h>
+#include <uapi/linux/in.h>
+#include <uapi/linux/tcp.h>
+#include <uapi/linux/udp.h>
+#include "bpf_helpers.h"
+#include "hash_func01.h"
+#include "jhash.h"
+
+#include "xdp_rss.h" /* Shared structs between _user & _kern */
+
+#define RSS_QUEUE_MAX 256
+
+struct bpf_map_def SEC("maps") rss_table = {
+	.type		= BPF_MAP_TYPE_ARRAY,
+	.key_size	= sizeof(u32),
+	.value_size	= sizeof(struct rss_table),
+	.max_entries	= 1,
+};
+
+struct bpf_map_def SEC("maps") rss_config = {
+	.type		= BPF_MAP_TYPE_ARRAY,
+	.key_size	= sizeof(u32),
+	.value_size	= sizeof(struct rss_config),
+	.max_entries	= 1,
+};
+
+struct bpf_map_def SEC("maps") rss_stats = {
+	.type		= BPF_MAP_TYPE_PERCPU_ARRAY,
+	.key_size	= sizeof(u32),
+	.value_size	= sizeof(u64),
+	.max_entries	= RSS_STAT_MAX,
+};
+
+/* Packets per predicted RX queue */
+struct bpf_map_def SEC("maps") rss_queue_cnt = {
+	.type		= BPF_MAP_TYPE_PERCPU_ARRAY,
+	.key_size	= sizeof(u32),
+	.value_size	= sizeof(u64),
+	.max_entries	= RSS_QUEUE_MAX,
+};
+
+struct bpf_map_def SEC("maps") rss_last = {
+	.type		= BPF_MAP_TYPE_ARRAY,
+	.key_size	= sizeof(u32),
+	.value_size	= sizeof(struct rss_last),
+	.max_entries	= 1,
+};
+
+struct vlan_hdr {
+	__be16 h_vlan_TCI;
+	__be16 h_vlan_encapsulated_proto;
+};
+
+static __always_inline
+void stats_inc(void *map, u32 key)
+{
+	u64 *cnt = bpf_map_lookup_elem(map, &key);
+
+	if (cnt)
+		*cnt += 1;
+}
+
+/* Hash input in RSS order: saddr, daddr, sport, dport */
+struct rss_input {
+	u8  bytes[RSS_TUPLE_MAX];
+	u32 addr_len;	/* 8 or 32 */
+	bool l4;	/* Ports follow the addresses */
+};
+
+/* Returns rss_type, RSS_TYPE_NONE when not IP */
+static __always_inline
+u32 parse_rss_input(struct xdp_md *ctx, struct rss_config *cfg,
+		    struct rss_input *in)
+{
+	void *data_end = (void *)(long)ctx->data_end;
+	void *data     = (void *)(long)ctx->data;
+	struct ethhdr *eth = data;
+	struct vlan_hdr *vh;
+	struct ipv6hdr *ip6h;
+	struct iphdr *iph;
+	struct udphdr *udph; /* ports at same offset in tcphdr */
+	u64 offset = sizeof(*eth);
+	u16 eth_type;
+	u8 proto;
+	void *l4;
+	int i;
+
+	if (data + offset > data_end)
+		return RSS_TYPE_NONE;
+	eth_type = eth->h_proto;
+
+#pragma clang loop unroll(full)
+	for (i = 0; i < 2; i++) {
+		if (eth_type != htons(ETH_P_8021Q) &&
+		    eth_type != htons(ETH_P_8021AD))
+			break;
+		vh = data + offset;
+		offset += sizeof(*vh);
+		if (data + offset > data_end)
+			return RSS_TYPE_NONE;
+		eth_type = vh->h_vlan_encapsulated_proto;
+	}
+
+	if (eth_type == htons(ETH_P_IP)) {
+		iph = data + offset;
+		if (iph + 1 > data_end)
+			return RSS_TYPE_NONE;
+		__builtin_memcpy(&in->bytes[0], &iph->saddr, 4);
+		__builtin_memcpy(&in->bytes[4], &iph->daddr, 4);
+		in->addr_len = 8;
+		/* Fragments use the 2-tuple, like NICs do */
+		if (iph->frag_off & htons(IP_MF | IP_OFFSET))
+			return RSS_TYPE_IPV4;
+		proto = iph->protocol;
+		l4 = (void *)iph + iph->ihl * 4;
+	} else if (eth_type == htons(ETH_P_IPV6)) {
+		ip6h = data + offset;
+		if (ip6h + 1 > data_end)
+			return RSS_TYPE_NONE;
+		__builtin_memcpy(&in->bytes[0], &ip6h->saddr, 16);
+		__builtin_memcpy(&in->bytes[16], &ip6h->daddr, 16);
+		in->addr_len = 32;
+		proto = ip6h->nexthdr; /* Extension headers: 2-tuple */
+		l4 = ip6h + 1;
+	} else {
+		return RSS_TYPE_NONE;
+	}
+
+	if (proto == IPPROTO_TCP ||
+	    (proto == IPPROTO_UDP && (cfg->flags & RSS_FLAG_UDP_4TUPLE))) {
+		udph = l4;
+		if (udph + 1 <= data_end) {
+			/* Constant offsets keep stack access verifiable */
+			if (in->addr_len == 8)
+				__builtin_memcpy(&in->bytes[8], &udph->source, 4);
+			else
+				__builtin_memcpy(&in->bytes[32], &udph->source, 4);
+			in->l4 = true;
+		}
+	}
+
+	if (in->addr_len == 8)
+		return in->l4 ? RSS_TYPE_IPV4_L4 : RSS_TYPE_IPV4;
+	return in->l4 ? RSS_TYPE_IPV6_L4 : RSS_TYPE_IPV6;
+}
+
+/* XOR of one table entry per input byte, constant n unrolls fully.
+ * Hash is linear in the input, so the port bytes can be added on top
+ * of the address part.
+ */
+static __always_inline
+u32 toeplitz_bytes(struct rss_table *t, u8 *in, const int start,
+		   const int n)
+{
+	u32 hash = 0;
+	int i;
+
+#pragma clang loop unroll(full)
+	for (i = start; i < start + n; i++)
+		hash ^= t->tbl[i][in[i]];
+	return hash;
+}
+
+static __always_inline
+u32 rss_toeplitz(struct rss_input *in)
+{
+	struct rss_table *t;
+	u32 key = 0, hash;
+
+	t = bpf_map_lookup_elem(&rss_table, &key);
+	if (!t)
+		return 0;
+
+	if (in->addr_len == 8) {
+		hash = toeplitz_bytes(t, in->bytes, 0, 8);
+		if (in->l4)
+			hash ^= toeplitz_bytes(t, in->bytes, 8, 4);
+	} else {
+		hash = toeplitz_bytes(t, in->bytes, 0, 32);
+		if (in->l4)
+			hash ^= toeplitz_bytes(t, in->bytes, 32, 4);
+	}
+	return hash;
+}
+
+/* Comparison hashes over the same input, constant lengths */
+static __always_inline
+u32 rss_superfast(struct rss_input *in)
+{
+	if (in->addr_len == 8)
+		return in->l4 ? SuperFastHash((char *)in->bytes, 12, 0) :
+				SuperFastHash((char *)in->bytes, 8, 0);
+	return in->l4 ? SuperFastHash((char *)in->bytes, 36, 0) :
+			SuperFastHash((char *)in->bytes, 32, 0);
+}
+
+static __always_inline
+u32 rss_jhash(struct rss_input *in)
+{
+	u32 *w = (u32 *)in->bytes;
+
+	if (in->addr_len == 8)
+		return in->l4 ? jhash2(w, 3, 0) : jhash2(w, 2, 0);
+	return in->l4 ? jhash2(w, 9, 0) : jhash2(w, 8, 0);
+}
+
+SEC("xdp_rss")
+int xdp_rss_prog(struct xdp_md *ctx)
+{
+	struct rss_input in = { 0 };
+	struct rss_config *cfg;
+	struct rss_last *last;
+	u32 key = 0, type, hash = 0, idx, queue;
+
+	cfg = bpf_map_lookup_elem(&rss_config, &key);
+	if (!cfg)
+		return XDP_PASS;
+
+	type = parse_rss_input(ctx, cfg, &in);
+	if (type == RSS_TYPE_NONE) {
+		stats_inc(&rss_stats, RSS_STAT_NOT_IP);
+		return XDP_PASS;
+	}
+
+	switch (cfg->hash_func) {
+	case RSS_HASH_TOEPLITZ:
+		hash = rss_toeplitz(&in);
+		break;
+	case RSS_HASH_SUPERFAST:
+		hash = rss_superfast(&in);
+		break;
+	case RSS_HASH_JHASH:
+		hash = rss_jhash(&in);
+		break;
+	default:
+		break;
+	}
+
+	if (cfg->flags & RSS_FLAG_SAVE_LAST) {
+		last = bpf_map_lookup_elem(&rss_last, &key);
+		if (last) {
+			last->hash = hash;
+			last->type = type;
+		}
+	}
+
+	/* Queue prediction, as NIC: indirection table by hash LSBs */
+	if (cfg->indir_size && cfg->indir_size <= RSS_INDIR_MAX) {
+		idx = hash % cfg->indir_size;
+		if (idx >= RSS_INDIR_MAX)
+			return XDP_PASS;
+		queue = cfg->indir[idx];
+		stats_inc(&rss_queue_cnt, queue & (RSS_QUEUE_MAX - 1));
+		stats_inc(&rss_stats, queue == ctx->rx_queue_index ?
+			  RSS_STAT_MATCH : RSS_STAT_MISMATCH);
+	}
+	return XDP_PASS;
+}
+
+char _license[] SEC("license") = "GPL";
@@ -0,0 +1,398 @@
+/* Copyright(c) 2017 Jesper Dangaard Brouer, Red Hat, Inc.
+ */
+static const char *__doc__=
+ " XDP software RSS: Toeplitz hash bit-exact with NIC RSS\n"
+ "\n"
+ " Computes the RSS Toeplitz hash of each packet (IPv4/IPv6 2-tuple,\n"
+ " 4-tuple for TCP, and for UDP with --udp4), using lookup tables built\n"
+ " here from the RSS key of --dev (ethtool -x), and predicts the RX\n"
+ " queue via the NIC indirection table.  Reports per queue counts, and\n"
+ " how often the prediction matches the actual RX queue.\n"
+ "\n"
+ " --selftest checks the table and reference implementations against\n"
+ " the Microsoft RSS verification suite, without loading BPF.";
+
+#include <assert.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/resource.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <getopt.h>
+#include <net/if.h>
+#include <time.h>
+
+#include <arpa/inet.h>
+#include <linux/if_link.h>
+#include <linux/ethtool.h>
+#include <linux/sockios.h>
+
+#include "libbpf.h"
+#include "bpf_load.h"
+#include "bpf_util.h"
+
+#include "xdp_rss.h" /* Shared structs between _user & _kern */
+
+/* Indexes into map_fd[], follow map order in _kern.c */
+#define MAP_TABLE	0
+#define MAP_CONFIG	1
+#define MAP_STATS	2
+#define MAP_QUEUE_CNT	3
+#define MAP_LAST	4
+
+#define RSS_QUEUE_MAX	256 /* Entries in rss_queue_cnt */
+
+/* ETH_RSS_HASH_TOP, not exported in uapi ethtool.h */
+#define RSS_HFUNC_TOEPLITZ	(1 << 0)
+
+static int ifindex = -1;
+static __u32 xdp_flags = 0;
+static char ifname_buf[IF_NAMESIZE];
+static char *ifname = NULL;
+
+/* Exit return codes */
+#define EXIT_OK			0
+#define EXIT_FAIL		1
+#define EXIT_FAIL_OPTION	2
+#define EXIT_FAIL_XDP		3
+#define EXIT_FAIL_TEST		50
+
+static void int_exit(int sig)
+{
+	fprintf(stderr,
+		"Interrupted: Removing XDP program on ifindex:%d device:%s\n",
+		ifindex, ifname);
+	if (ifindex > -1)
+		set_link_xdp_fd(ifindex, -1, xdp_flags);
+	exit(EXIT_OK);
+}
+
+static const struct option long_options[] = {
+	{"help",	no_argument,		NULL, 'h' },
+	{"dev",		required_argument,	NULL, 'd' },
+	{"sec",		required_argument,	NULL, 's' },
+	{"hash",	required_argument,	NULL, 'H' },
+	{"udp4",	no_argument,		NULL, 'u' },
+	{"default-key",	no_argument,		NULL, 'k' },
+	{"selftest",	no_argument,		NULL, 't' },
+	{"skb-mode",	no_argument,		NULL, 'S' },
+	{0, 0, NULL,  0 }
+};
+
+static void usage(char *argv[])
+{
+	int i;
+	printf("\nDOCUMENTATION:\n%s\n", __doc__);
+	printf("\n");
+	printf(" Usage: %s (options-see-below)\n",
+	       argv[0]);
+	printf(" Listing options:\n");
+	for (i = 0; long_options[i].name != 0; i++) {
+		printf(" --%-12s", long_options[i].name);
+		if (long_options[i].flag != NULL)
+			printf(" flag (internal value:%d)",
+			       *long_options[i].flag);
+		else
+			printf(" short-option: -%c",
+			       long_options[i].val);
+		printf("\n");
+	}
+	printf("\n");
+}
+
+static const char *rss_hash_names[RSS_HASH_MAX] = {
+	[RSS_HASH_TOEPLITZ]	= "toeplitz",
+	[RSS_HASH_SUPERFAST]	= "superfast",
+	[RSS_HASH_JHASH]	= "jhash",
+	[RSS_HASH_NONE]		= "none",
+};
+
+static const char *rss_stat_names[RSS_STAT_MAX] = {
+	[RSS_STAT_MATCH]	= "queue-match",
+	[RSS_STAT_MISMATCH]	= "queue-mismatch",
+	[RSS_STAT_NOT_IP]	= "not-ip",
+};
+
+static struct rss_table table;
+static struct rss_config config;
+static __u8 rss_key[RSS_KEY_MAX] = RSS_KEY_DEFAULT;
+static int rss_key_len = 40;
+
+/* Reads RSS key and indirection table of device, like ethtool -x */
+static bool rss_get_nic_config(const char *dev)
+{
+	struct ethtool_rxfh *rxfh;
+	struct ifreq ifr;
+	bool ok = false;
+	size_t size;
+	int fd;
+
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd < 0)
+		return false;
+
+	/* First call returns sizes only */
+	rxfh = calloc(1, sizeof(*rxfh));
+	if (!rxfh)
+		goto out;
+	rxfh->cmd = ETHTOOL_GRSSH;
+	memset(&ifr, 0, sizeof(ifr));
+	strncpy(ifr.ifr_name, dev, IF_NAMESIZE - 1);
+	ifr.ifr_data = (void *)rxfh;
+	if (ioctl(fd, SIOCETHTOOL, &ifr)) {
+		fprintf(stderr, "WARN: %s ETHTOOL_GRSSH: %s\n", dev,
+			strerror(errno));
+		goto out;
+	}
+	if (rxfh->indir_size > RSS_INDIR_MAX ||
+	    rxfh->key_size > RSS_KEY_MAX || !rxfh->key_size) {
+		fprintf(stderr, "WARN: %s RSS indir:%u key:%u unsupported\n",
+			dev, rxfh->indir_size, rxfh->key_size);
+		goto out;
+	}
+
+	size = sizeof(*rxfh) + rxfh->indir_size * sizeof(__u32) +
+		rxfh->key_size;
+	rxfh = realloc(rxfh, size);
+	if (!rxfh)
+		goto out;
+	ifr.ifr_data = (void *)rxfh;
+	if (ioctl(fd, SIOCETHTOOL, &ifr)) {
+		fprintf(stderr, "WARN: %s ETHTOOL_GRSSH: %s\n", dev,
+			strerror(errno));
+		goto out;
+	}
+	if (rxfh->hfunc && !(rxfh->hfunc & RSS_HFUNC_TOEPLITZ))
+		fprintf(stderr, "WARN: %s RSS hash func is not Toeplitz,"
+			" queue prediction will mismatch\n", dev);
+
+	config.indir_size = rxfh->indir_size;
+	memcpy(config.indir, rxfh->rss_config,
+	       rxfh->indir_size * sizeof(__u32));
+	rss_key_len = rxfh->key_size;
+	memcpy(rss_key, &rxfh->rss_config[rxfh->indir_size], rss_key_len);
+	ok = true;
+out:
+	free(rxfh);
+	close(fd);
+	return ok;
+}
+
+/* Checks both userspace implementations against the spec vectors */
+static int selftest(void)
+{
+	static const __u8 key[] = RSS_KEY_DEFAULT;
+	const struct rss_test_vector *v;
+	__u8 in[RSS_TUPLE_MAX];
+	__u32 ref, tbl;
+	int i, alen, failures = 0;
+
+	toeplitz_table_build(&table, key, sizeof(key));
+	for (i = 0; i < RSS_NR_TEST_VECTORS; i++) {
+		v = &rss_test_vectors[i];
+		alen = rss_test_vector_input(v, in);
+		if (alen < 0) {
+			failures++;
+			continue;
+		}
+		ref = toeplitz_hash_ref(key, sizeof(key), in, alen);
+		tbl = toeplitz_hash_tbl(&table, in, alen);
+		if (ref != v->hash_2tuple || tbl != v->hash_2tuple)
+			failures++;
+		printf(" %s %-36s 2-tuple 0x%08x ref:0x%08x tbl:0x%08x\n",
+		       v->family == AF_INET6 ? "IPv6" : "IPv4", v->src,
+		       v->hash_2tuple, ref, tbl);
+
+		ref = toeplitz_hash_ref(key, sizeof(key), in, alen + 4);
+		tbl = toeplitz_hash_tbl(&table, in, alen + 4);
+		if (ref != v->hash_4tuple || tbl != v->hash_4tuple)
+			failures++;
+		printf(" %s %-36s 4-tuple 0x%08x ref:0x%08x tbl:0x%08x\n",
+		       v->family == AF_INET6 ? "IPv6" : "IPv4", v->src,
+		       v->hash_4tuple, ref, tbl);
+	}
+	printf("selftest: %s (%d failures)\n", failures ? "FAILED" : "PASS",
+	       failures);
+	return failures ? EXIT_FAIL_TEST : EXIT_OK;
+}
+
+static __u64 percpu_sum(int fd, __u32 key)
+{
+	unsigned int nr_cpus = bpf_num_possible_cpus();
+	__u64 values[nr_cpus];
+	__u64 sum = 0;
+	int i;
+
+	if (bpf_map_lookup_elem(fd, &key, values))
+		return 0;
+	for (i = 0; i < nr_cpus; i++)
+		sum += values[i];
+	return sum;
+}
+
+struct rss_record {
+	__u64 stats[RSS_STAT_MAX];
+	__u64 queue[RSS_QUEUE_MAX];
+};
+
+static void stats_collect(struct rss_record *rec)
+{
+	__u32 key;
+
+	for (key = 0; key < RSS_STAT_MAX; key++)
+		rec->stats[key] = percpu_sum(map_fd[MAP_STATS], key);
+	for (key = 0; key < RSS_QUEUE_MAX; key++)
+		rec->queue[key] = percpu_sum(map_fd[MAP_QUEUE_CNT], key);
+}
+
+static void stats_print(struct rss_record *rec, struct rss_record *prev,
+			double period)
+{
+	__u64 total;
+	__u32 i;
+
+	printf("\nhash:%s indir_size:%u (queue: pps)\n",
+	       rss_hash_names[config.hash_func], config.indir_size);
+	for (i = 0; i < RSS_QUEUE_MAX; i++) {
+		if (rec->queue[i] == prev->queue[i])
+			continue;
+		printf(" queue %-3u %12.0f\n", i,
+		       (rec->queue[i] - prev->queue[i]) / period);
+	}
+	total = rec->stats[RSS_STAT_MATCH] + rec->stats[RSS_STAT_MISMATCH];
+	for (i = 0; i < RSS_STAT_MAX; i++)
+		printf(" %-15s %12llu\n", rss_stat_names[i], rec->stats[i]);
+	if (total)
+		printf(" prediction match %.2f%%\n",
+		       100.0 * rec->stats[RSS_STAT_MATCH] / total);
+}
+
+static void stats_poll(int interval)
+{
+	struct rss_record rec, prev;
+
+	memset(&prev, 0, sizeof(prev));
+	while (1) {
+		memset(&rec, 0, sizeof(rec));
+		stats_collect(&rec);
+		stats_print(&rec, &prev, interval);
+		prev = rec;
+		sleep(interval);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	struct rlimit r = {RLIM_INFINITY, RLIM_INFINITY};
+	bool default_key = false;
+	char filename[256];
+	int longindex = 0;
+	int interval = 1;
+	__u32 key = 0;
+	int opt, i;
+
+	snprintf(filename, sizeof(filename), "%s_kern.o", argv[0]);
+
+	/* Parse commands line args */
+	while ((opt = getopt_long(argc, argv, "hd:s:H:uktS",
+				  long_options, &longindex)) != -1) {
+		switch (opt) {
+		case 'd':
+			if (strlen(optarg) >= IF_NAMESIZE) {
+				fprintf(stderr, "ERR: --dev name too long\n");
+				goto error;
+			}
+			ifname = (char *)&ifname_buf;
+			strncpy(ifname, optarg, IF_NAMESIZE);
+			ifindex = if_nametoindex(ifname);
+			if (ifindex == 0) {
+				fprintf(stderr,
+					"ERR: --dev name unknown err(%d):%s\n",
+					errno, strerror(errno));
+				goto error;
+			}
+			break;
+		case 's':
+			interval = atoi(optarg);
+			break;
+		case 'H':
+			for (i = 0; i < RSS_HASH_MAX; i++)
+				if (!strcmp(optarg, rss_hash_names[i]))
+					break;
+			if (i == RSS_HASH_MAX) {
+				fprintf(stderr, "ERR: --hash toeplitz|superfast"
+					"|jhash|none\n");
+				goto error;
+			}
+			config.hash_func = i;
+			break;
+		case 'u':
+			config.flags |= RSS_FLAG_UDP_4TUPLE;
+			break;
+		case 'k':
+			default_key = true;
+			break;
+		case 't':
+			return selftest();
+		case 'S':
+			xdp_flags |= XDP_FLAGS_SKB_MODE;
+			break;
+		case 'h':
+		error:
+		default:
+			usage(argv);
+			return EXIT_FAIL_OPTION;
+		}
+	}
+	/* Required options */
+	if (ifindex == -1) {
+		fprintf(stderr, "ERR: required option --dev missing\n");
+		usage(argv);
+		return EXIT_FAIL_OPTION;
+	}
+
+	/* Without NIC RSS config: default key, no queue prediction */
+	if (!default_key && !rss_get_nic_config(ifname))
+		fprintf(stderr, "WARN: using default RSS key\n");
+	toeplitz_table_build(&table, rss_key, rss_key_len);
+
+	/* Increase resource limits */
+	if (setrlimit(RLIMIT_MEMLOCK, &r)) {
+		perror("setrlimit(RLIMIT_MEMLOCK, RLIM_INFINITY)");
+		return EXIT_FAIL;
+	}
+
+	if (load_bpf_file(filename)) {
+		fprintf(stderr, "ERR in load_bpf_file(): %s", bpf_log_buf);
+		return EXIT_FAIL;
+	}
+
+	if (!prog_fd[0]) {
+		fprintf(stderr, "ERR: load_bpf_file: %s\n", strerror(errno));
+		return EXIT_FAIL;
+	}
+
+	if (bpf_map_update_elem(map_fd[MAP_TABLE], &key, &table, 0) ||
+	    bpf_map_update_elem(map_fd[MAP_CONFIG], &key, &config, 0)) {
+		fprintf(stderr, "ERR: set rss maps: %s\n", strerror(errno));
+		return EXIT_FAIL;
+	}
+
+	/* Remove XDP program when program is interrupted */
+	signal(SIGINT, int_exit);
+
+	if (set_link_xdp_fd(ifindex, prog_fd[0], xdp_flags) < 0) {
+		fprintf(stderr, "link set xdp fd failed\n");
+		return EXIT_FAIL_XDP;
+	}
+
+	stats_poll(interval);
+
+	return EXIT_OK;
+}
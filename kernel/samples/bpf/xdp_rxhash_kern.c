@@ -1,5 +1,7 @@
 // *** DO NOT USE THIS PROGRAM ***
 // Obsoleted: only kept for historical reasons
+// The xdp_md2->rxhash extension was rejected upstream, see xdp_rss
+// for a software Toeplitz RSS hash that works on any kernel.
 
 /* xdp_rxhash feature test example */
 #include <uapi/linux/bpf.h>
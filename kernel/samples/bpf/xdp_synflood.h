@@ -0,0 +1,58 @@
+#ifndef __XDP_SYNFLOOD_H__
+#define __XDP_SYNFLOOD_H__
+
+/* Shared structs between _user & _kern (and _bench) */
+
+enum synflood_mode {
+	SYNFLOOD_MODE_OFF = 0,
+	SYNFLOOD_MODE_SYNDROP,	/* first-SYN drop, validate on retransmit */
+	SYNFLOOD_MODE_COOKIE,	/* SYN-ACK cookie, validate on RST */
+};
+
+struct syn_config {
+	__u32 mode;
+	__u32 secret;	/* cookie hash key, random from userspace */
+};
+
+enum syn_stat {
+	SYN_STAT_PASS_OTHER = 0,	/* non-SYN, IPv4 TCP */
+	SYN_STAT_PASS_VALIDATED,	/* SYN from validated source */
+	SYN_STAT_DROP_FIRST,		/* SYN from unvalidated source */
+	SYN_STAT_TX_COOKIE,		/* SYN-ACK cookie sent */
+	SYN_STAT_VALIDATED,		/* source got validated */
+	SYN_STAT_MAX
+};
+
+/* Keyed per source port, so parallel connects from one host (or NAT)
+ * don't overwrite each other's pending SYN.
+ */
+struct syn_pending_key {
+	__u32 saddr;	/* network byte-order */
+	__u16 sport;	/* network byte-order */
+	__u16 pad;
+};
+
+struct syn_pending {
+	__u64 first_ns;
+	__u32 seq;	/* network byte-order */
+	__u32 pad;
+};
+
+/* Linux retransmits a SYN after 1 sec (TCP_TIMEOUT_INIT), the
+ * window allow for some jitter and later retransmits.
+ */
+#define SYN_RETRANS_MIN_NS	(800ULL * 1000000)
+#define SYN_RETRANS_MAX_NS	(10ULL * 1000000000)
+
+/* Cookie time slot 2^30 ns ~1.07 sec, current and previous accepted */
+#define SYN_COOKIE_SLOT_SHIFT	30
+
+/* Hash input for the cookie, the client oriented 4-tuple */
+struct syn_cookie_input {
+	__u32 saddr;
+	__u32 daddr;
+	__u32 ports;	/* (source << 16) | dest, as in packet */
+	__u32 slot;
+};
+
+#endif /* __XDP_SYNFLOOD_H__ */
@@ -0,0 +1,387 @@
+/* Copyright(c) 2017 Jesper Dangaard Brouer, Red Hat, Inc.
+ */
+static const char *__doc__=
+ " XDP synflood: functional test and benchmark via BPF_PROG_TEST_RUN\n"
+ "\n"
+ " Loads xdp_synflood_kern.o (not attached to any device), checks\n"
+ " the verdicts and the generated SYN-ACK cookie of both modes, and\n"
+ " measures the per packet cost of: established flow packets, SYN\n"
+ " flood from spoofed sources, and SYNs from validated sources.\n"
+ " The syndrop check waits ~1 sec for the retransmit window.\n"
+ ;
+
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/resource.h>
+#include <getopt.h>
+#include <arpa/inet.h>
+#include <linux/bpf.h>
+
+#include "bpf_load.h"
+#include "bpf_util.h"
+#include "libbpf.h"
+
+#include "xdp_synflood.h"
+#include "xdp_test_run.h"
+
+/* Exit return codes */
+#define	EXIT_OK			0
+#define EXIT_FAIL		1
+#define EXIT_FAIL_OPTION	2
+#define EXIT_FAIL_BPF		40
+#define EXIT_FAIL_TEST		50
+
+/* Indexes into map_fd[], follow map order in _kern.c */
+#define MAP_CONFIG	0
+#define MAP_STATS	1
+#define MAP_VALIDATED	2
+#define MAP_PENDING	3
+
+#define NR_PKTS 256 /* Distinct spoofed sources per flood test */
+
+static const struct option long_options[] = {
+	{"help",	no_argument,		NULL, 'h' },
+	{"repeat",	required_argument,	NULL, 'r' },
+	{0, 0, NULL,  0 }
+};
+
+static const char *xdp_action_names[XDP_TX + 1] = {
+	[XDP_ABORTED]	= "XDP_ABORTED",
+	[XDP_DROP]	= "XDP_DROP",
+	[XDP_PASS]	= "XDP_PASS",
+	[XDP_TX]	= "XDP_TX",
+};
+
+static void usage(char *argv[])
+{
+	int i;
+	printf("\nDOCUMENTATION:\n%s\n", __doc__);
+	printf(" Usage: %s (options-see-below)\n",
+	       argv[0]);
+	printf(" Listing options:\n");
+	for (i = 0; long_options[i].name != 0; i++) {
+		printf(" --%-12s", long_options[i].name);
+		if (long_options[i].flag != NULL)
+			printf(" flag (internal value:%d)",
+			       *long_options[i].flag);
+		else
+			printf(" short-option: -%c",
+			       long_options[i].val);
+		printf("\n");
+	}
+	printf("\n");
+}
+
+static int failures;
+
+#define CHECK(cond, fmt, ...)						\
+	do {								\
+		if (!(cond)) {						\
+			failures++;					\
+			printf(" FAIL: " fmt "\n", ##__VA_ARGS__);	\
+		} else {						\
+			printf(" ok:   " fmt "\n", ##__VA_ARGS__);	\
+		}							\
+	} while (0)
+
+static void set_mode(__u32 mode)
+{
+	struct syn_config cfg = { .mode = mode, .secret = 0x12345678 };
+	__u32 key = 0;
+
+	if (bpf_map_update_elem(map_fd[MAP_CONFIG], &key, &cfg, BPF_ANY)) {
+		fprintf(stderr, "ERR: set syn_config: %s\n", strerror(errno));
+		exit(EXIT_FAIL_BPF);
+	}
+}
+
+static void clear_sources(void)
+{
+	int fds[] = { map_fd[MAP_VALIDATED], map_fd[MAP_PENDING] };
+	__u64 key, next; /* Room for both key types */
+	int i;
+
+	for (i = 0; i < 2; i++)
+		while (bpf_map_get_next_key(fds[i], NULL, &next) == 0) {
+			key = next;
+			bpf_map_delete_elem(fds[i], &key);
+		}
+}
+
+static void tcp_pkt(struct test_pkt *pkt, const char *src, __u16 sport,
+		    __u8 flags, __u32 seq)
+{
+	struct test_pkt_spec spec;
+
+	memset(&spec, 0, sizeof(spec));
+	spec.proto = IPPROTO_TCP;
+	spec.sport = sport;
+	spec.dport = 80;
+	spec.tcp_flags = flags;
+	spec.tcp_seq = seq;
+	if (!test_pkt_spec_addr(&spec, src, "198.18.0.1")) {
+		fprintf(stderr, "ERR: bad address %s\n", src);
+		exit(EXIT_FAIL);
+	}
+	test_pkt_build(pkt, &spec);
+}
+
+/* Single run, returning verdict and the (possibly rewritten) packet */
+static __u32 run_once(struct test_pkt *pkt, struct test_pkt *out)
+{
+	__u32 size_out = sizeof(out->data);
+	__u32 retval = 0, duration;
+
+	if (bpf_prog_test_run(prog_fd[0], 1, pkt->data, pkt->len,
+			      out->data, &size_out, &retval, &duration)) {
+		fprintf(stderr, "ERR: BPF_PROG_TEST_RUN failed: %s\n",
+			strerror(errno));
+		exit(EXIT_FAIL_BPF);
+	}
+	out->len = size_out;
+	return retval;
+}
+
+static bool csum_ok(struct test_pkt *pkt)
+{
+	struct iphdr *iph = (void *)pkt->data + sizeof(struct ethhdr);
+	struct tcphdr *tcph = (void *)(iph + 1);
+	int l4_len = ntohs(iph->tot_len) - sizeof(*iph);
+	__u32 sum;
+
+	if (test_csum_fold(test_csum_add(0, iph, sizeof(*iph))) != 0)
+		return false;
+	sum = test_csum_add(0, &iph->saddr, 8);
+	sum += htons(IPPROTO_TCP) + htons(l4_len);
+	return test_csum_fold(test_csum_add(sum, tcph, l4_len)) == 0;
+}
+
+static void test_cookie_mode(void)
+{
+	struct test_pkt syn, out, rst;
+	struct iphdr *iph;
+	struct tcphdr *tcph;
+	__u32 verdict, cookie;
+
+	printf("\nFunctional: SYN-ACK cookie mode\n");
+	set_mode(SYNFLOOD_MODE_COOKIE);
+	clear_sources();
+
+	tcp_pkt(&syn, "192.0.2.10", 40000, TEST_TCP_SYN, 1000);
+	verdict = run_once(&syn, &out);
+	CHECK(verdict == XDP_TX, "SYN from unknown source -> XDP_TX (%u)",
+	      verdict);
+
+	iph  = (void *)out.data + sizeof(struct ethhdr);
+	tcph = (void *)(iph + 1);
+	cookie = ntohl(tcph->ack_seq);
+	CHECK(tcph->syn && tcph->ack && !tcph->rst,
+	      "reply has SYN+ACK flags");
+	CHECK(iph->daddr == inet_addr("192.0.2.10") &&
+	      ntohs(tcph->dest) == 40000 && ntohs(tcph->source) == 80,
+	      "reply addressed to client");
+	CHECK(cookie != 1001, "ACK number is not seq+1 (cookie:0x%08x)",
+	      cookie);
+	CHECK(csum_ok(&out), "IP and TCP checksums valid");
+
+	/* Client RST answering unacceptable ACK: seq = SEG.ACK */
+	tcp_pkt(&rst, "192.0.2.10", 40000, TEST_TCP_RST, cookie ^ 0x80000000);
+	verdict = run_once(&rst, &out);
+	CHECK(verdict == XDP_PASS, "RST with bad cookie -> XDP_PASS (%u)",
+	      verdict);
+	tcp_pkt(&rst, "192.0.2.10", 40000, TEST_TCP_RST, cookie);
+	verdict = run_once(&rst, &out);
+	CHECK(verdict == XDP_DROP, "RST with cookie validates -> XDP_DROP (%u)",
+	      verdict);
+
+	verdict = run_once(&syn, &out);
+	CHECK(verdict == XDP_PASS, "SYN retransmit from validated -> XDP_PASS"
+	      " (%u)", verdict);
+}
+
+static void test_syndrop_mode(void)
+{
+	struct test_pkt syn, syn2, nat1, nat2, out;
+	__u32 verdict;
+
+	printf("\nFunctional: first-SYN drop mode\n");
+	set_mode(SYNFLOOD_MODE_SYNDROP);
+	clear_sources();
+
+	tcp_pkt(&syn, "192.0.2.20", 41000, TEST_TCP_SYN, 5000);
+	tcp_pkt(&syn2, "192.0.2.20", 41000, TEST_TCP_SYN, 7777);
+	verdict = run_once(&syn, &out);
+	CHECK(verdict == XDP_DROP, "first SYN -> XDP_DROP (%u)", verdict);
+	verdict = run_once(&syn, &out);
+	CHECK(verdict == XDP_DROP, "immediate repeat -> XDP_DROP (%u)",
+	      verdict);
+
+	/* Parallel connects from one host, e.g. behind NAT */
+	tcp_pkt(&nat1, "192.0.2.21", 42000, TEST_TCP_SYN, 1111);
+	tcp_pkt(&nat2, "192.0.2.21", 42001, TEST_TCP_SYN, 2222);
+	run_once(&nat1, &out);
+	run_once(&nat2, &out);
+
+	sleep(1);
+	verdict = run_once(&syn2, &out);
+	CHECK(verdict == XDP_DROP, "other seq after 1s -> XDP_DROP (%u)",
+	      verdict);
+	verdict = run_once(&nat1, &out);
+	CHECK(verdict == XDP_PASS, "retransmit of parallel connect, not the"
+	      " last SYN from host -> XDP_PASS (%u)", verdict);
+	sleep(1);
+	verdict = run_once(&syn2, &out);
+	CHECK(verdict == XDP_PASS, "retransmit after 1s -> XDP_PASS (%u)",
+	      verdict);
+	tcp_pkt(&syn, "192.0.2.20", 41001, TEST_TCP_SYN, 9999);
+	verdict = run_once(&syn, &out);
+	CHECK(verdict == XDP_PASS, "new SYN from validated -> XDP_PASS (%u)",
+	      verdict);
+}
+
+/* The kernel runs all repeats on the same buffer, thus a program that
+ * rewrites the packet (the SYN-ACK cookie) would only see the original
+ * once.  Such tests use rounds of single runs, which are noisier.
+ */
+static void bench(const char *desc, struct test_pkt *pkts, int nr,
+		  __u32 repeat, bool rewrites)
+{
+	__u64 verdicts[XDP_TX + 1] = { 0 };
+	__u32 rounds = repeat / 100 ? : 1;
+	double ns = 0, res;
+	int i;
+
+	if (!rewrites) {
+		ns = xdp_test_run_many(prog_fd[0], pkts, nr, repeat, verdicts);
+	} else {
+		for (i = 0; i < rounds && ns >= 0; i++) {
+			res = xdp_test_run_many(prog_fd[0], pkts, nr, 1,
+						verdicts);
+			ns = res < 0 ? res : ns + res / rounds;
+		}
+	}
+	if (ns < 0) {
+		fprintf(stderr, "ERR: BPF_PROG_TEST_RUN failed: %s\n",
+			strerror(-ns));
+		exit(EXIT_FAIL_BPF);
+	}
+	printf(" %-40s %7.2f ns/pkt %9.0f pps", desc, ns,
+	       ns > 0 ? 1000000000 / ns : 0);
+	for (i = 0; i <= XDP_TX; i++)
+		if (verdicts[i])
+			printf(" %s:%llu", xdp_action_names[i], verdicts[i]);
+	printf("\n");
+}
+
+/* Spoofed SYN flood, one distinct source per packet */
+static void build_flood(struct test_pkt *pkts, int nr, __u8 flags)
+{
+	char src[INET_ADDRSTRLEN];
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		snprintf(src, sizeof(src), "203.0.%d.%d", i / 250, 1 + i % 250);
+		tcp_pkt(&pkts[i], src, 1024 + i, flags, 0x1000 * i);
+	}
+}
+
+static void validate_flood_sources(int nr)
+{
+	__u64 now = 0;
+	__u32 ip;
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		ip = htonl((203 << 24) | ((i / 250) << 8) | (1 + i % 250));
+		bpf_map_update_elem(map_fd[MAP_VALIDATED], &ip, &now, BPF_ANY);
+	}
+}
+
+static void run_bench(__u32 repeat)
+{
+	struct test_pkt *pkts;
+
+	pkts = calloc(NR_PKTS, sizeof(*pkts));
+	if (!pkts)
+		exit(EXIT_FAIL);
+
+	printf("\nBenchmark, repeat %u over %d sources:\n", repeat, NR_PKTS);
+	set_mode(SYNFLOOD_MODE_OFF);
+	build_flood(pkts, NR_PKTS, TEST_TCP_SYN);
+	bench("mode off, SYN", pkts, NR_PKTS, repeat, false);
+
+	build_flood(pkts, NR_PKTS, TEST_TCP_ACK);
+	set_mode(SYNFLOOD_MODE_SYNDROP);
+	bench("established ACK (always pass)", pkts, NR_PKTS, repeat,
+	      false);
+
+	build_flood(pkts, NR_PKTS, TEST_TCP_SYN);
+	clear_sources();
+	bench("syndrop: SYN flood, spoofed", pkts, NR_PKTS, repeat, false);
+	set_mode(SYNFLOOD_MODE_COOKIE);
+	clear_sources();
+	bench("cookie: SYN flood, spoofed (SYN-ACK)", pkts, NR_PKTS, repeat,
+	      true);
+
+	validate_flood_sources(NR_PKTS);
+	bench("SYN from validated sources", pkts, NR_PKTS, repeat, false);
+	free(pkts);
+}
+
+int main(int argc, char **argv)
+{
+	struct rlimit r = {RLIM_INFINITY, RLIM_INFINITY};
+	__u32 repeat = 100000;
+	char filename[256];
+	int longindex = 0;
+	int opt;
+
+	while ((opt = getopt_long(argc, argv, "hr:",
+				  long_options, &longindex)) != -1) {
+		switch (opt) {
+		case 'r':
+			repeat = atoi(optarg);
+			break;
+		case 'h':
+		default:
+			usage(argv);
+			return EXIT_FAIL_OPTION;
+		}
+	}
+
+	if (setrlimit(RLIMIT_MEMLOCK, &r)) {
+		perror("setrlimit(RLIMIT_MEMLOCK, RLIM_INFINITY)");
+		return EXIT_FAIL;
+	}
+
+	/* Bench binary lives next to the kern object */
+	snprintf(filename, sizeof(filename), "%s", argv[0]);
+	if (strrchr(filename, '_'))
+		*strrchr(filename, '_') = '\0';
+	strncat(filename, "_kern.o", sizeof(filename) - strlen(filename) - 1);
+	if (load_bpf_file(filename)) {
+		fprintf(stderr, "ERR in load_bpf_file(%s): %s\n",
+			filename, bpf_log_buf);
+		return EXIT_FAIL_BPF;
+	}
+	if (!prog_fd[0]) {
+		printf("load_bpf_file: %s\n", strerror(errno));
+		return EXIT_FAIL_BPF;
+	}
+
+	test_cookie_mode();
+	test_syndrop_mode();
+	run_bench(repeat);
+
+	if (failures) {
+		printf("\n%d functional checks FAILED\n", failures);
+		return EXIT_FAIL_TEST;
+	}
+	return EXIT_OK;
+}
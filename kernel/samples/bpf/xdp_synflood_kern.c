@@ -0,0 +1,365 @@
+/*  XDP example: SYN-flood protection by validating TCP sources
+ *
+ *  SYNs from sources not yet validated are not passed to the stack.
+ *  A source is validated by proving it runs a real TCP stack, in one
+ *  of two modes (selected by userspace via syn_config):
+ *
+ *  SYNFLOOD_MODE_SYNDROP: first-SYN drop.  The first SYN is dropped
+ *   and remembered (LRU per source IP).  A real client retransmits
+ *   the same SYN (same sport and seq) after its RTO (1 sec), which
+ *   validates the source.  Spoofed floods rarely retransmit.
+ *
+ *  SYNFLOOD_MODE_COOKIE: SYN-ACK cookie (RST authentication).  The
+ *   SYN is answered via XDP_TX with a SYN-ACK carrying a cookie as
+ *   ACK number, which is deliberately not the expected seq+1.  Per
+ *   RFC 793 a client in SYN-SENT answers an unacceptable ACK with a
+ *   RST using the ACK number as seq, and later retransmits its SYN.
+ *   A RST carrying a valid cookie validates the source.  The cookie
+ *   is a keyed hash of the 4-tuple and a ~1 sec time slot.
+ *
+ *  Both modes are stateless until a source is validated, and cost the
+ *  legitimate client one SYN retransmit.  Validated sources are kept
+ *  in an LRU hash.  Non-SYN segments (established flows) always
+ *  pass, as does IPv6 and non-TCP traffic.
+ *
+ *  Copyright(c) 2017 Jesper Dangaard Brouer, Red Hat, Inc.
+ */
+#define KBUILD_MODNAME "foo"
+#include <uapi/linux/bpf.h>
+#include <uapi/linux/if_ether.h>
+#include <uapi/linux/if_packet.h>
+#include <uapi/linux/if_vlan.h>
+#include <uapi/linux/ip.h>
+#include <uapi/linux/in.h>
+#include <uapi/linux/tcp.h>
+#include "bpf_helpers.h"
+#include "hash_func01.h"
+
+#include "xdp_synflood.h" /* Shared structs between _user & _kern */
+
+struct vlan_hdr {
+	__be16 h_vlan_TCI;
+	__be16 h_vlan_encapsulated_proto;
+};
+
+struct bpf_map_def SEC("maps") syn_config = {
+	.type        = BPF_MAP_TYPE_ARRAY,
+	.key_size    = sizeof(u32),
+	.value_size  = sizeof(struct syn_config),
+	.max_entries = 1,
+};
+
+struct bpf_map_def SEC("maps") syn_stats = {
+	.type        = BPF_MAP_TYPE_PERCPU_ARRAY,
+	.key_size    = sizeof(u32),
+	.value_size  = sizeof(u64),
+	.max_entries = SYN_STAT_MAX,
+};
+
+/* Validated source IPs, value is validation time */
+struct bpf_map_def SEC("maps") syn_validated = {
+	.type        = BPF_MAP_TYPE_LRU_HASH,
+	.key_size    = sizeof(u32),
+	.value_size  = sizeof(u64),
+	.max_entries = 1000000,
+};
+
+/* First-SYN drop mode: SYNs waiting for a retransmit */
+struct bpf_map_def SEC("maps") syn_pending = {
+	.type        = BPF_MAP_TYPE_LRU_HASH,
+	.key_size    = sizeof(struct syn_pending_key),
+	.value_size  = sizeof(struct syn_pending),
+	.max_entries = 100000,
+};
+
+//#define DEBUG 1
+#ifdef  DEBUG
+/* Only use this for debug output. Notice output from bpf_trace_printk()
+ * end-up in /sys/kernel/debug/tracing/trace_pipe
+ */
+#define bpf_debug(fmt, ...)						\
+		({							\
+			char ____fmt[] = fmt;				\
+			bpf_trace_printk(____fmt, sizeof(____fmt),	\
+				     ##__VA_ARGS__);			\
+		})
+#else
+#define bpf_debug(fmt, ...) { } while (0)
+#endif
+
+static __always_inline
+u32 stats_count(u32 key, u32 action)
+{
+	u64 *value = bpf_map_lookup_elem(&syn_stats, &key);
+
+	if (value)
+		*value += 1;
+	return action;
+}
+
+/* Parse Ethernet layer 2, extract network layer 3 offset and protocol
+ *
+ * Returns false on error and non-supported ether-type
+ */
+static __always_inline
+bool parse_eth(struct ethhdr *eth, void *data_end,
+	       u16 *eth_proto, u64 *l3_offset)
+{
+	u16 eth_type;
+	u64 offset;
+
+	offset = sizeof(*eth);
+	if ((void *)eth + offset > data_end)
+		return false;
+
+	eth_type = eth->h_proto;
+
+	/* Skip non 802.3 Ethertypes */
+	if (unlikely(ntohs(eth_type) < ETH_P_802_3_MIN))
+		return false;
+
+	/* Handle VLAN tagged packet */
+	if (eth_type == htons(ETH_P_8021Q) || eth_type == htons(ETH_P_8021AD)) {
+		struct vlan_hdr *vlan_hdr;
+
+		vlan_hdr = (void *)eth + offset;
+		offset += sizeof(*vlan_hdr);
+		if ((void *)eth + offset > data_end)
+			return false;
+		eth_type = vlan_hdr->h_vlan_encapsulated_proto;
+	}
+
+	*eth_proto = ntohs(eth_type);
+	*l3_offset = offset;
+	return true;
+}
+
+/* Cookie over the client oriented 4-tuple, see xdp_synflood.h */
+static __always_inline
+u32 syn_cookie(struct iphdr *iph, struct tcphdr *tcph, u32 secret, u32 slot)
+{
+	struct syn_cookie_input in;
+
+	in.saddr = iph->saddr;
+	in.daddr = iph->daddr;
+	in.ports = ((u32)tcph->source << 16) | tcph->dest;
+	in.slot  = slot;
+	return SuperFastHash((const char *)&in, sizeof(in), secret);
+}
+
+static __always_inline
+u16 csum_fold_helper(u32 csum)
+{
+	csum = (csum & 0xffff) + (csum >> 16);
+	csum = (csum & 0xffff) + (csum >> 16);
+	return ~csum;
+}
+
+/* Incremental checksum update (RFC 1624) for a 32-bit field */
+static __always_inline
+void csum_replace4(u16 *sum, u32 from, u32 to)
+{
+	u32 csum = (u16)~(*sum);
+
+	csum += (~from >> 16) + (~from & 0xffff);
+	csum += (to >> 16) + (to & 0xffff);
+	*sum = csum_fold_helper(csum);
+}
+
+/* Turn the SYN into a SYN-ACK with the cookie as ACK number, in place.
+ * Swapping addresses and ports does not change the TCP checksum.
+ * TCP options are reflected as-is, the client discards the segment
+ * anyhow due to the unacceptable ACK.
+ */
+static __always_inline
+u32 tx_synack_cookie(struct ethhdr *eth, struct iphdr *iph,
+		     struct tcphdr *tcph, u32 cookie)
+{
+	u8 mac[ETH_ALEN];
+	u32 old_flags, new_flags;
+	u32 tmp, csum = 0;
+	u16 *w = (u16 *)iph;
+	u16 port;
+	int i;
+
+	/* The expected ACK would be seq+1, never use that */
+	if (cookie == ntohl(tcph->seq) + 1)
+		cookie ^= 1;
+
+	__builtin_memcpy(mac, eth->h_dest, ETH_ALEN);
+	__builtin_memcpy(eth->h_dest, eth->h_source, ETH_ALEN);
+	__builtin_memcpy(eth->h_source, mac, ETH_ALEN);
+
+	tmp = iph->saddr;
+	iph->saddr = iph->daddr;
+	iph->daddr = tmp;
+	iph->ttl   = 64;
+	iph->check = 0;
+#pragma clang loop unroll(full)
+	for (i = 0; i < sizeof(*iph) / 2; i++)
+		csum += w[i];
+	iph->check = csum_fold_helper(csum);
+
+	port = tcph->source;
+	tcph->source = tcph->dest;
+	tcph->dest   = port;
+
+	csum_replace4(&tcph->check, tcph->ack_seq, htonl(cookie));
+	tcph->ack_seq = htonl(cookie);
+	/* Our seq is not used for anything, reuse cookie */
+	csum_replace4(&tcph->check, tcph->seq, htonl(cookie));
+	tcph->seq = htonl(cookie);
+
+	/* Flags share a 32-bit word with doff and window */
+	old_flags = ((u32 *)tcph)[3];
+	tcph->ack = 1;
+	new_flags = ((u32 *)tcph)[3];
+	csum_replace4(&tcph->check, old_flags, new_flags);
+
+	return XDP_TX;
+}
+
+static __always_inline
+bool source_validated(u32 saddr)
+{
+	return bpf_map_lookup_elem(&syn_validated, &saddr) != NULL;
+}
+
+static __always_inline
+void source_validate(u32 saddr, u64 now)
+{
+	bpf_map_update_elem(&syn_validated, &saddr, &now, BPF_ANY);
+}
+
+static __always_inline
+u32 handle_syn_drop_first(struct iphdr *iph, struct tcphdr *tcph, u64 now)
+{
+	struct syn_pending_key key;
+	struct syn_pending *p, new;
+	u32 saddr = iph->saddr;
+	u64 age;
+
+	key.saddr = saddr;
+	key.sport = tcph->source;
+	key.pad   = 0;
+
+	p = bpf_map_lookup_elem(&syn_pending, &key);
+	if (p && p->seq == tcph->seq) {
+		age = now - p->first_ns;
+		if (age >= SYN_RETRANS_MIN_NS && age <= SYN_RETRANS_MAX_NS) {
+			source_validate(saddr, now);
+			bpf_map_delete_elem(&syn_pending, &key);
+			return stats_count(SYN_STAT_VALIDATED, XDP_PASS);
+		}
+		if (age < SYN_RETRANS_MIN_NS) /* Too early, keep first */
+			return stats_count(SYN_STAT_DROP_FIRST, XDP_DROP);
+	}
+	/* New (or too old) first SYN, remember it */
+	new.first_ns = now;
+	new.seq      = tcph->seq;
+	new.pad      = 0;
+	bpf_map_update_elem(&syn_pending, &key, &new, BPF_ANY);
+	return stats_count(SYN_STAT_DROP_FIRST, XDP_DROP);
+}
+
+static __always_inline
+u32 parse_tcp(struct xdp_md *ctx, struct iphdr *iph, u64 l4_offset)
+{
+	void *data_end = (void *)(long)ctx->data_end;
+	void *data     = (void *)(long)ctx->data;
+	struct tcphdr *tcph = data + l4_offset;
+	struct syn_config *cfg;
+	u32 key = 0, slot, cookie;
+	u64 now;
+
+	/* Ethernet header is rewritten on XDP_TX */
+	if (data + sizeof(struct ethhdr) > data_end || tcph + 1 > data_end)
+		return XDP_ABORTED;
+
+	/* Established flows, and our own outgoing handshakes */
+	if (!tcph->syn && !tcph->rst)
+		return stats_count(SYN_STAT_PASS_OTHER, XDP_PASS);
+	if (tcph->syn && tcph->ack)
+		return stats_count(SYN_STAT_PASS_OTHER, XDP_PASS);
+
+	cfg = bpf_map_lookup_elem(&syn_config, &key);
+	if (!cfg || cfg->mode == SYNFLOOD_MODE_OFF)
+		return stats_count(SYN_STAT_PASS_OTHER, XDP_PASS);
+
+	now  = bpf_ktime_get_ns();
+	slot = now >> SYN_COOKIE_SLOT_SHIFT;
+
+	if (tcph->rst) {
+		/* Only a cookie RST is of interest, others pass */
+		if (cfg->mode != SYNFLOOD_MODE_COOKIE ||
+		    source_validated(iph->saddr))
+			return stats_count(SYN_STAT_PASS_OTHER, XDP_PASS);
+		/* Cookie may have its low bit flipped, see tx_synack_cookie */
+		cookie = ntohl(tcph->seq);
+		if ((cookie ^ syn_cookie(iph, tcph, cfg->secret, slot)) <= 1 ||
+		    (cookie ^ syn_cookie(iph, tcph, cfg->secret, slot - 1)) <= 1) {
+			source_validate(iph->saddr, now);
+			return stats_count(SYN_STAT_VALIDATED, XDP_DROP);
+		}
+		return stats_count(SYN_STAT_PASS_OTHER, XDP_PASS);
+	}
+
+	/* Plain SYN */
+	if (source_validated(iph->saddr))
+		return stats_count(SYN_STAT_PASS_VALIDATED, XDP_PASS);
+
+	if (cfg->mode == SYNFLOOD_MODE_SYNDROP)
+		return handle_syn_drop_first(iph, tcph, now);
+
+	/* Cookie mode: SYN carrying data (e.g. TFO) is not answered */
+	if (iph->ihl != 5 || ntohs(iph->tot_len) != sizeof(*iph) + tcph->doff * 4)
+		return stats_count(SYN_STAT_DROP_FIRST, XDP_DROP);
+
+	cookie = syn_cookie(iph, tcph, cfg->secret, slot);
+	return stats_count(SYN_STAT_TX_COOKIE,
+			   tx_synack_cookie(data, iph, tcph, cookie));
+}
+
+static __always_inline
+u32 parse_ipv4(struct xdp_md *ctx, u64 l3_offset)
+{
+	void *data_end = (void *)(long)ctx->data_end;
+	void *data     = (void *)(long)ctx->data;
+	struct iphdr *iph = data + l3_offset;
+
+	if (iph + 1 > data_end) {
+		bpf_debug("Invalid IPv4 packet: L3off:%llu\n", l3_offset);
+		return XDP_ABORTED;
+	}
+	if (iph->protocol != IPPROTO_TCP)
+		return XDP_PASS;
+
+	/* Fragments other than the first carry no TCP header */
+	if (iph->frag_off & htons(0x1FFF))
+		return XDP_PASS;
+
+	return parse_tcp(ctx, iph, l3_offset + iph->ihl * 4);
+}
+
+SEC("xdp_synflood")
+int  xdp_synflood_program(struct xdp_md *ctx)
+{
+	void *data_end = (void *)(long)ctx->data_end;
+	void *data     = (void *)(long)ctx->data;
+	struct ethhdr *eth = data;
+	u16 eth_proto = 0;
+	u64 l3_offset = 0;
+
+	if (!(parse_eth(eth, data_end, &eth_proto, &l3_offset))) {
+		bpf_debug("Cannot parse L2: L3off:%llu proto:0x%x\n",
+			  l3_offset, eth_proto);
+		return XDP_PASS; /* Skip */
+	}
+
+	/* IPv6 not handled yet */
+	if (eth_proto == ETH_P_IP)
+		return parse_ipv4(ctx, l3_offset);
+	return XDP_PASS;
+}
+
+char _license[] SEC("license") = "GPL";
@@ -0,0 +1,176 @@
+#!/bin/bash
+
+TESTNAME=xdp_synflood
+
+usage() {
+  echo "Testing XDP SYN-flood protection modes: $TESTNAME"
+  echo ""
+  echo "Usage: $0 [-vfh]"
+  echo "  -v | --verbose : Verbose"
+  echo "  --flush        : Flush before starting (e.g. after --interactive)"
+  echo "  --interactive  : Keep netns setup running after test-run"
+  echo ""
+}
+
+cleanup()
+{
+	local status=$?
+
+	if [ "$status" = "0" ]; then
+		echo "selftests: $TESTNAME [PASS]";
+	else
+		echo "selftests: $TESTNAME [FAILED]";
+	fi
+
+	if [ -n "$INTERACTIVE" ]; then
+		echo "Namespace setup still active explore with:"
+		echo " ip netns exec ns1 bash"
+		echo " ip netns exec ns2 bash"
+		exit $status
+	fi
+
+	set +e
+	[ -n "$XDP_PID" ] && kill $XDP_PID 2> /dev/null
+	[ -n "$LISTEN_PID" ] && kill $LISTEN_PID 2> /dev/null
+	ip link del veth1 2> /dev/null
+	ip netns del ns1 2> /dev/null
+	ip netns del ns2 2> /dev/null
+}
+
+# Using external program "getopt" to get --long-options
+OPTIONS=$(getopt -o hvfi: \
+    --long verbose,flush,help,interactive,debug -- "$@")
+if (( $? != 0 )); then
+    usage
+    echo "selftests: $TESTNAME [FAILED] Error calling getopt, unknown option?"
+    exit 2
+fi
+eval set -- "$OPTIONS"
+
+##  --- Parse command line arguments / parameters ---
+while true; do
+	case "$1" in
+	    -v | --verbose)
+		export VERBOSE=yes
+		shift
+		;;
+	    -i | --interactive | --debug )
+		INTERACTIVE=yes
+		shift
+		;;
+	    -f | --flush )
+		cleanup
+		shift
+		;;
+	    -- )
+		shift
+		break
+		;;
+	    -h | --help )
+		usage;
+		echo "selftests: $TESTNAME [SKIP] usage help info requested"
+		exit 0
+		;;
+	    * )
+		shift
+		break
+		;;
+	esac
+done
+
+if [ "$EUID" -ne 0 ]; then
+	echo "selftests: $TESTNAME [FAILED] need root privileges"
+	exit 1
+fi
+
+ip link set dev lo xdp off 2>/dev/null > /dev/null
+if [ $? -ne 0 ];then
+	echo "selftests: $TESTNAME [SKIP] need ip xdp support"
+	exit 0
+fi
+
+if [ ! -x ./xdp_synflood ]; then
+	echo "selftests: $TESTNAME [SKIP] build ./xdp_synflood first"
+	exit 0
+fi
+
+# Interactive mode likely require us to cleanup netns
+if [ -n "$INTERACTIVE" ]; then
+	ip link del veth1 2> /dev/null
+	ip netns del ns1 2> /dev/null
+	ip netns del ns2 2> /dev/null
+fi
+
+# Exit on failure
+set -e
+
+# Some shell-tools dependencies
+which ip > /dev/null
+which nc > /dev/null
+which timeout > /dev/null
+
+# Make rest of shell verbose, showing comments as doc/info
+if [ -n "$VERBOSE" ]; then
+    set -v
+fi
+
+# Create two namespaces
+ip netns add ns1
+ip netns add ns2
+
+# Run cleanup if failing or on kill
+trap cleanup 0 2 3 6 9
+
+# Create veth pair, ns1 is the protected server
+ip link add veth1 type veth peer name veth2
+ip link set veth1 netns ns1
+ip link set veth2 netns ns2
+
+export IPADDR1=100.64.42.1
+export IPADDR2=100.64.42.2
+export PORT=8042
+
+ip netns exec ns1 ip addr add ${IPADDR1}/24 dev veth1
+ip netns exec ns2 ip addr add ${IPADDR2}/24 dev veth2
+ip netns exec ns1 ip link set veth1 up
+ip netns exec ns2 ip link set veth2 up
+ip netns exec ns1 ip link set lo up
+ip netns exec ns2 ip link set lo up
+
+# Client SYN is held back by XDP, the connect only succeed after the
+# kernel retransmits the SYN (1 sec initial RTO).  The validation
+# is per source IP, thus each mode needs a fresh program load.
+connect_test()
+{
+	local mode=$1
+
+	ip netns exec ns1 ./xdp_synflood --dev veth1 --skb-mode \
+		--mode $mode --sec 1 > /dev/null &
+	XDP_PID=$!
+	sleep 1
+
+	ip netns exec ns1 nc -l $PORT > /dev/null &
+	LISTEN_PID=$!
+	sleep 0.2
+
+	local start=$(date +%s%N)
+	ip netns exec ns2 timeout 10 \
+		bash -c "echo $TESTNAME > /dev/tcp/$IPADDR1/$PORT"
+	local ms=$(( ($(date +%s%N) - start) / 1000000 ))
+	echo " - mode $mode: connect succeeded after $ms ms"
+
+	# A connect without any SYN retransmit means XDP did nothing
+	if [ $ms -lt 800 ]; then
+		echo " - mode $mode: first SYN was not held back"
+		exit 1
+	fi
+
+	kill $LISTEN_PID 2> /dev/null || true
+	kill $XDP_PID
+	wait $XDP_PID 2> /dev/null || true
+	XDP_PID=
+	LISTEN_PID=
+}
+
+connect_test syndrop
+connect_test cookie
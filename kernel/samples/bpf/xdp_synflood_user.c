@@ -0,0 +1,269 @@
+/* Copyright(c) 2017 Jesper Dangaard Brouer, Red Hat, Inc.
+ */
+static const char *__doc__=
+ " XDP SYN-flood protection, see xdp_synflood_kern.c for details.\n"
+ "\n"
+ " Mode 'syndrop' drops the first SYN of unknown sources, and\n"
+ " validates the source on the SYN retransmit.  Mode 'cookie'\n"
+ " answers with a SYN-ACK cookie via XDP_TX, and validates the\n"
+ " source on the RST the client sends back.";
+
+#include <assert.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <locale.h>
+#include <time.h>
+
+#include <sys/resource.h>
+#include <getopt.h>
+#include <net/if.h>
+
+#include "libbpf.h"
+#include "bpf_load.h"
+#include "bpf_util.h"
+#include "xdp_synflood.h" /* Shared structs between _user & _kern */
+
+static int ifindex = -1;
+static char ifname_buf[IF_NAMESIZE];
+static char *ifname = NULL;
+static __u32 xdp_flags = 0;
+
+/* Exit return codes */
+#define	EXIT_OK			0
+#define EXIT_FAIL		1
+#define EXIT_FAIL_OPTION	2
+#define EXIT_FAIL_XDP		3
+#define EXIT_FAIL_MAP		20
+
+static void int_exit(int sig)
+{
+	fprintf(stderr, "Interrupted: Removing XDP program on ifindex:%d\n",
+		ifindex);
+	if (ifindex > -1)
+		set_link_xdp_fd(ifindex, -1, xdp_flags);
+	exit(EXIT_OK);
+}
+
+static const struct option long_options[] = {
+	{"help",	no_argument,		NULL, 'h' },
+	{"dev",		required_argument,	NULL, 'd' },
+	{"mode",	required_argument,	NULL, 'm' },
+	{"sec",		required_argument,	NULL, 's' },
+	{"skb-mode",	no_argument,		NULL, 'S' },
+	{0, 0, NULL,  0 }
+};
+
+static const char *syn_stat_names[SYN_STAT_MAX] = {
+	[SYN_STAT_PASS_OTHER]		= "pass_other",
+	[SYN_STAT_PASS_VALIDATED]	= "syn_pass_validated",
+	[SYN_STAT_DROP_FIRST]		= "syn_drop_unvalidated",
+	[SYN_STAT_TX_COOKIE]		= "synack_cookie_tx",
+	[SYN_STAT_VALIDATED]		= "source_validated",
+};
+
+static void usage(char *argv[])
+{
+	int i;
+	printf("\nDOCUMENTATION:\n%s\n", __doc__);
+	printf("\n");
+	printf(" Usage: %s (options-see-below)\n",
+	       argv[0]);
+	printf(" Listing options:\n");
+	for (i = 0; long_options[i].name != 0; i++) {
+		printf(" --%-12s", long_options[i].name);
+		if (long_options[i].flag != NULL)
+			printf(" flag (internal value:%d)",
+			       *long_options[i].flag);
+		else
+			printf(" short-option: -%c",
+			       long_options[i].val);
+		printf("\n");
+	}
+	printf("\n");
+}
+
+#define NANOSEC_PER_SEC 1000000000 /* 10^9 */
+static __u64 gettime(void)
+{
+	struct timespec t;
+	int res;
+
+	res = clock_gettime(CLOCK_MONOTONIC, &t);
+	if (res < 0) {
+		fprintf(stderr, "Error with gettimeofday! (%i)\n", res);
+		exit(EXIT_FAIL);
+	}
+	return (__u64) t.tv_sec * NANOSEC_PER_SEC + t.tv_nsec;
+}
+
+struct stats_record {
+	__u64 timestamp;
+	__u64 cnt[SYN_STAT_MAX];
+};
+
+static void stats_collect(int fd, struct stats_record *rec)
+{
+	unsigned int nr_cpus = bpf_num_possible_cpus();
+	__u64 values[nr_cpus];
+	__u32 key;
+	int i;
+
+	rec->timestamp = gettime();
+	for (key = 0; key < SYN_STAT_MAX; key++) {
+		rec->cnt[key] = 0;
+		if (bpf_map_lookup_elem(fd, &key, values)) {
+			fprintf(stderr, "ERR: bpf_map_lookup_elem failed\n");
+			continue;
+		}
+		for (i = 0; i < nr_cpus; i++)
+			rec->cnt[key] += values[i];
+	}
+}
+
+static void stats_poll(int interval)
+{
+	struct stats_record rec, prev;
+	double period;
+	int i;
+
+	/* Trick to pretty printf with thousands separators use %' */
+	setlocale(LC_NUMERIC, "en_US");
+
+	memset(&rec, 0, sizeof(rec));
+	stats_collect(map_fd[1], &rec);
+	while (1) {
+		sleep(interval);
+		prev = rec;
+		stats_collect(map_fd[1], &rec);
+		period = (double)(rec.timestamp - prev.timestamp) /
+			NANOSEC_PER_SEC;
+
+		printf("\n%-22s %-14s %s\n", "XDP-synflood", "pps", "total");
+		for (i = 0; i < SYN_STAT_MAX; i++)
+			printf("%-22s %'-14.0f %'llu\n", syn_stat_names[i],
+			       (rec.cnt[i] - prev.cnt[i]) / period,
+			       rec.cnt[i]);
+		fflush(stdout);
+	}
+}
+
+static __u32 random_secret(void)
+{
+	__u32 secret;
+	FILE *f;
+
+	f = fopen("/dev/urandom", "r");
+	if (f && fread(&secret, sizeof(secret), 1, f) == 1) {
+		fclose(f);
+		return secret;
+	}
+	if (f)
+		fclose(f);
+	srandom(gettime());
+	return random();
+}
+
+int main(int argc, char **argv)
+{
+	struct rlimit r = {RLIM_INFINITY, RLIM_INFINITY};
+	struct syn_config cfg = { .mode = SYNFLOOD_MODE_SYNDROP };
+	char filename[256];
+	int longindex = 0;
+	int interval = 2;
+	__u32 key = 0;
+	int opt;
+
+	snprintf(filename, sizeof(filename), "%s_kern.o", argv[0]);
+
+	/* Parse commands line args */
+	while ((opt = getopt_long(argc, argv, "hd:m:s:S",
+				  long_options, &longindex)) != -1) {
+		switch (opt) {
+		case 'd':
+			if (strlen(optarg) >= IF_NAMESIZE) {
+				fprintf(stderr, "ERR: --dev name too long\n");
+				goto error;
+			}
+			ifname = (char *)&ifname_buf;
+			strncpy(ifname, optarg, IF_NAMESIZE);
+			ifindex = if_nametoindex(ifname);
+			if (ifindex == 0) {
+				fprintf(stderr,
+					"ERR: --dev name unknown err(%d):%s\n",
+					errno, strerror(errno));
+				goto error;
+			}
+			break;
+		case 'm':
+			if (!strcmp(optarg, "syndrop"))
+				cfg.mode = SYNFLOOD_MODE_SYNDROP;
+			else if (!strcmp(optarg, "cookie"))
+				cfg.mode = SYNFLOOD_MODE_COOKIE;
+			else if (!strcmp(optarg, "off"))
+				cfg.mode = SYNFLOOD_MODE_OFF;
+			else {
+				fprintf(stderr, "ERR: --mode syndrop|cookie|off\n");
+				goto error;
+			}
+			break;
+		case 's':
+			interval = atoi(optarg);
+			break;
+		case 'S':
+			xdp_flags |= XDP_FLAGS_SKB_MODE;
+			break;
+		case 'h':
+		error:
+		default:
+			usage(argv);
+			return EXIT_FAIL_OPTION;
+		}
+	}
+	/* Required options */
+	if (ifindex == -1) {
+		printf("ERR: required option --dev missing");
+		usage(argv);
+		return EXIT_FAIL_OPTION;
+	}
+
+	/* Increase resource limits */
+	if (setrlimit(RLIMIT_MEMLOCK, &r)) {
+		perror("setrlimit(RLIMIT_MEMLOCK, RLIM_INFINITY)");
+		return EXIT_FAIL;
+	}
+
+	if (load_bpf_file(filename)) {
+		fprintf(stderr, "ERR in load_bpf_file(): %s", bpf_log_buf);
+		return EXIT_FAIL;
+	}
+	if (!prog_fd[0]) {
+		printf("load_bpf_file: %s\n", strerror(errno));
+		return EXIT_FAIL;
+	}
+
+	cfg.secret = random_secret();
+	if (bpf_map_update_elem(map_fd[0], &key, &cfg, BPF_ANY)) {
+		fprintf(stderr, "ERR: cannot set syn_config (%d):%s\n",
+			errno, strerror(errno));
+		return EXIT_FAIL_MAP;
+	}
+
+	/* Remove XDP program when program is interrupted */
+	signal(SIGINT, int_exit);
+	signal(SIGTERM, int_exit);
+
+	if (set_link_xdp_fd(ifindex, prog_fd[0], xdp_flags) < 0) {
+		printf("link set xdp fd failed\n");
+		return EXIT_FAIL_XDP;
+	}
+	printf("XDP SYN-flood protection on %s (ifindex:%d) mode:%u\n",
+	       ifname, ifindex, cfg.mode);
+
+	stats_poll(interval);
+	return EXIT_OK;
+}
@@ -0,0 +1,60 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#ifndef __XDP_TCPDUMP_H
+#define __XDP_TCPDUMP_H
+
+/* Header for perf event (meta data place before pkt data) */
+struct my_perf_hdr {
+	__u16 cookie;
+	__u16 pkt_len;		/* Length of packet on the wire */
+	__u16 cap_len;		/* Bytes captured, after snaplen */
+	__u64 timestamp;	/* bpf_ktime_get_ns(), CLOCK_MONOTONIC */
+} __attribute__((packed));
+#define COOKIE	0x9ca9
+
+/* Capture config, set by userspace in map tcpdump_config.
+ * Addresses and ports in network byte-order.
+ */
+struct tcpdump_config {
+	__u32 snaplen;		/* Zero means full packet */
+	__u32 sample_n;		/* Capture 1-in-N, zero or one is all */
+	__u32 flags;		/* TCPDUMP_* flags below */
+	__u32 saddr;		/* IPv4 only */
+	__u32 daddr;		/* IPv4 only */
+	__u16 sport;
+	__u16 dport;
+	__u16 port;		/* Either source or dest port */
+	__u8  proto;		/* IPPROTO_* */
+	__u8  pad;
+	__u32 rb_wakeup;	/* Ringbuf: wakeup reader after N bytes */
+};
+
+#define TCPDUMP_SAMPLE_FLOW	(1U << 0) /* 1-in-N flows, via 5-tuple hash */
+#define TCPDUMP_FILTER_PROTO	(1U << 1)
+#define TCPDUMP_FILTER_SADDR	(1U << 2)
+#define TCPDUMP_FILTER_DADDR	(1U << 3)
+#define TCPDUMP_FILTER_SPORT	(1U << 4)
+#define TCPDUMP_FILTER_DPORT	(1U << 5)
+#define TCPDUMP_FILTER_PORT	(1U << 6)
+#define TCPDUMP_NEED_PARSE	(TCPDUMP_SAMPLE_FLOW | TCPDUMP_FILTER_PROTO | \
+				 TCPDUMP_FILTER_SADDR | TCPDUMP_FILTER_DADDR | \
+				 TCPDUMP_FILTER_SPORT | TCPDUMP_FILTER_DPORT | \
+				 TCPDUMP_FILTER_PORT)
+
+/* Per CPU counters in map tcpdump_stats */
+enum tcpdump_stat {
+	TCPDUMP_STAT_SEEN = 0,
+	TCPDUMP_STAT_FILTERED,	/* Not matching filter */
+	TCPDUMP_STAT_SAMPLED,	/* Skipped by sampling */
+	TCPDUMP_STAT_CAPTURED,	/* Pushed into perf ring */
+	TCPDUMP_STAT_RING_FULL,	/* Perf output or ringbuf reserve failed */
+	TCPDUMP_STAT_MAX
+};
+
+/* Ringbuf transport (xdp_tcpdump_rb_kern.c) reserves fixed size slots,
+ * in size classes, as bpf_ringbuf_reserve needs a constant size.
+ */
+#define RINGBUF_SIZE		(16 << 20) /* Shared by all CPUs */
+#define RINGBUF_SLOT_MAX	2048
+#define RINGBUF_SNAP_MAX	(RINGBUF_SLOT_MAX - sizeof(struct my_perf_hdr))
+
+#endif /* __XDP_TCPDUMP_H */
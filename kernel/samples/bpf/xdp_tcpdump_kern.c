@@ -1,58 +1,330 @@
 /* SPDX-License-Identifier: GPL-2.0
  * Copyright (c) 2018 Jesper Dangaard Brouer
+ *
+ * Built twice: as-is packets go via per CPU perf rings, and included
+ * from xdp_tcpdump_rb_kern.c with TCPDUMP_RINGBUF defined, packets go
+ * via a single shared BPF ring buffer (reserve/submit).
  */
 #define KBUILD_MODNAME "foo"
 #include <linux/ptrace.h>
 #include <uapi/linux/bpf.h>
+#include <uapi/linux/if_ether.h>
+#include <uapi/linux/ip.h>
+#include <uapi/linux/ipv6.h>
+#include <uapi/linux/in.h>
+#include <uapi/linux/udp.h>
 #include "bpf_helpers.h"
+#include "hash_func01.h"
+
+#include "xdp_tcpdump.h" /* Shared structs between _user & _kern */
 
 #define MAX_CPUS 128
 
+#ifdef TCPDUMP_RINGBUF
+struct bpf_map_def SEC("maps") ring_map = {
+	.type		= BPF_MAP_TYPE_RINGBUF,
+	.max_entries	= RINGBUF_SIZE,
+};
+#else
 struct bpf_map_def SEC("maps") perf_ring_map = {
 	.type		= BPF_MAP_TYPE_PERF_EVENT_ARRAY,
 	.key_size	= sizeof(int),
 	.value_size	= sizeof(u32),
 	.max_entries	= MAX_CPUS,
 };
+#endif
+
+struct bpf_map_def SEC("maps") tcpdump_config = {
+	.type		= BPF_MAP_TYPE_ARRAY,
+	.key_size	= sizeof(u32),
+	.value_size	= sizeof(struct tcpdump_config),
+	.max_entries	= 1,
+};
+
+struct bpf_map_def SEC("maps") tcpdump_stats = {
+	.type		= BPF_MAP_TYPE_PERCPU_ARRAY,
+	.key_size	= sizeof(u32),
+	.value_size	= sizeof(u64),
+	.max_entries	= TCPDUMP_STAT_MAX,
+};
 
 char _license[] SEC("license") = "GPL";
 
-/* Header for perf event (meta data place before pkt data) */
-struct my_perf_hdr {
-	u16 cookie;
-	u16 pkt_len;
-} __packed;
-#define COOKIE	0x9ca9
+struct vlan_hdr {
+	__be16 h_vlan_TCI;
+	__be16 h_vlan_encapsulated_proto;
+};
+
+struct flow_tuple {
+	u32 saddr[4];
+	u32 daddr[4];
+	u16 sport;
+	u16 dport;
+	u32 proto;
+};
+
+static __always_inline
+u64 *stats_inc(u32 key)
+{
+	u64 *cnt = bpf_map_lookup_elem(&tcpdump_stats, &key);
+
+	if (cnt)
+		*cnt += 1;
+	return cnt;
+}
+
+/* Extract 5-tuple, for IPv4 and IPv6 with up to two VLAN headers.
+ * Returns false for non-IP, ports are zero for non TCP/UDP.
+ */
+static __always_inline
+bool parse_flow(void *data, void *data_end, struct flow_tuple *f)
+{
+	struct ethhdr *eth = data;
+	struct vlan_hdr *vh;
+	struct udphdr *udph; /* ports at same offset in tcphdr */
+	struct ipv6hdr *ip6h;
+	struct iphdr *iph;
+	u64 offset = sizeof(*eth);
+	u16 eth_type;
+	void *l4;
+	int i;
+
+	if (data + offset > data_end)
+		return false;
+	eth_type = eth->h_proto;
 
+#pragma clang loop unroll(full)
+	for (i = 0; i < 2; i++) {
+		if (eth_type != htons(ETH_P_8021Q) &&
+		    eth_type != htons(ETH_P_8021AD))
+			break;
+		vh = data + offset;
+		offset += sizeof(*vh);
+		if (data + offset > data_end)
+			return false;
+		eth_type = vh->h_vlan_encapsulated_proto;
+	}
+
+	if (eth_type == htons(ETH_P_IP)) {
+		iph = data + offset;
+		if (iph + 1 > data_end)
+			return false;
+		f->saddr[0] = iph->saddr;
+		f->daddr[0] = iph->daddr;
+		f->proto    = iph->protocol;
+		/* Non-first fragments carry no ports */
+		if (iph->frag_off & htons(0x1FFF))
+			return true;
+		l4 = (void *)iph + iph->ihl * 4;
+	} else if (eth_type == htons(ETH_P_IPV6)) {
+		ip6h = data + offset;
+		if (ip6h + 1 > data_end)
+			return false;
+		__builtin_memcpy(f->saddr, ip6h->saddr.s6_addr32, 16);
+		__builtin_memcpy(f->daddr, ip6h->daddr.s6_addr32, 16);
+		f->proto = ip6h->nexthdr; /* Extension headers not walked */
+		l4 = ip6h + 1;
+	} else {
+		return false;
+	}
+
+	if (f->proto != IPPROTO_TCP && f->proto != IPPROTO_UDP)
+		return true;
+	udph = l4;
+	if (udph + 1 > data_end)
+		return true;
+	f->sport = udph->source;
+	f->dport = udph->dest;
+	return true;
+}
+
+static __always_inline
+bool filter_match(struct tcpdump_config *cfg, struct flow_tuple *f)
+{
+	u32 flags = cfg->flags;
+
+	if ((flags & TCPDUMP_FILTER_PROTO) && f->proto != cfg->proto)
+		return false;
+	if ((flags & TCPDUMP_FILTER_SADDR) && f->saddr[0] != cfg->saddr)
+		return false;
+	if ((flags & TCPDUMP_FILTER_DADDR) && f->daddr[0] != cfg->daddr)
+		return false;
+	if ((flags & TCPDUMP_FILTER_SPORT) && f->sport != cfg->sport)
+		return false;
+	if ((flags & TCPDUMP_FILTER_DPORT) && f->dport != cfg->dport)
+		return false;
+	if ((flags & TCPDUMP_FILTER_PORT) &&
+	    f->sport != cfg->port && f->dport != cfg->port)
+		return false;
+	return true;
+}
+
+#ifdef TCPDUMP_RINGBUF
+#define RB_CHUNK 64
+
+/* Reserve a slot, copy header and packet into it and submit.  The
+ * reserve size must be a constant, thus a few size classes.  Packet is
+ * copied in RB_CHUNK blocks, then the tail byte by byte, with bounds
+ * checks the verifier can follow.
+ */
+static __always_inline
+int tcpdump_output(struct xdp_md *ctx, struct tcpdump_config *cfg,
+		   struct my_perf_hdr *hdr)
+{
+	void *data_end = (void *)(long)ctx->data_end;
+	void *data     = (void *)(long)ctx->data;
+	u32 cap = hdr->cap_len;
+	u32 slot, off, pos, i;
+	u64 flags = 0;
+	u8 *e, *pkt;
+
+	if (cap <= 128 - sizeof(*hdr)) {
+		slot = 128;
+		e = bpf_ringbuf_reserve(&ring_map, 128, 0);
+	} else if (cap <= 512 - sizeof(*hdr)) {
+		slot = 512;
+		e = bpf_ringbuf_reserve(&ring_map, 512, 0);
+	} else {
+		slot = RINGBUF_SLOT_MAX;
+		e = bpf_ringbuf_reserve(&ring_map, RINGBUF_SLOT_MAX, 0);
+	}
+	if (!e)
+		return -1;
+	__builtin_memcpy(e, hdr, sizeof(*hdr));
+
+	for (i = 0; i < RINGBUF_SLOT_MAX / RB_CHUNK; i++) {
+		off = i * RB_CHUNK;
+		if (off + RB_CHUNK > cap ||
+		    off + RB_CHUNK + sizeof(*hdr) > slot)
+			break;
+		pkt = data + off;
+		if (pkt + RB_CHUNK > data_end)
+			break;
+		__builtin_memcpy(e + sizeof(*hdr) + off, pkt, RB_CHUNK);
+	}
+	off = i * RB_CHUNK;
+
+	for (i = 0; i < RB_CHUNK; i++) {
+		pos = off + i;
+		if (pos >= cap || pos + sizeof(*hdr) >= slot)
+			break;
+		pkt = data + pos;
+		if (pkt + 1 > data_end)
+			break;
+		e[sizeof(*hdr) + pos] = *pkt;
+	}
+
+	/* Batch wakeups: only wake reader when enough bytes are queued,
+	 * it also polls with a timeout.  Zero is the kernel default.
+	 */
+	if (cfg->rb_wakeup) {
+		if (bpf_ringbuf_query(&ring_map, BPF_RB_AVAIL_DATA) >=
+		    cfg->rb_wakeup)
+			flags = BPF_RB_FORCE_WAKEUP;
+		else
+			flags = BPF_RB_NO_WAKEUP;
+	}
+	bpf_ringbuf_submit(e, flags);
+	return 0;
+}
+#else
+static __always_inline
+int tcpdump_output(struct xdp_md *ctx, struct tcpdump_config *cfg,
+		   struct my_perf_hdr *hdr)
+{
+	/* The XDP perf_event_output handler will use the upper 32 bits
+	 * of the flags argument as a number of bytes to include of the
+	 * packet payload in the event data. If the size is too big, the
+	 * call to bpf_perf_event_output will fail and return -EFAULT.
+	 *
+	 * See bpf_xdp_event_output in net/core/filter.c.
+	 *
+	 * The BPF_F_CURRENT_CPU flag means that the event output fd
+	 * will be indexed by the CPU number in the event map.
+	 */
+	u64 flags = BPF_F_CURRENT_CPU;
+
+	flags |= (u64)hdr->cap_len << 32;
+	return bpf_perf_event_output(ctx, &perf_ring_map, flags,
+				     hdr, sizeof(*hdr));
+}
+#endif
+
+#ifdef TCPDUMP_RINGBUF
+SEC("xdp_tcpdump_to_ringbuf")
+#else
 SEC("xdp_tcpdump_to_perf_ring")
+#endif
 int _xdp_prog0(struct xdp_md *ctx)
 {
 	void *data_end = (void *)(long)ctx->data_end;
 	void *data     = (void *)(long)ctx->data;
+	struct tcpdump_config *cfg;
+	struct flow_tuple f = { 0 };
 	struct my_perf_hdr hdr;
+	u64 *seen;
+	u32 key = 0;
+	u32 hash;
 
-	if (data < data_end) {
-		/* The XDP perf_event_output handler will use the upper 32 bits
-		 * of the flags argument as a number of bytes to include of the
-		 * packet payload in the event data. If the size is too big, the
-		 * call to bpf_perf_event_output will fail and return -EFAULT.
-		 *
-		 * See bpf_xdp_event_output in net/core/filter.c.
-		 *
-		 * The BPF_F_CURRENT_CPU flag means that the event output fd
-		 * will be indexed by the CPU number in the event map.
-		 */
-		u64 flags = BPF_F_CURRENT_CPU;
-		u16 sample_size;
-
-		hdr.cookie = COOKIE;
-		hdr.pkt_len = (u16)(data_end - data);
-		sample_size = hdr.pkt_len;
-		flags |= (u64)sample_size << 32;
-
-		bpf_perf_event_output(ctx, &perf_ring_map, flags,
-				      &hdr, sizeof(hdr));
+	if (data >= data_end)
+		return XDP_PASS;
+
+	cfg = bpf_map_lookup_elem(&tcpdump_config, &key);
+	seen = stats_inc(TCPDUMP_STAT_SEEN);
+	if (!cfg || !seen)
+		return XDP_PASS;
+
+	/* Parsing only needed for filter or per flow sampling */
+	if (cfg->flags & TCPDUMP_NEED_PARSE) {
+		if (!parse_flow(data, data_end, &f) &&
+		    (cfg->flags & ~TCPDUMP_SAMPLE_FLOW)) {
+			stats_inc(TCPDUMP_STAT_FILTERED);
+			return XDP_PASS;
+		}
+		if (!filter_match(cfg, &f)) {
+			stats_inc(TCPDUMP_STAT_FILTERED);
+			return XDP_PASS;
+		}
+	}
+
+	if (cfg->sample_n > 1) {
+		if (cfg->flags & TCPDUMP_SAMPLE_FLOW) {
+			/* Symmetric, both directions of a flow sampled */
+			f.saddr[0] ^= f.daddr[0];
+			f.saddr[1] ^= f.daddr[1];
+			f.saddr[2] ^= f.daddr[2];
+			f.saddr[3] ^= f.daddr[3];
+			f.sport ^= f.dport;
+			__builtin_memset(f.daddr, 0, sizeof(f.daddr));
+			f.dport = 0;
+			hash = SuperFastHash((char *)&f, sizeof(f), 0x9ca9);
+			if (hash % cfg->sample_n) {
+				stats_inc(TCPDUMP_STAT_SAMPLED);
+				return XDP_PASS;
+			}
+		} else if (*seen % cfg->sample_n) {
+			/* Per CPU packet count, 1-in-N on each CPU */
+			stats_inc(TCPDUMP_STAT_SAMPLED);
+			return XDP_PASS;
+		}
 	}
 
+	hdr.cookie = COOKIE;
+	hdr.pkt_len = (u16)(data_end - data);
+	hdr.cap_len = hdr.pkt_len;
+	if (cfg->snaplen && hdr.cap_len > cfg->snaplen)
+		hdr.cap_len = cfg->snaplen;
+#ifdef TCPDUMP_RINGBUF
+	if (hdr.cap_len > RINGBUF_SNAP_MAX)
+		hdr.cap_len = RINGBUF_SNAP_MAX;
+#endif
+	/* Allow userspace to merge per CPU rings by timestamp */
+	hdr.timestamp = bpf_ktime_get_ns();
+
+	if (tcpdump_output(ctx, cfg, &hdr) < 0)
+		stats_inc(TCPDUMP_STAT_RING_FULL);
+	else
+		stats_inc(TCPDUMP_STAT_CAPTURED);
+
 	return XDP_PASS;
 }
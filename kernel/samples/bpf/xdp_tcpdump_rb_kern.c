@@ -0,0 +1,7 @@
+/* SPDX-License-Identifier: GPL-2.0
+ *
+ * Ringbuf transport variant of xdp_tcpdump_kern.c, for comparing
+ * against per CPU perf rings.  Needs kernel v5.8 or later.
+ */
+#define TCPDUMP_RINGBUF
+#include "xdp_tcpdump_kern.c"
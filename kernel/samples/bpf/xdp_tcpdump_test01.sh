@@ -0,0 +1,223 @@
+#!/bin/bash
+
+TESTNAME=xdp_tcpdump
+
+usage() {
+  echo "Sustained capture throughput of xdp_tcpdump over veth: $TESTNAME"
+  echo ""
+  echo "Usage: $0 [-vfh] [--duration SEC]"
+  echo "  -v | --verbose : Verbose"
+  echo "  --flush        : Flush before starting (e.g. after --interactive)"
+  echo "  --interactive  : Keep netns setup running after test-run"
+  echo "  --duration SEC : Seconds of traffic per run (default 10)"
+  echo ""
+  echo "Sends pktgen traffic over a veth pair, captured by xdp_tcpdump"
+  echo "with a single reader thread and with one thread per CPU ring."
+  echo "Then with in-kernel snaplen, 1-in-N sampling and a port filter,"
+  echo "which should cut both capture load and lost events."
+  echo "Compares perf ring and BPF ringbuf (--ringbuf) transports, on"
+  echo "pps, reader CPU usage and XDP ns/pkt (kernel.bpf_stats_enabled)."
+  echo "Also runs the in-process synthetic producer for comparison."
+  echo ""
+}
+
+cleanup()
+{
+	local status=$?
+
+	if [ "$status" = "0" ]; then
+		echo "selftests: $TESTNAME [PASS]";
+	else
+		echo "selftests: $TESTNAME [FAILED]";
+	fi
+
+	if [ -n "$INTERACTIVE" ]; then
+		echo "Namespace setup still active explore with:"
+		echo " ip netns exec ns1 bash"
+		echo " ip netns exec ns2 bash"
+		exit $status
+	fi
+
+	set +e
+	[ -n "$CAP_PID" ] && kill $CAP_PID 2> /dev/null
+	ip netns exec ns2 sh -c "echo stop > /proc/net/pktgen/pgctrl" 2> /dev/null
+	[ -n "$STATS_ENABLED" ] && \
+		sysctl -q -w kernel.bpf_stats_enabled=$STATS_ENABLED
+	ip link del veth1 2> /dev/null
+	ip netns del ns1 2> /dev/null
+	ip netns del ns2 2> /dev/null
+	rm -rf $DIR
+}
+
+# Using external program "getopt" to get --long-options
+OPTIONS=$(getopt -o hvfi: \
+    --long verbose,flush,help,interactive,debug,duration: -- "$@")
+if (( $? != 0 )); then
+    usage
+    echo "selftests: $TESTNAME [FAILED] Error calling getopt, unknown option?"
+    exit 2
+fi
+eval set -- "$OPTIONS"
+
+DURATION=10
+
+##  --- Parse command line arguments / parameters ---
+while true; do
+	case "$1" in
+	    -v | --verbose)
+		export VERBOSE=yes
+		shift
+		;;
+	    -i | --interactive | --debug )
+		INTERACTIVE=yes
+		shift
+		;;
+	    -f | --flush )
+		cleanup
+		shift
+		;;
+	    --duration )
+		DURATION=$2
+		shift 2
+		;;
+	    -- )
+		shift
+		break
+		;;
+	    -h | --help )
+		usage;
+		echo "selftests: $TESTNAME [SKIP] usage help info requested"
+		exit 0
+		;;
+	    * )
+		shift
+		break
+		;;
+	esac
+done
+
+if [ "$EUID" -ne 0 ]; then
+	echo "selftests: $TESTNAME [FAILED] need root privileges"
+	exit 1
+fi
+
+if [ ! -x ./xdp_tcpdump ]; then
+	echo "selftests: $TESTNAME [SKIP] build ./xdp_tcpdump first"
+	exit 0
+fi
+
+modprobe pktgen 2> /dev/null
+if [ ! -d /proc/net/pktgen ]; then
+	echo "selftests: $TESTNAME [SKIP] need pktgen module"
+	exit 0
+fi
+
+# Interactive mode likely require us to cleanup netns
+if [ -n "$INTERACTIVE" ]; then
+	ip link del veth1 2> /dev/null
+	ip netns del ns1 2> /dev/null
+	ip netns del ns2 2> /dev/null
+fi
+
+# Exit on failure
+set -e
+
+# Make rest of shell verbose, showing comments as doc/info
+if [ -n "$VERBOSE" ]; then
+    set -v
+fi
+
+DIR=$(mktemp -d /tmp/${TESTNAME}.XXXXXX)
+
+# Create two namespaces
+ip netns add ns1
+ip netns add ns2
+
+# Run cleanup if failing or on kill
+trap cleanup 0 2 3 6 9
+
+# ns1 captures on veth1, ns2 runs pktgen on veth2
+ip link add veth1 type veth peer name veth2
+ip link set veth1 netns ns1
+ip link set veth2 netns ns2
+
+export IPADDR1=100.64.44.1
+export IPADDR2=100.64.44.2
+
+ip netns exec ns1 ip addr add ${IPADDR1}/24 dev veth1
+ip netns exec ns2 ip addr add ${IPADDR2}/24 dev veth2
+ip netns exec ns1 ip link set veth1 up
+ip netns exec ns2 ip link set veth2 up
+MAC1=$(ip netns exec ns1 cat /sys/class/net/veth1/address)
+
+# pktgen config, per network namespace
+pgset() {
+	local file=$1 cmd=$2
+
+	ip netns exec ns2 sh -c "echo \"$cmd\" > /proc/net/pktgen/$file"
+}
+
+# One pktgen thread per CPU, flows spread over the CPUs on receive
+THREADS=$(nproc)
+for ((t = 0; t < THREADS; t++)); do
+	dev=veth2@$t
+	pgset kpktgend_$t "rem_device_all"
+	pgset kpktgend_$t "add_device $dev"
+	pgset $dev "count 0"
+	pgset $dev "clone_skb 0"
+	pgset $dev "pkt_size 256"
+	pgset $dev "delay 0"
+	pgset $dev "dst $IPADDR1"
+	pgset $dev "dst_mac $MAC1"
+	pgset $dev "flag UDPSRC_RND"
+	pgset $dev "udp_src_min 1024"
+	pgset $dev "udp_src_max 65000"
+done
+
+# Account XDP program run-time, for the ns/pkt cost per transport
+STATS_ENABLED=$(sysctl -n kernel.bpf_stats_enabled 2> /dev/null || true)
+[ -n "$STATS_ENABLED" ] && sysctl -q -w kernel.bpf_stats_enabled=1
+
+run() {
+	local desc="$1"
+	shift
+
+	ip netns exec ns1 ./xdp_tcpdump --dev veth1 --sec 1 \
+		--write $DIR/capture "$@" > $DIR/log &
+	CAP_PID=$!
+	sleep 1
+
+	ip netns exec ns2 sh -c "echo start > /proc/net/pktgen/pgctrl" &
+	sleep $DURATION
+	ip netns exec ns2 sh -c "echo stop > /proc/net/pktgen/pgctrl"
+	wait $! 2> /dev/null || true
+
+	kill -INT $CAP_PID
+	wait $CAP_PID
+	CAP_PID=
+	echo " - $desc: $(grep '^Total:' $DIR/log)"
+	[ -n "$VERBOSE" ] && grep '^kernel:' $DIR/log | tail -n 1
+	rm -f $DIR/capture*.pcap
+}
+
+run "veth, 1 reader thread      " --threads 1
+run "veth, thread per CPU ring  "
+run "veth, thread per CPU O_DIRECT" --direct
+run "veth, snaplen 96           " --snaplen 96
+run "veth, sample 1-in-10       " --sample 10
+run "veth, sample 1-in-10 flows " --sample 10 --sample-flow
+run "veth, filter udp dport 9   " --filter-proto udp --filter-dport 9
+
+# BPF ringbuf needs kernel v5.8
+KVER=$(uname -r | awk -F. '{ printf "%d%03d", $1, $2 }')
+if [ "$KVER" -ge 5008 ] && [ -f ./xdp_tcpdump_rb_kern.o ]; then
+	run "ringbuf, 1 reader thread   " --ringbuf
+	run "ringbuf, kernel wakeup     " --ringbuf --rb-wakeup 0
+	run "ringbuf, snaplen 96        " --ringbuf --snaplen 96
+else
+	echo " - ringbuf transport: skipped, needs kernel v5.8"
+fi
+
+./xdp_tcpdump --synthetic $DURATION --sec $DURATION \
+	--write $DIR/synthetic > $DIR/log
+echo " - synthetic producer        : $(grep '^Total:' $DIR/log)"
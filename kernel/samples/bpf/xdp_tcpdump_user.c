@@ -2,8 +2,26 @@
  * Copyright (c) 2018 Jesper Dangaard Brouer
  */
 static const char *__doc__ =
- "XDP debug program storing XDP level frame into tcpdump-pcap file";
+ "XDP debug program storing XDP level frame into tcpdump-pcap file\n"
+ "\n"
+ " Each perf ring (one per CPU) is served by a pool of reader threads\n"
+ " (default one per ring).  Every thread writes its own pcap segment\n"
+ " file in large batches, optionally with O_DIRECT.  Segments can be\n"
+ " merged by timestamp into a single file when capture stops.\n"
+ "\n"
+ " --ringbuf uses a single BPF ring buffer shared by all CPUs instead\n"
+ " of perf rings (kernel v5.8+), drained by one epoll driven reader.\n"
+ " The reader is only woken after --rb-wakeup bytes are queued.\n"
+ "\n"
+ " --snaplen, --sample and the --filter-* options are applied by the\n"
+ " XDP program, before the packet is copied into the perf ring.  The\n"
+ " kernel side counters show seen, filtered and sampled-out packets.\n"
+ "\n"
+ " --synthetic SEC runs the writer threads on synthetic packets\n"
+ " (no XDP), to measure the sustained capture throughput of the\n"
+ " writer path itself.";
 
+#define _GNU_SOURCE /* O_DIRECT */
 #include <errno.h>
 #include <signal.h>
 #include <stdio.h>
@@ -12,10 +30,17 @@ static const char *__doc__ =
 #include <string.h>
 #include <unistd.h>
 #include <locale.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
 #include <sys/resource.h>
+#include <sys/time.h>
 #include <sys/sysinfo.h>
+#include <sys/stat.h>
 #include <getopt.h>
 #include <net/if.h>
+#include <netdb.h>
+#include <arpa/inet.h>
 #include <assert.h>
 
 #include <linux/if_link.h>
@@ -28,6 +53,7 @@ static const char *__doc__ =
 #include <sys/ioctl.h>
 
 #include "bpf_util.h"
+#include "xdp_tcpdump.h" /* Shared structs between _user & _kern */
 
 /* libbpf related (located in tools/lib/) */
 #include <bpf/bpf.h>
@@ -46,14 +72,34 @@ static char *ifname;
 static int pmu_fds[MAX_CPUS];
 static struct perf_event_mmap_page *headers[MAX_CPUS];
 
-static pcap_dumper_t *global_pcap_dumper;
-
 static __u32 xdp_flags;
 
+#define RB_WAKEUP_DEFAULT (64 << 10) /* Bytes, zero is kernel default */
+
+static volatile bool exiting;
+
 static const struct option long_options[] = {
 	{"help",	no_argument,		NULL, 'h' },
 	{"dev",		required_argument,	NULL, 'd' },
 	{"skb-mode",	no_argument,		NULL, 'S' },
+	{"sec",		required_argument,	NULL, 's' },
+	{"threads",	required_argument,	NULL, 't' },
+	{"write",	required_argument,	NULL, 'w' },
+	{"direct",	no_argument,		NULL, 'O' },
+	{"merge",	no_argument,		NULL, 'm' },
+	{"ring-pages",	required_argument,	NULL, 'r' },
+	{"synthetic",	required_argument,	NULL, 'y' },
+	{"snaplen",	required_argument,	NULL, 'c' },
+	{"sample",	required_argument,	NULL, 'n' },
+	{"sample-flow",	no_argument,		NULL, 'F' },
+	{"filter-proto", required_argument,	NULL, 'P' },
+	{"filter-src",	required_argument,	NULL, '1' },
+	{"filter-dst",	required_argument,	NULL, '2' },
+	{"filter-port",	required_argument,	NULL, '3' },
+	{"filter-sport", required_argument,	NULL, '4' },
+	{"filter-dport", required_argument,	NULL, '5' },
+	{"ringbuf",	no_argument,		NULL, 'R' },
+	{"rb-wakeup",	required_argument,	NULL, 'W' },
 	{0, 0, NULL,  0 }
 };
 
@@ -65,14 +111,8 @@ static const struct option long_options[] = {
 
 static void exit_sig_handler(int sig)
 {
-	fprintf(stderr,
-		"Interrupted: Removing XDP program on ifindex:%d device:%s\n",
-		ifindex, ifname);
-	if (ifindex > -1)
-		bpf_set_link_xdp_fd(ifindex, -1, xdp_flags);
-	if (global_pcap_dumper)
-		pcap_dump_close(global_pcap_dumper);
-	exit(EXIT_SUCCESS);
+	/* Reader threads drain the rings and flush their files */
+	exiting = true;
 }
 
 static void usage(char *argv[])
@@ -95,11 +135,152 @@ static void usage(char *argv[])
 	printf("\n");
 }
 
-/* Based on ./tools/testing/selftests/bpf/trace_helpers.c */
-typedef enum bpf_perf_event_ret (*perf_event_print_fn)(void *data, int size);
+#define NANOSEC_PER_SEC 1000000000 /* 10^9 */
+static __u64 gettime(clockid_t clk)
+{
+	struct timespec t;
+
+	clock_gettime(clk, &t);
+	return (__u64) t.tv_sec * NANOSEC_PER_SEC + t.tv_nsec;
+}
+
+/* XDP timestamps are CLOCK_MONOTONIC, pcap wants wall-clock */
+static __u64 mono_to_realtime_ns;
+
+/*** pcap segment writer ***/
+
+/* The on-disk pcap record header (struct pcap_pkthdr is in-memory) */
+struct pcap_sf_pkthdr {
+	__u32 ts_sec;
+	__u32 ts_usec;
+	__u32 caplen;
+	__u32 len;
+};
+
+#define SNAPLEN		(1 << 16)
+static __u32 snaplen = SNAPLEN; /* Written in pcap file header */
+#define DIO_ALIGN	4096		/* O_DIRECT offset/size alignment */
+#define WRITE_BATCH	(4 << 20)	/* Bytes per write(2) */
+
+struct pcap_writer {
+	int    fd;
+	bool   direct;
+	char  *buf;
+	size_t size;
+	size_t used;
+	__u64  pkts;
+	__u64  bytes;	/* Written to file */
+};
+
+/* Writes out full buffer, or for O_DIRECT all whole DIO_ALIGN blocks
+ * keeping the tail in the buffer.  With final, O_DIRECT is turned off
+ * to also write the unaligned tail.
+ */
+static int pcap_writer_flush(struct pcap_writer *w, bool final)
+{
+	size_t len = w->used, off = 0;
+	ssize_t res;
+
+	if (w->direct && final) {
+		fcntl(w->fd, F_SETFL, fcntl(w->fd, F_GETFL) & ~O_DIRECT);
+		w->direct = false;
+	}
+	if (w->direct)
+		len &= ~((size_t)DIO_ALIGN - 1);
+
+	while (off < len) {
+		res = write(w->fd, w->buf + off, len - off);
+		if (res < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "ERR: pcap write: %s\n",
+				strerror(errno));
+			return -errno;
+		}
+		off += res;
+	}
+	w->bytes += len;
+	memmove(w->buf, w->buf + len, w->used - len);
+	w->used -= len;
+	return 0;
+}
+
+static int pcap_writer_open(struct pcap_writer *w, const char *path,
+			    bool direct)
+{
+	struct pcap_file_header *fh;
+
+	memset(w, 0, sizeof(*w));
+	w->size   = WRITE_BATCH;
+	w->direct = direct;
+	if (posix_memalign((void **)&w->buf, DIO_ALIGN, w->size))
+		return -ENOMEM;
 
+	w->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC |
+		     (direct ? O_DIRECT : 0), 0644);
+	if (w->fd < 0) {
+		fprintf(stderr, "ERR: open %s: %s\n", path, strerror(errno));
+		free(w->buf);
+		return -errno;
+	}
+
+	fh = (void *)w->buf;
+	fh->magic		= 0xa1b2c3d4; /* usec timestamps */
+	fh->version_major	= PCAP_VERSION_MAJOR;
+	fh->version_minor	= PCAP_VERSION_MINOR;
+	fh->thiszone		= 0;
+	fh->sigfigs		= 0;
+	fh->snaplen		= snaplen;
+	fh->linktype		= DLT_EN10MB;
+	w->used = sizeof(*fh);
+	return 0;
+}
+
+static inline int pcap_writer_add(struct pcap_writer *w,
+				  struct pcap_sf_pkthdr *hdr,
+				  const void *data)
+{
+	size_t need = sizeof(*hdr) + hdr->caplen;
+	int err;
+
+	if (w->used + need > w->size) {
+		err = pcap_writer_flush(w, false);
+		if (err)
+			return err;
+	}
+	memcpy(w->buf + w->used, hdr, sizeof(*hdr));
+	memcpy(w->buf + w->used + sizeof(*hdr), data, hdr->caplen);
+	w->used += need;
+	w->pkts++;
+	return 0;
+}
+
+static int pcap_writer_close(struct pcap_writer *w)
+{
+	int err = pcap_writer_flush(w, true);
+
+	close(w->fd);
+	free(w->buf);
+	w->buf = NULL;
+	return err;
+}
+
+/*** Reader threads, each owning a set of perf rings ***/
+
+struct capture_thread {
+	pthread_t tid;
+	int	  idx;
+	int	  nr_rings;
+	int	  rings[MAX_CPUS];
+	char	  path[256];
+	struct pcap_writer w;
+	__u64	  lost;
+	__u64	  synthetic_end; /* CLOCK_MONOTONIC ns, synthetic mode */
+};
+
+/* Based on ./tools/testing/selftests/bpf/trace_helpers.c */
 static int page_size;
-static int page_cnt = 8;
+static int page_cnt = 64; /* Per CPU ring pages, must be power-of-2 */
 
 int perf_event_mmap_header(int fd, struct perf_event_mmap_page **header)
 {
@@ -125,21 +306,15 @@ struct perf_event_sample {
 	char data[];
 };
 
-/* Header for perf event (meta data place before pkt data) */
-struct my_perf_hdr {
-	__u16 cookie;
-	__u16 pkt_len;
-} __packed;
-#define COOKIE	0x9ca9
-
-static int pcap_dump_xdp_data(pcap_dumper_t *dumper, void *data, int size)
+static int pcap_dump_xdp_data(struct capture_thread *t, void *data, int size)
 {
 	struct {
 		/* Top part of data, provide by XDP bpf program */
 		struct my_perf_hdr hdr;
 		__u8  pkt_data[];
 	} *e = data;
-	struct pcap_pkthdr pcap_hdr;
+	struct pcap_sf_pkthdr pcap_hdr;
+	__u64 ts;
 
 	if (e->hdr.cookie != COOKIE) {
 		fprintf(stderr, "BUG cookie %x sized %d\n",
@@ -147,29 +322,32 @@ static int pcap_dump_xdp_data(pcap_dumper_t *dumper, void *data, int size)
 		return LIBBPF_PERF_EVENT_ERROR;
 	}
 
-	// printf("Pkt len: %-5d bytes event sz:%d\n", e->hdr.pkt_len, size);
-
-	/* TODO: Find fast timestamp method, maybe XDP prog can
-	 * transfer this in my_perf_hdr?  Else the perf-ring infra can
-	 * do some (I think this extra data will be avail at end of
-	 * pkt_data).
-	 */
-	/* pcap_hdr.ts = struct timeval */
-	pcap_hdr.caplen = e->hdr.pkt_len;
-	pcap_hdr.len    = e->hdr.pkt_len;
-	pcap_dump((u_char *)dumper, &pcap_hdr, e->pkt_data);
+	ts = e->hdr.timestamp + mono_to_realtime_ns;
+	pcap_hdr.ts_sec  = ts / NANOSEC_PER_SEC;
+	pcap_hdr.ts_usec = (ts % NANOSEC_PER_SEC) / 1000;
+	pcap_hdr.caplen  = e->hdr.cap_len;
+	pcap_hdr.len     = e->hdr.pkt_len;
+	if (pcap_writer_add(&t->w, &pcap_hdr, e->pkt_data))
+		return LIBBPF_PERF_EVENT_ERROR;
 
 	return LIBBPF_PERF_EVENT_CONT;
 }
 
+static int ringbuf_event_process(void *ctx, void *data, size_t size)
+{
+	if (pcap_dump_xdp_data(ctx, data, size) != LIBBPF_PERF_EVENT_CONT)
+		return -1;
+	return 0;
+}
+
 static enum bpf_perf_event_ret perf_event_process(void *event, void *priv)
 {
 	struct perf_event_sample *e = event;
-	pcap_dumper_t *dumper = priv;
+	struct capture_thread *t = priv;
 	int ret;
 
 	if (e->header.type == PERF_RECORD_SAMPLE) {
-		ret = pcap_dump_xdp_data(dumper, e->data, e->size);
+		ret = pcap_dump_xdp_data(t, e->data, e->size);
 		if (ret != LIBBPF_PERF_EVENT_CONT)
 			return ret;
 	} else if (e->header.type == PERF_RECORD_LOST) {
@@ -178,7 +356,7 @@ static enum bpf_perf_event_ret perf_event_process(void *event, void *priv)
 			__u64 id;
 			__u64 lost;
 		} *lost = (void *) e;
-		printf("lost %lld events\n", lost->lost);
+		t->lost += lost->lost;
 	} else {
 		printf("unknown event type=%d size=%d\n",
 		       e->header.type, e->header.size);
@@ -187,44 +365,188 @@ static enum bpf_perf_event_ret perf_event_process(void *event, void *priv)
 	return LIBBPF_PERF_EVENT_CONT;
 }
 
-
-int pcap_perf_event_poller(int *fds, struct perf_event_mmap_page **headers,
-			   int num_fds, pcap_dumper_t *pcap_dumper)
+static void *pcap_perf_event_poller(void *arg)
 {
-	enum bpf_perf_event_ret ret;
+	struct capture_thread *t = arg;
+	enum bpf_perf_event_ret ret = LIBBPF_PERF_EVENT_CONT;
 	struct pollfd *pfds;
+	bool drained = false;
 	void *buf = NULL;
 	size_t len = 0;
-	int i;
+	int i, ring;
 
-	pfds = calloc(num_fds, sizeof(*pfds));
+	pfds = calloc(t->nr_rings, sizeof(*pfds));
 	if (!pfds)
-		return LIBBPF_PERF_EVENT_ERROR;
+		return NULL;
 
-	for (i = 0; i < num_fds; i++) {
-		pfds[i].fd = fds[i];
+	for (i = 0; i < t->nr_rings; i++) {
+		pfds[i].fd = pmu_fds[t->rings[i]];
 		pfds[i].events = POLLIN;
 	}
 
-	for (;;) {
-		poll(pfds, num_fds, 1000);
-		for (i = 0; i < num_fds; i++) {
-			if (!pfds[i].revents)
+	/* After exiting is set, do a last pass reading all rings */
+	while (!drained) {
+		drained = exiting;
+		poll(pfds, t->nr_rings, drained ? 0 : 100);
+		for (i = 0; i < t->nr_rings; i++) {
+			if (!pfds[i].revents && !drained)
 				continue;
 
-			ret = bpf_perf_event_read_simple(headers[i],
+			ring = t->rings[i];
+			ret = bpf_perf_event_read_simple(headers[ring],
 							 page_cnt * page_size,
 							 page_size, &buf, &len,
-							 perf_event_process,
-							 pcap_dumper);
-			if (ret != LIBBPF_PERF_EVENT_CONT)
+							 perf_event_process, t);
+			if (ret != LIBBPF_PERF_EVENT_CONT) {
+				exiting = true;
 				break;
+			}
 		}
 	}
 	free(buf);
 	free(pfds);
 
-	return ret;
+	return NULL;
+}
+
+/* Single reader for the shared ring buffer.  Kernel side only wakes
+ * us every rb_wakeup bytes, and poll consumes nothing on timeout, thus
+ * consume explicitly on timeout, which bounds the latency.
+ */
+static struct ring_buffer *ringbuf;
+
+static void *pcap_ringbuf_poller(void *arg)
+{
+	int err = 0;
+
+	while (!exiting && err >= 0) {
+		err = ring_buffer__poll(ringbuf, 10);
+		if (err == -EINTR)
+			err = 0;
+		if (err == 0) /* Timeout, below the wakeup threshold */
+			err = ring_buffer__consume(ringbuf);
+	}
+	if (err >= 0)
+		ring_buffer__consume(ringbuf); /* Drain on exit */
+	exiting = true;
+	return NULL;
+}
+
+/* Synthetic producer: packets of mixed sizes straight into the writer,
+ * measures the writer path without XDP and perf rings.
+ */
+static void *synthetic_producer(void *arg)
+{
+	static const __u32 sizes[] = { 64, 64, 128, 576, 1514 };
+	struct capture_thread *t = arg;
+	struct pcap_sf_pkthdr hdr;
+	__u8 pkt[1514];
+	__u64 ts, n = 0;
+	int i;
+
+	memset(pkt, 0xab, sizeof(pkt));
+	while (!exiting) {
+		ts = gettime(CLOCK_REALTIME);
+		if (ts - mono_to_realtime_ns >= t->synthetic_end)
+			break;
+		/* Batch of packets per clock read */
+		for (i = 0; i < 64; i++, n++) {
+			hdr.ts_sec  = ts / NANOSEC_PER_SEC;
+			hdr.ts_usec = (ts % NANOSEC_PER_SEC) / 1000;
+			hdr.caplen  = sizes[n % (sizeof(sizes) / sizeof(sizes[0]))];
+			hdr.len     = hdr.caplen;
+			memcpy(pkt, &n, sizeof(n));
+			if (pcap_writer_add(&t->w, &hdr, pkt))
+				return NULL;
+		}
+	}
+	return NULL;
+}
+
+/*** Merge segments by timestamp ***/
+
+struct pcap_segment {
+	char  *base;
+	size_t size;
+	size_t off;
+};
+
+static inline __u64 seg_ts(struct pcap_segment *s)
+{
+	struct pcap_sf_pkthdr *h = (void *)(s->base + s->off);
+
+	return (__u64)h->ts_sec * 1000000 + h->ts_usec;
+}
+
+static bool seg_valid(struct pcap_segment *s)
+{
+	struct pcap_sf_pkthdr *h = (void *)(s->base + s->off);
+
+	return s->off + sizeof(*h) <= s->size &&
+	       s->off + sizeof(*h) + h->caplen <= s->size;
+}
+
+/* Each segment is in timestamp order, when its thread only serves one
+ * ring.  With fewer threads than rings the result is near-sorted.
+ */
+static int pcap_merge(const char *path, struct capture_thread *t, int n)
+{
+	struct pcap_segment segs[MAX_CPUS];
+	struct pcap_sf_pkthdr *h;
+	struct pcap_writer w;
+	struct stat st;
+	int i, min, fd, err;
+
+	err = pcap_writer_open(&w, path, false);
+	if (err)
+		return err;
+
+	for (i = 0; i < n; i++) {
+		memset(&segs[i], 0, sizeof(segs[i]));
+		fd = open(t[i].path, O_RDONLY);
+		if (fd < 0 || fstat(fd, &st) ||
+		    st.st_size <= sizeof(struct pcap_file_header)) {
+			if (fd >= 0)
+				close(fd);
+			continue;
+		}
+		segs[i].base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE,
+				    fd, 0);
+		close(fd);
+		if (segs[i].base == MAP_FAILED) {
+			segs[i].base = NULL;
+			continue;
+		}
+		madvise(segs[i].base, st.st_size, MADV_SEQUENTIAL);
+		segs[i].size = st.st_size;
+		segs[i].off  = sizeof(struct pcap_file_header);
+	}
+
+	while (1) {
+		min = -1;
+		for (i = 0; i < n; i++) {
+			if (!segs[i].base || !seg_valid(&segs[i]))
+				continue;
+			if (min < 0 || seg_ts(&segs[i]) < seg_ts(&segs[min]))
+				min = i;
+		}
+		if (min < 0)
+			break;
+		h = (void *)(segs[min].base + segs[min].off);
+		err = pcap_writer_add(&w, h, h + 1);
+		if (err)
+			break;
+		segs[min].off += sizeof(*h) + h->caplen;
+	}
+
+	for (i = 0; i < n; i++) {
+		if (!segs[i].base)
+			continue;
+		munmap(segs[i].base, segs[i].size);
+		unlink(t[i].path);
+	}
+	printf("Merged %d segments into %s (%llu packets)\n", n, path, w.pkts);
+	return pcap_writer_close(&w) ? : err;
 }
 
 static void setup_bpf_perf_event(int map_fd, int num)
@@ -252,23 +574,170 @@ static void setup_bpf_perf_event(int map_fd, int num)
 	}
 }
 
+static const char *tcpdump_stat_names[TCPDUMP_STAT_MAX] = {
+	[TCPDUMP_STAT_SEEN]	 = "seen",
+	[TCPDUMP_STAT_FILTERED]	 = "filtered",
+	[TCPDUMP_STAT_SAMPLED]	 = "sampled-out",
+	[TCPDUMP_STAT_CAPTURED]	 = "captured",
+	[TCPDUMP_STAT_RING_FULL] = "ring-full",
+};
+
+/* Sum per CPU kernel side counters */
+static void kern_stats_collect(int fd, __u64 *sum)
+{
+	unsigned int nr_cpus = bpf_num_possible_cpus();
+	__u64 values[nr_cpus];
+	__u32 key;
+	int i;
+
+	for (key = 0; key < TCPDUMP_STAT_MAX; key++) {
+		sum[key] = 0;
+		if (bpf_map_lookup_elem(fd, &key, values))
+			continue;
+		for (i = 0; i < nr_cpus; i++)
+			sum[key] += values[i];
+	}
+}
+
+/* Reader side CPU cost, all threads of this process */
+static __u64 cpu_time_ns(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) *
+		(__u64)NANOSEC_PER_SEC +
+		(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1000ULL;
+}
+
+/* XDP side CPU cost, needs sysctl kernel.bpf_stats_enabled=1 */
+static void prog_run_stats(int prog_fd, __u64 *run_ns, __u64 *run_cnt)
+{
+	struct bpf_prog_info info = {};
+	__u32 len = sizeof(info);
+
+	*run_ns = *run_cnt = 0;
+	if (prog_fd < 0 || bpf_obj_get_info_by_fd(prog_fd, &info, &len))
+		return;
+	*run_ns  = info.run_time_ns;
+	*run_cnt = info.run_cnt;
+}
+
+/* Sustained capture throughput, written packets and bytes.  With the
+ * XDP program loaded (stats_fd >= 0) also the kernel side counters.
+ * CPU cost is reported as reader CPU usage and XDP ns per packet.
+ */
+static void stats_poll(struct capture_thread *t, int n, int interval,
+		       __u64 start, __u64 end, int stats_fd, int prog_fd)
+{
+	__u64 pkts, bytes, lost, prev_pkts = 0, prev_bytes = 0;
+	__u64 kern[TCPDUMP_STAT_MAX], prev_kern[TCPDUMP_STAT_MAX] = { 0 };
+	__u64 cpu, prev_cpu = cpu_time_ns();
+	__u64 run_ns, run_cnt, prev_run_ns, prev_run_cnt;
+	__u64 now, prev;
+	double period;
+	int i;
+
+	prog_run_stats(prog_fd, &prev_run_ns, &prev_run_cnt);
+
+	/* Trick to pretty printf with thousands separators use %' */
+	setlocale(LC_NUMERIC, "en_US");
+
+	prev = start;
+	while (!exiting && (!end || prev < end)) {
+		sleep(interval);
+		now = gettime(CLOCK_MONOTONIC);
+		pkts = bytes = lost = 0;
+		for (i = 0; i < n; i++) {
+			pkts  += t[i].w.pkts;
+			bytes += t[i].w.bytes + t[i].w.used;
+			lost  += t[i].lost;
+		}
+		period = (double)(now - prev) / NANOSEC_PER_SEC;
+		printf("capture: %'12.0f pps %'10.1f MB/s lost-events %'llu"
+		       " (total %'llu pkts in %.0f sec)\n",
+		       (pkts - prev_pkts) / period,
+		       (bytes - prev_bytes) / period / 1000000, lost, pkts,
+		       (double)(now - start) / NANOSEC_PER_SEC);
+		if (stats_fd >= 0) {
+			kern_stats_collect(stats_fd, kern);
+			printf("kernel: ");
+			for (i = 0; i < TCPDUMP_STAT_MAX; i++) {
+				printf(" %s %'.0f pps", tcpdump_stat_names[i],
+				       (kern[i] - prev_kern[i]) / period);
+				prev_kern[i] = kern[i];
+			}
+			printf("\n");
+		}
+		cpu = cpu_time_ns();
+		prog_run_stats(prog_fd, &run_ns, &run_cnt);
+		printf("cpu: reader %5.1f%%", (cpu - prev_cpu) * 100.0 /
+		       (now - prev));
+		if (run_cnt > prev_run_cnt)
+			printf(" xdp %6.1f ns/pkt", (double)(run_ns - prev_run_ns) /
+			       (run_cnt - prev_run_cnt));
+		printf("\n");
+		prev_cpu = cpu;
+		prev_run_ns  = run_ns;
+		prev_run_cnt = run_cnt;
+		fflush(stdout);
+		prev_pkts  = pkts;
+		prev_bytes = bytes;
+		prev = now;
+	}
+}
+
+/* Accepts tcp, udp, icmp etc. from /etc/protocols or a number */
+static int parse_proto(const char *str)
+{
+	struct protoent *pe = getprotobyname(str);
+	char *end;
+	long val;
+
+	if (pe)
+		return pe->p_proto;
+	val = strtol(str, &end, 0);
+	if (*end || val < 0 || val > 255)
+		return -1;
+	return val;
+}
+
+static int parse_port(const char *str, __u16 *port)
+{
+	char *end;
+	long val = strtol(str, &end, 0);
+
+	if (*end || val < 0 || val > 65535)
+		return -1;
+	*port = htons(val);
+	return 0;
+}
+
 int main(int argc, char **argv)
 {
 	struct rlimit r = {100 * 1024 * 1024, RLIM_INFINITY};
 	struct bpf_prog_load_attr prog_load_attr = {
 		.prog_type	= BPF_PROG_TYPE_XDP,
 	};
-	struct bpf_map *perf_ring_map;
+	static struct capture_thread threads[MAX_CPUS];
+	const char *prefix = "xdp_tcpdump";
+	struct bpf_map *perf_ring_map, *map;
+	struct tcpdump_config cfg = { 0 };
+	int stats_fd = -1, val;
+	__u64 cpu_start, run_ns, run_cnt;
+	bool use_ringbuf = false;
+	__u32 key = 0;
+	int nr_threads = 0, synthetic = 0;
 	struct bpf_object *obj;
+	bool direct = false, merge = false;
 	char filename[256];
 	int longindex = 0;
-	int prog_fd, opt;
+	int interval = 2;
+	int prog_fd = -1, opt;
 	int map_fd, i;
+	__u64 start, end = 0, pkts = 0, lost = 0;
 	int numcpus;
-	int err;
-
-	pcap_t *pcap_handle = pcap_open_dead(DLT_EN10MB, 1 << 16);
-	pcap_dumper_t *pcap_dumper;
+	int err = 0;
 
 	numcpus = get_nprocs();
 	if (numcpus > MAX_CPUS) {
@@ -278,14 +747,10 @@ int main(int argc, char **argv)
 
 	snprintf(filename, sizeof(filename), "%s_kern.o", argv[0]);
 	prog_load_attr.file = filename;
-
-	if (setrlimit(RLIMIT_MEMLOCK, &r)) {
-		perror("setrlimit(RLIMIT_MEMLOCK)");
-		return EXIT_FAILURE;
-	}
+	cfg.rb_wakeup = RB_WAKEUP_DEFAULT;
 
 	/* Parse commands line args */
-	while ((opt = getopt_long(argc, argv, "hSd:",
+	while ((opt = getopt_long(argc, argv, "hSd:s:t:w:Omr:y:c:n:FP:1:2:3:4:5:RW:",
 				  long_options, &longindex)) != -1) {
 		switch (opt) {
 		case 'd':
@@ -306,6 +771,97 @@ int main(int argc, char **argv)
 		case 'S':
 			xdp_flags |= XDP_FLAGS_SKB_MODE;
 			break;
+		case 's':
+			interval = atoi(optarg);
+			break;
+		case 't':
+			nr_threads = atoi(optarg);
+			if (nr_threads < 1 || nr_threads > MAX_CPUS) {
+				fprintf(stderr, "ERR: --threads 1-%d\n",
+					MAX_CPUS);
+				goto error;
+			}
+			break;
+		case 'w':
+			prefix = optarg;
+			break;
+		case 'O':
+			direct = true;
+			break;
+		case 'm':
+			merge = true;
+			break;
+		case 'r':
+			page_cnt = atoi(optarg);
+			if (page_cnt < 1 || (page_cnt & (page_cnt - 1))) {
+				fprintf(stderr,
+					"ERR: --ring-pages must be power-of-2\n");
+				goto error;
+			}
+			break;
+		case 'y':
+			synthetic = atoi(optarg);
+			break;
+		case 'c':
+			val = atoi(optarg);
+			if (val < 1 || val > 0xFFFF) {
+				fprintf(stderr, "ERR: --snaplen 1-65535\n");
+				goto error;
+			}
+			cfg.snaplen = snaplen = val;
+			break;
+		case 'n':
+			val = atoi(optarg);
+			if (val < 1) {
+				fprintf(stderr, "ERR: --sample N must be >= 1\n");
+				goto error;
+			}
+			cfg.sample_n = val;
+			break;
+		case 'F':
+			cfg.flags |= TCPDUMP_SAMPLE_FLOW;
+			break;
+		case 'P':
+			val = parse_proto(optarg);
+			if (val < 0) {
+				fprintf(stderr, "ERR: --filter-proto unknown\n");
+				goto error;
+			}
+			cfg.proto = val;
+			cfg.flags |= TCPDUMP_FILTER_PROTO;
+			break;
+		case '1':
+		case '2':
+			if (inet_pton(AF_INET, optarg, opt == '1' ?
+				      &cfg.saddr : &cfg.daddr) != 1) {
+				fprintf(stderr, "ERR: --filter-%s IPv4 only\n",
+					opt == '1' ? "src" : "dst");
+				goto error;
+			}
+			cfg.flags |= opt == '1' ? TCPDUMP_FILTER_SADDR :
+						  TCPDUMP_FILTER_DADDR;
+			break;
+		case '3':
+			if (parse_port(optarg, &cfg.port))
+				goto error;
+			cfg.flags |= TCPDUMP_FILTER_PORT;
+			break;
+		case '4':
+			if (parse_port(optarg, &cfg.sport))
+				goto error;
+			cfg.flags |= TCPDUMP_FILTER_SPORT;
+			break;
+		case '5':
+			if (parse_port(optarg, &cfg.dport))
+				goto error;
+			cfg.flags |= TCPDUMP_FILTER_DPORT;
+			break;
+		case 'R':
+			use_ringbuf = true;
+			break;
+		case 'W':
+			cfg.rb_wakeup = atoi(optarg);
+			break;
 		case 'h':
 		error:
 		default:
@@ -314,11 +870,63 @@ int main(int argc, char **argv)
 		}
 	}
 	/* Required option */
-	if (ifindex == -1) {
+	if (ifindex == -1 && !synthetic) {
 		fprintf(stderr, "ERR: required option --dev missing\n");
 		usage(argv);
 		return EXIT_FAIL_OPTION;
 	}
+	if ((cfg.flags & TCPDUMP_SAMPLE_FLOW) && cfg.sample_n < 2) {
+		fprintf(stderr, "ERR: --sample-flow needs --sample N\n");
+		return EXIT_FAIL_OPTION;
+	}
+	if (use_ringbuf) {
+		/* Single consumer of the shared ring */
+		if (nr_threads > 1)
+			fprintf(stderr, "WARN: --ringbuf uses one reader thread\n");
+		nr_threads = 1;
+		snprintf(filename, sizeof(filename), "%s_rb_kern.o", argv[0]);
+	}
+	if (!nr_threads)
+		nr_threads = numcpus;
+	if (nr_threads > numcpus && !synthetic)
+		nr_threads = numcpus;
+
+	mono_to_realtime_ns = gettime(CLOCK_REALTIME) -
+		gettime(CLOCK_MONOTONIC);
+
+	/* One segment per thread, single thread writes prefix directly */
+	for (i = 0; i < nr_threads; i++) {
+		threads[i].idx = i;
+		if (nr_threads == 1)
+			snprintf(threads[i].path, sizeof(threads[i].path),
+				 "%s.pcap", prefix);
+		else
+			snprintf(threads[i].path, sizeof(threads[i].path),
+				 "%s.%d.pcap", prefix, i);
+		if (pcap_writer_open(&threads[i].w, threads[i].path, direct))
+			return EXIT_FAIL_PCAP;
+	}
+
+	signal(SIGINT,  exit_sig_handler);
+	signal(SIGTERM, exit_sig_handler);
+
+	start = gettime(CLOCK_MONOTONIC);
+	if (synthetic) {
+		end = start + (__u64)synthetic * NANOSEC_PER_SEC;
+		for (i = 0; i < nr_threads; i++) {
+			threads[i].synthetic_end = end;
+			pthread_create(&threads[i].tid, NULL,
+				       synthetic_producer, &threads[i]);
+		}
+		printf("Synthetic producer: %d writer threads for %d sec%s\n",
+		       nr_threads, synthetic, direct ? " (O_DIRECT)" : "");
+		goto run;
+	}
+
+	if (setrlimit(RLIMIT_MEMLOCK, &r)) {
+		perror("setrlimit(RLIMIT_MEMLOCK)");
+		return EXIT_FAILURE;
+	}
 
 	if (bpf_prog_load_xattr(&prog_load_attr, &obj, &prog_fd))
 		return EXIT_FAIL_BPF;
@@ -328,40 +936,109 @@ int main(int argc, char **argv)
 		return EXIT_FAIL_BPF;
 	}
 
-	perf_ring_map = bpf_map__next(NULL, obj); // TODO find by name
+	perf_ring_map = bpf_object__find_map_by_name(obj, use_ringbuf ?
+						     "ring_map" :
+						     "perf_ring_map");
 	if (!perf_ring_map) {
 		fprintf(stderr, "Failed loading map in obj file\n");
 		return EXIT_FAIL_BPF;
 	}
 	map_fd = bpf_map__fd(perf_ring_map);
 
-	pcap_dumper = pcap_dump_open(pcap_handle, "xdp_tcpdump.pcap");
-	// TEST: pcap_dumper = pcap_dump_open(pcap_handle, "/dev/null");
-	if (!pcap_dumper) {
-		fprintf(stderr, "Failed to open pcap file: %s\n",
-			pcap_geterr(pcap_handle));
-		return EXIT_FAIL_PCAP;
+	map = bpf_object__find_map_by_name(obj, "tcpdump_config");
+	if (!map ||
+	    bpf_map_update_elem(bpf_map__fd(map), &key, &cfg, BPF_ANY)) {
+		fprintf(stderr, "ERR: cannot set tcpdump_config map\n");
+		return EXIT_FAIL_BPF;
 	}
-	global_pcap_dumper = pcap_dumper;
+	map = bpf_object__find_map_by_name(obj, "tcpdump_stats");
+	if (map)
+		stats_fd = bpf_map__fd(map);
 
-	if (bpf_set_link_xdp_fd(ifindex, prog_fd, xdp_flags) < 0) {
-		fprintf(stderr, "link set xdp fd failed\n");
-		return EXIT_FAIL_XDP;
+	if (use_ringbuf) {
+		ringbuf = ring_buffer__new(map_fd, ringbuf_event_process,
+					   &threads[0], NULL);
+		if (!ringbuf) {
+			fprintf(stderr, "ERR: ring_buffer__new: %s\n",
+				strerror(errno));
+			return EXIT_FAIL_BPF;
+		}
+		pthread_create(&threads[0].tid, NULL, pcap_ringbuf_poller,
+			       &threads[0]);
+		goto attach;
 	}
 
-	/* Remove XDP program when program is interrupted or killed */
-	signal(SIGINT,  exit_sig_handler);
-	signal(SIGTERM, exit_sig_handler);
-
 	setup_bpf_perf_event(map_fd, numcpus);
 
 	for (i = 0; i < numcpus; i++)
 		if (perf_event_mmap_header(pmu_fds[i], &headers[i]) < 0)
 			return 1;
 
-	err = pcap_perf_event_poller(pmu_fds, headers, numcpus,	pcap_dumper);
-	if (err)
-		return EXIT_FAIL_XDP;
+	/* Rings are spread round-robin over the reader threads */
+	for (i = 0; i < numcpus; i++) {
+		struct capture_thread *t = &threads[i % nr_threads];
+
+		t->rings[t->nr_rings++] = i;
+	}
+	for (i = 0; i < nr_threads; i++)
+		pthread_create(&threads[i].tid, NULL,
+			       pcap_perf_event_poller, &threads[i]);
+attach:
+
+	if (bpf_set_link_xdp_fd(ifindex, prog_fd, xdp_flags) < 0) {
+		fprintf(stderr, "link set xdp fd failed\n");
+		exiting = true;
+		err = EXIT_FAIL_XDP;
+	}
+	if (use_ringbuf)
+		printf("Capture on %s: shared ringbuf %d MB, wakeup %u bytes%s\n",
+		       ifname, RINGBUF_SIZE >> 20, cfg.rb_wakeup,
+		       direct ? " (O_DIRECT)" : "");
+	else
+		printf("Capture on %s: %d perf rings, %d reader threads%s\n",
+		       ifname, numcpus, nr_threads,
+		       direct ? " (O_DIRECT)" : "");
+	if (cfg.snaplen || cfg.sample_n > 1 || cfg.flags)
+		printf(" snaplen %u, sample 1-in-%u %s, filter flags 0x%x\n",
+		       snaplen, cfg.sample_n ? : 1,
+		       cfg.flags & TCPDUMP_SAMPLE_FLOW ? "flows" : "packets",
+		       cfg.flags & ~TCPDUMP_SAMPLE_FLOW);
+run:
+	cpu_start = cpu_time_ns();
+	stats_poll(threads, nr_threads, interval, start, end, stats_fd,
+		   prog_fd);
+
+	if (ifindex > -1 && !synthetic) {
+		fprintf(stderr,
+			"Interrupted: Removing XDP program on ifindex:%d"
+			" device:%s\n", ifindex, ifname);
+		bpf_set_link_xdp_fd(ifindex, -1, xdp_flags);
+	}
+	exiting = true;
+	for (i = 0; i < nr_threads; i++) {
+		pthread_join(threads[i].tid, NULL);
+		if (pcap_writer_close(&threads[i].w))
+			err = EXIT_FAIL_PCAP;
+		pkts += threads[i].w.pkts;
+		lost += threads[i].lost;
+	}
+	ring_buffer__free(ringbuf);
+	prog_run_stats(prog_fd, &run_ns, &run_cnt);
+	printf("Total: %'llu packets, %'.0f pps average, %'llu lost-events,"
+	       " reader cpu %.1f%%, xdp %.1f ns/pkt\n",
+	       pkts, pkts / ((double)(gettime(CLOCK_MONOTONIC) - start) /
+			     NANOSEC_PER_SEC), lost,
+	       (cpu_time_ns() - cpu_start) * 100.0 /
+	       (gettime(CLOCK_MONOTONIC) - start),
+	       run_cnt ? (double)run_ns / run_cnt : 0.0);
+
+	if (merge && nr_threads > 1) {
+		char path[256];
+
+		snprintf(path, sizeof(path), "%s.pcap", prefix);
+		if (pcap_merge(path, threads, nr_threads))
+			err = EXIT_FAIL_PCAP;
+	}
 
-	return EXIT_SUCCESS;
+	return err ? err : EXIT_SUCCESS;
 }
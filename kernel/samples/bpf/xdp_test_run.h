@@ -0,0 +1,223 @@
+/* Helpers for benchmarking XDP programs via BPF_PROG_TEST_RUN
+ *
+ * The kernel runs the program "repeat" times on a copy of the given
+ * packet and returns the average duration in nanosec.  This allow
+ * measuring per packet cost of XDP programs without a traffic
+ * generator, using synthetic packets build here.
+ *
+ *  Copyright(c) 2017 Jesper Dangaard Brouer, Red Hat, Inc.
+ */
+#ifndef __XDP_TEST_RUN_H
+#define __XDP_TEST_RUN_H
+
+#include <linux/if_ether.h>
+#include <linux/ip.h>
+#include <linux/ipv6.h>
+#include <linux/in.h>
+#include <linux/tcp.h>
+#include <linux/udp.h>
+#include <arpa/inet.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "libbpf.h" /* bpf_prog_test_run() */
+
+#define TEST_PKT_SIZE	128 /* Enough for headers, avoid copy cost */
+
+struct test_vlan_hdr {
+	__be16 h_vlan_TCI;
+	__be16 h_vlan_encapsulated_proto;
+};
+
+struct test_pkt {
+	__u8  data[TEST_PKT_SIZE];
+	__u32 len;
+};
+
+/* Describes a synthetic packet, address in network byte-order and
+ * ports in host byte-order.
+ */
+struct test_pkt_spec {
+	int family;		/* AF_INET or AF_INET6 */
+	union {
+		struct in_addr  v4;
+		struct in6_addr v6;
+	} saddr, daddr;
+	__u8  proto;		/* IPPROTO_TCP, IPPROTO_UDP or other */
+	__u16 sport;
+	__u16 dport;
+	__u8  ttl;		/* 0 means default 64 */
+	__u8  tcp_flags;	/* TEST_TCP_* bits */
+	__u32 tcp_seq;
+	__u32 tcp_ack_seq;
+	int   nr_vlans;		/* 0-2 VLAN headers */
+};
+
+#define TEST_TCP_FIN	0x01
+#define TEST_TCP_SYN	0x02
+#define TEST_TCP_RST	0x04
+#define TEST_TCP_PSH	0x08
+#define TEST_TCP_ACK	0x10
+
+static inline __u16 test_csum_fold(__u32 sum)
+{
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+	return ~sum;
+}
+
+static inline __u32 test_csum_add(__u32 sum, const void *buf, int len)
+{
+	const __u16 *p = buf;
+
+	for (; len > 1; len -= 2)
+		sum += *p++;
+	if (len)
+		sum += *(const __u8 *)p;
+	return sum;
+}
+
+/* Build Ethernet (optional VLAN) + IPv4/IPv6 + TCP/UDP packet */
+static inline int test_pkt_build(struct test_pkt *pkt,
+				  const struct test_pkt_spec *s)
+{
+	struct ethhdr *eth = (struct ethhdr *)pkt->data;
+	__u16 proto = s->family == AF_INET6 ? ETH_P_IPV6 : ETH_P_IP;
+	int off = sizeof(*eth), l4_len = 0, i;
+	__u8 ttl = s->ttl ? s->ttl : 64;
+	__u32 sum = 0;
+	void *l4;
+
+	memset(pkt, 0, sizeof(*pkt));
+	memset(eth->h_dest, 0x02, ETH_ALEN);
+	memset(eth->h_source, 0x04, ETH_ALEN);
+	eth->h_proto = htons(s->nr_vlans ? ETH_P_8021Q : proto);
+
+	for (i = 0; i < s->nr_vlans && i < 2; i++) {
+		struct test_vlan_hdr *vh = (void *)pkt->data + off;
+
+		vh->h_vlan_TCI = htons(100 + i);
+		vh->h_vlan_encapsulated_proto =
+			htons(i + 1 < s->nr_vlans ? ETH_P_8021Q : proto);
+		off += sizeof(*vh);
+	}
+
+	if (s->proto == IPPROTO_TCP)
+		l4_len = sizeof(struct tcphdr);
+	else if (s->proto == IPPROTO_UDP)
+		l4_len = sizeof(struct udphdr);
+
+	if (s->family == AF_INET6) {
+		struct ipv6hdr *ip6h = (void *)pkt->data + off;
+
+		ip6h->version     = 6;
+		ip6h->payload_len = htons(l4_len);
+		ip6h->nexthdr     = s->proto;
+		ip6h->hop_limit   = ttl;
+		memcpy(&ip6h->saddr, &s->saddr.v6, sizeof(ip6h->saddr));
+		memcpy(&ip6h->daddr, &s->daddr.v6, sizeof(ip6h->daddr));
+		/* Pseudo header sum for L4 csum */
+		sum = test_csum_add(0, &ip6h->saddr, 32);
+		off += sizeof(*ip6h);
+	} else {
+		struct iphdr *iph = (void *)pkt->data + off;
+
+		iph->version  = 4;
+		iph->ihl      = 5;
+		iph->tot_len  = htons(sizeof(*iph) + l4_len);
+		iph->ttl      = ttl;
+		iph->protocol = s->proto;
+		iph->saddr    = s->saddr.v4.s_addr;
+		iph->daddr    = s->daddr.v4.s_addr;
+		iph->check    = test_csum_fold(test_csum_add(0, iph,
+							     sizeof(*iph)));
+		sum = test_csum_add(0, &iph->saddr, 8);
+		off += sizeof(*iph);
+	}
+	l4 = (void *)pkt->data + off;
+	sum += htons(s->proto) + htons(l4_len);
+
+	if (s->proto == IPPROTO_TCP) {
+		struct tcphdr *tcph = l4;
+
+		tcph->source  = htons(s->sport);
+		tcph->dest    = htons(s->dport);
+		tcph->seq     = htonl(s->tcp_seq);
+		tcph->ack_seq = htonl(s->tcp_ack_seq);
+		tcph->doff    = sizeof(*tcph) / 4;
+		tcph->fin     = !!(s->tcp_flags & TEST_TCP_FIN);
+		tcph->syn     = !!(s->tcp_flags & TEST_TCP_SYN);
+		tcph->rst     = !!(s->tcp_flags & TEST_TCP_RST);
+		tcph->psh     = !!(s->tcp_flags & TEST_TCP_PSH);
+		tcph->ack     = !!(s->tcp_flags & TEST_TCP_ACK);
+		tcph->window  = htons(65535);
+		tcph->check   = test_csum_fold(test_csum_add(sum, tcph,
+							     l4_len));
+	} else if (s->proto == IPPROTO_UDP) {
+		struct udphdr *udph = l4;
+
+		udph->source = htons(s->sport);
+		udph->dest   = htons(s->dport);
+		udph->len    = htons(l4_len);
+		udph->check  = test_csum_fold(test_csum_add(sum, udph,
+							    l4_len));
+	}
+	off += l4_len;
+
+	/* Pad to minimum Ethernet frame size (without FCS) */
+	pkt->len = off < 60 ? 60 : off;
+	return pkt->len;
+}
+
+/* Helper for filling spec from address strings */
+static inline bool test_pkt_spec_addr(struct test_pkt_spec *s,
+				      const char *src, const char *dst)
+{
+	s->family = strchr(src, ':') ? AF_INET6 : AF_INET;
+	return inet_pton(s->family, src, &s->saddr) == 1 &&
+	       inet_pton(s->family, dst, &s->daddr) == 1;
+}
+
+/* Run prog_fd on pkt repeat times.  Returns the kernel measured
+ * average ns per packet, or a negative value on error.  The XDP
+ * verdict is stored in *retval.
+ */
+static inline int xdp_test_run(int prog_fd, struct test_pkt *pkt,
+			       __u32 repeat, __u32 *retval)
+{
+	__u8 data_out[TEST_PKT_SIZE + 256];
+	__u32 size_out = sizeof(data_out);
+	__u32 duration = 0;
+	int err;
+
+	err = bpf_prog_test_run(prog_fd, repeat, pkt->data, pkt->len,
+				data_out, &size_out, retval, &duration);
+	if (err)
+		return -errno;
+	return duration;
+}
+
+/* Run over nr different packets (e.g. many source addresses), repeat
+ * times each.  Returns average ns per packet over all runs, or
+ * negative on error.  Verdict histogram is added to verdicts[] which
+ * must hold XDP_TX + 1 entries (if non-NULL).
+ */
+static inline double xdp_test_run_many(int prog_fd, struct test_pkt *pkts,
+				       int nr, __u32 repeat, __u64 *verdicts)
+{
+	double sum = 0;
+	__u32 retval;
+	int i, ns;
+
+	for (i = 0; i < nr; i++) {
+		ns = xdp_test_run(prog_fd, &pkts[i], repeat, &retval);
+		if (ns < 0)
+			return ns;
+		sum += ns;
+		if (verdicts && retval <= XDP_TX)
+			verdicts[retval] += repeat;
+	}
+	return nr ? sum / nr : 0;
+}
+
+#endif /* __XDP_TEST_RUN_H */
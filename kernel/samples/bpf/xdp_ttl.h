@@ -0,0 +1,58 @@
+#ifndef __XDP_TTL_H__
+#define __XDP_TTL_H__
+
+/* Shared structs between _user & _kern (and _bench) */
+
+/* Hop-Count Filtering (HCF): the hop count a packet travelled is
+ * inferred from its TTL, as initial TTL minus received TTL.  A spoofer
+ * rarely knows the hop count from the spoofed source to the victim.
+ */
+enum hcf_mode {
+	HCF_MODE_OFF = 0,	/* TTL histogram only */
+	HCF_MODE_LEARN,		/* Learn hop count per source /24 */
+	HCF_MODE_ENFORCE,	/* Also drop when hop count deviates */
+};
+
+#define HCF_FLAG_LEARN_ALL	(1U << 0) /* Learn from any IPv4, not only
+					   * TCP ACK (established flows) */
+
+struct hcf_config {
+	__u32 mode;
+	__u32 tolerance;	/* Hops allowed away from learned hop count */
+	__u32 flags;
+	__u32 min_conf;		/* Enforce from this confidence, 0: default */
+};
+
+/* Value in ip2hc_map, key is source /24 prefix (network byte-order).
+ *
+ * The hop count is a majority vote (Boyer-Moore): a sample equal to hc
+ * increments conf, any other decrements it, and at zero confidence the
+ * next sample takes over.  Thus a few spoofed outliers cannot move or
+ * widen what is enforced, and a changed route takes over eventually.
+ * conf is halved for every HCF_AGE_NS period no sample was learned.
+ */
+struct hc_info {
+	__u8  hc;
+	__u8  pad;
+	__u16 conf;		/* Saturates at HCF_CONF_MAX */
+	__u32 samples;		/* Learned packets, racy across CPUs */
+	__u64 last_ns;		/* Last learned sample */
+};
+
+#define HCF_CONF_MAX		1024
+#define HCF_MIN_CONF_DEFAULT	8
+#define HCF_AGE_NS		(60ULL * 1000000000)
+
+#define HCF_PREFIX_MASK		0xFFFFFF00 /* /24, host byte-order */
+#define HCF_MAX_PREFIXES	(1 << 20)
+
+enum hcf_stat {
+	HCF_STAT_LEARNED = 0,	/* Learn/enforce, sample recorded */
+	HCF_STAT_NEW_PREFIX,	/* Learn/enforce, new /24 inserted */
+	HCF_STAT_PASS,		/* Enforce, hop count within range */
+	HCF_STAT_DROP,		/* Enforce, hop count deviates */
+	HCF_STAT_UNKNOWN,	/* Enforce, prefix not (confidently) learned */
+	HCF_STAT_MAX
+};
+
+#endif /* __XDP_TTL_H__ */
@@ -0,0 +1,398 @@
+/* Copyright(c) 2017 Jesper Dangaard Brouer, Red Hat, Inc.
+ */
+static const char *__doc__=
+ " XDP TTL hop-count filtering: functional test and benchmark via\n"
+ " BPF_PROG_TEST_RUN\n"
+ "\n"
+ " Loads xdp_ttl_kern.o (not attached to any device), checks learning\n"
+ " and enforcement verdicts, and measures the per packet cost of each\n"
+ " HCF mode: off (TTL histogram only), learn, and enforce for matching,\n"
+ " spoofed (deviating hop count) and unknown source prefixes.\n"
+ ;
+
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/resource.h>
+#include <getopt.h>
+#include <arpa/inet.h>
+#include <linux/bpf.h>
+
+#include "bpf_load.h"
+#include "bpf_util.h"
+#include "libbpf.h"
+
+#include "xdp_ttl.h"
+#include "xdp_test_run.h"
+
+/* Exit return codes */
+#define	EXIT_OK			0
+#define EXIT_FAIL		1
+#define EXIT_FAIL_OPTION	2
+#define EXIT_FAIL_BPF		40
+#define EXIT_FAIL_TEST		50
+
+/* Indexes into map_fd[], follow map order in _kern.c */
+#define MAP_TTL		0
+#define MAP_IP2HC	1
+#define MAP_CONFIG	2
+#define MAP_STATS	3
+
+#define NR_PKTS 256 /* Distinct source prefixes per benchmark */
+
+static const struct option long_options[] = {
+	{"help",	no_argument,		NULL, 'h' },
+	{"repeat",	required_argument,	NULL, 'r' },
+	{0, 0, NULL,  0 }
+};
+
+static const char *xdp_action_names[XDP_TX + 1] = {
+	[XDP_ABORTED]	= "XDP_ABORTED",
+	[XDP_DROP]	= "XDP_DROP",
+	[XDP_PASS]	= "XDP_PASS",
+	[XDP_TX]	= "XDP_TX",
+};
+
+static void usage(char *argv[])
+{
+	int i;
+	printf("\nDOCUMENTATION:\n%s\n", __doc__);
+	printf(" Usage: %s (options-see-below)\n",
+	       argv[0]);
+	printf(" Listing options:\n");
+	for (i = 0; long_options[i].name != 0; i++) {
+		printf(" --%-12s", long_options[i].name);
+		if (long_options[i].flag != NULL)
+			printf(" flag (internal value:%d)",
+			       *long_options[i].flag);
+		else
+			printf(" short-option: -%c",
+			       long_options[i].val);
+		printf("\n");
+	}
+	printf("\n");
+}
+
+static int failures;
+
+#define CHECK(cond, fmt, ...)						\
+	do {								\
+		if (!(cond)) {						\
+			failures++;					\
+			printf(" FAIL: " fmt "\n", ##__VA_ARGS__);	\
+		} else {						\
+			printf(" ok:   " fmt "\n", ##__VA_ARGS__);	\
+		}							\
+	} while (0)
+
+static void set_mode(__u32 mode, __u32 tolerance)
+{
+	struct hcf_config cfg = { .mode = mode, .tolerance = tolerance };
+	__u32 key = 0;
+
+	if (bpf_map_update_elem(map_fd[MAP_CONFIG], &key, &cfg, BPF_ANY)) {
+		fprintf(stderr, "ERR: set hcf_config: %s\n", strerror(errno));
+		exit(EXIT_FAIL_BPF);
+	}
+}
+
+static void clear_prefixes(void)
+{
+	__u32 key, next;
+
+	while (bpf_map_get_next_key(map_fd[MAP_IP2HC], NULL, &next) == 0) {
+		key = next;
+		bpf_map_delete_elem(map_fd[MAP_IP2HC], &key);
+	}
+}
+
+static bool lookup_prefix(const char *src, struct hc_info *hc)
+{
+	__u32 prefix = inet_addr(src) & htonl(HCF_PREFIX_MASK);
+
+	return bpf_map_lookup_elem(map_fd[MAP_IP2HC], &prefix, hc) == 0;
+}
+
+static void tcp_pkt(struct test_pkt *pkt, const char *src, __u8 ttl,
+		    __u8 flags)
+{
+	struct test_pkt_spec spec;
+
+	memset(&spec, 0, sizeof(spec));
+	spec.proto = IPPROTO_TCP;
+	spec.sport = 40000;
+	spec.dport = 80;
+	spec.ttl = ttl;
+	spec.tcp_flags = flags;
+	if (!test_pkt_spec_addr(&spec, src, "198.18.0.1")) {
+		fprintf(stderr, "ERR: bad address %s\n", src);
+		exit(EXIT_FAIL);
+	}
+	test_pkt_build(pkt, &spec);
+}
+
+static __u32 run_once(struct test_pkt *pkt)
+{
+	struct test_pkt out;
+	__u32 size_out = sizeof(out.data);
+	__u32 retval = 0, duration;
+
+	if (bpf_prog_test_run(prog_fd[0], 1, pkt->data, pkt->len,
+			      out.data, &size_out, &retval, &duration)) {
+		fprintf(stderr, "ERR: BPF_PROG_TEST_RUN failed: %s\n",
+			strerror(errno));
+		exit(EXIT_FAIL_BPF);
+	}
+	return retval;
+}
+
+static void test_learn(void)
+{
+	struct test_pkt pkt;
+	struct hc_info hc;
+	bool found;
+	int i;
+
+	printf("\nFunctional: learn\n");
+	set_mode(HCF_MODE_LEARN, 0);
+	clear_prefixes();
+
+	tcp_pkt(&pkt, "198.51.100.1", 57, TEST_TCP_SYN);
+	run_once(&pkt);
+	CHECK(!lookup_prefix("198.51.100.1", &hc),
+	      "SYN is not learned (spoofable)");
+
+	tcp_pkt(&pkt, "192.0.2.10", 57, TEST_TCP_ACK);
+	CHECK(run_once(&pkt) == XDP_PASS, "learn mode always passes");
+	found = lookup_prefix("192.0.2.10", &hc);
+	CHECK(found && hc.hc == 7 && hc.conf == 1,
+	      "ACK TTL 57 learned as 7 hops for 192.0.2.0/24 (%u conf:%u)",
+	      found ? hc.hc : 0, found ? hc.conf : 0);
+
+	for (i = 0; i < 9; i++)
+		run_once(&pkt);
+	tcp_pkt(&pkt, "192.0.2.20", 119, TEST_TCP_ACK | TEST_TCP_PSH);
+	run_once(&pkt);
+	found = lookup_prefix("192.0.2.99", &hc);
+	CHECK(found && hc.hc == 7 && hc.conf == 9 && hc.samples == 11,
+	      "outlier ACK (9 hops) only lowers confidence (%u conf:%u)",
+	      found ? hc.hc : 0, found ? hc.conf : 0);
+
+	tcp_pkt(&pkt, "203.0.113.1", 57, TEST_TCP_ACK);
+	run_once(&pkt);
+}
+
+static void test_enforce(void)
+{
+	struct test_pkt pkt;
+	__u32 verdict;
+
+	printf("\nFunctional: enforce, tolerance 1\n");
+	set_mode(HCF_MODE_ENFORCE, 1);
+
+	tcp_pkt(&pkt, "192.0.2.30", 56, TEST_TCP_SYN);
+	verdict = run_once(&pkt);
+	CHECK(verdict == XDP_PASS, "8 hops, within tolerance -> XDP_PASS"
+	      " (%u)", verdict);
+	tcp_pkt(&pkt, "192.0.2.30", 55, TEST_TCP_SYN);
+	verdict = run_once(&pkt);
+	CHECK(verdict == XDP_DROP, "9 hops, outlier not learned -> XDP_DROP"
+	      " (%u)", verdict);
+	tcp_pkt(&pkt, "192.0.2.30", 64, TEST_TCP_SYN);
+	verdict = run_once(&pkt);
+	CHECK(verdict == XDP_DROP, "0 hops, spoofed -> XDP_DROP (%u)",
+	      verdict);
+	tcp_pkt(&pkt, "203.0.113.1", 30, TEST_TCP_SYN);
+	verdict = run_once(&pkt);
+	CHECK(verdict == XDP_PASS, "single sample prefix -> XDP_PASS (%u)",
+	      verdict);
+	tcp_pkt(&pkt, "203.0.114.1", 30, TEST_TCP_SYN);
+	verdict = run_once(&pkt);
+	CHECK(verdict == XDP_PASS, "unknown prefix -> XDP_PASS (%u)",
+	      verdict);
+}
+
+/* Route change while enforcing: 192.0.2.0/24 moves from 7 to 12 hops.
+ * The first ACKs are dropped, but still vote the old hop count out.
+ */
+static void test_route_change(void)
+{
+	struct test_pkt pkt;
+	struct hc_info hc;
+	__u32 verdict;
+	bool found;
+	int i;
+
+	printf("\nFunctional: route change while enforcing\n");
+	set_mode(HCF_MODE_ENFORCE, 1);
+
+	tcp_pkt(&pkt, "192.0.2.40", 52, TEST_TCP_ACK);
+	verdict = run_once(&pkt);
+	CHECK(verdict == XDP_DROP, "12 hops ACK, confident 7 -> XDP_DROP"
+	      " (%u)", verdict);
+	for (i = 0; i < 19; i++)
+		run_once(&pkt);
+	found = lookup_prefix("192.0.2.40", &hc);
+	CHECK(found && hc.hc == 12 && hc.conf == 11,
+	      "20 ACKs at 12 hops take over the vote (%u conf:%u)",
+	      found ? hc.hc : 0, found ? hc.conf : 0);
+	verdict = run_once(&pkt);
+	CHECK(verdict == XDP_PASS, "12 hops after route change -> XDP_PASS"
+	      " (%u)", verdict);
+	tcp_pkt(&pkt, "192.0.2.40", 57, TEST_TCP_SYN);
+	verdict = run_once(&pkt);
+	CHECK(verdict == XDP_DROP, "old 7 hops -> XDP_DROP (%u)", verdict);
+}
+
+/* Same clock as bpf_ktime_get_ns() */
+static __u64 monotonic_ns(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (__u64)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+static void test_aging(void)
+{
+	__u32 prefix = inet_addr("192.0.2.0");
+	struct hc_info hc = { .hc = 12, .conf = 800, .samples = 800 };
+	struct test_pkt pkt;
+	bool found;
+
+	printf("\nFunctional: aging\n");
+	set_mode(HCF_MODE_LEARN, 0);
+
+	/* 3.5 periods idle halves confidence three times */
+	hc.last_ns = monotonic_ns() - HCF_AGE_NS * 7 / 2;
+	if (bpf_map_update_elem(map_fd[MAP_IP2HC], &prefix, &hc, BPF_ANY)) {
+		fprintf(stderr, "ERR: set ip2hc: %s\n", strerror(errno));
+		exit(EXIT_FAIL_BPF);
+	}
+	tcp_pkt(&pkt, "192.0.2.50", 52, TEST_TCP_ACK);
+	run_once(&pkt);
+	found = lookup_prefix("192.0.2.50", &hc);
+	CHECK(found && hc.hc == 12 && hc.conf == 101,
+	      "conf 800 idle 3.5 periods, plus one sample -> 101 (conf:%u)",
+	      found ? hc.conf : 0);
+}
+
+static void bench(const char *desc, struct test_pkt *pkts, int nr,
+		  __u32 repeat)
+{
+	__u64 verdicts[XDP_TX + 1] = { 0 };
+	double ns;
+	int i;
+
+	ns = xdp_test_run_many(prog_fd[0], pkts, nr, repeat, verdicts);
+	if (ns < 0) {
+		fprintf(stderr, "ERR: BPF_PROG_TEST_RUN failed: %s\n",
+			strerror(-ns));
+		exit(EXIT_FAIL_BPF);
+	}
+	printf(" %-40s %7.2f ns/pkt %9.0f pps", desc, ns,
+	       ns > 0 ? 1000000000 / ns : 0);
+	for (i = 0; i <= XDP_TX; i++)
+		if (verdicts[i])
+			printf(" %s:%llu", xdp_action_names[i], verdicts[i]);
+	printf("\n");
+}
+
+/* One source per /24 prefix, 10 hops away from initial TTL 64 */
+static void build_pkts(struct test_pkt *pkts, int nr, const char *net,
+		       __u8 ttl, __u8 flags)
+{
+	char src[INET_ADDRSTRLEN];
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		snprintf(src, sizeof(src), "%s.%d.%d.1", net, i / 256, i % 256);
+		tcp_pkt(&pkts[i], src, ttl, flags);
+	}
+}
+
+static void run_bench(__u32 repeat)
+{
+	struct test_pkt *pkts;
+
+	pkts = calloc(NR_PKTS, sizeof(*pkts));
+	if (!pkts)
+		exit(EXIT_FAIL);
+
+	printf("\nBenchmark, repeat %u over %d source prefixes:\n", repeat,
+	       NR_PKTS);
+	clear_prefixes();
+	build_pkts(pkts, NR_PKTS, "10", 54, TEST_TCP_ACK);
+	set_mode(HCF_MODE_OFF, 0);
+	bench("mode off (TTL histogram)", pkts, NR_PKTS, repeat);
+	set_mode(HCF_MODE_LEARN, 0);
+	bench("learn, ACK", pkts, NR_PKTS, repeat);
+
+	set_mode(HCF_MODE_ENFORCE, 1);
+	bench("enforce, matching hop count", pkts, NR_PKTS, repeat);
+	build_pkts(pkts, NR_PKTS, "10", 40, TEST_TCP_SYN);
+	bench("enforce, spoofed hop count", pkts, NR_PKTS, repeat);
+	build_pkts(pkts, NR_PKTS, "11", 54, TEST_TCP_SYN);
+	bench("enforce, unknown prefix", pkts, NR_PKTS, repeat);
+	free(pkts);
+}
+
+int main(int argc, char **argv)
+{
+	struct rlimit r = {RLIM_INFINITY, RLIM_INFINITY};
+	__u32 repeat = 100000;
+	char filename[256];
+	int longindex = 0;
+	int opt;
+
+	while ((opt = getopt_long(argc, argv, "hr:",
+				  long_options, &longindex)) != -1) {
+		switch (opt) {
+		case 'r':
+			repeat = atoi(optarg);
+			break;
+		case 'h':
+		default:
+			usage(argv);
+			return EXIT_FAIL_OPTION;
+		}
+	}
+
+	if (setrlimit(RLIMIT_MEMLOCK, &r)) {
+		perror("setrlimit(RLIMIT_MEMLOCK, RLIM_INFINITY)");
+		return EXIT_FAIL;
+	}
+
+	/* Bench binary lives next to the kern object */
+	snprintf(filename, sizeof(filename), "%s", argv[0]);
+	if (strrchr(filename, '_'))
+		*strrchr(filename, '_') = '\0';
+	strncat(filename, "_kern.o", sizeof(filename) - strlen(filename) - 1);
+	if (load_bpf_file(filename)) {
+		fprintf(stderr, "ERR in load_bpf_file(%s): %s\n",
+			filename, bpf_log_buf);
+		return EXIT_FAIL_BPF;
+	}
+	if (!prog_fd[0]) {
+		printf("load_bpf_file: %s\n", strerror(errno));
+		return EXIT_FAIL_BPF;
+	}
+
+	test_learn();
+	test_enforce();
+	test_route_change();
+	test_aging();
+	run_bench(repeat);
+
+	if (failures) {
+		printf("\n%d functional checks FAILED\n", failures);
+		return EXIT_FAIL_TEST;
+	}
+	return EXIT_OK;
+}
@@ -1,4 +1,7 @@
 /*  XDP example of parsing TTL value of IP-header.
+ *
+ *  Also implements Hop-Count Filtering (HCF) against spoofed sources:
+ *  learn the hop count per source /24, then drop deviating packets.
  *
  *  Copyright(c) 2017 Jesper Dangaard Brouer, Red Hat, Inc.
  */
@@ -12,6 +15,8 @@
 #include <uapi/linux/tcp.h>
 #include "bpf_helpers.h"
 
+#include "xdp_ttl.h" /* Shared structs between _user & _kern */
+
 struct vlan_hdr {
 	__be16 h_vlan_TCI;
 	__be16 h_vlan_encapsulated_proto;
@@ -24,15 +29,28 @@ struct bpf_map_def SEC("maps") ttl_map = {
 	.max_entries = 256,
 };
 
-struct hc_info {
-	u8 hop_count;
+/* Shared (not percpu) LRU, all CPUs learn into and enforce from the
+ * same table.  Keyed by /24 as hosts in a prefix share the route.
+ */
+struct bpf_map_def SEC("maps") ip2hc_map = {
+	.type = BPF_MAP_TYPE_LRU_HASH,
+	.key_size = sizeof(u32), /* Source IPv4 /24 prefix */
+	.value_size = sizeof(struct hc_info),
+	.max_entries = HCF_MAX_PREFIXES,
 };
 
-struct bpf_map_def SEC("maps") ip2hc_map = {
-	.type = BPF_MAP_TYPE_PERCPU_ARRAY, // What to choose HASH???
-	.key_size = sizeof(u32), /* IP-address */
-	.value_size = sizeof(struct hc_info), // kernel round up ARRAY type
-	.max_entries = 100000,
+struct bpf_map_def SEC("maps") hcf_config = {
+	.type = BPF_MAP_TYPE_ARRAY,
+	.key_size = sizeof(u32),
+	.value_size = sizeof(struct hcf_config),
+	.max_entries = 1,
+};
+
+struct bpf_map_def SEC("maps") hcf_stats = {
+	.type = BPF_MAP_TYPE_PERCPU_ARRAY,
+	.key_size = sizeof(u32),
+	.value_size = sizeof(u64),
+	.max_entries = HCF_STAT_MAX,
 };
 
 //#define DEBUG 1
@@ -89,15 +107,122 @@ bool parse_eth(struct ethhdr *eth, void *data_end,
 	return true;
 }
 
+static __always_inline
+void hcf_stats_inc(u32 key)
+{
+	u64 *cnt = bpf_map_lookup_elem(&hcf_stats, &key);
+
+	if (cnt)
+		*cnt += 1;
+}
+
+/* Initial TTL is the smallest common OS default (32, 64, 128, 255)
+ * not below the received TTL.
+ */
+static __always_inline
+u8 ttl_to_hops(u8 ttl)
+{
+	if (ttl <= 32)
+		return 32 - ttl;
+	if (ttl <= 64)
+		return 64 - ttl;
+	if (ttl <= 128)
+		return 128 - ttl;
+	return 255 - ttl;
+}
+
+/* Only learn from TCP with ACK set, likely a completed handshake
+ * (unless HCF_FLAG_LEARN_ALL).  A spoofer can still inject bare ACKs,
+ * the majority vote in hcf_learn() keeps those from taking over.
+ */
+static __always_inline
+bool hcf_learnable(struct hcf_config *cfg, struct iphdr *iph,
+		   void *data_end)
+{
+	struct tcphdr *tcph;
+
+	if (cfg->flags & HCF_FLAG_LEARN_ALL)
+		return true;
+	if (iph->protocol != IPPROTO_TCP || iph->frag_off & htons(0x1FFF))
+		return false;
+	tcph = (void *)iph + iph->ihl * 4;
+	if (tcph + 1 > data_end)
+		return false;
+	return tcph->ack && !tcph->syn && !tcph->rst;
+}
+
+static __always_inline
+void hcf_learn(struct hcf_config *cfg, struct iphdr *iph, void *data_end,
+	       u32 prefix, u8 hops)
+{
+	struct hc_info *hc, new = { .hc = hops, .conf = 1, .samples = 1 };
+	u64 now, age;
+
+	if (!hcf_learnable(cfg, iph, data_end))
+		return;
+
+	now = bpf_ktime_get_ns();
+	hc = bpf_map_lookup_elem(&ip2hc_map, &prefix);
+	if (!hc) {
+		new.last_ns = now;
+		/* BPF_NOEXIST: other CPU might have inserted it */
+		if (!bpf_map_update_elem(&ip2hc_map, &prefix, &new,
+					 BPF_NOEXIST))
+			hcf_stats_inc(HCF_STAT_NEW_PREFIX);
+		hcf_stats_inc(HCF_STAT_LEARNED);
+		return;
+	}
+	/* Racy read-modify-write, can only lose a sample.  Confidence
+	 * is halved for every HCF_AGE_NS period without samples.
+	 */
+	age = (now - hc->last_ns) / HCF_AGE_NS;
+	hc->conf = age >= 16 ? 0 : hc->conf >> age;
+	hc->last_ns = now;
+	if (hops == hc->hc) {
+		if (hc->conf < HCF_CONF_MAX)
+			hc->conf++;
+	} else if (hc->conf) {
+		hc->conf--;
+	} else {
+		hc->hc = hops;
+		hc->conf = 1;
+	}
+	hc->samples++;
+	hcf_stats_inc(HCF_STAT_LEARNED);
+}
+
+static __always_inline
+u32 hcf_enforce(struct hcf_config *cfg, u32 prefix, u8 hops)
+{
+	u32 min_conf = cfg->min_conf ? : HCF_MIN_CONF_DEFAULT;
+	struct hc_info *hc;
+
+	/* Too few samples yet (or one spoofed ACK), not enforced */
+	hc = bpf_map_lookup_elem(&ip2hc_map, &prefix);
+	if (!hc || hc->conf < min_conf) {
+		hcf_stats_inc(HCF_STAT_UNKNOWN);
+		return XDP_PASS;
+	}
+	if (hops + cfg->tolerance < hc->hc ||
+	    hops > hc->hc + cfg->tolerance) {
+		hcf_stats_inc(HCF_STAT_DROP);
+		return XDP_DROP;
+	}
+	hcf_stats_inc(HCF_STAT_PASS);
+	return XDP_PASS;
+}
+
 static __always_inline
 u32 parse_ipv4(struct xdp_md *ctx, u64 l3_offset)
 {
 	void *data_end = (void *)(long)ctx->data_end;
 	void *data     = (void *)(long)ctx->data;
 	struct iphdr *iph = data + l3_offset;
+	struct hcf_config *cfg;
 	u64 *counter;
-	u64 total = 0;
 	u32 ttl; /* type need to match map */
+	u32 prefix, key = 0;
+	u8 hops;
 
 	if (iph + 1 > data_end) {
 		bpf_debug("Invalid IPv4 packet: L3off:%llu\n", l3_offset);
@@ -111,15 +236,22 @@ u32 parse_ipv4(struct xdp_md *ctx, u64 l3_offset)
 	if (counter) {
 		/* Don't need __sync_fetch_and_add(); as percpu map */
 		*counter += 1;
-		total = *counter;
 	}
 
-	if (total > 1000000) {
-		/* Too many packet drop some */
-		//if (total & 1)
-		//	return XDP_DROP;
-	}
+	cfg = bpf_map_lookup_elem(&hcf_config, &key);
+	if (!cfg || cfg->mode == HCF_MODE_OFF)
+		return XDP_PASS;
+
+	hops   = ttl_to_hops(ttl);
+	prefix = iph->saddr & htonl(HCF_PREFIX_MASK);
 
+	/* Also learn while enforcing, else a route change would be
+	 * dropped forever.  The vote moves on once the majority of
+	 * learnable packets carry the new hop count.
+	 */
+	hcf_learn(cfg, iph, data_end, prefix, hops);
+	if (cfg->mode == HCF_MODE_ENFORCE)
+		return hcf_enforce(cfg, prefix, hops);
 	return XDP_PASS;
 }
 
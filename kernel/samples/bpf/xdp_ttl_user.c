@@ -1,7 +1,14 @@
 /* Copyright(c) 2017 Jesper Dangaard Brouer, Red Hat, Inc.
  */
 static const char *__doc__=
- " XDP example of parsing TTL value of IP-header.";
+ " XDP example of parsing TTL value of IP-header.\n"
+ "\n"
+ " Hop-Count Filtering (HCF) mode: --mode learn records the hop count\n"
+ " (inferred from TTL) per source /24, as a majority vote.  --mode\n"
+ " enforce drops packets whose hop count is more than --tolerance away\n"
+ " from it, for prefixes with vote confidence of at least --min-conf.\n"
+ " Enforce keeps learning, thus a changed route takes over the vote.\n"
+ " With --learn-sec N, learning switches to enforce after N sec.";
 
 #include <assert.h>
 #include <errno.h>
@@ -14,11 +21,20 @@ static const char *__doc__=
 
 #include <sys/resource.h>
 #include <getopt.h>
+#include <time.h>
 
 #include "libbpf.h"
 #include "bpf_load.h"
 #include "bpf_util.h"
 
+#include "xdp_ttl.h" /* Shared structs between _user & _kern */
+
+/* Indexes into map_fd[], follow map order in _kern.c */
+#define MAP_TTL		0
+#define MAP_IP2HC	1
+#define MAP_CONFIG	2
+#define MAP_STATS	3
+
 static int ifindex = -1;
 
 static void int_exit(int sig)
@@ -33,6 +49,12 @@ static void int_exit(int sig)
 static const struct option long_options[] = {
 	{"help",	no_argument,		NULL, 'h' },
 	{"ifindex",	required_argument,	NULL, 'i' },
+	{"mode",	required_argument,	NULL, 'm' },
+	{"learn-sec",	required_argument,	NULL, 'l' },
+	{"tolerance",	required_argument,	NULL, 't' },
+	{"min-conf",	required_argument,	NULL, 'c' },
+	{"learn-all",	no_argument,		NULL, 'a' },
+	{"sec",		required_argument,	NULL, 's' },
 	{0, 0, NULL,  0 }
 };
 
@@ -67,8 +89,65 @@ static void usage(char *argv[])
 
 struct ttl_stats {
 	__u64 data[MAX_KEYS];
+	__u64 hcf[HCF_STAT_MAX];
+	__u32 prefixes;
 };
 
+static const char *hcf_stat_names[HCF_STAT_MAX] = {
+	[HCF_STAT_LEARNED]	= "learned",
+	[HCF_STAT_NEW_PREFIX]	= "new-prefix",
+	[HCF_STAT_PASS]		= "pass",
+	[HCF_STAT_DROP]		= "drop",
+	[HCF_STAT_UNKNOWN]	= "unknown",
+};
+
+static const char *hcf_mode_names[] = {
+	[HCF_MODE_OFF]		= "off",
+	[HCF_MODE_LEARN]	= "learn",
+	[HCF_MODE_ENFORCE]	= "enforce",
+};
+
+static struct hcf_config hcf_cfg;
+
+static bool hcf_config_set(void)
+{
+	__u32 key = 0;
+
+	if (bpf_map_update_elem(map_fd[MAP_CONFIG], &key, &hcf_cfg, 0)) {
+		fprintf(stderr, "ERR: set hcf_config: %s\n", strerror(errno));
+		return false;
+	}
+	return true;
+}
+
+static __u64 percpu_sum(int fd, __u32 key)
+{
+	unsigned int nr_cpus = bpf_num_possible_cpus();
+	__u64 values[nr_cpus];
+	__u64 sum = 0;
+	int i;
+
+	if (bpf_map_lookup_elem(fd, &key, values))
+		return 0;
+	for (i = 0; i < nr_cpus; i++)
+		sum += values[i];
+	return sum;
+}
+
+/* Walks the LRU hash, fine at stats interval */
+static __u32 count_prefixes(void)
+{
+	__u32 key, next, cnt = 0;
+	void *prev = NULL;
+
+	while (bpf_map_get_next_key(map_fd[MAP_IP2HC], prev, &next) == 0) {
+		key = next;
+		prev = &key;
+		cnt++;
+	}
+	return cnt;
+}
+
 static bool stats_collect(struct ttl_stats *record)
 {
 	unsigned int nr_cpus = bpf_num_possible_cpus();
@@ -92,6 +171,11 @@ static bool stats_collect(struct ttl_stats *record)
 
 		record->data[key] = sum;
 	}
+
+	for (key = 0; key < HCF_STAT_MAX; key++)
+		record->hcf[key] = percpu_sum(map_fd[MAP_STATS], key);
+	if (hcf_cfg.mode != HCF_MODE_OFF)
+		record->prefixes = count_prefixes();
 	return true;
 }
 
@@ -127,11 +211,23 @@ static void stats_print(struct ttl_stats *record)
 		if (count)
 			printf("TTL: %3d count:%llu\n", ttl, count);
 	}
+
+	if (hcf_cfg.mode == HCF_MODE_OFF)
+		return;
+	printf("\nHCF mode:%s tolerance:%u prefixes:%u\n",
+	       hcf_mode_names[hcf_cfg.mode], hcf_cfg.tolerance,
+	       record->prefixes);
+	for (ttl = 0; ttl < HCF_STAT_MAX; ttl++)
+		printf(" %-12s %llu\n", hcf_stat_names[ttl], record->hcf[ttl]);
 }
 
-static void stats_poll(int interval)
+static void stats_poll(int interval, int learn_sec)
 {
 	struct ttl_stats record;
+	time_t switch_at = 0;
+
+	if (hcf_cfg.mode == HCF_MODE_LEARN && learn_sec)
+		switch_at = time(NULL) + learn_sec;
 
 	while (1) {
 		memset(&record, 0, sizeof(record));
@@ -139,6 +235,13 @@ static void stats_poll(int interval)
 		if (stats_collect(&record))
 			stats_print(&record);
 
+		/* End of learning phase */
+		if (switch_at && time(NULL) >= switch_at) {
+			hcf_cfg.mode = HCF_MODE_ENFORCE;
+			if (!hcf_config_set())
+				return;
+			switch_at = 0;
+		}
 		sleep(interval);
 	}
 }
@@ -148,17 +251,44 @@ int main(int argc, char **argv)
 	struct rlimit r = {RLIM_INFINITY, RLIM_INFINITY};
 	char filename[256];
 	int longindex = 0;
-	int opt;
+	int learn_sec = 0;
+	int interval = 1;
+	int opt, i;
 
 	snprintf(filename, sizeof(filename), "%s_kern.o", argv[0]);
 
 	/* Parse commands line args */
-	while ((opt = getopt_long(argc, argv, "hi:",
+	while ((opt = getopt_long(argc, argv, "hi:m:l:t:c:as:",
 				  long_options, &longindex)) != -1) {
 		switch (opt) {
 		case 'i':
 			ifindex = atoi(optarg);
 			break;
+		case 'm':
+			for (i = 0; i <= HCF_MODE_ENFORCE; i++)
+				if (!strcmp(optarg, hcf_mode_names[i]))
+					break;
+			if (i > HCF_MODE_ENFORCE) {
+				fprintf(stderr, "ERR: --mode off|learn|enforce\n");
+				return EXIT_FAIL_OPTION;
+			}
+			hcf_cfg.mode = i;
+			break;
+		case 'l':
+			learn_sec = atoi(optarg);
+			break;
+		case 't':
+			hcf_cfg.tolerance = atoi(optarg);
+			break;
+		case 'c':
+			hcf_cfg.min_conf = atoi(optarg);
+			break;
+		case 'a':
+			hcf_cfg.flags |= HCF_FLAG_LEARN_ALL;
+			break;
+		case 's':
+			interval = atoi(optarg);
+			break;
 		case 'h':
 		default:
 			usage(argv);
@@ -188,6 +318,9 @@ int main(int argc, char **argv)
 		return 1;
 	}
 
+	if (!hcf_config_set())
+		return EXIT_FAIL;
+
 	/* Remove XDP program when program is interrupted */
 	signal(SIGINT, int_exit);
 
@@ -196,7 +329,7 @@ int main(int argc, char **argv)
 		return EXIT_FAIL_XDP;
 	}
 
-	stats_poll(1);
+	stats_poll(interval, learn_sec);
 
 	return EXIT_OK;
 }